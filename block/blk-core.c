@@ -222,6 +222,17 @@ void __blk_run_queue(struct request_queue *q)
 	if (unlikely(blk_queue_stopped(q)))
 		return;
 
+	/*
+	 * Let a driver that can preempt what it has in flight know when the
+	 * scheduler holds a request that should not wait for it. It is told
+	 * once, until it clears ->notified_urgent.
+	 */
+	if (q->urgent_request_fn && !q->notified_urgent && elv_is_urgent(q)) {
+		q->notified_urgent = true;
+		q->urgent_request_fn(q);
+		return;
+	}
+
 	q->request_fn(q);
 }
 EXPORT_SYMBOL(__blk_run_queue);
@@ -746,6 +757,36 @@ void blk_requeue_request(struct request_queue *q, struct request *rq)
 }
 EXPORT_SYMBOL(blk_requeue_request);
 
+/*
+ * Unlike blk_requeue_request(), which puts @rq at the head of the dispatch
+ * queue, hand it back to the scheduler so that the driver can be given
+ * another request first. Called with the queue lock held.
+ */
+int blk_reinsert_request(struct request_queue *q, struct request *rq)
+{
+	if (unlikely(!blk_reinsert_req_sup(q)))
+		return -EIO;
+
+	blk_delete_timer(rq);
+	blk_clear_rq_complete(rq);
+	trace_block_rq_requeue(q, rq);
+
+	if (blk_rq_tagged(rq))
+		blk_queue_end_tag(q, rq);
+
+	BUG_ON(blk_queued_rq(rq));
+
+	return elv_reinsert_request(q, rq);
+}
+EXPORT_SYMBOL(blk_reinsert_request);
+
+bool blk_reinsert_req_sup(struct request_queue *q)
+{
+	return q->elevator &&
+		q->elevator->type->ops.elevator_reinsert_req_fn != NULL;
+}
+EXPORT_SYMBOL(blk_reinsert_req_sup);
+
 static void add_acct_request(struct request_queue *q, struct request *rq,
 			     int where)
 {
@@ -1433,6 +1474,9 @@ void blk_dequeue_request(struct request *rq)
 
 	list_del_init(&rq->queuelist);
 
+	if (blk_rq_queued_read(rq))
+		q->nr_queued_reads--;
+
 	if (blk_account_rq(rq)) {
 		q->in_flight[rq_is_sync(rq)]++;
 		set_io_start_time_ns(rq);
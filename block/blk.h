@@ -36,6 +36,12 @@ enum rq_atomic_flags {
 	REQ_ATOM_COMPLETE = 0,
 };
 
+/* Reads that went through the elevator, counted until they are started */
+static inline bool blk_rq_queued_read(struct request *rq)
+{
+	return (rq->cmd_flags & REQ_SORTED) && rq_data_dir(rq) == READ;
+}
+
 static inline int blk_mark_rq_complete(struct request *rq)
 {
 	return test_and_set_bit(REQ_ATOM_COMPLETE, &rq->atomic_flags);
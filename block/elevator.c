@@ -484,6 +484,8 @@ void elv_merge_requests(struct request_queue *q, struct request *rq,
 		elv_rqhash_del(q, next);
 		q->nr_sorted--;
 	}
+	if (blk_rq_queued_read(next))
+		q->nr_queued_reads--;
 
 	q->last_merge = rq;
 }
@@ -506,10 +508,42 @@ void elv_requeue_request(struct request_queue *q, struct request *rq)
 	}
 
 	rq->cmd_flags &= ~REQ_STARTED;
+	if (blk_rq_queued_read(rq))
+		q->nr_queued_reads++;
 
 	__elv_add_request(q, rq, ELEVATOR_INSERT_REQUEUE);
 }
 
+int elv_reinsert_request(struct request_queue *q, struct request *rq)
+{
+	struct elevator_queue *e = q->elevator;
+	int ret;
+
+	if (!e->type->ops.elevator_reinsert_req_fn ||
+	    !(rq->cmd_flags & REQ_SORTED))
+		return -EPERM;
+
+	if (blk_account_rq(rq)) {
+		q->in_flight[rq_is_sync(rq)]--;
+		if (rq->cmd_flags & REQ_SORTED)
+			elv_deactivate_rq(q, rq);
+	}
+
+	rq->cmd_flags &= ~REQ_STARTED;
+	q->nr_sorted++;
+	if (blk_rq_queued_read(rq))
+		q->nr_queued_reads++;
+
+	ret = e->type->ops.elevator_reinsert_req_fn(q, rq);
+	if (ret) {
+		q->nr_sorted--;
+		if (blk_rq_queued_read(rq))
+			q->nr_queued_reads--;
+	}
+
+	return ret;
+}
+
 void elv_drain_elevator(struct request_queue *q)
 {
 	static int printed;
@@ -584,6 +618,8 @@ void __elv_add_request(struct request_queue *q, struct request *rq, int where)
 		       !(rq->cmd_flags & REQ_DISCARD));
 		rq->cmd_flags |= REQ_SORTED;
 		q->nr_sorted++;
+		if (rq_data_dir(rq) == READ)
+			q->nr_queued_reads++;
 		if (rq_mergeable(rq)) {
 			elv_rqhash_add(q, rq);
 			if (!q->last_merge)
@@ -660,6 +696,21 @@ int elv_may_queue(struct request_queue *q, int rw)
 	return ELV_MQUEUE_MAY;
 }
 
+/*
+ * Whether the elevator holds a request that should not wait for the ones
+ * already issued to the device, if the driver is able to preempt them.
+ */
+bool elv_is_urgent(struct request_queue *q)
+{
+	struct elevator_queue *e = q->elevator;
+
+	if (e && e->type->ops.elevator_is_urgent_fn)
+		return e->type->ops.elevator_is_urgent_fn(q);
+
+	return false;
+}
+EXPORT_SYMBOL(elv_is_urgent);
+
 void elv_abort_queue(struct request_queue *q)
 {
 	struct request *rq;
@@ -0,0 +1,434 @@
+/*
+ *  ROW (Read Over Write) i/o scheduler.
+ *
+ *  Flash storage has no seek penalty, so there is nothing to gain from
+ *  sorting or from idling on a queue the way CFQ does for rotating disks;
+ *  what hurts is a read that waits behind a batch of buffered writes. ROW
+ *  keeps one FIFO per class of request and serves them in strict priority
+ *  order, reads first:
+ *
+ *	high read	reads of the RT i/o priority class
+ *	read		reads of the BE class
+ *	sync write	synchronous writes of the BE class
+ *	write		asynchronous writes
+ *	low read	reads of the IDLE class
+ *	low sync write	synchronous writes of the IDLE class
+ *
+ *  Each queue may dispatch up to its quantum of requests per dispatch
+ *  cycle; once every queue holding requests has used its quantum the cycle
+ *  restarts. The quanta bound how long a higher queue can keep a lower one
+ *  waiting. On top of that, a class passed over more than its starvation
+ *  limit times in a row is served before the others.
+ *
+ *  A read queued while asynchronous writes are in flight is reported as
+ *  urgent through elevator_is_urgent_fn, so that a driver able to do so
+ *  may preempt the write. The driver gives the preempted write back with
+ *  blk_reinsert_request() and it is put at the head of its queue.
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/compiler.h>
+#include <linux/ioprio.h>
+#include <linux/sched.h>
+
+enum row_queue_prio {
+	ROWQ_PRIO_HIGH_READ = 0,
+	ROWQ_PRIO_REG_READ,
+	ROWQ_PRIO_REG_SWRITE,
+	ROWQ_PRIO_REG_WRITE,
+	ROWQ_PRIO_LOW_READ,
+	ROWQ_PRIO_LOW_SWRITE,
+	ROWQ_MAX_PRIO,
+};
+
+enum row_queue_class {
+	ROWQ_CLASS_HIGH = 0,
+	ROWQ_CLASS_REG,
+	ROWQ_CLASS_LOW,
+	ROWQ_MAX_CLASS,
+};
+
+static const int row_queue_class[ROWQ_MAX_PRIO] = {
+	[ROWQ_PRIO_HIGH_READ]	= ROWQ_CLASS_HIGH,
+	[ROWQ_PRIO_REG_READ]	= ROWQ_CLASS_REG,
+	[ROWQ_PRIO_REG_SWRITE]	= ROWQ_CLASS_REG,
+	[ROWQ_PRIO_REG_WRITE]	= ROWQ_CLASS_REG,
+	[ROWQ_PRIO_LOW_READ]	= ROWQ_CLASS_LOW,
+	[ROWQ_PRIO_LOW_SWRITE]	= ROWQ_CLASS_LOW,
+};
+
+/* requests each queue may dispatch per cycle */
+static const int row_quantum[ROWQ_MAX_PRIO] = {
+	[ROWQ_PRIO_HIGH_READ]	= 100,
+	[ROWQ_PRIO_REG_READ]	= 75,
+	[ROWQ_PRIO_REG_SWRITE]	= 2,
+	[ROWQ_PRIO_REG_WRITE]	= 1,
+	[ROWQ_PRIO_LOW_READ]	= 1,
+	[ROWQ_PRIO_LOW_SWRITE]	= 1,
+};
+
+/* dispatches from a higher class a waiting class tolerates */
+static const int reg_starv_limit = 5000;
+static const int low_starv_limit = 10000;
+
+struct row_queue {
+	struct list_head fifo;
+	unsigned int nr_req;
+	unsigned int nr_dispatched;	/* in the current cycle */
+	int quantum;
+};
+
+struct row_data {
+	struct row_queue row_queues[ROWQ_MAX_PRIO];
+
+	unsigned int starved[ROWQ_MAX_CLASS];
+	int starv_limit[ROWQ_MAX_CLASS];
+
+	unsigned int writes_in_flight;
+};
+
+#define RQ_ROWQ(rq)	((struct row_queue *)((rq)->elv.priv[0]))
+
+static inline bool row_queue_is_async_write(struct row_data *rd,
+					    struct row_queue *rqueue)
+{
+	return rqueue == &rd->row_queues[ROWQ_PRIO_REG_WRITE];
+}
+
+static int row_ioprio_class(struct request *rq)
+{
+	int ioprio = req_get_ioprio(rq);
+
+	if (ioprio_valid(ioprio))
+		return IOPRIO_PRIO_CLASS(ioprio);
+	if (current->io_context)
+		return task_ioprio_class(current->io_context);
+	return task_nice_ioclass(current);
+}
+
+static enum row_queue_prio row_get_queue_prio(struct request *rq)
+{
+	const int ioprio_class = row_ioprio_class(rq);
+
+	if (rq_data_dir(rq) == READ) {
+		if (ioprio_class == IOPRIO_CLASS_RT)
+			return ROWQ_PRIO_HIGH_READ;
+		if (ioprio_class == IOPRIO_CLASS_IDLE)
+			return ROWQ_PRIO_LOW_READ;
+		return ROWQ_PRIO_REG_READ;
+	}
+
+	if (!rq_is_sync(rq))
+		return ROWQ_PRIO_REG_WRITE;
+	if (ioprio_class == IOPRIO_CLASS_IDLE)
+		return ROWQ_PRIO_LOW_SWRITE;
+	return ROWQ_PRIO_REG_SWRITE;
+}
+
+static void row_add_request(struct request_queue *q, struct request *rq)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+	struct row_queue *rqueue = &rd->row_queues[row_get_queue_prio(rq)];
+
+	rq->elv.priv[0] = rqueue;
+	rq_set_fifo_time(rq, jiffies);
+	list_add_tail(&rq->queuelist, &rqueue->fifo);
+	rqueue->nr_req++;
+}
+
+static void row_remove_request(struct request *rq)
+{
+	rq_fifo_clear(rq);
+	RQ_ROWQ(rq)->nr_req--;
+}
+
+static void row_merged_requests(struct request_queue *q, struct request *rq,
+				struct request *next)
+{
+	/* keep the merged request where the older of the two was queued */
+	if (RQ_ROWQ(rq) == RQ_ROWQ(next) &&
+	    time_before(rq_fifo_time(next), rq_fifo_time(rq))) {
+		list_move(&rq->queuelist, &next->queuelist);
+		rq_set_fifo_time(rq, rq_fifo_time(next));
+	}
+
+	row_remove_request(next);
+}
+
+static int row_first_queued(struct row_data *rd, int class)
+{
+	int i;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		if (row_queue_class[i] == class && rd->row_queues[i].nr_req)
+			return i;
+	return -1;
+}
+
+static int row_get_next_queue(struct row_data *rd)
+{
+	struct row_queue *rqueue;
+	int class;
+	int i;
+
+	for (class = ROWQ_CLASS_REG; class < ROWQ_MAX_CLASS; class++) {
+		if (rd->starved[class] < rd->starv_limit[class])
+			continue;
+		i = row_first_queued(rd, class);
+		if (i >= 0)
+			return i;
+	}
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		rqueue = &rd->row_queues[i];
+		if (rqueue->nr_req && rqueue->nr_dispatched < rqueue->quantum)
+			return i;
+	}
+
+	/* every queue holding requests used its quantum: start a new cycle */
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		rd->row_queues[i].nr_dispatched = 0;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		if (rd->row_queues[i].nr_req)
+			return i;
+	return -1;
+}
+
+static void row_dispatch_insert(struct request_queue *q, struct row_data *rd,
+				struct request *rq)
+{
+	if (row_queue_is_async_write(rd, RQ_ROWQ(rq)))
+		rd->writes_in_flight++;
+	row_remove_request(rq);
+	elv_dispatch_add_tail(q, rq);
+}
+
+static int row_dispatch_requests(struct request_queue *q, int force)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+	struct row_queue *rqueue;
+	int dispatched = 0;
+	int class;
+	int i;
+
+	if (unlikely(force)) {
+		for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+			rqueue = &rd->row_queues[i];
+			while (!list_empty(&rqueue->fifo)) {
+				row_dispatch_insert(q, rd,
+					rq_entry_fifo(rqueue->fifo.next));
+				dispatched++;
+			}
+			rqueue->nr_dispatched = 0;
+		}
+		memset(rd->starved, 0, sizeof(rd->starved));
+		return dispatched;
+	}
+
+	i = row_get_next_queue(rd);
+	if (i < 0)
+		return 0;
+
+	rqueue = &rd->row_queues[i];
+	row_dispatch_insert(q, rd, rq_entry_fifo(rqueue->fifo.next));
+	rqueue->nr_dispatched++;
+
+	rd->starved[row_queue_class[i]] = 0;
+	for (class = row_queue_class[i] + 1; class < ROWQ_MAX_CLASS; class++)
+		if (row_first_queued(rd, class) >= 0)
+			rd->starved[class]++;
+
+	return 1;
+}
+
+static int row_reinsert_request(struct request_queue *q, struct request *rq)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+	struct row_queue *rqueue = RQ_ROWQ(rq);
+
+	if (row_queue_is_async_write(rd, rqueue))
+		rd->writes_in_flight--;
+	if (rqueue->nr_dispatched)
+		rqueue->nr_dispatched--;
+
+	list_add(&rq->queuelist, &rqueue->fifo);
+	rqueue->nr_req++;
+
+	return 0;
+}
+
+static void row_completed_request(struct request_queue *q, struct request *rq)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+
+	if (row_queue_is_async_write(rd, RQ_ROWQ(rq)))
+		rd->writes_in_flight--;
+}
+
+/*
+ * A read should not wait behind asynchronous writes already issued to the
+ * device when the driver can preempt them.
+ */
+static bool row_is_urgent(struct request_queue *q)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+
+	return rd->writes_in_flight &&
+		(rd->row_queues[ROWQ_PRIO_HIGH_READ].nr_req ||
+		 rd->row_queues[ROWQ_PRIO_REG_READ].nr_req);
+}
+
+static void row_exit_queue(struct elevator_queue *e)
+{
+	struct row_data *rd = e->elevator_data;
+	int i;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		BUG_ON(!list_empty(&rd->row_queues[i].fifo));
+
+	kfree(rd);
+}
+
+static void *row_init_queue(struct request_queue *q)
+{
+	struct row_data *rd;
+	int i;
+
+	rd = kmalloc_node(sizeof(*rd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!rd)
+		return NULL;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		INIT_LIST_HEAD(&rd->row_queues[i].fifo);
+		rd->row_queues[i].quantum = row_quantum[i];
+	}
+	rd->starv_limit[ROWQ_CLASS_HIGH] = INT_MAX;
+	rd->starv_limit[ROWQ_CLASS_REG] = reg_starv_limit;
+	rd->starv_limit[ROWQ_CLASS_LOW] = low_starv_limit;
+	return rd;
+}
+
+
+static ssize_t
+row_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+row_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR)					\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct row_data *rd = e->elevator_data;				\
+	return row_var_show(__VAR, (page));				\
+}
+SHOW_FUNCTION(row_hp_read_quantum_show,
+	rd->row_queues[ROWQ_PRIO_HIGH_READ].quantum);
+SHOW_FUNCTION(row_rp_read_quantum_show,
+	rd->row_queues[ROWQ_PRIO_REG_READ].quantum);
+SHOW_FUNCTION(row_rp_swrite_quantum_show,
+	rd->row_queues[ROWQ_PRIO_REG_SWRITE].quantum);
+SHOW_FUNCTION(row_rp_write_quantum_show,
+	rd->row_queues[ROWQ_PRIO_REG_WRITE].quantum);
+SHOW_FUNCTION(row_lp_read_quantum_show,
+	rd->row_queues[ROWQ_PRIO_LOW_READ].quantum);
+SHOW_FUNCTION(row_lp_swrite_quantum_show,
+	rd->row_queues[ROWQ_PRIO_LOW_SWRITE].quantum);
+SHOW_FUNCTION(row_reg_starv_limit_show, rd->starv_limit[ROWQ_CLASS_REG]);
+SHOW_FUNCTION(row_low_starv_limit_show, rd->starv_limit[ROWQ_CLASS_LOW]);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX)				\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct row_data *rd = e->elevator_data;				\
+	int __data;							\
+	int ret = row_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	*(__PTR) = __data;						\
+	return ret;							\
+}
+STORE_FUNCTION(row_hp_read_quantum_store,
+	&rd->row_queues[ROWQ_PRIO_HIGH_READ].quantum, 1, INT_MAX);
+STORE_FUNCTION(row_rp_read_quantum_store,
+	&rd->row_queues[ROWQ_PRIO_REG_READ].quantum, 1, INT_MAX);
+STORE_FUNCTION(row_rp_swrite_quantum_store,
+	&rd->row_queues[ROWQ_PRIO_REG_SWRITE].quantum, 1, INT_MAX);
+STORE_FUNCTION(row_rp_write_quantum_store,
+	&rd->row_queues[ROWQ_PRIO_REG_WRITE].quantum, 1, INT_MAX);
+STORE_FUNCTION(row_lp_read_quantum_store,
+	&rd->row_queues[ROWQ_PRIO_LOW_READ].quantum, 1, INT_MAX);
+STORE_FUNCTION(row_lp_swrite_quantum_store,
+	&rd->row_queues[ROWQ_PRIO_LOW_SWRITE].quantum, 1, INT_MAX);
+STORE_FUNCTION(row_reg_starv_limit_store,
+	&rd->starv_limit[ROWQ_CLASS_REG], 1, INT_MAX);
+STORE_FUNCTION(row_low_starv_limit_store,
+	&rd->starv_limit[ROWQ_CLASS_LOW], 1, INT_MAX);
+#undef STORE_FUNCTION
+
+#define ROW_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, row_##name##_show, \
+				      row_##name##_store)
+
+static struct elv_fs_entry row_attrs[] = {
+	ROW_ATTR(hp_read_quantum),
+	ROW_ATTR(rp_read_quantum),
+	ROW_ATTR(rp_swrite_quantum),
+	ROW_ATTR(rp_write_quantum),
+	ROW_ATTR(lp_read_quantum),
+	ROW_ATTR(lp_swrite_quantum),
+	ROW_ATTR(reg_starv_limit),
+	ROW_ATTR(low_starv_limit),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_row = {
+	.ops = {
+		.elevator_merge_req_fn =	row_merged_requests,
+		.elevator_dispatch_fn =		row_dispatch_requests,
+		.elevator_add_req_fn =		row_add_request,
+		.elevator_completed_req_fn =	row_completed_request,
+		.elevator_is_urgent_fn =	row_is_urgent,
+		.elevator_reinsert_req_fn =	row_reinsert_request,
+		.elevator_init_fn =		row_init_queue,
+		.elevator_exit_fn =		row_exit_queue,
+	},
+
+	.elevator_attrs = row_attrs,
+	.elevator_name = "row",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init row_init(void)
+{
+	return elv_register(&iosched_row);
+}
+
+static void __exit row_exit(void)
+{
+	elv_unregister(&iosched_row);
+}
+
+module_init(row_init);
+module_exit(row_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Read Over Write IO scheduler");
@@ -14,6 +14,9 @@
  * according to the requests completion error code.
  * Each test is exposed via debugfs and can be triggered by writing to
  * the debugfs file.
+ * A performance mode, under test-iosched/perf, measures throughput and
+ * completion latency of sequential, random or mixed streams against any
+ * of the registered schedulers.
  *
  */
 
@@ -24,8 +27,12 @@
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/test-iosched.h>
 #include <linux/delay.h>
+#include <linux/random.h>
+#include <linux/semaphore.h>
+#include <linux/uaccess.h>
 #include "blk.h"
 
 #define MODULE_NAME "test-iosched"
@@ -41,6 +48,7 @@
 static DEFINE_SPINLOCK(blk_dev_test_list_lock);
 static LIST_HEAD(blk_dev_test_list);
 static struct test_data *ptd;
+static struct dentry *test_debugfs_root;
 
 static struct test_request *
 latter_test_request(struct request_queue *q,
@@ -681,9 +689,16 @@ struct dentry *test_iosched_get_debugfs_utils_root(void)
 }
 EXPORT_SYMBOL(test_iosched_get_debugfs_utils_root);
 
+/* The root directory is shared with perf/ and outlives the queue */
+static void test_debugfs_cleanup(struct test_data *td)
+{
+	debugfs_remove_recursive(td->debug.debug_tests_root);
+	debugfs_remove_recursive(td->debug.debug_utils_root);
+}
+
 static int test_debugfs_init(struct test_data *td)
 {
-	td->debug.debug_root = debugfs_create_dir("test-iosched", NULL);
+	td->debug.debug_root = test_debugfs_root;
 	if (!td->debug.debug_root)
 		return -ENOENT;
 
@@ -716,15 +731,10 @@ static int test_debugfs_init(struct test_data *td)
 	return 0;
 
 err:
-	debugfs_remove_recursive(td->debug.debug_root);
+	test_debugfs_cleanup(td);
 	return -ENOENT;
 }
 
-static void test_debugfs_cleanup(struct test_data *td)
-{
-	debugfs_remove_recursive(td->debug.debug_root);
-}
-
 static void print_req(struct request *req)
 {
 	struct bio *bio;
@@ -873,6 +883,477 @@ static void test_exit_queue(struct elevator_queue *e)
 	kfree(td);
 }
 
+/*
+ * Performance mode: streams requests at a block device through whatever
+ * scheduler its queue runs, so that the same scenario can be measured
+ * against each of them. Unlike the test cases above it does not need
+ * test-iosched to be the active scheduler; the scheduler to measure is
+ * selected with perf/scheduler (or left as is) and restored afterwards.
+ *
+ * The device is opened exclusively, so a mounted partition is refused.
+ * All offsets are relative to the start of the given partition, whose
+ * contents are overwritten unless read_percent is 100.
+ *
+ * The debugfs knobs can be written at any time; a run works on a copy of
+ * them taken when it starts, so writes during a run apply to the next one.
+ */
+#define TEST_PERF_MAX_DEPTH	64
+#define TEST_PERF_MAX_SECTORS	1024
+#define TEST_PERF_HIST_BUCKETS	20
+
+enum test_perf_mode {
+	TEST_PERF_SEQUENTIAL,
+	TEST_PERF_RANDOM,
+};
+
+struct test_perf_stats {
+	u64 count;
+	u64 errors;
+	u64 total_us;
+	u64 min_us;
+	u64 max_us;
+	u32 hist[TEST_PERF_HIST_BUCKETS];	/* log2 of the latency in us */
+};
+
+/* Scenario of a run, copied from the knobs in struct test_perf */
+struct test_perf_scenario {
+	u32 mode;
+	u32 read_percent;
+	u32 queue_depth;
+	u32 req_sectors;
+	u32 nr_reqs;
+	sector_t first_sector;
+	sector_t span;
+};
+
+struct test_perf_slot {
+	struct list_head list;
+	void *buf;
+	ktime_t start;
+};
+
+struct test_perf {
+	struct dentry *root;
+	struct mutex lock;		/* one run at a time */
+
+	/* scenario */
+	char device[64];
+	char scheduler[ELV_NAME_MAX];
+	u32 mode;
+	u32 read_percent;
+	u32 queue_depth;
+	u32 req_sectors;
+	u32 nr_reqs;
+	u32 start_sector;
+	u32 nr_sectors;
+
+	/* run state */
+	spinlock_t slot_lock;
+	struct list_head free_slots;
+	struct semaphore slots_sem;	/* counts the free slots */
+
+	/* results of the last run */
+	struct test_perf_scenario run;
+	char run_scheduler[ELV_NAME_MAX];
+	u64 elapsed_us;
+	int run_result;
+	struct test_perf_stats stats[2];
+};
+
+static struct test_perf test_perf = {
+	.lock		= __MUTEX_INITIALIZER(test_perf.lock),
+	.slot_lock	= __SPIN_LOCK_UNLOCKED(test_perf.slot_lock),
+	.free_slots	= LIST_HEAD_INIT(test_perf.free_slots),
+	.mode		= TEST_PERF_SEQUENTIAL,
+	.read_percent	= 100,
+	.queue_depth	= 4,
+	.req_sectors	= 8,
+	.nr_reqs	= 1024,
+	.nr_sectors	= 2 * 1024 * 1024,
+};
+
+static void test_perf_account(struct test_perf_stats *st, u64 us, int err)
+{
+	int bucket = us ? fls64(us) - 1 : 0;
+
+	if (err)
+		st->errors++;
+	if (!st->count || us < st->min_us)
+		st->min_us = us;
+	if (us > st->max_us)
+		st->max_us = us;
+	st->count++;
+	st->total_us += us;
+	st->hist[min(bucket, TEST_PERF_HIST_BUCKETS - 1)]++;
+}
+
+/* Called with the queue lock held */
+static void test_perf_end_io(struct request *rq, int err)
+{
+	struct test_perf *tp = &test_perf;
+	struct test_perf_slot *slot = rq->end_io_data;
+	s64 us = ktime_us_delta(ktime_get(), slot->start);
+	unsigned long flags;
+
+	spin_lock_irqsave(&tp->slot_lock, flags);
+	test_perf_account(&tp->stats[rq_data_dir(rq)], max_t(s64, us, 0), err);
+	list_add(&slot->list, &tp->free_slots);
+	spin_unlock_irqrestore(&tp->slot_lock, flags);
+
+	__blk_put_request(rq->q, rq);
+	up(&tp->slots_sem);
+}
+
+static sector_t test_perf_next_sector(struct test_perf_scenario *sc,
+				      unsigned int n)
+{
+	sector_t chunks = sc->span;
+	sector_t chunk = sc->mode == TEST_PERF_RANDOM ? random32() : n;
+
+	sector_div(chunks, sc->req_sectors);
+
+	return sc->first_sector + sector_div(chunk, chunks) * sc->req_sectors;
+}
+
+/*
+ * The request is inserted sorted, like a bio from the page cache would
+ * be, so the scheduler under test gets to queue, merge and reorder it.
+ */
+static int test_perf_issue(struct test_perf_scenario *sc,
+			   struct block_device *bdev,
+			   struct test_perf_slot *slot, unsigned int n)
+{
+	struct request_queue *q = bdev_get_queue(bdev);
+	int rw = (random32() % 100 < sc->read_percent) ? READ : WRITE;
+	sector_t sector = test_perf_next_sector(sc, n);
+	struct request *rq;
+	int ret;
+
+	rq = blk_get_request(q, rw, GFP_KERNEL);
+	if (!rq)
+		return -ENOMEM;
+
+	ret = blk_rq_map_kern(q, rq, slot->buf, sc->req_sectors << 9,
+			      GFP_KERNEL);
+	if (ret) {
+		blk_put_request(rq);
+		return ret;
+	}
+
+	rq->cmd_type = REQ_TYPE_FS;
+	rq->__sector = sector;
+	rq->bio->bi_sector = sector;
+	rq->rq_disk = bdev->bd_disk;
+	rq->end_io = test_perf_end_io;
+	rq->end_io_data = slot;
+
+	slot->start = ktime_get();
+	elv_add_request(q, rq, ELEVATOR_INSERT_SORT);
+	blk_run_queue(q);
+
+	return 0;
+}
+
+static void test_perf_free_slots(struct test_perf *tp)
+{
+	struct test_perf_slot *slot, *tmp;
+
+	list_for_each_entry_safe(slot, tmp, &tp->free_slots, list) {
+		list_del(&slot->list);
+		kfree(slot->buf);
+		kfree(slot);
+	}
+}
+
+static int test_perf_alloc_slots(struct test_perf *tp,
+				 struct test_perf_scenario *sc)
+{
+	struct test_perf_slot *slot;
+	unsigned int nr = sc->queue_depth;
+
+	while (nr--) {
+		slot = kzalloc(sizeof(*slot), GFP_KERNEL);
+		if (!slot)
+			goto err;
+		slot->buf = kzalloc(sc->req_sectors << 9, GFP_KERNEL);
+		if (!slot->buf) {
+			kfree(slot);
+			goto err;
+		}
+		list_add(&slot->list, &tp->free_slots);
+	}
+	return 0;
+
+err:
+	test_perf_free_slots(tp);
+	return -ENOMEM;
+}
+
+static int test_perf_stream(struct test_perf *tp,
+			    struct test_perf_scenario *sc,
+			    struct block_device *bdev)
+{
+	struct test_perf_slot *slot;
+	unsigned int depth = sc->queue_depth;
+	ktime_t start;
+	int ret = 0;
+	int i;
+
+	ret = test_perf_alloc_slots(tp, sc);
+	if (ret)
+		return ret;
+	sema_init(&tp->slots_sem, depth);
+
+	start = ktime_get();
+	for (i = 0; i < sc->nr_reqs; i++) {
+		if (down_interruptible(&tp->slots_sem)) {
+			ret = -EINTR;
+			break;
+		}
+
+		spin_lock_irq(&tp->slot_lock);
+		slot = list_first_entry(&tp->free_slots, struct test_perf_slot,
+					list);
+		list_del(&slot->list);
+		spin_unlock_irq(&tp->slot_lock);
+
+		ret = test_perf_issue(sc, bdev, slot, i);
+		if (ret) {
+			spin_lock_irq(&tp->slot_lock);
+			list_add(&slot->list, &tp->free_slots);
+			spin_unlock_irq(&tp->slot_lock);
+			up(&tp->slots_sem);
+			break;
+		}
+	}
+
+	/* Wait for the requests still in flight */
+	for (i = 0; i < depth; i++)
+		down(&tp->slots_sem);
+	tp->elapsed_us = ktime_us_delta(ktime_get(), start);
+
+	test_perf_free_slots(tp);
+	return ret;
+}
+
+static int test_perf_run(struct test_perf *tp)
+{
+	fmode_t mode = FMODE_READ | FMODE_WRITE | FMODE_EXCL;
+	struct test_perf_scenario sc;
+	struct block_device *bdev;
+	struct request_queue *q;
+	char old_elv[ELV_NAME_MAX] = "";
+	sector_t capacity;
+	u32 start_sector, nr_sectors;
+	int ret;
+
+	/* The knobs are not locked against debugfs writes, read each once */
+	sc.mode = ACCESS_ONCE(tp->mode);
+	sc.read_percent = ACCESS_ONCE(tp->read_percent);
+	sc.queue_depth = ACCESS_ONCE(tp->queue_depth);
+	sc.req_sectors = ACCESS_ONCE(tp->req_sectors);
+	sc.nr_reqs = ACCESS_ONCE(tp->nr_reqs);
+	start_sector = ACCESS_ONCE(tp->start_sector);
+	nr_sectors = ACCESS_ONCE(tp->nr_sectors);
+
+	if (!sc.queue_depth || sc.queue_depth > TEST_PERF_MAX_DEPTH ||
+	    !sc.req_sectors || sc.req_sectors > TEST_PERF_MAX_SECTORS ||
+	    sc.read_percent > 100 || sc.mode > TEST_PERF_RANDOM)
+		return -EINVAL;
+	test_pr_info("%s: %s: %u reqs of %u sectors, depth %u, %u%% reads",
+		     __func__, tp->device, sc.nr_reqs, sc.req_sectors,
+		     sc.queue_depth, sc.read_percent);
+
+	bdev = blkdev_get_by_path(tp->device, mode, tp);
+	if (IS_ERR(bdev))
+		return PTR_ERR(bdev);
+	q = bdev_get_queue(bdev);
+
+	capacity = i_size_read(bdev->bd_inode) >> 9;
+	if (sc.req_sectors > queue_max_hw_sectors(q) ||
+	    start_sector >= capacity) {
+		ret = -EINVAL;
+		goto out;
+	}
+	sc.first_sector = get_start_sect(bdev) + start_sector;
+	sc.span = min_t(sector_t, nr_sectors, capacity - start_sector);
+	if (sc.span < sc.req_sectors) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (tp->scheduler[0] &&
+	    strcmp(tp->scheduler, q->elevator->type->elevator_name)) {
+		strlcpy(old_elv, q->elevator->type->elevator_name,
+			sizeof(old_elv));
+		ret = elevator_change(q, tp->scheduler);
+		if (ret)
+			goto out;
+	}
+	strlcpy(tp->run_scheduler, q->elevator->type->elevator_name,
+		sizeof(tp->run_scheduler));
+
+	tp->run = sc;
+	memset(tp->stats, 0, sizeof(tp->stats));
+	tp->elapsed_us = 0;
+	ret = test_perf_stream(tp, &sc, bdev);
+
+	if (old_elv[0] && elevator_change(q, old_elv))
+		test_pr_err("%s: failed to restore scheduler %s", __func__,
+			    old_elv);
+out:
+	blkdev_put(bdev, mode);
+	return ret;
+}
+
+static ssize_t test_perf_run_write(struct file *file, const char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	struct test_perf *tp = &test_perf;
+	int ret;
+
+	mutex_lock(&tp->lock);
+	ret = tp->run_result = test_perf_run(tp);
+	mutex_unlock(&tp->lock);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations test_perf_run_fops = {
+	.write = test_perf_run_write,
+};
+
+static void test_perf_show_stats(struct seq_file *m, const char *dir,
+				 struct test_perf_stats *st, u64 elapsed_us,
+				 unsigned int req_kb)
+{
+	u64 kb = st->count * req_kb;
+	int i;
+
+	if (!st->count)
+		return;
+
+	seq_printf(m, "%s: %llu reqs %llu errors %llu KB/s %llu IOPS\n", dir,
+		   st->count, st->errors,
+		   elapsed_us ? div64_u64(kb * USEC_PER_SEC, elapsed_us) : 0,
+		   elapsed_us ? div64_u64(st->count * USEC_PER_SEC,
+					  elapsed_us) : 0);
+	seq_printf(m, "  latency us: avg %llu min %llu max %llu\n",
+		   div64_u64(st->total_us, st->count), st->min_us, st->max_us);
+	for (i = 0; i < TEST_PERF_HIST_BUCKETS; i++) {
+		if (!st->hist[i])
+			continue;
+		if (i == TEST_PERF_HIST_BUCKETS - 1)
+			seq_printf(m, "  %7lu+       %u\n", 1UL << i,
+				   st->hist[i]);
+		else
+			seq_printf(m, "  %7lu-%-7lu %u\n", i ? 1UL << i : 0,
+				   (2UL << i) - 1, st->hist[i]);
+	}
+}
+
+static int test_perf_results_show(struct seq_file *m, void *unused)
+{
+	struct test_perf *tp = &test_perf;
+
+	mutex_lock(&tp->lock);
+	seq_printf(m, "device %s scheduler %s result %d\n", tp->device,
+		   tp->run_scheduler, tp->run_result);
+	seq_printf(m, "mode %s read_percent %u queue_depth %u req_sectors %u\n",
+		   tp->run.mode == TEST_PERF_RANDOM ? "random" : "sequential",
+		   tp->run.read_percent, tp->run.queue_depth,
+		   tp->run.req_sectors);
+	seq_printf(m, "elapsed %llu us\n", tp->elapsed_us);
+	test_perf_show_stats(m, "read", &tp->stats[READ], tp->elapsed_us,
+			     tp->run.req_sectors / 2);
+	test_perf_show_stats(m, "write", &tp->stats[WRITE], tp->elapsed_us,
+			     tp->run.req_sectors / 2);
+	mutex_unlock(&tp->lock);
+
+	return 0;
+}
+
+static int test_perf_results_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, test_perf_results_show, NULL);
+}
+
+static const struct file_operations test_perf_results_fops = {
+	.open = test_perf_results_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* perf/device and perf/scheduler hold a single, newline terminated word */
+static ssize_t test_perf_str_read(struct file *file, char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	char *str = file->private_data;
+	char tmp[80];
+	int len;
+
+	mutex_lock(&test_perf.lock);
+	len = scnprintf(tmp, sizeof(tmp), "%s\n", str);
+	mutex_unlock(&test_perf.lock);
+
+	return simple_read_from_buffer(buf, count, ppos, tmp, len);
+}
+
+static ssize_t test_perf_str_write(struct file *file, const char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	char *str = file->private_data;
+	size_t size = str == test_perf.device ? sizeof(test_perf.device) :
+						sizeof(test_perf.scheduler);
+	char tmp[80];
+
+	if (count >= size)
+		return -EINVAL;
+	if (copy_from_user(tmp, buf, count))
+		return -EFAULT;
+	tmp[count] = '\0';
+
+	mutex_lock(&test_perf.lock);
+	strlcpy(str, strstrip(tmp), size);
+	mutex_unlock(&test_perf.lock);
+
+	return count;
+}
+
+static const struct file_operations test_perf_str_fops = {
+	.open = simple_open,
+	.read = test_perf_str_read,
+	.write = test_perf_str_write,
+	.llseek = default_llseek,
+};
+
+static void test_perf_debugfs_init(struct dentry *root)
+{
+	struct test_perf *tp = &test_perf;
+	umode_t mode = S_IRUGO | S_IWUSR;
+
+	tp->root = debugfs_create_dir("perf", root);
+	if (!tp->root)
+		return;
+
+	debugfs_create_file("device", mode, tp->root, tp->device,
+			    &test_perf_str_fops);
+	debugfs_create_file("scheduler", mode, tp->root, tp->scheduler,
+			    &test_perf_str_fops);
+	debugfs_create_u32("mode", mode, tp->root, &tp->mode);
+	debugfs_create_u32("read_percent", mode, tp->root, &tp->read_percent);
+	debugfs_create_u32("queue_depth", mode, tp->root, &tp->queue_depth);
+	debugfs_create_u32("req_sectors", mode, tp->root, &tp->req_sectors);
+	debugfs_create_u32("nr_reqs", mode, tp->root, &tp->nr_reqs);
+	debugfs_create_u32("start_sector", mode, tp->root, &tp->start_sector);
+	debugfs_create_u32("nr_sectors", mode, tp->root, &tp->nr_sectors);
+	debugfs_create_file("run", S_IWUSR, tp->root, NULL,
+			    &test_perf_run_fops);
+	debugfs_create_file("results", S_IRUGO, tp->root, NULL,
+			    &test_perf_results_fops);
+}
+
 static struct elevator_type elevator_test_iosched = {
 	.ops = {
 		.elevator_merge_req_fn = test_merged_requests,
@@ -889,6 +1370,10 @@ static struct elevator_type elevator_test_iosched = {
 
 static int __init test_init(void)
 {
+	test_debugfs_root = debugfs_create_dir("test-iosched", NULL);
+	if (test_debugfs_root)
+		test_perf_debugfs_init(test_debugfs_root);
+
 	elv_register(&elevator_test_iosched);
 
 	return 0;
@@ -897,6 +1382,7 @@ static int __init test_init(void)
 static void __exit test_exit(void)
 {
 	elv_unregister(&elevator_test_iosched);
+	debugfs_remove_recursive(test_debugfs_root);
 }
 
 module_init(test_init);
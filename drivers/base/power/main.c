@@ -314,6 +314,7 @@ static int dpm_run_callback(pm_callback_t cb, struct device *dev,
 			    pm_message_t state, char *info)
 {
 	ktime_t calltime;
+	u64 start;
 	int error;
 
 	if (!cb)
@@ -322,7 +323,9 @@ static int dpm_run_callback(pm_callback_t cb, struct device *dev,
 	calltime = initcall_debug_start(dev);
 
 	pm_dev_dbg(dev, state, info);
+	start = local_clock();
 	error = cb(dev);
+	suspend_timing_device(dev, state, local_clock() - start);
 	suspend_report_result(cb, error);
 
 	initcall_debug_report(dev, calltime, error);
@@ -848,10 +851,13 @@ static int legacy_suspend(struct device *dev, pm_message_t state,
 {
 	int error;
 	ktime_t calltime;
+	u64 start;
 
 	calltime = initcall_debug_start(dev);
 
+	start = local_clock();
 	error = cb(dev, state);
+	suspend_timing_device(dev, state, local_clock() - start);
 	suspend_report_result(cb, error);
 
 	initcall_debug_report(dev, calltime, error);
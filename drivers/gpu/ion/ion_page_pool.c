@@ -0,0 +1,109 @@
+/*
+ * drivers/gpu/ion/ion_page_pool.c
+ *
+ * Copyright (C) 2011 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include "ion_priv.h"
+
+/*
+ * Pages handed to ion_page_pool_free() must already be zeroed and clean
+ * in the caches, so that ion_page_pool_alloc() can return them straight to
+ * a new buffer. Pages that are not in the pool are allocated with
+ * pool->gfp_mask, which must include __GFP_ZERO.
+ */
+struct page *ion_page_pool_alloc(struct ion_page_pool *pool)
+{
+	struct page *page = NULL;
+
+	spin_lock(&pool->lock);
+	if (pool->count) {
+		page = list_first_entry(&pool->items, struct page, lru);
+		list_del(&page->lru);
+		pool->count--;
+	}
+	spin_unlock(&pool->lock);
+
+	if (!page)
+		page = alloc_pages(pool->gfp_mask, pool->order);
+
+	return page;
+}
+
+void ion_page_pool_free(struct ion_page_pool *pool, struct page *page)
+{
+	spin_lock(&pool->lock);
+	list_add(&page->lru, &pool->items);
+	pool->count++;
+	spin_unlock(&pool->lock);
+}
+
+/* Number of pages, in PAGE_SIZE units, held by the pool */
+int ion_page_pool_total(struct ion_page_pool *pool)
+{
+	return pool->count << pool->order;
+}
+
+/*
+ * Give up to nr_to_scan pages, in PAGE_SIZE units, back to the page
+ * allocator. Returns the number of pages freed.
+ */
+int ion_page_pool_shrink(struct ion_page_pool *pool, int nr_to_scan)
+{
+	int freed = 0;
+
+	while (freed < nr_to_scan) {
+		struct page *page;
+
+		spin_lock(&pool->lock);
+		if (!pool->count) {
+			spin_unlock(&pool->lock);
+			break;
+		}
+		page = list_first_entry(&pool->items, struct page, lru);
+		list_del(&page->lru);
+		pool->count--;
+		spin_unlock(&pool->lock);
+
+		__free_pages(page, pool->order);
+		freed += 1 << pool->order;
+	}
+
+	return freed;
+}
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order)
+{
+	struct ion_page_pool *pool;
+
+	pool = kzalloc(sizeof(struct ion_page_pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->items);
+	pool->gfp_mask = gfp_mask;
+	pool->order = order;
+
+	return pool;
+}
+
+void ion_page_pool_destroy(struct ion_page_pool *pool)
+{
+	ion_page_pool_shrink(pool, INT_MAX);
+	kfree(pool);
+}
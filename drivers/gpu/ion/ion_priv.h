@@ -25,6 +25,7 @@
 #include <linux/ion.h>
 #include <linux/iommu.h>
 #include <linux/seq_file.h>
+#include <linux/spinlock.h>
 
 enum {
 	DI_PARTITION_NUM = 0,
@@ -176,4 +177,31 @@ void ion_cp_heap_get_base(struct ion_heap *heap, unsigned long *base,
 
 void ion_mem_map_show(struct ion_heap *heap);
 
+/**
+ * struct ion_page_pool - pagepool struct
+ * @lock:		protects items and count
+ * @items:		list of free pages, linked through page->lru
+ * @count:		number of entries in items
+ * @gfp_mask:		gfp mask used for pages not found in the pool
+ * @order:		order of the pages in the pool
+ *
+ * Keeps zeroed, cache-clean pages of one order around so that buffer
+ * allocation does not go through the page allocator and cache maintenance
+ * every time. The owner drains it from a shrinker.
+ */
+struct ion_page_pool {
+	spinlock_t lock;
+	struct list_head items;
+	int count;
+	gfp_t gfp_mask;
+	unsigned int order;
+};
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order);
+void ion_page_pool_destroy(struct ion_page_pool *pool);
+struct page *ion_page_pool_alloc(struct ion_page_pool *pool);
+void ion_page_pool_free(struct ion_page_pool *pool, struct page *page);
+int ion_page_pool_total(struct ion_page_pool *pool);
+int ion_page_pool_shrink(struct ion_page_pool *pool, int nr_to_scan);
+
 #endif 
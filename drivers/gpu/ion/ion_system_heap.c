@@ -33,15 +33,94 @@ static atomic_t system_contig_heap_allocated;
 static unsigned int system_heap_has_outer_cache;
 static unsigned int system_heap_contig_has_outer_cache;
 
+/*
+ * Buffers are built from the largest of these orders that still fits, so
+ * big camera and video buffers need few sg entries and map with large
+ * IOMMU pages when memory is not fragmented.
+ */
+static const unsigned int orders[] = {8, 4, 0};
+#define NUM_ORDERS ARRAY_SIZE(orders)
+
+/* Opportunistic: high orders are only taken if they are free right now */
+static gfp_t high_order_gfp_flags = (GFP_KERNEL | __GFP_ZERO | __GFP_NOWARN |
+				     __GFP_NORETRY) & ~__GFP_WAIT;
+static gfp_t low_order_gfp_flags = GFP_KERNEL | __GFP_ZERO;
+
+struct ion_system_heap {
+	struct ion_heap heap;
+	struct ion_page_pool *pools[NUM_ORDERS];
+	struct shrinker shrinker;
+};
+
+static int order_to_index(unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++)
+		if (order == orders[i])
+			return i;
+	BUG();
+	return -1;
+}
+
+static struct page *alloc_largest_available(struct ion_system_heap *sys_heap,
+					    unsigned long size,
+					    unsigned int max_order,
+					    unsigned int *order)
+{
+	struct page *page;
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		if (size < (PAGE_SIZE << orders[i]))
+			continue;
+		if (max_order < orders[i])
+			continue;
+
+		page = ion_page_pool_alloc(sys_heap->pools[i]);
+		if (!page)
+			continue;
+
+		*order = orders[i];
+		return page;
+	}
+
+	return NULL;
+}
+
+/*
+ * Recycle a page block into its pool. It is zeroed and flushed here, on
+ * free, so that allocation from the pool needs neither.
+ */
+static void free_buffer_page(struct ion_system_heap *sys_heap,
+			     struct page *page, unsigned int order)
+{
+	void *vaddr = page_address(page);
+	size_t len = PAGE_SIZE << order;
+
+	memset(vaddr, 0, len);
+	dmac_flush_range(vaddr, vaddr + len);
+	if (system_heap_has_outer_cache)
+		outer_flush_range(page_to_phys(page), page_to_phys(page) + len);
+
+	ion_page_pool_free(sys_heap->pools[order_to_index(order)], page);
+}
+
 static int ion_system_heap_allocate(struct ion_heap *heap,
 				     struct ion_buffer *buffer,
 				     unsigned long size, unsigned long align,
 				     unsigned long flags)
 {
+	struct ion_system_heap *sys_heap = container_of(heap,
+							struct ion_system_heap,
+							heap);
 	struct sg_table *table;
 	struct scatterlist *sg;
-	int i, j;
+	unsigned long size_remaining = PAGE_ALIGN(size);
+	unsigned int max_order = orders[0];
 	int npages = PAGE_ALIGN(size) / PAGE_SIZE;
+	int nents = 0;
+	int i;
 
 	table = kmalloc(sizeof(struct sg_table), GFP_KERNEL);
 	if (!table)
@@ -49,19 +128,34 @@ static int ion_system_heap_allocate(struct ion_heap *heap,
 	i = sg_alloc_table(table, npages, GFP_KERNEL);
 	if (i)
 		goto err0;
-	for_each_sg(table->sgl, sg, table->nents, i) {
+
+	/* Sized for order-0 pages; only the first nents entries get used */
+	sg = table->sgl;
+	while (size_remaining) {
 		struct page *page;
-		page = alloc_page(GFP_KERNEL|__GFP_ZERO);
+		unsigned int order;
+
+		page = alloc_largest_available(sys_heap, size_remaining,
+					       max_order, &order);
 		if (!page)
 			goto err1;
-		sg_set_page(sg, page, PAGE_SIZE, 0);
+		sg_set_page(sg, page, PAGE_SIZE << order, 0);
+		nents++;
+
+		size_remaining -= PAGE_SIZE << order;
+		max_order = order;
+		if (size_remaining)
+			sg = sg_next(sg);
 	}
+	sg_mark_end(sg);
+	table->nents = nents;
+
 	buffer->priv_virt = table;
 	atomic_add(size, &system_heap_allocated);
 	return 0;
 err1:
-	for_each_sg(table->sgl, sg, i, j)
-		__free_page(sg_page(sg));
+	for_each_sg(table->sgl, sg, nents, i)
+		__free_pages(sg_page(sg), get_order(sg->length));
 	sg_free_table(table);
 err0:
 	kfree(table);
@@ -70,12 +164,15 @@ err0:
 
 void ion_system_heap_free(struct ion_buffer *buffer)
 {
+	struct ion_system_heap *sys_heap = container_of(buffer->heap,
+							struct ion_system_heap,
+							heap);
 	int i;
 	struct scatterlist *sg;
 	struct sg_table *table = buffer->priv_virt;
 
 	for_each_sg(table->sgl, sg, table->nents, i)
-		__free_page(sg_page(sg));
+		free_buffer_page(sys_heap, sg_page(sg), get_order(sg->length));
 	if (buffer->sg_table)
 		sg_free_table(buffer->sg_table);
 	kfree(buffer->sg_table);
@@ -102,16 +199,25 @@ void *ion_system_heap_map_kernel(struct ion_heap *heap,
 		return ERR_PTR(-EINVAL);
 	} else {
 		struct scatterlist *sg;
-		int i;
+		int i, j;
 		void *vaddr;
 		struct sg_table *table = buffer->priv_virt;
+		int npages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
 		struct page **pages = kmalloc(
-					sizeof(struct page *) * table->nents,
+					sizeof(struct page *) * npages,
 					GFP_KERNEL);
+		struct page **tmp = pages;
+
+		if (!pages)
+			return ERR_PTR(-ENOMEM);
+
+		for_each_sg(table->sgl, sg, table->nents, i) {
+			struct page *page = sg_page(sg);
 
-		for_each_sg(table->sgl, sg, table->nents, i)
-			pages[i] = sg_page(sg);
-		vaddr = vmap(pages, table->nents, VM_MAP, PAGE_KERNEL);
+			for (j = 0; j < sg->length / PAGE_SIZE; j++)
+				*(tmp++) = page++;
+		}
+		vaddr = vmap(pages, npages, VM_MAP, PAGE_KERNEL);
 		kfree(pages);
 
 		return vaddr;
@@ -159,17 +265,33 @@ int ion_system_heap_map_user(struct ion_heap *heap, struct ion_buffer *buffer,
 	} else {
 		struct sg_table *table = buffer->priv_virt;
 		unsigned long addr = vma->vm_start;
-		unsigned long offset = vma->vm_pgoff;
+		unsigned long offset = vma->vm_pgoff * PAGE_SIZE;
 		struct scatterlist *sg;
 		int i;
+		int ret;
 
+		/* Entries can be high-order blocks, so map them by pfn */
 		for_each_sg(table->sgl, sg, table->nents, i) {
-			if (offset) {
-				offset--;
+			struct page *page = sg_page(sg);
+			unsigned long remainder = vma->vm_end - addr;
+			unsigned long len = sg->length;
+
+			if (offset >= sg->length) {
+				offset -= sg->length;
 				continue;
+			} else if (offset) {
+				page += offset / PAGE_SIZE;
+				len = sg->length - offset;
+				offset = 0;
 			}
-			vm_insert_page(vma, addr, sg_page(sg));
-			addr += PAGE_SIZE;
+			len = min(len, remainder);
+			ret = remap_pfn_range(vma, addr, page_to_pfn(page), len,
+					      vma->vm_page_prot);
+			if (ret)
+				return ret;
+			addr += len;
+			if (addr >= vma->vm_end)
+				break;
 		}
 		return 0;
 	}
@@ -210,7 +332,7 @@ int ion_system_heap_cache_ops(struct ion_heap *heap, struct ion_buffer *buffer,
 				WARN(1, "Could not translate virtual address to physical address\n");
 				return -EINVAL;
 			}
-			outer_cache_op(pstart, pstart + PAGE_SIZE);
+			outer_cache_op(pstart, pstart + sg->length);
 		}
 	}
 	return 0;
@@ -219,9 +341,22 @@ int ion_system_heap_cache_ops(struct ion_heap *heap, struct ion_buffer *buffer,
 static int ion_system_print_debug(struct ion_heap *heap, struct seq_file *s,
 				  const struct rb_root *unused)
 {
+	struct ion_system_heap *sys_heap = container_of(heap,
+							struct ion_system_heap,
+							heap);
+	int i;
+
 	seq_printf(s, "total bytes currently allocated: %lx\n",
 			(unsigned long) atomic_read(&system_heap_allocated));
 
+	for (i = 0; i < NUM_ORDERS; i++) {
+		struct ion_page_pool *pool = sys_heap->pools[i];
+
+		seq_printf(s, "%d order %u pages in pool = %lu total\n",
+			   pool->count, pool->order,
+			   (unsigned long) ion_page_pool_total(pool) * PAGE_SIZE);
+	}
+
 	return 0;
 }
 
@@ -305,22 +440,78 @@ static struct ion_heap_ops vmalloc_ops = {
 	.unmap_iommu = ion_system_heap_unmap_iommu,
 };
 
+static int ion_system_heap_shrink(struct shrinker *shrinker,
+				  struct shrink_control *sc)
+{
+	struct ion_system_heap *sys_heap = container_of(shrinker,
+							struct ion_system_heap,
+							shrinker);
+	int nr_total = 0;
+	int nr_freed = 0;
+	int i;
+
+	if (sc->nr_to_scan) {
+		for (i = 0; i < NUM_ORDERS && nr_freed < sc->nr_to_scan; i++)
+			nr_freed += ion_page_pool_shrink(sys_heap->pools[i],
+						sc->nr_to_scan - nr_freed);
+	}
+
+	for (i = 0; i < NUM_ORDERS; i++)
+		nr_total += ion_page_pool_total(sys_heap->pools[i]);
+
+	return nr_total;
+}
+
+static void ion_system_heap_destroy_pools(struct ion_system_heap *sys_heap)
+{
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++)
+		if (sys_heap->pools[i])
+			ion_page_pool_destroy(sys_heap->pools[i]);
+}
+
 struct ion_heap *ion_system_heap_create(struct ion_platform_heap *pheap)
 {
-	struct ion_heap *heap;
+	struct ion_system_heap *sys_heap;
+	int i;
 
-	heap = kzalloc(sizeof(struct ion_heap), GFP_KERNEL);
-	if (!heap)
+	sys_heap = kzalloc(sizeof(struct ion_system_heap), GFP_KERNEL);
+	if (!sys_heap)
 		return ERR_PTR(-ENOMEM);
-	heap->ops = &vmalloc_ops;
-	heap->type = ION_HEAP_TYPE_SYSTEM;
+	sys_heap->heap.ops = &vmalloc_ops;
+	sys_heap->heap.type = ION_HEAP_TYPE_SYSTEM;
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		gfp_t gfp_flags = low_order_gfp_flags;
+
+		if (orders[i])
+			gfp_flags = high_order_gfp_flags;
+		sys_heap->pools[i] = ion_page_pool_create(gfp_flags, orders[i]);
+		if (!sys_heap->pools[i]) {
+			ion_system_heap_destroy_pools(sys_heap);
+			kfree(sys_heap);
+			return ERR_PTR(-ENOMEM);
+		}
+	}
+
+	sys_heap->shrinker.shrink = ion_system_heap_shrink;
+	sys_heap->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&sys_heap->shrinker);
+
 	system_heap_has_outer_cache = pheap->has_outer_cache;
-	return heap;
+	return &sys_heap->heap;
 }
 
 void ion_system_heap_destroy(struct ion_heap *heap)
 {
-	kfree(heap);
+	struct ion_system_heap *sys_heap = container_of(heap,
+							struct ion_system_heap,
+							heap);
+
+	unregister_shrinker(&sys_heap->shrinker);
+	ion_system_heap_destroy_pools(sys_heap);
+	kfree(sys_heap);
 }
 
 static int ion_system_contig_heap_allocate(struct ion_heap *heap,
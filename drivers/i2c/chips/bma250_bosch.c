@@ -3241,6 +3241,7 @@ static int bma250_probe(struct i2c_client *client,
 	data->early_suspend.level = EARLY_SUSPEND_LEVEL_BLANK_SCREEN + 1;
 	data->early_suspend.suspend = bma250_early_suspend;
 	data->early_suspend.resume = bma250_late_resume;
+	data->early_suspend.async = true;
 	register_early_suspend(&data->early_suspend);
 #endif
 
@@ -2761,6 +2761,7 @@ static int synaptics_ts_probe(
 	ts->early_suspend.level = EARLY_SUSPEND_LEVEL_STOP_DRAWING - 1;
 	ts->early_suspend.suspend = synaptics_ts_early_suspend;
 	ts->early_suspend.resume = synaptics_ts_late_resume;
+	ts->early_suspend.async = true;
 	register_early_suspend(&ts->early_suspend);
 #endif
 
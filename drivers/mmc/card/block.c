@@ -1123,6 +1123,23 @@ static inline void mmc_apply_rel_rw(struct mmc_blk_request *brq,
 	 R1_CC_ERROR |				\
 	 R1_ERROR)		
 
+static int mmc_blk_wait_for_ready(struct mmc_card *card, struct request *req)
+{
+	u32 status;
+
+	do {
+		int err = get_card_status(card, &status, 5);
+		if (err) {
+			pr_err("%s: error %d requesting status\n",
+			       req->rq_disk->disk_name, err);
+			return err;
+		}
+	} while (!(status & R1_READY_FOR_DATA) ||
+		 (R1_CURRENT_STATE(status) == R1_STATE_PRG));
+
+	return 0;
+}
+
 static int mmc_blk_err_check(struct mmc_card *card,
 			     struct mmc_async_req *areq)
 {
@@ -1141,6 +1158,13 @@ static int mmc_blk_err_check(struct mmc_card *card,
 	if (!req)
 		return MMC_BLK_ABORT;
 
+	/* Stopped by mmc_urgent_request(), let the card finish programming */
+	if (brq->data.error == -EINTR && rq_data_dir(req) == WRITE) {
+		if (mmc_blk_wait_for_ready(card, req))
+			return MMC_BLK_CMD_ERR;
+		return MMC_BLK_URGENT;
+	}
+
 	if (brq->sbc.error || brq->cmd.error || brq->stop.error ||
 	    brq->data.error) {
 		switch (mmc_blk_cmd_recovery(card, req, brq, &ecc_err)) {
@@ -1162,16 +1186,8 @@ static int mmc_blk_err_check(struct mmc_card *card,
 	}
 
 	if (!mmc_host_is_spi(card->host) && rq_data_dir(req) != READ) {
-		u32 status;
-		do {
-			int err = get_card_status(card, &status, 5);
-			if (err) {
-				pr_err("%s: error %d requesting status\n",
-				       req->rq_disk->disk_name, err);
-				return MMC_BLK_CMD_ERR;
-			}
-		} while (!(status & R1_READY_FOR_DATA) ||
-			 (R1_CURRENT_STATE(status) == R1_STATE_PRG));
+		if (mmc_blk_wait_for_ready(card, req))
+			return MMC_BLK_CMD_ERR;
 	}
 
 	if (brq->data.error) {
@@ -1317,6 +1333,9 @@ static int mmc_blk_packed_err_check(struct mmc_card *card,
 	u8 ext_csd[512];
 
 	check = mmc_blk_err_check(card, areq);
+	if (check == MMC_BLK_URGENT)
+		return check;
+
 	err = get_card_status(card, &status, 0);
 	if (err) {
 		pr_err("%s: error %d sending status command\n",
@@ -1459,6 +1478,45 @@ static void mmc_blk_rw_rq_prep(struct mmc_queue_req *mqrq,
 	mmc_queue_bounce_pre(mqrq);
 }
 
+#define MMC_BLK_MIX_SHIFT	10
+
+/*
+ * Running average of the share of writes among the requests issued, with
+ * one sample per request: a pack of n writes counts n times.
+ */
+static void mmc_blk_update_wr_mix(struct mmc_queue *mq, int data_dir,
+				  unsigned int nr)
+{
+	unsigned int sample = data_dir == WRITE ? 1 << MMC_BLK_MIX_SHIFT : 0;
+
+	while (nr--)
+		mq->wr_mix = (mq->wr_mix * 7 + sample) >> 3;
+}
+
+/*
+ * Writes to see in a row before packing them. A pack delays any read
+ * queued behind it by its whole length, so the more reads are mixed with
+ * the writes, the longer the run of writes has to be for packing to pay
+ * off: num_wr_reqs_to_start_packing when reads dominate, down to none for
+ * a stream of writes only.
+ */
+static int mmc_blk_packing_threshold(struct mmc_queue *mq)
+{
+	unsigned int rd_mix = (1 << MMC_BLK_MIX_SHIFT) - mq->wr_mix;
+
+	return (mq->num_wr_reqs_to_start_packing * rd_mix) >> MMC_BLK_MIX_SHIFT;
+}
+
+/*
+ * Reads the scheduler holds behind the pack. Packing more writes in front
+ * of them would only add to their latency. Sync writes are left packable,
+ * as fsync writeback is where packing helps most.
+ */
+static bool mmc_blk_read_waiting(struct request_queue *q)
+{
+	return q->nr_queued_reads;
+}
+
 static void mmc_blk_write_packing_control(struct mmc_queue *mq,
 					  struct request *req)
 {
@@ -1475,13 +1533,14 @@ static void mmc_blk_write_packing_control(struct mmc_queue *mq,
 
 	if (!req || (req && (req->cmd_flags & REQ_FLUSH))) {
 		if (mq->num_of_potential_packed_wr_reqs >
-				mq->num_wr_reqs_to_start_packing)
+				mmc_blk_packing_threshold(mq))
 			mq->wr_packing_enabled = true;
 		mq->num_of_potential_packed_wr_reqs = 0;
 		return;
 	}
 
 	data_dir = rq_data_dir(req);
+	mmc_blk_update_wr_mix(mq, data_dir, 1);
 
 	if (data_dir == READ) {
 		mq->num_of_potential_packed_wr_reqs = 0;
@@ -1492,7 +1551,7 @@ static void mmc_blk_write_packing_control(struct mmc_queue *mq,
 	}
 
 	if (mq->num_of_potential_packed_wr_reqs >
-			mq->num_wr_reqs_to_start_packing)
+			mmc_blk_packing_threshold(mq))
 		mq->wr_packing_enabled = true;
 
 }
@@ -1521,6 +1580,8 @@ void mmc_blk_init_packed_statistics(struct mmc_card *card)
 	       sizeof(*card->wr_pack_stats.packing_events));
 	memset(&card->wr_pack_stats.pack_stop_reason, 0,
 		sizeof(card->wr_pack_stats.pack_stop_reason));
+	memset(&card->wr_pack_stats.pack_size_hist, 0,
+		sizeof(card->wr_pack_stats.pack_size_hist));
 	card->wr_pack_stats.enabled = true;
 	spin_unlock(&card->wr_pack_stats.lock);
 }
@@ -1596,6 +1657,8 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 	u8 put_back = 0;
 	u8 max_packed_rw = 0;
 	u8 reqs = 0;
+	bool read_waiting;
+	unsigned int packed_sectors = blk_rq_sectors(req);
 	struct mmc_wr_pack_stats *stats = &card->wr_pack_stats;
 
 	mmc_blk_clear_packed(mq->mqrq_cur);
@@ -1638,8 +1701,14 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 
 	while (reqs < max_packed_rw - 1) {
 		spin_lock_irq(q->queue_lock);
-		next = blk_fetch_request(q);
+		read_waiting = mmc_blk_read_waiting(q);
+		if (!read_waiting)
+			next = blk_fetch_request(q);
 		spin_unlock_irq(q->queue_lock);
+		if (read_waiting) {
+			MMC_BLK_UPDATE_STOP_REASON(stats, READ_WAITING);
+			break;
+		}
 		if (!next) {
 			MMC_BLK_UPDATE_STOP_REASON(stats, EMPTY_QUEUE);
 			break;
@@ -1684,6 +1753,7 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 		if (rq_data_dir(next) == WRITE)
 			mq->num_of_potential_packed_wr_reqs++;
 		list_add_tail(&next->queuelist, &mq->mqrq_cur->packed_list);
+		packed_sectors += blk_rq_sectors(next);
 		cur = next;
 		reqs++;
 	}
@@ -1699,11 +1769,17 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 			stats->packing_events[reqs + 1]++;
 		if (reqs + 1 == max_packed_rw)
 			MMC_BLK_UPDATE_STOP_REASON(stats, THRESHOLD);
+		if (reqs > 0)
+			stats->pack_size_hist[min_t(int,
+					ilog2(max(packed_sectors >> 1, 1U)),
+					MMC_PACK_SIZE_BUCKETS - 1)]++;
 	}
 
 	spin_unlock(&stats->lock);
 
 	if (reqs > 0) {
+		/* req itself was counted by mmc_blk_write_packing_control() */
+		mmc_blk_update_wr_mix(mq, WRITE, reqs);
 		list_add(&req->queuelist, &mq->mqrq_cur->packed_list);
 		mq->mqrq_cur->packed_num = ++reqs;
 		return reqs;
@@ -1850,6 +1926,104 @@ static int mmc_blk_end_packed_req(struct mmc_queue *mq,
 	return ret;
 }
 
+/* Running average of the time a write takes, per KB */
+static void mmc_blk_update_wr_cost(struct mmc_queue *mq,
+				   struct mmc_queue_req *mq_rq)
+{
+	struct mmc_data *data = &mq_rq->brq.data;
+	unsigned int kb = (data->blocks * data->blksz) >> 10;
+	u64 sample;
+
+	if (!kb || !ktime_to_ns(mq_rq->issue_time))
+		return;
+
+	sample = div_u64(ktime_to_ns(ktime_sub(ktime_get(),
+					       mq_rq->issue_time)), kb);
+	mq_rq->issue_time = ktime_set(0, 0);
+	if (mq->wr_ns_per_kb)
+		sample = div_u64((u64)mq->wr_ns_per_kb * 7 + sample, 8);
+	mq->wr_ns_per_kb = min_t(u64, sample, UINT_MAX);
+}
+
+/* What a stopped write would still have taken, going by the average */
+static u64 mmc_blk_wr_time_left(struct mmc_queue *mq,
+				struct mmc_queue_req *mq_rq)
+{
+	struct mmc_data *data = &mq_rq->brq.data;
+	u64 expected_ns = (u64)mq->wr_ns_per_kb *
+		((data->blocks * data->blksz) >> 10);
+	s64 elapsed_ns = ktime_to_ns(ktime_sub(mq->urgent_stop_time,
+					       mq_rq->issue_time));
+
+	if (!ktime_to_ns(mq_rq->issue_time) || elapsed_ns < 0 ||
+	    elapsed_ns >= expected_ns)
+		return 0;
+
+	return div_u64(expected_ns - elapsed_ns, NSEC_PER_USEC);
+}
+
+static void mmc_blk_reinsert_req(struct request_queue *q, struct request *req)
+{
+	if (blk_reinsert_request(q, req))
+		blk_requeue_request(q, req);
+}
+
+/* Called with the queue lock held; the last request reinserted runs first */
+static void mmc_blk_reinsert_mqrq(struct mmc_queue *mq,
+				  struct mmc_queue_req *mqrq)
+{
+	struct request *prq, *tmp;
+
+	if (mqrq->packed_cmd == MMC_PACKED_NONE) {
+		mmc_blk_reinsert_req(mq->queue, mqrq->req);
+		return;
+	}
+
+	list_for_each_entry_safe_reverse(prq, tmp, &mqrq->packed_list,
+					 queuelist) {
+		list_del_init(&prq->queuelist);
+		mmc_blk_reinsert_req(mq->queue, prq);
+	}
+	mmc_blk_clear_packed(mqrq);
+}
+
+/*
+ * The write of mq_rq was stopped for an urgent read, see
+ * mmc_urgent_request(). Complete what the host reports as written and give
+ * the rest back to the scheduler, together with the request prepared
+ * behind it, which mmc_start_req() did not start. The queue thread then
+ * fetches the read. A packed write is given back whole: there is no telling
+ * which of its requests reached the card.
+ */
+static void mmc_blk_preempt_write(struct mmc_queue *mq,
+				  struct mmc_queue_req *mq_rq,
+				  struct request *rqc)
+{
+	struct mmc_card *card = mq->card;
+	struct request_queue *q = mq->queue;
+	struct mmc_blk_request *brq = &mq_rq->brq;
+	u64 saved_us = mmc_blk_wr_time_left(mq, mq_rq);
+
+	mq_rq->issue_time = ktime_set(0, 0);
+
+	spin_lock_irq(q->queue_lock);
+	card->urgent_stats.preempted++;
+	card->urgent_stats.saved_us += saved_us;
+
+	if (rqc) {
+		mmc_blk_reinsert_mqrq(mq, mq->mqrq_cur);
+		/* The scheduler owns it again, leave no stale pointers */
+		mq->mqrq_cur->req = NULL;
+		mq->mqrq_cur->brq.mrq.data = NULL;
+	}
+
+	if (mq_rq->packed_cmd != MMC_PACKED_NONE ||
+	    !brq->data.bytes_xfered ||
+	    __blk_end_request(mq_rq->req, 0, brq->data.bytes_xfered))
+		mmc_blk_reinsert_mqrq(mq, mq_rq);
+	spin_unlock_irq(q->queue_lock);
+}
+
 static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 {
 	struct mmc_blk_data *md = mq->data;
@@ -1880,6 +2054,8 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 		} else
 			areq = NULL;
 		areq = mmc_start_req(card->host, areq, (int *) &status);
+		if (rqc && card->host->areq == &mq->mqrq_cur->mmc_active)
+			mq->mqrq_cur->issue_time = ktime_get();
 		if (!areq)
 			return 0;
 
@@ -1897,6 +2073,8 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 		case MMC_BLK_SUCCESS:
 		case MMC_BLK_PARTIAL:
 			mmc_blk_reset_success(md, type);
+			if (status == MMC_BLK_SUCCESS && type == MMC_BLK_WRITE)
+				mmc_blk_update_wr_cost(mq, mq_rq);
 
 			if (mq_rq->packed_cmd != MMC_PACKED_NONE) {
 				ret = mmc_blk_end_packed_req(mq, mq_rq);
@@ -1953,6 +2131,9 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 			break;
 		case MMC_BLK_NOMEDIUM:
 			goto cmd_abort;
+		case MMC_BLK_URGENT:
+			mmc_blk_preempt_write(mq, mq_rq, rqc);
+			return 0;
 		}
 
 		if (ret) {
@@ -2198,6 +2379,10 @@ static int sd_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 		case MMC_BLK_NOMEDIUM:
 			card->do_remove = 1;
 			goto cmd_abort;
+		case MMC_BLK_URGENT:
+			/* SD cards are not preempted, see mmc_init_queue() */
+			WARN_ON(1);
+			goto cmd_abort;
 		}
 
 		if (ret) {
@@ -43,6 +43,72 @@ static int mmc_prep_request(struct request_queue *q, struct request *req)
 	return BLKPREP_OK;
 }
 
+/*
+ * Called by the queue thread, holding thread_sem, each time it runs out of
+ * requests. The idle timer is armed while the screen is off, or when the
+ * card asked for an urgent BKOPS that could not be started right away.
+ */
+static void mmc_queue_idle(struct mmc_queue *mq)
+{
+	struct mmc_card *card = mq->card;
+
+	if (!mq->idle) {
+		mq->idle = true;
+		mq->idle_since = jiffies;
+	}
+
+	if (mq->idle_bkops && (mq->screen_off || mmc_card_need_bkops(card)))
+		queue_delayed_work(system_freezable_wq, &mq->bkops_work,
+				   msecs_to_jiffies(card->bkops_info.idle_ms));
+}
+
+static void mmc_queue_bkops_work(struct work_struct *work)
+{
+	struct mmc_queue *mq = container_of(to_delayed_work(work),
+					    struct mmc_queue, bkops_work);
+	struct mmc_card *card = mq->card;
+	unsigned long idle_end;
+
+	/* Busy or suspended, armed again when the queue next goes idle */
+	if (down_trylock(&mq->thread_sem))
+		return;
+
+	if (!mq->idle || !(mq->screen_off || mmc_card_need_bkops(card)))
+		goto out;
+
+	idle_end = mq->idle_since + msecs_to_jiffies(card->bkops_info.idle_ms);
+	if (time_before(jiffies, idle_end)) {
+		queue_delayed_work(system_freezable_wq, &mq->bkops_work,
+				   idle_end - jiffies);
+		goto out;
+	}
+
+	mmc_start_idle_bkops(card);
+out:
+	up(&mq->thread_sem);
+}
+
+#ifdef CONFIG_HAS_EARLYSUSPEND
+static void mmc_queue_early_suspend(struct early_suspend *h)
+{
+	struct mmc_queue *mq = container_of(h, struct mmc_queue,
+					    early_suspend);
+
+	mq->screen_off = true;
+	queue_delayed_work(system_freezable_wq, &mq->bkops_work,
+			   msecs_to_jiffies(mq->card->bkops_info.idle_ms));
+}
+
+static void mmc_queue_late_resume(struct early_suspend *h)
+{
+	struct mmc_queue *mq = container_of(h, struct mmc_queue,
+					    early_suspend);
+
+	mq->screen_off = false;
+	cancel_delayed_work(&mq->bkops_work);
+}
+#endif
+
 static int mmc_queue_thread(void *d)
 {
 	struct mmc_queue *mq = d;
@@ -60,9 +126,12 @@ static int mmc_queue_thread(void *d)
 		set_current_state(TASK_INTERRUPTIBLE);
 		req = blk_fetch_request(q);
 		mq->mqrq_cur->req = req;
+		if (req && rq_data_dir(req) == READ)
+			q->notified_urgent = false;
 		spin_unlock_irq(q->queue_lock);
 
 		if (req || mq->mqrq_prev->req) {
+			mq->idle = false;
 			if (mmc_card_doing_bkops(mq->card))
 				mmc_interrupt_bkops(mq->card);
 
@@ -75,6 +144,7 @@ static int mmc_queue_thread(void *d)
 			}
 
 			mmc_start_bkops(mq->card);
+			mmc_queue_idle(mq);
 			up(&mq->thread_sem);
 			schedule();
 			down(&mq->thread_sem);
@@ -158,6 +228,46 @@ static void mmc_request(struct request_queue *q)
 		wake_up_process(mq->thread);
 }
 
+/*
+ * Called with the queue lock held, instead of mmc_request(), when the
+ * scheduler has a read that should not wait for the write in flight. The
+ * write is stopped and mmc_blk_issue_rw_rq() gives back what is left of
+ * it (MMC_BLK_URGENT), so that the read is fetched next. The queue thread
+ * clears ->notified_urgent once it fetches a read.
+ */
+static void mmc_urgent_request(struct request_queue *q)
+{
+	struct mmc_queue *mq = q->queuedata;
+	struct mmc_card *card;
+	int i;
+
+	if (!mq) {
+		mmc_request(q);
+		return;
+	}
+
+	card = mq->card;
+	card->urgent_stats.notified++;
+
+	/*
+	 * The queue thread changes the mqrq slots without the queue lock,
+	 * so neither of them is looked into here. Each is only offered to
+	 * the host, which stops it under its own lock if it is the write
+	 * in flight. A request of another partition's queue, or one that
+	 * has just completed, is left alone.
+	 */
+	for (i = 0; i < ARRAY_SIZE(mq->mqrq); i++)
+		if (!mmc_stop_request(card->host, &mq->mqrq[i].brq.mrq))
+			break;
+
+	if (i < ARRAY_SIZE(mq->mqrq))
+		mq->urgent_stop_time = ktime_get();
+	else
+		card->urgent_stats.not_stopped++;
+
+	mmc_request(q);
+}
+
 static struct scatterlist *mmc_alloc_sg(int sg_len, int *err)
 {
 	struct scatterlist *sg;
@@ -225,7 +335,11 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 	mq->queue->queuedata = mq;
 	mq->num_wr_reqs_to_start_packing = DEFAULT_NUM_REQS_TO_START_PACK;
 
+	INIT_DELAYED_WORK(&mq->bkops_work, mmc_queue_bkops_work);
+
 	blk_queue_prep_rq(mq->queue, mmc_prep_request);
+	if (mmc_card_mmc(card) && host->ops->stop_request)
+		blk_queue_urgent_request(mq->queue, mmc_urgent_request);
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, mq->queue);
 	if (mmc_can_erase(card))
 		mmc_queue_setup_discard(mq->queue, card);
@@ -320,6 +434,20 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 		goto free_bounce_sg;
 	}
 
+	/* Only the user area, the other partitions share its idle time */
+	if (mmc_card_mmc(card) && card->ext_csd.bkops_en &&
+	    (host->caps2 & MMC_CAP2_BKOPS) && !subname) {
+		mq->idle_bkops = true;
+#ifdef CONFIG_HAS_EARLYSUSPEND
+		mq->early_suspend.suspend = mmc_queue_early_suspend;
+		mq->early_suspend.resume = mmc_queue_late_resume;
+		mq->early_suspend.level = EARLY_SUSPEND_LEVEL_DISABLE_FB;
+		register_early_suspend(&mq->early_suspend);
+#else
+		mq->screen_off = true;
+#endif
+	}
+
 	return 0;
  free_bounce_sg:
 	kfree(mqrq_cur->bounce_sg);
@@ -349,11 +477,17 @@ void mmc_cleanup_queue(struct mmc_queue *mq)
 	struct mmc_queue_req *mqrq_cur = mq->mqrq_cur;
 	struct mmc_queue_req *mqrq_prev = mq->mqrq_prev;
 
+#ifdef CONFIG_HAS_EARLYSUSPEND
+	if (mq->idle_bkops)
+		unregister_early_suspend(&mq->early_suspend);
+#endif
+
 	
 	mmc_queue_resume(mq);
 
 	
 	kthread_stop(mq->thread);
+	cancel_delayed_work_sync(&mq->bkops_work);
 
 	
 	spin_lock_irqsave(q->queue_lock, flags);
@@ -396,6 +530,12 @@ void mmc_queue_suspend(struct mmc_queue *mq)
 		spin_unlock_irqrestore(q->queue_lock, flags);
 
 		down(&mq->thread_sem);
+		cancel_delayed_work_sync(&mq->bkops_work);
+
+		/* Unless the host keeps the card powered to let it finish */
+		if (mq->idle_bkops && mmc_card_doing_bkops(mq->card) &&
+		    !mq->card->host->bkops_started)
+			mmc_interrupt_bkops(mq->card);
 	}
 }
 
@@ -1,6 +1,9 @@
 #ifndef MMC_QUEUE_H
 #define MMC_QUEUE_H
 
+#include <linux/workqueue.h>
+#include <linux/earlysuspend.h>
+
 struct request;
 struct task_struct;
 
@@ -21,6 +24,7 @@ enum mmc_blk_status {
 	MMC_BLK_DATA_ERR,
 	MMC_BLK_ECC_ERR,
 	MMC_BLK_NOMEDIUM,
+	MMC_BLK_URGENT,
 };
 
 enum mmc_packed_cmd {
@@ -42,6 +46,7 @@ struct mmc_queue_req {
 	enum mmc_packed_cmd	packed_cmd;
 	int		packed_fail_idx;
 	u8		packed_num;
+	ktime_t			issue_time;
 };
 
 struct mmc_queue {
@@ -58,6 +63,17 @@ struct mmc_queue {
 	bool			wr_packing_enabled;
 	int			num_of_potential_packed_wr_reqs;
 	int			num_wr_reqs_to_start_packing;
+	unsigned int		wr_mix;		/* share of writes, of 1024 */
+	u32			wr_ns_per_kb;	/* average cost of a write */
+	ktime_t			urgent_stop_time;
+	bool			idle_bkops;	/* BKOPS from the idle timer */
+	bool			idle;
+	bool			screen_off;
+	unsigned long		idle_since;	/* jiffies */
+	struct delayed_work	bkops_work;
+#ifdef CONFIG_HAS_EARLYSUSPEND
+	struct early_suspend	early_suspend;
+#endif
 	int (*err_check_fn) (struct mmc_card *, struct mmc_async_req *);
 	void (*packed_test_fn) (struct request_queue *, struct mmc_queue_req *);
 };
@@ -245,6 +245,7 @@ struct mmc_card *mmc_alloc_card(struct mmc_host *host, struct device_type *type)
 	card->dev.type = type;
 
 	spin_lock_init(&card->wr_pack_stats.lock);
+	card->bkops_info.idle_ms = MMC_BKOPS_IDLE_MS;
 
 	return card;
 }
@@ -44,6 +44,7 @@
 #include "sdio_ops.h"
 
 #define MMC_BKOPS_MAX_TIMEOUT    (4 * 60 * 1000) 
+#define MMC_BKOPS_DEFER_TIMEOUT	(10 * 1000)
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/mmcio.h>
@@ -277,6 +278,8 @@ void mmc_start_bkops(struct mmc_card *card)
 		if (mmc_is_exception_event(card, EXT_CSD_URGENT_BKOPS) || is_storage_encrypting)
 			if (card->ext_csd.raw_bkops_status >= EXT_CSD_BKOPS_LEVEL_2 || is_storage_encrypting) {
 				spin_lock_irqsave(&card->host->lock, flags);
+				if (!mmc_card_need_bkops(card))
+					card->bkops_info.need_since = jiffies;
 				mmc_card_set_need_bkops(card);
 				spin_unlock_irqrestore(&card->host->lock, flags);
 			}
@@ -289,6 +292,18 @@ void mmc_start_bkops(struct mmc_card *card)
 		return;
 	}
 
+	/*
+	 * Without HPI the next request would wait for the whole operation,
+	 * leave it to mmc_start_idle_bkops() once the queue has gone idle.
+	 * A critical level, or one left pending for too long under steady
+	 * I/O, is started anyway.
+	 */
+	if (!card->ext_csd.hpi_en && !is_storage_encrypting &&
+	    card->ext_csd.raw_bkops_status < EXT_CSD_BKOPS_LEVEL_3 &&
+	    time_before(jiffies, card->bkops_info.need_since +
+			msecs_to_jiffies(MMC_BKOPS_DEFER_TIMEOUT)))
+		return;
+
 	mmc_claim_host(card->host);
 
 	timeout = (card->ext_csd.raw_bkops_status >= EXT_CSD_BKOPS_LEVEL_2) ?
@@ -317,11 +332,59 @@ void mmc_start_bkops(struct mmc_card *card)
 		mmc_card_set_doing_bkops(card);
 	}
 	spin_unlock_irqrestore(&card->host->lock, flags);
+	card->bkops_info.start_time = ktime_get();
+	card->bkops_info.stats.urgent_started++;
 out:
 	mmc_release_host(card->host);
 }
 EXPORT_SYMBOL(mmc_start_bkops);
 
+/*
+ * Called by the block queue once it has been idle for bkops_info.idle_ms.
+ * BKOPS is started at any level the card reports, without waiting for it:
+ * the next request stops it, see mmc_interrupt_bkops(). A card without HPI
+ * cannot be stopped, so it only gets the urgent levels mmc_start_bkops()
+ * left for idle time.
+ */
+void mmc_start_idle_bkops(struct mmc_card *card)
+{
+	unsigned long flags;
+	int err;
+
+	if (!card->ext_csd.bkops_en || !(card->host->caps2 & MMC_CAP2_BKOPS))
+		return;
+
+	if (mmc_card_doing_bkops(card) ||
+	    card->host->bkops_trigger == ENCRYPT_MAGIC_NUMBER2)
+		return;
+
+	if (!card->ext_csd.hpi_en && !mmc_card_need_bkops(card))
+		return;
+
+	err = mmc_read_bkops_status(card);
+	if (err || !card->ext_csd.raw_bkops_status)
+		return;
+
+	mmc_claim_host(card->host);
+	err = mmc_switch(card, EXT_CSD_CMD_SET_NORMAL,
+			EXT_CSD_BKOPS_START, 1, 0);
+	if (err) {
+		pr_warning("%s: error %d starting idle bkops\n",
+			   mmc_hostname(card->host), err);
+		goto out;
+	}
+
+	spin_lock_irqsave(&card->host->lock, flags);
+	mmc_card_clr_need_bkops(card);
+	mmc_card_set_doing_bkops(card);
+	spin_unlock_irqrestore(&card->host->lock, flags);
+	card->bkops_info.start_time = ktime_get();
+	card->bkops_info.stats.idle_started++;
+out:
+	mmc_release_host(card->host);
+}
+EXPORT_SYMBOL(mmc_start_idle_bkops);
+
 static void mmc_wait_done(struct mmc_request *mrq)
 {
 	complete(&mrq->completion);
@@ -451,13 +514,15 @@ void mmc_wait_for_req(struct mmc_host *host, struct mmc_request *mrq)
 }
 EXPORT_SYMBOL(mmc_wait_for_req);
 
-int mmc_interrupt_hpi(struct mmc_card *card)
+/* Sets *stopped when the card was programming and HPI got it out of it */
+static int __mmc_interrupt_hpi(struct mmc_card *card, bool *stopped)
 {
 	int err;
 	u32 status;
 
 	BUG_ON(!card);
 
+	*stopped = false;
 	if (!card->ext_csd.hpi_en) {
 		pr_info("%s: HPI enable bit unset\n", mmc_hostname(card->host));
 		return 1;
@@ -481,6 +546,7 @@ int mmc_interrupt_hpi(struct mmc_card *card)
 			if (err)
 				break;
 		} while (!(status & R1_READY_FOR_DATA) || (R1_CURRENT_STATE(status) == R1_STATE_PRG));
+		*stopped = !err;
 	} else
 		pr_debug("%s: Left prg-state\n", mmc_hostname(card->host));
 
@@ -488,6 +554,13 @@ out:
 	mmc_release_host(card->host);
 	return err;
 }
+
+int mmc_interrupt_hpi(struct mmc_card *card)
+{
+	bool stopped;
+
+	return __mmc_interrupt_hpi(card, &stopped);
+}
 EXPORT_SYMBOL(mmc_interrupt_hpi);
 
 int mmc_wait_for_cmd(struct mmc_host *host, struct mmc_command *cmd, int retries)
@@ -509,23 +582,74 @@ int mmc_wait_for_cmd(struct mmc_host *host, struct mmc_command *cmd, int retries
 
 EXPORT_SYMBOL(mmc_wait_for_cmd);
 
+int mmc_stop_request(struct mmc_host *host, struct mmc_request *mrq)
+{
+	if (!host->ops->stop_request)
+		return -ENOTSUPP;
+
+	return host->ops->stop_request(host, mrq);
+}
+EXPORT_SYMBOL(mmc_stop_request);
+
+/* A card without HPI has to be left to finish */
+static int mmc_bkops_wait_done(struct mmc_card *card)
+{
+	unsigned long timeout;
+	u32 status;
+	int err;
+
+	timeout = jiffies + msecs_to_jiffies(MMC_BKOPS_MAX_TIMEOUT);
+	do {
+		err = mmc_send_status(card, &status);
+		if (err)
+			return err;
+		if ((status & R1_READY_FOR_DATA) &&
+		    R1_CURRENT_STATE(status) != R1_STATE_PRG)
+			return 0;
+		mmc_delay(1);
+	} while (time_before(jiffies, timeout));
+
+	return -ETIMEDOUT;
+}
+
 int mmc_interrupt_bkops(struct mmc_card *card)
 {
-	int err = 0;
+	struct mmc_bkops_info *bkops;
 	unsigned long flags;
+	bool stopped;
+	int err;
+	u64 us;
 
 	BUG_ON(!card);
+	bkops = &card->bkops_info;
+
+	mmc_claim_host(card->host);
+	if (card->ext_csd.hpi_en) {
+		err = __mmc_interrupt_hpi(card, &stopped);
+		if (stopped)
+			bkops->stats.hpi++;
+		else if (!err)
+			bkops->stats.completed++;
+	} else {
+		err = mmc_bkops_wait_done(card);
+		if (!err)
+			bkops->stats.completed++;
+	}
 
-	err = mmc_interrupt_hpi(card);
+	if (ktime_to_ns(bkops->start_time)) {
+		us = ktime_us_delta(ktime_get(), bkops->start_time);
+		bkops->stats.total_us += us;
+		if (us > bkops->stats.max_us)
+			bkops->stats.max_us = us;
+		bkops->start_time = ktime_set(0, 0);
+	}
 
 	spin_lock_irqsave(&card->host->lock, flags);
 	mmc_card_clr_doing_bkops(card);
 	spin_unlock_irqrestore(&card->host->lock, flags);
+	mmc_release_host(card->host);
 	if (err)
-		pr_err("%s: send hpi fail : %d\n",
-		       mmc_hostname(card->host), err);
-	else
-		pr_err("%s: send hpi done : %d\n",
+		pr_err("%s: error %d stopping bkops\n",
 		       mmc_hostname(card->host), err);
 	return err;
 }
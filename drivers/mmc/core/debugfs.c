@@ -429,6 +429,33 @@ static ssize_t mmc_wr_pack_stats_read(struct file *filp, char __user *ubuf,
 			pack_stats->pack_stop_reason[THRESHOLD]);
 		strlcat(ubuf, temp_buf, cnt);
 	}
+	if (pack_stats->pack_stop_reason[READ_WAITING]) {
+		snprintf(temp_buf, TEMP_BUF_SIZE,
+			 "%s: %d times: read waiting\n",
+			mmc_hostname(card->host),
+			pack_stats->pack_stop_reason[READ_WAITING]);
+		strlcat(ubuf, temp_buf, cnt);
+	}
+
+	snprintf(temp_buf, TEMP_BUF_SIZE, "%s: packed write sizes:\n",
+		 mmc_hostname(card->host));
+	strlcat(ubuf, temp_buf, cnt);
+
+	for (i = 0; i < MMC_PACK_SIZE_BUCKETS; i++) {
+		if (!pack_stats->pack_size_hist[i])
+			continue;
+		if (i == MMC_PACK_SIZE_BUCKETS - 1)
+			snprintf(temp_buf, TEMP_BUF_SIZE,
+				 "%s: %u KB and more - %d times\n",
+				 mmc_hostname(card->host), 1U << i,
+				 pack_stats->pack_size_hist[i]);
+		else
+			snprintf(temp_buf, TEMP_BUF_SIZE,
+				 "%s: %u-%u KB - %d times\n",
+				 mmc_hostname(card->host), 1U << i,
+				 (2U << i) - 1, pack_stats->pack_size_hist[i]);
+		strlcat(ubuf, temp_buf, cnt);
+	}
 
 	spin_unlock(&pack_stats->lock);
 
@@ -473,6 +500,61 @@ static const struct file_operations mmc_dbg_wr_pack_stats_fops = {
 	.write		= mmc_wr_pack_stats_write,
 };
 
+static int mmc_urgent_stats_show(struct seq_file *s, void *data)
+{
+	struct mmc_card *card = s->private;
+	struct mmc_urgent_stats *stats = &card->urgent_stats;
+
+	seq_printf(s, "notified:\t%u\n", stats->notified);
+	seq_printf(s, "preempted:\t%u\n", stats->preempted);
+	seq_printf(s, "not stopped:\t%u\n", stats->not_stopped);
+	seq_printf(s, "saved:\t\t%llu us\n",
+		   (unsigned long long)stats->saved_us);
+
+	return 0;
+}
+
+static int mmc_urgent_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mmc_urgent_stats_show, inode->i_private);
+}
+
+static const struct file_operations mmc_dbg_urgent_stats_fops = {
+	.open		= mmc_urgent_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int mmc_bkops_stats_show(struct seq_file *s, void *data)
+{
+	struct mmc_card *card = s->private;
+	struct mmc_bkops_stats *stats = &card->bkops_info.stats;
+
+	seq_printf(s, "idle started:\t%u\n", stats->idle_started);
+	seq_printf(s, "urgent started:\t%u\n", stats->urgent_started);
+	seq_printf(s, "stopped by hpi:\t%u\n", stats->hpi);
+	seq_printf(s, "completed:\t%u\n", stats->completed);
+	seq_printf(s, "total:\t\t%llu us\n",
+		   (unsigned long long)stats->total_us);
+	seq_printf(s, "max:\t\t%llu us\n",
+		   (unsigned long long)stats->max_us);
+
+	return 0;
+}
+
+static int mmc_bkops_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mmc_bkops_stats_show, inode->i_private);
+}
+
+static const struct file_operations mmc_dbg_bkops_stats_fops = {
+	.open		= mmc_bkops_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 void mmc_add_card_debugfs(struct mmc_card *card)
 {
 	struct mmc_host	*host = card->host;
@@ -509,6 +591,21 @@ void mmc_add_card_debugfs(struct mmc_card *card)
 					 &mmc_dbg_wr_pack_stats_fops))
 			goto err;
 
+	if (mmc_card_mmc(card) && card->host->ops->stop_request)
+		if (!debugfs_create_file("urgent_stats", S_IRUSR, root, card,
+					 &mmc_dbg_urgent_stats_fops))
+			goto err;
+
+	if (mmc_card_mmc(card) && card->ext_csd.bkops_en &&
+	    (card->host->caps2 & MMC_CAP2_BKOPS)) {
+		if (!debugfs_create_file("bkops_stats", S_IRUSR, root, card,
+					 &mmc_dbg_bkops_stats_fops))
+			goto err;
+		if (!debugfs_create_u32("bkops_idle_ms", S_IRUSR | S_IWUSR,
+					root, &card->bkops_info.idle_ms))
+			goto err;
+	}
+
 	return;
 
 err:
@@ -544,6 +544,9 @@ msmsdcc_dma_complete_tlet(unsigned long data)
 	if (host->dma.result & DMOV_RSLT_DONE) {
 		host->curr.data_xfered = host->curr.xfer_size;
 		host->curr.xfer_remain -= host->curr.xfer_size;
+	} else if (mrq->data->error == -EINTR) {
+		/* flushed by msmsdcc_stop_request() */
+		msmsdcc_reset_and_restore(host);
 	} else {
 		
 		if (host->dma.result & DMOV_RSLT_ERROR)
@@ -3779,6 +3782,44 @@ exit:
 	return rc;
 }
 
+/*
+ * Abort mrq, if it is the write in its data phase, so that the block layer
+ * can serve an urgent read first. Checked under host->lock against the
+ * request in flight, as the caller only holds the queue lock. The transfer ends as on a data error: the DMA is
+ * flushed and STOP_TRANSMISSION sent, and the request completes with
+ * -EINTR. A write whose data is all sent is left alone: the card is
+ * programming it and there is nothing left to stop.
+ */
+static int msmsdcc_stop_request(struct mmc_host *mmc, struct mmc_request *mrq)
+{
+	struct msmsdcc_host *host = mmc_priv(mmc);
+	struct mmc_data *data;
+	unsigned long flags;
+	int rc = 0;
+
+	spin_lock_irqsave(&host->lock, flags);
+	data = host->curr.data;
+	if (host->curr.mrq != mrq || !data ||
+	    !(data->flags & MMC_DATA_WRITE) || !data->stop ||
+	    data->error || host->curr.got_dataend || host->dummy_52_sent) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	if (host->dma.sg && is_dma_mode(host)) {
+		data->error = -EINTR;
+		msm_dmov_flush(host->dma.channel, 0);
+	} else if (host->sps.sg && is_sps_mode(host)) {
+		data->error = -EINTR;
+		msmsdcc_sps_exit_curr_xfer(host);
+	} else {
+		rc = -ENOTSUPP;
+	}
+out:
+	spin_unlock_irqrestore(&host->lock, flags);
+	return rc;
+}
+
 static const struct mmc_host_ops msmsdcc_ops = {
 	.enable		= msmsdcc_enable,
 	.disable	= msmsdcc_disable,
@@ -3790,6 +3831,7 @@ static const struct mmc_host_ops msmsdcc_ops = {
 	.enable_sdio_irq = msmsdcc_enable_sdio_irq,
 	.start_signal_voltage_switch = msmsdcc_switch_io_voltage,
 	.execute_tuning = msmsdcc_execute_tuning,
+	.stop_request	= msmsdcc_stop_request,
 };
 
 static unsigned int
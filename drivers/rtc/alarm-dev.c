@@ -109,6 +109,8 @@ static long alarm_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		new_alarm_time.tv_nsec = 0;
 		goto from_old_alarm_set;
 
+	case ANDROID_ALARM_SET_EXACT_AND_WAIT(0):
+	case ANDROID_ALARM_SET_EXACT(0):
 	case ANDROID_ALARM_SET_AND_WAIT(0):
 	case ANDROID_ALARM_SET(0):
 		if (copy_from_user(&new_alarm_time, (void __user *)arg,
@@ -121,11 +123,19 @@ from_old_alarm_set:
 		pr_alarm(INFO, "alarm %d set %ld.%09ld\n", alarm_type,
 			new_alarm_time.tv_sec, new_alarm_time.tv_nsec);
 		alarm_enabled |= alarm_type_mask;
-		alarm_start_range(&alarms[alarm_type],
-			timespec_to_ktime(new_alarm_time),
-			timespec_to_ktime(new_alarm_time));
+		if (ANDROID_ALARM_BASE_CMD(cmd) == ANDROID_ALARM_SET_EXACT(0) ||
+		    ANDROID_ALARM_BASE_CMD(cmd) ==
+				ANDROID_ALARM_SET_EXACT_AND_WAIT(0))
+			alarm_start_range(&alarms[alarm_type],
+				timespec_to_ktime(new_alarm_time),
+				timespec_to_ktime(new_alarm_time));
+		else
+			alarm_start_coalesced(&alarms[alarm_type],
+				timespec_to_ktime(new_alarm_time));
 		spin_unlock_irqrestore(&alarm_slock, flags);
 		if (ANDROID_ALARM_BASE_CMD(cmd) != ANDROID_ALARM_SET_AND_WAIT(0)
+		    && ANDROID_ALARM_BASE_CMD(cmd) !=
+				ANDROID_ALARM_SET_EXACT_AND_WAIT(0)
 		    && cmd != ANDROID_ALARM_SET_AND_WAIT_OLD)
 			break;
 		
@@ -53,6 +53,17 @@ module_param_array_named(offalarm_snooze, offalarm_snooze, uint, &offalarm_snooz
 #endif
 
 
+/*
+ * Alarms started with alarm_start_coalesced() may be delayed by up to
+ * coalesce_ms[type] so that they run on a wakeup that happens anyway.
+ * wakeups_saved[type] counts the alarms that ran before their deadline,
+ * i.e. without needing a wakeup of their own.
+ */
+static unsigned int coalesce_ms[ANDROID_ALARM_TYPE_COUNT];
+module_param_array(coalesce_ms, uint, NULL, S_IRUGO | S_IWUSR | S_IWGRP);
+static unsigned int wakeups_saved[ANDROID_ALARM_TYPE_COUNT];
+module_param_array(wakeups_saved, uint, NULL, S_IRUGO);
+
 #define pr_alarm(debug_level_mask, args...) \
 	do { \
 		if (debug_mask & ANDROID_ALARM_PRINT_##debug_level_mask) { \
@@ -184,6 +195,14 @@ void alarm_start_range(struct alarm *alarm, ktime_t start, ktime_t end)
 	spin_unlock_irqrestore(&alarm_slock, flags);
 }
 
+void alarm_start_coalesced(struct alarm *alarm, ktime_t expires)
+{
+	unsigned int window = ACCESS_ONCE(coalesce_ms[alarm->type]);
+
+	alarm_start_range(alarm, expires,
+		ktime_add_ns(expires, (u64)window * NSEC_PER_MSEC));
+}
+
 int alarm_try_to_cancel(struct alarm *alarm)
 {
 	struct alarm_queue *base = &alarms[alarm->type];
@@ -345,6 +364,8 @@ static enum hrtimer_restart alarm_timer_triggered(struct hrtimer *timer)
 		base->first = rb_next(&alarm->node);
 		rb_erase(&alarm->node, &base->alarms);
 		RB_CLEAR_NODE(&alarm->node);
+		if (alarm->expires.tv64 > now.tv64)
+			wakeups_saved[alarm->type]++;
 		pr_alarm(CALL, "call alarm, type %d, func %pF, %lld (s %lld)\n",
 			alarm->type, alarm->function,
 			ktime_to_ns(alarm->expires),
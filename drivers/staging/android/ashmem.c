@@ -27,6 +27,7 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
 #include <asm/cacheflush.h>
@@ -35,7 +36,13 @@
 #define ASHMEM_NAME_PREFIX_LEN (sizeof(ASHMEM_NAME_PREFIX) - 1)
 #define ASHMEM_FULL_NAME_LEN (ASHMEM_NAME_LEN + ASHMEM_NAME_PREFIX_LEN)
 
+/*
+ * Each area has its own mutex, protecting everything in it including its
+ * unpinned ranges. ashmem_lru_lock only covers the global LRU of unpinned
+ * ranges and lru_count, and nests inside the area mutex.
+ */
 struct ashmem_area {
+	struct mutex mutex;
 	char name[ASHMEM_FULL_NAME_LEN]; 
 	struct list_head unpinned_list;	 
 	struct file *file;		 
@@ -57,7 +64,7 @@ static LIST_HEAD(ashmem_lru_list);
 
 static unsigned long lru_count;
 
-static DEFINE_MUTEX(ashmem_mutex);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -88,16 +95,25 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 
 static inline void lru_add(struct ashmem_range *range)
 {
+	spin_lock(&ashmem_lru_lock);
 	list_add_tail(&range->lru, &ashmem_lru_list);
 	lru_count += range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
-static inline void lru_del(struct ashmem_range *range)
+static inline void __lru_del(struct ashmem_range *range)
 {
 	list_del(&range->lru);
 	lru_count -= range_size(range);
 }
 
+static inline void lru_del(struct ashmem_range *range)
+{
+	spin_lock(&ashmem_lru_lock);
+	__lru_del(range);
+	spin_unlock(&ashmem_lru_lock);
+}
+
 static int range_alloc(struct ashmem_area *asma,
 		       struct ashmem_range *prev_range, unsigned int purged,
 		       size_t start, size_t end)
@@ -138,11 +154,17 @@ static inline void range_shrink(struct ashmem_range *range,
 {
 	size_t pre = range_size(range);
 
+	if (!range_on_lru(range)) {
+		range->pgstart = start;
+		range->pgend = end;
+		return;
+	}
+
+	spin_lock(&ashmem_lru_lock);
 	range->pgstart = start;
 	range->pgend = end;
-
-	if (range_on_lru(range))
-		lru_count -= pre - range_size(range);
+	lru_count -= pre - range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -162,6 +184,7 @@ static int ashmem_open(struct inode *inode, struct file *file)
 		return -ENOMEM;
 	}
 
+	mutex_init(&asma->mutex);
 	INIT_LIST_HEAD(&asma->unpinned_list);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
@@ -175,10 +198,10 @@ static int ashmem_release(struct inode *ignored, struct file *file)
 	struct ashmem_area *asma = file->private_data;
 	struct ashmem_range *range, *next;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
 		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	if (asma->file)
 		fput(asma->file);
@@ -193,7 +216,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	
 	if (asma->size == 0)
@@ -212,7 +235,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	asma->file->f_pos = *pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -221,7 +244,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -241,7 +264,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -257,7 +280,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	
 	if (unlikely(!asma->size)) {
@@ -301,40 +324,66 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	asma->vm_start = vma->vm_start;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
+/*
+ * Ranges are purged oldest first, each under the mutex of its own area
+ * only: the LRU lock is dropped across the truncation, so pin/unpin on
+ * other areas carry on meanwhile. Areas whose mutex is taken, possibly by
+ * the allocation that got us here, are skipped for this pass.
+ */
 static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct ashmem_range *range, *next;
+	struct ashmem_range *range;
+	struct ashmem_area *asma;
+	struct ashmem_range *first_busy = NULL;
+	long nr_to_scan = sc->nr_to_scan;
+	unsigned long count;
 
 	
-	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
+	if (nr_to_scan && !(sc->gfp_mask & __GFP_FS))
 		return -1;
-	if (!sc->nr_to_scan)
+	if (!nr_to_scan)
 		return lru_count;
 
-	
-	if (!mutex_trylock(&ashmem_mutex)) {
-                return -1;
-	}
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+	spin_lock(&ashmem_lru_lock);
+	while (nr_to_scan > 0 && !list_empty(&ashmem_lru_list)) {
+		struct inode *inode;
+		loff_t start, end;
+
+		range = list_first_entry(&ashmem_lru_list,
+					 struct ashmem_range, lru);
+		asma = range->asma;
+		if (!mutex_trylock(&asma->mutex)) {
+			/* Give up once the busy ranges have all come round */
+			if (range == first_busy)
+				break;
+			if (!first_busy)
+				first_busy = range;
+			list_move_tail(&range->lru, &ashmem_lru_list);
+			continue;
+		}
+		__lru_del(range);
+		range->purged = ASHMEM_WAS_PURGED;
+		nr_to_scan -= range_size(range);
+		spin_unlock(&ashmem_lru_lock);
 
+		inode = asma->file->f_dentry->d_inode;
+		start = range->pgstart * PAGE_SIZE;
+		end = (range->pgend + 1) * PAGE_SIZE - 1;
 		vmtruncate_range(inode, start, end);
-		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
+		mutex_unlock(&asma->mutex);
 
-		sc->nr_to_scan -= range_size(range);
-		if (sc->nr_to_scan <= 0)
-			break;
+		/* first_busy may have been freed while the lock was dropped */
+		spin_lock(&ashmem_lru_lock);
+		first_busy = NULL;
 	}
-	mutex_unlock(&ashmem_mutex);
+	count = lru_count;
+	spin_unlock(&ashmem_lru_lock);
 
-	return lru_count;
+	return count;
 }
 
 static struct shrinker ashmem_shrinker = {
@@ -346,7 +395,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -361,7 +410,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -369,7 +418,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	
 	if (unlikely(asma->file)) {
@@ -383,7 +432,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -392,7 +441,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		size_t len;
 
@@ -405,7 +454,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 					  sizeof(ASHMEM_NAME_DEF))))
 			ret = -EFAULT;
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -523,7 +572,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
@@ -537,7 +586,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -648,10 +697,12 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		break;
 	case ASHMEM_SET_SIZE:
 		ret = -EINVAL;
+		mutex_lock(&asma->mutex);
 		if (!asma->file) {
 			ret = 0;
 			asma->size = (size_t) arg;
 		}
+		mutex_unlock(&asma->mutex);
 		break;
 	case ASHMEM_GET_SIZE:
 		ret = asma->size;
@@ -33,9 +33,47 @@
 #include <linux/uaccess.h>
 #include <linux/vmalloc.h>
 #include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/bitmap.h>
 
 #include "binder.h"
 
+/*
+ * Locking
+ *
+ * binder_lock serializes changes to the object graph: nodes and their
+ * reference counts, refs, death notifications, transaction stacks and
+ * process teardown.
+ *
+ * proc->alloc_lock protects the buffer allocator of a proc, including the
+ * flag bits of its struct binder_buffer.
+ *
+ * node->lock protects the node's async_todo list, has_async_transaction
+ * and node->lat.
+ *
+ * proc->inner_lock protects the todo lists of the proc and its threads,
+ * the thread tree, thread->looper and thread->return_error{,2}, the thread
+ * pool counters and proc->lat. Transaction stacks are changed with both
+ * binder_lock and the owning proc's inner_lock held, so either of them is
+ * enough to read one.
+ *
+ * The locks nest in this order:
+ *
+ *	binder_lock
+ *	  proc->alloc_lock
+ *	    binder_lru_lock
+ *	  node->lock
+ *	    proc->inner_lock
+ *
+ * alloc_lock may sleep and is never taken with node->lock or an inner_lock
+ * held. At most one node->lock and one inner_lock are held at a time.
+ *
+ * Reading transaction complete, reply and one-way transaction work off a
+ * todo list only takes the reader's inner_lock. Node and death work, and
+ * synchronous transactions, which go onto the reader's transaction stack,
+ * are handled with binder_lock held.
+ */
 static DEFINE_MUTEX(binder_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
 static DEFINE_MUTEX(binder_mmap_lock);
@@ -145,23 +183,66 @@ enum binder_stat_types {
 	BINDER_STAT_COUNT
 };
 
+/* Counted without binder_lock, hence atomic */
 struct binder_stats {
-	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
-	int obj_created[BINDER_STAT_COUNT];
-	int obj_deleted[BINDER_STAT_COUNT];
+	atomic_t br[_IOC_NR(BR_FAILED_REPLY) + 1];
+	atomic_t bc[_IOC_NR(BC_REPLY_SG) + 1];
+	atomic_t obj_created[BINDER_STAT_COUNT];
+	atomic_t obj_deleted[BINDER_STAT_COUNT];
 };
 
 static struct binder_stats binder_stats;
 
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
-	binder_stats.obj_deleted[type]++;
+	atomic_inc(&binder_stats.obj_deleted[type]);
 }
 
 static inline void binder_stats_created(enum binder_stat_types type)
 {
-	binder_stats.obj_created[type]++;
+	atomic_inc(&binder_stats.obj_created[type]);
+}
+
+/*
+ * Latency histograms, kept per process under proc->inner_lock and per
+ * node under node->lock. Bucket n counts samples in [2^(n-1), 2^n)
+ * microseconds, the last bucket everything slower.
+ *
+ * queue:  transaction queued to the target until a target thread reads it
+ * handle: target thread read the transaction until it sent the reply
+ * reply:  reply queued until the calling thread reads it
+ */
+#define BINDER_LAT_BUCKETS 20
+
+struct binder_lat_hist {
+	u32 count;
+	u32 max_us;
+	u64 total_us;
+	u32 bucket[BINDER_LAT_BUCKETS];
+};
+
+struct binder_lat_stats {
+	struct binder_lat_hist queue;
+	struct binder_lat_hist handle;
+	struct binder_lat_hist reply;
+};
+
+static u32 binder_lat_us(ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+
+	if (us < 0)
+		return 0;
+	return min_t(s64, us, (u32)~0U);
+}
+
+static void binder_lat_add(struct binder_lat_hist *hist, u32 us)
+{
+	hist->count++;
+	hist->total_us += us;
+	if (us > hist->max_us)
+		hist->max_us = us;
+	hist->bucket[min(fls(us), BINDER_LAT_BUCKETS - 1)]++;
 }
 
 struct binder_transaction_log_entry {
@@ -198,6 +279,12 @@ static struct binder_transaction_log_entry *binder_transaction_log_add(
 	return e;
 }
 
+/* A scheduling policy and a kernel priority, as in task->normal_prio */
+struct binder_priority {
+	unsigned int sched_policy;
+	int prio;
+};
+
 struct binder_work {
 	struct list_head entry;
 	enum {
@@ -228,10 +315,13 @@ struct binder_node {
 	unsigned pending_strong_ref:1;
 	unsigned has_weak_ref:1;
 	unsigned pending_weak_ref:1;
-	unsigned has_async_transaction:1;
 	unsigned accept_fds:1;
-	unsigned min_priority:8;
+	unsigned sched_policy:2;
+	int min_priority:8;
+	spinlock_t lock;
+	bool has_async_transaction;	/* not a bit, node->lock */
 	struct list_head async_todo;
+	struct binder_lat_stats *lat;
 };
 
 struct binder_ref_death {
@@ -258,7 +348,10 @@ struct binder_ref {
 
 struct binder_buffer {
 	struct list_head entry; 
-	struct rb_node rb_node; 
+	union {
+		struct rb_node rb_node;		/* allocated_buffers */
+		struct list_head free_entry;	/* proc->free_lists[] */
+	};
 				
 	unsigned free:1;
 	unsigned allow_user_free:1;
@@ -273,6 +366,28 @@ struct binder_buffer {
 	uint8_t data[0];
 };
 
+/*
+ * Free buffers are kept on lists segregated by size: list n holds the
+ * buffers of 2^(n-1) up to 2^n - 1 bytes.
+ */
+#define BINDER_FREE_LISTS	24
+
+/*
+ * Pages of the buffer area that no buffer uses any more stay mapped, on
+ * binder_lru, so the next transaction can reuse them without touching the
+ * page tables. The shrinker unmaps and frees them under memory pressure.
+ */
+struct binder_lru_page {
+	struct list_head lru;
+	struct page *page;
+	struct binder_proc *proc;
+};
+
+static LIST_HEAD(binder_lru);
+static DEFINE_SPINLOCK(binder_lru_lock);
+static int binder_lru_count;
+static unsigned long binder_lru_reclaimed;
+
 enum binder_deferred_state {
 	BINDER_DEFERRED_PUT_FILES    = 0x01,
 	BINDER_DEFERRED_FLUSH        = 0x02,
@@ -292,26 +407,34 @@ struct binder_proc {
 	struct files_struct *files;
 	struct hlist_node deferred_work_node;
 	int deferred_work;
+	int tmp_ref;
+	bool is_dead;
 	void *buffer;
 	ptrdiff_t user_buffer_offset;
 
+	struct mutex alloc_lock;
 	struct list_head buffers;
-	struct rb_root free_buffers;
+	struct list_head free_lists[BINDER_FREE_LISTS];
+	DECLARE_BITMAP(free_lists_map, BINDER_FREE_LISTS);
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
-	struct page **pages;
+	struct binder_lru_page *pages;
+	int pages_mapped;
+	int pages_cached;
 	size_t buffer_size;
 	uint32_t buffer_free;
+	spinlock_t inner_lock;
 	struct list_head todo;
 	wait_queue_head_t wait;
 	struct binder_stats stats;
+	struct binder_lat_stats lat;
 	struct list_head delivered_death;
 	int max_threads;
 	int requested_threads;
 	int requested_threads_started;
 	int ready_threads;
-	long default_priority;
+	struct binder_priority default_priority;
 	struct dentry *debugfs_entry;
 };
 
@@ -337,6 +460,8 @@ struct binder_thread {
 		
 	wait_queue_head_t wait;
 	struct binder_stats stats;
+	int tmp_ref;
+	bool is_dead;
 };
 
 struct binder_transaction {
@@ -353,13 +478,19 @@ struct binder_transaction {
 	struct binder_buffer *buffer;
 	unsigned int	code;
 	unsigned int	flags;
-	long	priority;
-	long	saved_priority;
+	struct binder_priority	priority;
+	struct binder_priority	saved_priority;
 	uid_t	sender_euid;
+	ktime_t	start_time;	/* queued to the target */
+	ktime_t	deliver_time;	/* read by the target thread */
 };
 
+#define CREATE_TRACE_POINTS
+#include "trace/binder.h"
+
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
+static void binder_free_proc(struct binder_proc *proc);
 
 int task_get_unused_fd_flags(struct binder_proc *proc, int flags)
 {
@@ -498,6 +629,98 @@ static void binder_set_nice(long nice)
 	binder_user_error("binder: %d RLIMIT_NICE not set\n", current->pid);
 }
 
+static bool binder_is_rt_policy(unsigned int policy)
+{
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+static int binder_to_user_prio(unsigned int policy, int prio)
+{
+	if (binder_is_rt_policy(policy))
+		return MAX_USER_RT_PRIO - 1 - prio;
+	return prio - MAX_RT_PRIO - 20;
+}
+
+static int binder_to_kernel_prio(unsigned int policy, int user_prio)
+{
+	if (binder_is_rt_policy(policy))
+		return MAX_USER_RT_PRIO - 1 - user_prio;
+	return MAX_RT_PRIO + 20 + user_prio;
+}
+
+static struct binder_priority binder_current_priority(void)
+{
+	struct binder_priority p;
+
+	p.sched_policy = current->policy;
+	p.prio = current->normal_prio;
+	return p;
+}
+
+static struct binder_priority binder_node_priority(struct binder_node *node)
+{
+	struct binder_priority p;
+
+	p.sched_policy = node->sched_policy;
+	p.prio = binder_to_kernel_prio(node->sched_policy, node->min_priority);
+	return p;
+}
+
+static void binder_node_set_min_priority(struct binder_node *node,
+					 unsigned long flags)
+{
+	unsigned int policy = (flags & FLAT_BINDER_FLAG_SCHED_POLICY_MASK) >>
+			      FLAT_BINDER_FLAG_SCHED_POLICY_SHIFT;
+	int prio = (s8)(flags & FLAT_BINDER_FLAG_PRIORITY_MASK);
+
+	if (binder_is_rt_policy(policy))
+		prio = clamp(prio, 1, MAX_USER_RT_PRIO - 1);
+	else
+		prio = clamp(prio, -20, 19);
+	node->sched_policy = policy;
+	node->min_priority = prio;
+}
+
+/*
+ * Switch the current thread to @desired, policy included. Threads without
+ * CAP_SYS_NICE that may not use the rt priority asked for fall back to the
+ * strongest nice value they are allowed.
+ */
+static void binder_set_priority(struct binder_priority desired)
+{
+	struct sched_param params;
+	unsigned int policy = desired.sched_policy;
+	int prio = desired.prio;
+
+	if (current->policy == policy && current->normal_prio == prio)
+		return;
+
+	if (binder_is_rt_policy(policy) &&
+	    !has_capability_noaudit(current, CAP_SYS_NICE) &&
+	    binder_to_user_prio(policy, prio) >
+	    task_rlimit(current, RLIMIT_RTPRIO)) {
+		binder_debug(BINDER_DEBUG_PRIORITY_CAP,
+			     "binder: %d: rt priority %d not allowed, "
+			     "using nice -20 instead\n", current->pid,
+			     binder_to_user_prio(policy, prio));
+		policy = SCHED_NORMAL;
+		prio = binder_to_kernel_prio(policy, -20);
+	}
+
+	if (binder_is_rt_policy(policy)) {
+		params.sched_priority = binder_to_user_prio(policy, prio);
+		sched_setscheduler_nocheck(current,
+					   policy | SCHED_RESET_ON_FORK,
+					   &params);
+		return;
+	}
+	if (current->policy != policy) {
+		params.sched_priority = 0;
+		sched_setscheduler_nocheck(current, policy, &params);
+	}
+	binder_set_nice(binder_to_user_prio(policy, prio));
+}
+
 static size_t binder_buffer_size(struct binder_proc *proc,
 				 struct binder_buffer *buffer)
 {
@@ -508,14 +731,16 @@ static size_t binder_buffer_size(struct binder_proc *proc,
 			struct binder_buffer, entry) - (size_t)buffer->data;
 }
 
+static int binder_free_list_index(size_t size)
+{
+	return min_t(int, fls_long(size), BINDER_FREE_LISTS - 1);
+}
+
 static void binder_insert_free_buffer(struct binder_proc *proc,
 				      struct binder_buffer *new_buffer)
 {
-	struct rb_node **p = &proc->free_buffers.rb_node;
-	struct rb_node *parent = NULL;
-	struct binder_buffer *buffer;
-	size_t buffer_size;
 	size_t new_buffer_size;
+	int index;
 
 	BUG_ON(!new_buffer->free);
 
@@ -525,20 +750,56 @@ static void binder_insert_free_buffer(struct binder_proc *proc,
 		     "binder: %d: add free buffer, size %zd, "
 		     "at %p\n", proc->pid, new_buffer_size, new_buffer);
 
-	while (*p) {
-		parent = *p;
-		buffer = rb_entry(parent, struct binder_buffer, rb_node);
-		BUG_ON(!buffer->free);
+	/* Most recently freed first, its pages are likely still mapped */
+	index = binder_free_list_index(new_buffer_size);
+	list_add(&new_buffer->free_entry, &proc->free_lists[index]);
+	__set_bit(index, proc->free_lists_map);
+}
 
-		buffer_size = binder_buffer_size(proc, buffer);
+/* Must be called before the size of @buffer changes */
+static void binder_remove_free_buffer(struct binder_proc *proc,
+				      struct binder_buffer *buffer)
+{
+	int index = binder_free_list_index(binder_buffer_size(proc, buffer));
 
-		if (new_buffer_size < buffer_size)
-			p = &parent->rb_left;
-		else
-			p = &parent->rb_right;
+	BUG_ON(!buffer->free);
+	list_del(&buffer->free_entry);
+	if (list_empty(&proc->free_lists[index]))
+		__clear_bit(index, proc->free_lists_map);
+}
+
+/*
+ * Best fit among the buffers of the size class of @size, else the most
+ * recently freed buffer of the next non-empty class, all of which are
+ * large enough.
+ */
+static struct binder_buffer *binder_find_free_buffer(struct binder_proc *proc,
+						     size_t size)
+{
+	struct binder_buffer *buffer, *best_fit = NULL;
+	size_t buffer_size, best_fit_size = 0;
+	int index = binder_free_list_index(size);
+
+	list_for_each_entry(buffer, &proc->free_lists[index], free_entry) {
+		buffer_size = binder_buffer_size(proc, buffer);
+		if (buffer_size < size)
+			continue;
+		if (!best_fit || buffer_size < best_fit_size) {
+			best_fit = buffer;
+			best_fit_size = buffer_size;
+			if (buffer_size == size)
+				break;
+		}
 	}
-	rb_link_node(&new_buffer->rb_node, parent, p);
-	rb_insert_color(&new_buffer->rb_node, &proc->free_buffers);
+	if (best_fit)
+		return best_fit;
+
+	index = find_next_bit(proc->free_lists_map, BINDER_FREE_LISTS,
+			      index + 1);
+	if (index >= BINDER_FREE_LISTS)
+		return NULL;
+	return list_first_entry(&proc->free_lists[index], struct binder_buffer,
+				free_entry);
 }
 
 static void binder_insert_allocated_buffer(struct binder_proc *proc,
@@ -569,13 +830,15 @@ static void binder_insert_allocated_buffer(struct binder_proc *proc,
 static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 						  void __user *user_ptr)
 {
-	struct rb_node *n = proc->allocated_buffers.rb_node;
+	struct rb_node *n;
 	struct binder_buffer *buffer;
 	struct binder_buffer *kern_ptr;
 
 	kern_ptr = user_ptr - proc->user_buffer_offset
 		- offsetof(struct binder_buffer, data);
 
+	mutex_lock(&proc->alloc_lock);
+	n = proc->allocated_buffers.rb_node;
 	while (n) {
 		buffer = rb_entry(n, struct binder_buffer, rb_node);
 		BUG_ON(buffer->free);
@@ -585,11 +848,36 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 		else if (kern_ptr > buffer)
 			n = n->rb_right;
 		else
-			return buffer;
+			break;
 	}
-	return NULL;
+	mutex_unlock(&proc->alloc_lock);
+	return n ? buffer : NULL;
 }
 
+/* Called with proc->alloc_lock held, for mapped pages no buffer uses */
+static void binder_lru_add(struct binder_lru_page *lru)
+{
+	spin_lock(&binder_lru_lock);
+	list_add_tail(&lru->lru, &binder_lru);
+	binder_lru_count++;
+	spin_unlock(&binder_lru_lock);
+	lru->proc->pages_cached++;
+}
+
+static void binder_lru_del(struct binder_lru_page *lru)
+{
+	spin_lock(&binder_lru_lock);
+	list_del_init(&lru->lru);
+	binder_lru_count--;
+	spin_unlock(&binder_lru_lock);
+	lru->proc->pages_cached--;
+}
+
+/*
+ * Allocating a range maps the pages that are not mapped yet and takes the
+ * others off binder_lru. Freeing a range only puts the pages on binder_lru;
+ * they are unmapped by binder_shrink() or when the proc goes away.
+ */
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
@@ -597,7 +885,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	void *page_addr;
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
-	struct page **page;
+	struct binder_lru_page *lru;
 	struct mm_struct *mm;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
@@ -607,6 +895,30 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
+	if (allocate == 0)
+		goto free_range;
+
+	if (vma == NULL && proc->vma == NULL) {
+		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
+			     "map pages in userspace, no vma\n", proc->pid);
+		return -ENOMEM;
+	}
+
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		lru = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (!lru->page)
+			break;
+	}
+	if (page_addr >= end) {
+		/* All cached, no need for the page tables */
+		for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+			lru = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+			BUG_ON(list_empty(&lru->lru));
+			binder_lru_del(lru);
+		}
+		return 0;
+	}
+
 	if (vma)
 		mm = NULL;
 	else
@@ -622,9 +934,6 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		}
 	}
 
-	if (allocate == 0)
-		goto free_range;
-
 	if (vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
 			     "map pages in userspace, no vma\n", proc->pid);
@@ -634,18 +943,22 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
 		int ret;
 		struct page **page_array_ptr;
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		lru = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
+		if (lru->page) {
+			BUG_ON(list_empty(&lru->lru));
+			binder_lru_del(lru);
+			continue;
+		}
+		lru->page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (lru->page == NULL) {
 			printk(KERN_INFO "binder: %d: binder_alloc_buf failed "
 				     "for page at %p\n", proc->pid, page_addr);
 			goto err_alloc_page_failed;
 		}
 		tmp_area.addr = page_addr;
 		tmp_area.size = PAGE_SIZE + PAGE_SIZE ;
-		page_array_ptr = page;
+		page_array_ptr = &lru->page;
 		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
 		if (ret) {
 			printk(KERN_INFO "binder: %d: binder_alloc_buf failed "
@@ -655,14 +968,14 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		}
 		user_page_addr =
 			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
+		ret = vm_insert_page(vma, user_page_addr, lru->page);
 		if (ret) {
 			printk(KERN_INFO "binder: %d: binder_alloc_buf failed "
 				     "to map page at %lx in userspace\n",
 				     proc->pid, user_page_addr);
 			goto err_vm_insert_page_failed;
 		}
-		
+		proc->pages_mapped++;
 	}
 	if (mm) {
 		up_write(&mm->mmap_sem);
@@ -670,37 +983,120 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	}
 	return 0;
 
-free_range:
-	for (page_addr = end - PAGE_SIZE; page_addr >= start;
-	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
 err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
 err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
+	__free_page(lru->page);
+	lru->page = NULL;
 err_alloc_page_failed:
-		;
-	}
+	/* The pages before the failed one are mapped, give them back */
+	for (end = page_addr, page_addr = start; page_addr < end;
+	     page_addr += PAGE_SIZE)
+		binder_lru_add(&proc->pages[(page_addr - proc->buffer) /
+					    PAGE_SIZE]);
 err_no_vma:
 	if (mm) {
 		up_write(&mm->mmap_sem);
 		mmput(mm);
 	}
 	return -ENOMEM;
+
+free_range:
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		lru = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		BUG_ON(!lru->page || !list_empty(&lru->lru));
+		binder_lru_add(lru);
+	}
+	return 0;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+/*
+ * Unmap and free a page taken off binder_lru. Called with proc->alloc_lock
+ * held from reclaim, so only trylocks the mm, and leaves a last put of it,
+ * if the task exited meanwhile, to a worker. Returns -EBUSY if the page
+ * must be put back.
+ */
+static int binder_free_lru_page(struct binder_proc *proc,
+				struct binder_lru_page *lru)
+{
+	void *page_addr = proc->buffer + (lru - proc->pages) * PAGE_SIZE;
+	struct vm_area_struct *vma;
+	struct mm_struct *mm;
+
+	mm = get_task_mm(proc->tsk);
+	if (mm) {
+		if (!down_read_trylock(&mm->mmap_sem)) {
+			mmput_async(mm);
+			return -EBUSY;
+		}
+		vma = proc->vma;
+		if (vma && mm == proc->vma_vm_mm)
+			zap_page_range(vma, (uintptr_t)page_addr +
+				proc->user_buffer_offset, PAGE_SIZE, NULL);
+		up_read(&mm->mmap_sem);
+		mmput_async(mm);
+	} else if (proc->vma) {
+		/* Still mapped but the mm is out of reach, leave it */
+		return -EBUSY;
+	}
+
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	__free_page(lru->page);
+	lru->page = NULL;
+	proc->pages_mapped--;
+	return 0;
+}
+
+static int binder_shrink(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct binder_lru_page *lru;
+	struct binder_proc *proc;
+	int nr_to_scan = sc->nr_to_scan;
+	int count;
+	bool freed;
+
+	spin_lock(&binder_lru_lock);
+	while (nr_to_scan-- > 0 && !list_empty(&binder_lru)) {
+		lru = list_first_entry(&binder_lru, struct binder_lru_page, lru);
+		proc = lru->proc;
+		/* Also avoids recursing into a proc that is allocating */
+		if (!mutex_trylock(&proc->alloc_lock)) {
+			list_move_tail(&lru->lru, &binder_lru);
+			continue;
+		}
+		list_del_init(&lru->lru);
+		binder_lru_count--;
+		proc->pages_cached--;
+		spin_unlock(&binder_lru_lock);
+
+		freed = !binder_free_lru_page(proc, lru);
+		if (!freed)
+			binder_lru_add(lru);
+		mutex_unlock(&proc->alloc_lock);
+
+		spin_lock(&binder_lru_lock);
+		if (freed)
+			binder_lru_reclaimed++;
+	}
+	count = binder_lru_count;
+	spin_unlock(&binder_lru_lock);
+
+	return count;
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static struct binder_buffer *binder_alloc_buf_locked(struct binder_proc *proc,
+						     size_t data_size,
+						     size_t offsets_size,
+						     size_t extra_buffers_size,
+						     int is_async)
 {
-	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
 	size_t buffer_size;
-	struct rb_node *best_fit = NULL;
 	void *has_page_addr;
 	void *end_page_addr;
 	size_t size;
@@ -720,6 +1116,14 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		return NULL;
 	}
 
+	size += ALIGN(extra_buffers_size, sizeof(void *));
+	if (size < extra_buffers_size) {
+		binder_user_error("binder: %d: got transaction with invalid "
+			"extra buffers size %zd\n", proc->pid,
+			extra_buffers_size);
+		return NULL;
+	}
+
 	if (is_async &&
 	    proc->free_async_space < size + sizeof(struct binder_buffer)) {
 		binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
@@ -728,30 +1132,13 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		return NULL;
 	}
 
-	while (n) {
-		buffer = rb_entry(n, struct binder_buffer, rb_node);
-		BUG_ON(!buffer->free);
-		buffer_size = binder_buffer_size(proc, buffer);
-
-		if (size < buffer_size) {
-			best_fit = n;
-			n = n->rb_left;
-		} else if (size > buffer_size)
-			n = n->rb_right;
-		else {
-			best_fit = n;
-			break;
-		}
-	}
-	if (best_fit == NULL) {
+	buffer = binder_find_free_buffer(proc, size);
+	if (buffer == NULL) {
 		printk(KERN_INFO "binder: %d: binder_alloc_buf size %zd failed, "
 			     "no address space\n", proc->pid, size);
 		return NULL;
 	}
-	if (n == NULL) {
-		buffer = rb_entry(best_fit, struct binder_buffer, rb_node);
-		buffer_size = binder_buffer_size(proc, buffer);
-	}
+	buffer_size = binder_buffer_size(proc, buffer);
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_alloc_buf size %zd got buff"
@@ -759,7 +1146,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 
 	has_page_addr =
 		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK);
-	if (n == NULL) {
+	if (size != buffer_size) {
 		if (size + sizeof(struct binder_buffer) + 4 >= buffer_size)
 			buffer_size = size; 
 		else
@@ -773,7 +1160,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	    (void *)PAGE_ALIGN((uintptr_t)buffer->data), end_page_addr, NULL))
 		return NULL;
 
-	rb_erase(best_fit, &proc->free_buffers);
+	binder_remove_free_buffer(proc, buffer);
 	buffer->free = 0;
 	binder_insert_allocated_buffer(proc, buffer);
 	if (buffer_size != size) {
@@ -788,6 +1175,9 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	buffer->data_size = data_size;
 	buffer->offsets_size = offsets_size;
 	buffer->async_transaction = is_async;
+	buffer->allow_user_free = 0;
+	buffer->transaction = NULL;
+	buffer->target_node = NULL;
 	if (is_async) {
 		proc->free_async_space -= size + sizeof(struct binder_buffer);
 		binder_debug(BINDER_DEBUG_BUFFER_ALLOC_ASYNC,
@@ -799,6 +1189,26 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+/*
+ * The buffer allocator of a proc is protected by proc->alloc_lock rather
+ * than binder_lock, so senders can allocate and fill target buffers
+ * without serializing against unrelated transactions.
+ */
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size,
+					      size_t extra_buffers_size,
+					      int is_async)
+{
+	struct binder_buffer *buffer;
+
+	mutex_lock(&proc->alloc_lock);
+	buffer = binder_alloc_buf_locked(proc, data_size, offsets_size,
+					 extra_buffers_size, is_async);
+	mutex_unlock(&proc->alloc_lock);
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -861,6 +1271,7 @@ static void binder_free_buf(struct binder_proc *proc,
 {
 	size_t size, buffer_size;
 
+	mutex_lock(&proc->alloc_lock);
 	buffer_size = binder_buffer_size(proc, buffer);
 
 	size = ALIGN(buffer->data_size, sizeof(void *)) +
@@ -895,7 +1306,7 @@ static void binder_free_buf(struct binder_proc *proc,
 		struct binder_buffer *next = list_entry(buffer->entry.next,
 						struct binder_buffer, entry);
 		if (next->free) {
-			rb_erase(&next->rb_node, &proc->free_buffers);
+			binder_remove_free_buffer(proc, next);
 			binder_delete_free_buffer(proc, next);
 		}
 	}
@@ -903,12 +1314,13 @@ static void binder_free_buf(struct binder_proc *proc,
 		struct binder_buffer *prev = list_entry(buffer->entry.prev,
 						struct binder_buffer, entry);
 		if (prev->free) {
+			binder_remove_free_buffer(proc, prev);
 			binder_delete_free_buffer(proc, buffer);
-			rb_erase(&prev->rb_node, &proc->free_buffers);
 			buffer = prev;
 		}
 	}
 	binder_insert_free_buffer(proc, buffer);
+	mutex_unlock(&proc->alloc_lock);
 }
 
 static struct binder_node *binder_get_node(struct binder_proc *proc,
@@ -962,7 +1374,10 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	node->cookie = cookie;
 	node->work.type = BINDER_WORK_NODE;
 	INIT_LIST_HEAD(&node->work.entry);
+	spin_lock_init(&node->lock);
 	INIT_LIST_HEAD(&node->async_todo);
+	/* Stats are left out if this fails; nothing may sleep to add them */
+	node->lat = kzalloc(sizeof(*node->lat), GFP_KERNEL);
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 		     "binder: %d:%d node %d u%p c%p created\n",
 		     proc->pid, current->pid, node->debug_id,
@@ -970,6 +1385,7 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	return node;
 }
 
+/* @target_list, if given, is a todo list of node->proc */
 static int binder_inc_node(struct binder_node *node, int strong, int internal,
 			   struct list_head *target_list)
 {
@@ -987,8 +1403,10 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 		} else
 			node->local_strong_refs++;
 		if (!node->has_strong_ref && target_list) {
+			spin_lock(&node->proc->inner_lock);
 			list_del_init(&node->work.entry);
 			list_add_tail(&node->work.entry, target_list);
+			spin_unlock(&node->proc->inner_lock);
 		}
 	} else {
 		if (!internal)
@@ -999,7 +1417,9 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 					     "for %d\n", node->debug_id);
 				return -EINVAL;
 			}
+			spin_lock(&node->proc->inner_lock);
 			list_add_tail(&node->work.entry, target_list);
+			spin_unlock(&node->proc->inner_lock);
 		}
 	}
 	return 0;
@@ -1021,15 +1441,19 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 			return 0;
 	}
 	if (node->proc && (node->has_strong_ref || node->has_weak_ref)) {
+		spin_lock(&node->proc->inner_lock);
 		if (list_empty(&node->work.entry)) {
 			list_add_tail(&node->work.entry, &node->proc->todo);
 			wake_up_interruptible(&node->proc->wait);
 		}
+		spin_unlock(&node->proc->inner_lock);
 	} else {
 		if (hlist_empty(&node->refs) && !node->local_strong_refs &&
 		    !node->local_weak_refs) {
-			list_del_init(&node->work.entry);
 			if (node->proc) {
+				spin_lock(&node->proc->inner_lock);
+				list_del_init(&node->work.entry);
+				spin_unlock(&node->proc->inner_lock);
 				rb_erase(&node->rb_node, &node->proc->nodes);
 				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 					     "binder: refless node %d deleted\n",
@@ -1040,6 +1464,7 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 					     "binder: dead node %d deleted\n",
 					     node->debug_id);
 			}
+			kfree(node->lat);
 			kfree(node);
 			binder_stats_deleted(BINDER_STAT_NODE);
 		}
@@ -1153,7 +1578,9 @@ static void binder_delete_ref(struct binder_ref *ref)
 			     "binder: %d delete ref %d desc %d "
 			     "has death notification\n", ref->proc->pid,
 			     ref->debug_id, ref->desc);
+		spin_lock(&ref->proc->inner_lock);
 		list_del(&ref->death->work.entry);
+		spin_unlock(&ref->proc->inner_lock);
 		kfree(ref->death);
 		binder_stats_deleted(BINDER_STAT_DEATH);
 	}
@@ -1222,8 +1649,10 @@ static void binder_pop_transaction(struct binder_thread *target_thread,
 	if (target_thread) {
 		BUG_ON(target_thread->transaction_stack != t);
 		BUG_ON(target_thread->transaction_stack->from != target_thread);
+		spin_lock(&target_thread->proc->inner_lock);
 		target_thread->transaction_stack =
 			target_thread->transaction_stack->from_parent;
+		spin_unlock(&target_thread->proc->inner_lock);
 		t->from = NULL;
 	}
 	t->need_reply = 0;
@@ -1241,29 +1670,37 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 	while (1) {
 		target_thread = t->from;
 		if (target_thread) {
+			struct binder_proc *target_proc = target_thread->proc;
+			uint32_t return_error;
+
+			spin_lock(&target_proc->inner_lock);
 			if (target_thread->return_error != BR_OK &&
 			   target_thread->return_error2 == BR_OK) {
 				target_thread->return_error2 =
 					target_thread->return_error;
 				target_thread->return_error = BR_OK;
 			}
-			if (target_thread->return_error == BR_OK) {
+			return_error = target_thread->return_error;
+			spin_unlock(&target_proc->inner_lock);
+			if (return_error == BR_OK) {
 				binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
 					     "binder: send failed reply for "
 					     "transaction %d to %d:%d\n",
-					      t->debug_id, target_thread->proc->pid,
+					      t->debug_id, target_proc->pid,
 					      target_thread->pid);
 
 				binder_pop_transaction(target_thread, t);
+				spin_lock(&target_proc->inner_lock);
 				target_thread->return_error = error_code;
+				spin_unlock(&target_proc->inner_lock);
 				wake_up_interruptible(&target_thread->wait);
 			} else {
 				printk(KERN_INFO "binder: reply failed, target "
 					     "thread, %d:%d, has error code %d "
 					     "already\n",
-					     target_thread->proc->pid,
+					     target_proc->pid,
 					     target_thread->pid,
-					     target_thread->return_error);
+					     return_error);
 			}
 			return;
 		} else {
@@ -1289,6 +1726,26 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 	}
 }
 
+/*
+ * Temporary references keep a proc or thread allocated while binder_lock
+ * is dropped; the final put frees an object that died in the meantime.
+ */
+static void binder_thread_dec_tmpref(struct binder_thread *thread)
+{
+	BUG_ON(thread->tmp_ref <= 0);
+	if (--thread->tmp_ref == 0 && thread->is_dead) {
+		kfree(thread);
+		binder_stats_deleted(BINDER_STAT_THREAD);
+	}
+}
+
+static void binder_proc_dec_tmpref(struct binder_proc *proc)
+{
+	BUG_ON(proc->tmp_ref <= 0);
+	if (--proc->tmp_ref == 0 && proc->is_dead)
+		binder_free_proc(proc);
+}
+
 static void binder_transaction_buffer_release(struct binder_proc *proc,
 					      struct binder_buffer *buffer,
 					      size_t *failed_at)
@@ -1358,6 +1815,9 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 				task_close_fd(proc, fp->handle);
 			break;
 
+		case BINDER_TYPE_PTR:
+			break;
+
 		default:
 			printk(KERN_INFO "binder: transaction release %d bad "
 				     "object type %lx\n", debug_id, fp->type);
@@ -1366,9 +1826,101 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
+/* Target thread @proc is replying to @in_reply_to */
+static void binder_lat_handled(struct binder_proc *proc,
+			       struct binder_transaction *in_reply_to)
+{
+	struct binder_node *node;
+	u32 us = binder_lat_us(in_reply_to->deliver_time);
+
+	trace_binder_reply_handled(in_reply_to, us);
+	spin_lock(&proc->inner_lock);
+	binder_lat_add(&proc->lat.handle, us);
+	spin_unlock(&proc->inner_lock);
+	/* The buffer, and with it the node, may already have been freed */
+	if (in_reply_to->buffer && in_reply_to->buffer->target_node) {
+		node = in_reply_to->buffer->target_node;
+		spin_lock(&node->lock);
+		if (node->lat)
+			binder_lat_add(&node->lat->handle, us);
+		spin_unlock(&node->lock);
+	}
+}
+
+/* @t has just been read by a thread of @proc as @cmd */
+static void binder_lat_delivered(struct binder_proc *proc,
+				 struct binder_transaction *t, uint32_t cmd)
+{
+	struct binder_node *node;
+	u32 us = binder_lat_us(t->start_time);
+
+	trace_binder_transaction_received(t, us);
+	if (cmd == BR_REPLY) {
+		spin_lock(&proc->inner_lock);
+		binder_lat_add(&proc->lat.reply, us);
+		spin_unlock(&proc->inner_lock);
+		return;
+	}
+	t->deliver_time = ktime_get();
+	spin_lock(&proc->inner_lock);
+	binder_lat_add(&proc->lat.queue, us);
+	spin_unlock(&proc->inner_lock);
+	node = t->buffer->target_node;
+	spin_lock(&node->lock);
+	if (node->lat)
+		binder_lat_add(&node->lat->queue, us);
+	spin_unlock(&node->lock);
+}
+
+/*
+ * Copy the buffers referenced by BINDER_TYPE_PTR objects from the sender
+ * into the space reserved after the offsets array, and point the objects
+ * at the kernel address of the copies; binder_transaction() checks them
+ * and moves them to the target's view. Runs before binder_lock is retaken,
+ * so large payloads do not stall unrelated transactions. Objects at bad
+ * offsets are skipped here and rejected by binder_transaction().
+ */
+static int binder_copy_sg_buffers(struct binder_proc *proc,
+				  struct binder_thread *thread,
+				  struct binder_proc *target_proc,
+				  struct binder_buffer *buffer,
+				  size_t *offp, size_t *off_end,
+				  size_t extra_buffers_size)
+{
+	uint8_t *sg_bufp = (uint8_t *)off_end;
+	uint8_t *sg_buf_end = sg_bufp + extra_buffers_size;
+
+	for (; offp < off_end; offp++) {
+		struct binder_buffer_object *bp;
+
+		if (*offp > buffer->data_size - sizeof(*bp) ||
+		    buffer->data_size < sizeof(*bp) ||
+		    !IS_ALIGNED(*offp, sizeof(void *)))
+			continue;
+		bp = (struct binder_buffer_object *)(buffer->data + *offp);
+		if (bp->type != BINDER_TYPE_PTR)
+			continue;
+		if (bp->length > sg_buf_end - sg_bufp) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"too large buffer, %zd\n",
+				proc->pid, thread->pid, bp->length);
+			return -EINVAL;
+		}
+		if (copy_from_user(sg_bufp, bp->buffer, bp->length)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid buffer ptr\n", proc->pid, thread->pid);
+			return -EFAULT;
+		}
+		bp->buffer = sg_bufp;
+		sg_bufp += ALIGN(bp->length, sizeof(void *));
+	}
+	return 0;
+}
+
 static void binder_transaction(struct binder_proc *proc,
 			       struct binder_thread *thread,
-			       struct binder_transaction_data *tr, int reply)
+			       struct binder_transaction_data *tr, int reply,
+			       size_t extra_buffers_size)
 {
 	struct binder_transaction *t;
 	struct binder_work *tcomplete;
@@ -1382,6 +1934,7 @@ static void binder_transaction(struct binder_proc *proc,
 	struct binder_transaction_log_entry *e;
 	uint32_t return_error;
 
+	mutex_lock(&binder_lock);
 	e = binder_transaction_log_add(&binder_transaction_log);
 	e->call_type = reply ? 2 : !!(tr->flags & TF_ONE_WAY);
 	e->from_proc = proc->pid;
@@ -1399,7 +1952,7 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
-		binder_set_nice(in_reply_to->saved_priority);
+		binder_set_priority(in_reply_to->saved_priority);
 		if (in_reply_to->to_thread != thread) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
@@ -1413,7 +1966,9 @@ static void binder_transaction(struct binder_proc *proc,
 			in_reply_to = NULL;
 			goto err_bad_call_stack;
 		}
+		spin_lock(&proc->inner_lock);
 		thread->transaction_stack = in_reply_to->to_parent;
+		spin_unlock(&proc->inner_lock);
 		target_thread = in_reply_to->from;
 		if (target_thread == NULL) {
 			return_error = BR_DEAD_REPLY;
@@ -1535,20 +2090,29 @@ static void binder_transaction(struct binder_proc *proc,
 	t->to_thread = target_thread;
 	t->code = tr->code;
 	t->flags = tr->flags;
-	t->priority = task_nice(current);
+	t->priority = binder_current_priority();
+
+	trace_binder_transaction(reply, t, target_node);
+
+	if (target_node)
+		binder_inc_node(target_node, 1, 0, NULL);
+	target_proc->tmp_ref++;
+	if (target_thread)
+		target_thread->tmp_ref++;
+	mutex_unlock(&binder_lock);
+
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
-		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
+		tr->offsets_size, extra_buffers_size,
+		!reply && (t->flags & TF_ONE_WAY));
 	if (t->buffer == NULL) {
 		return_error = BR_FAILED_REPLY;
 		printk(KERN_INFO "binder: t->buffer binder_alloc_buf fail\n");
 		goto err_binder_alloc_buf_failed;
 	}
-	t->buffer->allow_user_free = 0;
 	t->buffer->debug_id = t->debug_id;
 	t->buffer->transaction = t;
 	t->buffer->target_node = target_node;
-	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
+	trace_binder_transaction_alloc_buf(t->buffer);
 
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
 
@@ -1569,9 +2133,31 @@ static void binder_transaction(struct binder_proc *proc,
 			"invalid offsets size, %zd\n",
 			proc->pid, thread->pid, tr->offsets_size);
 		return_error = BR_FAILED_REPLY;
-		goto err_bad_offset;
+		goto err_copy_data_failed;
 	}
 	off_end = (void *)offp + tr->offsets_size;
+	if (extra_buffers_size) {
+		if (!IS_ALIGNED(extra_buffers_size, sizeof(void *))) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid buffers size, %zd\n",
+				proc->pid, thread->pid, extra_buffers_size);
+			return_error = BR_FAILED_REPLY;
+			goto err_copy_data_failed;
+		}
+		if (binder_copy_sg_buffers(proc, thread, target_proc,
+					   t->buffer, offp, off_end,
+					   extra_buffers_size)) {
+			return_error = BR_FAILED_REPLY;
+			goto err_copy_data_failed;
+		}
+	}
+
+	mutex_lock(&binder_lock);
+	if (target_proc->is_dead ||
+	    (target_thread && target_thread->is_dead)) {
+		return_error = BR_DEAD_REPLY;
+		goto err_dead_target;
+	}
 	for (; offp < off_end; offp++) {
 		struct flat_binder_object *fp;
 		if (*offp > t->buffer->data_size - sizeof(*fp) ||
@@ -1596,7 +2182,7 @@ static void binder_transaction(struct binder_proc *proc,
 					printk(KERN_INFO "binder: %d %d BINDER_TYPE_WEAK_BINDER node==null \n", proc->pid, thread->pid);
 					goto err_binder_new_node_failed;
 				}
-				node->min_priority = fp->flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
+				binder_node_set_min_priority(node, fp->flags);
 				node->accept_fds = !!(fp->flags & FLAT_BINDER_FLAG_ACCEPTS_FDS);
 			}
 			if (fp->cookie != node->cookie) {
@@ -1605,6 +2191,7 @@ static void binder_transaction(struct binder_proc *proc,
 					proc->pid, thread->pid,
 					fp->binder, node->debug_id,
 					fp->cookie, node->cookie);
+				return_error = BR_FAILED_REPLY;
 				goto err_binder_get_ref_for_node_failed;
 			}
 			ref = binder_get_ref_for_node(target_proc, node);
@@ -1705,6 +2292,28 @@ static void binder_transaction(struct binder_proc *proc,
 			fp->handle = target_fd;
 		} break;
 
+		case BINDER_TYPE_PTR: {
+			struct binder_buffer_object *bp = (void *)fp;
+			uint8_t *sg_buf = (uint8_t *)off_end;
+			uint8_t *sg_buf_end = sg_buf + extra_buffers_size;
+
+			/* Only objects binder_copy_sg_buffers() filled in */
+			if (!extra_buffers_size ||
+			    (uint8_t *)bp->buffer < sg_buf ||
+			    (uint8_t *)bp->buffer > sg_buf_end ||
+			    bp->length > sg_buf_end - (uint8_t *)bp->buffer) {
+				binder_user_error("binder: %d:%d got transaction with invalid buffer object, %p\n",
+					proc->pid, thread->pid, bp->buffer);
+				return_error = BR_FAILED_REPLY;
+				goto err_bad_object_type;
+			}
+			binder_debug(BINDER_DEBUG_TRANSACTION,
+				     "        ptr %p size %zd\n",
+				     bp->buffer, bp->length);
+			bp->buffer = (uint8_t *)bp->buffer +
+				     target_proc->user_buffer_offset;
+		} break;
+
 		default:
 			binder_user_error("binder: %d:%d got transactio"
 				"n with invalid object type, %lx\n",
@@ -1715,29 +2324,51 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	if (reply) {
 		BUG_ON(t->buffer->async_transaction != 0);
+		binder_lat_handled(proc, in_reply_to);
 		binder_pop_transaction(target_thread, in_reply_to);
 	} else if (!(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
 		t->need_reply = 1;
 		t->from_parent = thread->transaction_stack;
+		spin_lock(&proc->inner_lock);
 		thread->transaction_stack = t;
-	} else {
+		spin_unlock(&proc->inner_lock);
+	}
+	t->work.type = BINDER_WORK_TRANSACTION;
+	t->start_time = ktime_get();
+	if (!reply && (t->flags & TF_ONE_WAY)) {
 		BUG_ON(target_node == NULL);
 		BUG_ON(t->buffer->async_transaction != 1);
+		spin_lock(&target_node->lock);
 		if (target_node->has_async_transaction) {
-			target_list = &target_node->async_todo;
+			list_add_tail(&t->work.entry, &target_node->async_todo);
 			target_wait = NULL;
-		} else
-			target_node->has_async_transaction = 1;
+		} else {
+			target_node->has_async_transaction = true;
+			spin_lock(&target_proc->inner_lock);
+			list_add_tail(&t->work.entry, target_list);
+			spin_unlock(&target_proc->inner_lock);
+		}
+		spin_unlock(&target_node->lock);
+	} else {
+		spin_lock(&target_proc->inner_lock);
+		list_add_tail(&t->work.entry, target_list);
+		spin_unlock(&target_proc->inner_lock);
 	}
-	t->work.type = BINDER_WORK_TRANSACTION;
-	list_add_tail(&t->work.entry, target_list);
 	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
+	spin_lock(&proc->inner_lock);
 	list_add_tail(&tcomplete->entry, &thread->todo);
+	spin_unlock(&proc->inner_lock);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
+	if (target_thread)
+		binder_thread_dec_tmpref(target_thread);
+	binder_proc_dec_tmpref(target_proc);
+	mutex_unlock(&binder_lock);
 	return;
 
+err_copy_data_failed:
+	mutex_lock(&binder_lock);
 err_get_unused_fd_failed:
 err_fget_failed:
 err_fd_not_allowed:
@@ -1746,11 +2377,20 @@ err_binder_get_ref_failed:
 err_binder_new_node_failed:
 err_bad_object_type:
 err_bad_offset:
-err_copy_data_failed:
+err_dead_target:
 	binder_transaction_buffer_release(target_proc, t->buffer, offp);
 	t->buffer->transaction = NULL;
 	binder_free_buf(target_proc, t->buffer);
+	goto err_put_target;
+
 err_binder_alloc_buf_failed:
+	mutex_lock(&binder_lock);
+	if (target_node)
+		binder_dec_node(target_node, 1, 0);
+err_put_target:
+	if (target_thread)
+		binder_thread_dec_tmpref(target_thread);
+	binder_proc_dec_tmpref(target_proc);
 	kfree(tcomplete);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 err_alloc_tcomplete_failed:
@@ -1773,12 +2413,34 @@ err_no_context_mgr_node:
 		*fe = *e;
 	}
 
+	spin_lock(&proc->inner_lock);
 	BUG_ON(thread->return_error != BR_OK);
-	if (in_reply_to) {
+	if (in_reply_to)
 		thread->return_error = BR_TRANSACTION_COMPLETE;
-		binder_send_failed_reply(in_reply_to, return_error);
-	} else
+	else
 		thread->return_error = return_error;
+	spin_unlock(&proc->inner_lock);
+	if (in_reply_to)
+		binder_send_failed_reply(in_reply_to, return_error);
+	mutex_unlock(&binder_lock);
+}
+
+/* Queue death work for @thread, or for any thread of its proc */
+static void binder_queue_death_work(struct binder_thread *thread,
+				    struct binder_work *w)
+{
+	struct binder_proc *proc = thread->proc;
+
+	spin_lock(&proc->inner_lock);
+	if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
+			      BINDER_LOOPER_STATE_ENTERED)) {
+		list_add_tail(&w->entry, &thread->todo);
+		spin_unlock(&proc->inner_lock);
+	} else {
+		list_add_tail(&w->entry, &proc->todo);
+		spin_unlock(&proc->inner_lock);
+		wake_up_interruptible(&proc->wait);
+	}
 }
 
 int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
@@ -1787,15 +2449,36 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 	uint32_t cmd;
 	void __user *ptr = buffer + *consumed;
 	void __user *end = buffer + size;
+	bool locked;
+	int ret;
 
 	while (ptr < end && thread->return_error == BR_OK) {
 		if (get_user(cmd, (uint32_t __user *)ptr))
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
 		if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.bc)) {
-			binder_stats.bc[_IOC_NR(cmd)]++;
-			proc->stats.bc[_IOC_NR(cmd)]++;
-			thread->stats.bc[_IOC_NR(cmd)]++;
+			atomic_inc(&binder_stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&proc->stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&thread->stats.bc[_IOC_NR(cmd)]);
+		}
+		/*
+		 * binder_transaction() takes binder_lock itself and the looper
+		 * commands only need the inner_lock; the rest change the graph.
+		 */
+		switch (cmd) {
+		case BC_TRANSACTION:
+		case BC_REPLY:
+		case BC_TRANSACTION_SG:
+		case BC_REPLY_SG:
+		case BC_REGISTER_LOOPER:
+		case BC_ENTER_LOOPER:
+		case BC_EXIT_LOOPER:
+			locked = false;
+			break;
+		default:
+			locked = true;
+			mutex_lock(&binder_lock);
+			break;
 		}
 		switch (cmd) {
 		case BC_INCREFS:
@@ -1807,7 +2490,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			const char *debug_string;
 
 			if (get_user(target, (uint32_t __user *)ptr))
-				return -EFAULT;
+				goto err_fault;
 			ptr += sizeof(uint32_t);
 			if (target == 0 && binder_context_mgr_node &&
 			    (cmd == BC_INCREFS || cmd == BC_ACQUIRE)) {
@@ -1861,10 +2544,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			struct binder_node *node;
 
 			if (get_user(node_ptr, (void * __user *)ptr))
-				return -EFAULT;
+				goto err_fault;
 			ptr += sizeof(void *);
 			if (get_user(cookie, (void * __user *)ptr))
-				return -EFAULT;
+				goto err_fault;
 			ptr += sizeof(void *);
 			node = binder_get_node(proc, node_ptr);
 			if (node == NULL) {
@@ -1918,17 +2601,20 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 		}
 		case BC_ATTEMPT_ACQUIRE:
 				printk(KERN_INFO "binder: BC_ATTEMPT_ACQUIRE not supported\n");
-			return -EINVAL;
+			ret = -EINVAL;
+			goto err;
 		case BC_ACQUIRE_RESULT:
 			    printk(KERN_INFO "binder: BC_ACQUIRE_RESULT not supported\n");
-			return -EINVAL;
+			ret = -EINVAL;
+			goto err;
 
 		case BC_FREE_BUFFER: {
 			void __user *data_ptr;
 			struct binder_buffer *buffer;
+			bool allow_user_free;
 
 			if (get_user(data_ptr, (void * __user *)ptr))
-				return -EFAULT;
+				goto err_fault;
 			ptr += sizeof(void *);
 
 			buffer = binder_buffer_lookup(proc, data_ptr);
@@ -1938,7 +2624,11 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
-			if (!buffer->allow_user_free) {
+			/* Set by binder_thread_read() without binder_lock */
+			mutex_lock(&proc->alloc_lock);
+			allow_user_free = buffer->allow_user_free;
+			mutex_unlock(&proc->alloc_lock);
+			if (!allow_user_free) {
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p matched "
 					"unreturned buffer\n",
@@ -1955,11 +2645,18 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				buffer->transaction = NULL;
 			}
 			if (buffer->async_transaction && buffer->target_node) {
-				BUG_ON(!buffer->target_node->has_async_transaction);
-				if (list_empty(&buffer->target_node->async_todo))
-					buffer->target_node->has_async_transaction = 0;
-				else
-					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
+				struct binder_node *node = buffer->target_node;
+
+				spin_lock(&node->lock);
+				BUG_ON(!node->has_async_transaction);
+				if (list_empty(&node->async_todo))
+					node->has_async_transaction = false;
+				else {
+					spin_lock(&proc->inner_lock);
+					list_move_tail(node->async_todo.next, &thread->todo);
+					spin_unlock(&proc->inner_lock);
+				}
+				spin_unlock(&node->lock);
 			}
 			binder_transaction_buffer_release(proc, buffer, NULL);
 			binder_free_buf(proc, buffer);
@@ -1971,9 +2668,21 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			struct binder_transaction_data tr;
 
 			if (copy_from_user(&tr, ptr, sizeof(tr)))
-				return -EFAULT;
+				goto err_fault;
+			ptr += sizeof(tr);
+			binder_transaction(proc, thread, &tr, cmd == BC_REPLY, 0);
+			break;
+		}
+
+		case BC_TRANSACTION_SG:
+		case BC_REPLY_SG: {
+			struct binder_transaction_data_sg tr;
+
+			if (copy_from_user(&tr, ptr, sizeof(tr)))
+				goto err_fault;
 			ptr += sizeof(tr);
-			binder_transaction(proc, thread, &tr, cmd == BC_REPLY);
+			binder_transaction(proc, thread, &tr.transaction_data,
+					   cmd == BC_REPLY_SG, tr.buffers_size);
 			break;
 		}
 
@@ -1981,6 +2690,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			binder_debug(BINDER_DEBUG_THREADS,
 				     "binder: %d:%d BC_REGISTER_LOOPER\n",
 				     proc->pid, thread->pid);
+			spin_lock(&proc->inner_lock);
 			if (thread->looper & BINDER_LOOPER_STATE_ENTERED) {
 				thread->looper |= BINDER_LOOPER_STATE_INVALID;
 				binder_user_error("binder: %d:%d ERROR:"
@@ -1998,11 +2708,13 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				proc->requested_threads_started++;
 			}
 			thread->looper |= BINDER_LOOPER_STATE_REGISTERED;
+			spin_unlock(&proc->inner_lock);
 			break;
 		case BC_ENTER_LOOPER:
 			binder_debug(BINDER_DEBUG_THREADS,
 				     "binder: %d:%d BC_ENTER_LOOPER\n",
 				     proc->pid, thread->pid);
+			spin_lock(&proc->inner_lock);
 			if (thread->looper & BINDER_LOOPER_STATE_REGISTERED) {
 				thread->looper |= BINDER_LOOPER_STATE_INVALID;
 				binder_user_error("binder: %d:%d ERROR:"
@@ -2011,12 +2723,15 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					proc->pid, thread->pid);
 			}
 			thread->looper |= BINDER_LOOPER_STATE_ENTERED;
+			spin_unlock(&proc->inner_lock);
 			break;
 		case BC_EXIT_LOOPER:
 			binder_debug(BINDER_DEBUG_THREADS,
 				     "binder: %d:%d BC_EXIT_LOOPER\n",
 				     proc->pid, thread->pid);
+			spin_lock(&proc->inner_lock);
 			thread->looper |= BINDER_LOOPER_STATE_EXITED;
+			spin_unlock(&proc->inner_lock);
 			break;
 
 		case BC_REQUEST_DEATH_NOTIFICATION:
@@ -2027,10 +2742,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			struct binder_ref_death *death;
 
 			if (get_user(target, (uint32_t __user *)ptr))
-				return -EFAULT;
+				goto err_fault;
 			ptr += sizeof(uint32_t);
 			if (get_user(cookie, (void __user * __user *)ptr))
-				return -EFAULT;
+				goto err_fault;
 			ptr += sizeof(void *);
 			ref = binder_get_ref(proc, target);
 			if (ref == NULL) {
@@ -2064,7 +2779,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				}
 				death = kzalloc(sizeof(*death), GFP_KERNEL);
 				if (death == NULL) {
+					spin_lock(&proc->inner_lock);
 					thread->return_error = BR_ERROR;
+					spin_unlock(&proc->inner_lock);
 					binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
 						     "binder: %d:%d "
 						     "BC_REQUEST_DEATH_NOTIFICATION failed\n",
@@ -2077,12 +2794,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				ref->death = death;
 				if (ref->node->proc == NULL) {
 					ref->death->work.type = BINDER_WORK_DEAD_BINDER;
-					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
-						list_add_tail(&ref->death->work.entry, &thread->todo);
-					} else {
-						list_add_tail(&ref->death->work.entry, &proc->todo);
-						wake_up_interruptible(&proc->wait);
-					}
+					binder_queue_death_work(thread, &ref->death->work);
 				}
 			} else {
 				if (ref->death == NULL) {
@@ -2105,17 +2817,15 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					break;
 				}
 				ref->death = NULL;
+				spin_lock(&proc->inner_lock);
 				if (list_empty(&death->work.entry)) {
+					spin_unlock(&proc->inner_lock);
 					death->work.type = BINDER_WORK_CLEAR_DEATH_NOTIFICATION;
-					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
-						list_add_tail(&death->work.entry, &thread->todo);
-					} else {
-						list_add_tail(&death->work.entry, &proc->todo);
-						wake_up_interruptible(&proc->wait);
-					}
+					binder_queue_death_work(thread, &death->work);
 				} else {
 					BUG_ON(death->work.type != BINDER_WORK_DEAD_BINDER);
 					death->work.type = BINDER_WORK_DEAD_BINDER_AND_CLEAR;
+					spin_unlock(&proc->inner_lock);
 				}
 			}
 		} break;
@@ -2124,7 +2834,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			void __user *cookie;
 			struct binder_ref_death *death = NULL;
 			if (get_user(cookie, (void __user * __user *)ptr))
-				return -EFAULT;
+				goto err_fault;
 
 			ptr += sizeof(void *);
 			list_for_each_entry(w, &proc->delivered_death, entry) {
@@ -2147,32 +2857,37 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			list_del_init(&death->work.entry);
 			if (death->work.type == BINDER_WORK_DEAD_BINDER_AND_CLEAR) {
 				death->work.type = BINDER_WORK_CLEAR_DEATH_NOTIFICATION;
-				if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
-					list_add_tail(&death->work.entry, &thread->todo);
-				} else {
-					list_add_tail(&death->work.entry, &proc->todo);
-					wake_up_interruptible(&proc->wait);
-				}
+				binder_queue_death_work(thread, &death->work);
 			}
 		} break;
 
 		default:
 			printk(KERN_INFO "binder: %d:%d unknown command %d\n",
 				     proc->pid, thread->pid, cmd);
-			return -EINVAL;
+			ret = -EINVAL;
+			goto err;
 		}
+		if (locked)
+			mutex_unlock(&binder_lock);
 		*consumed = ptr - buffer;
 	}
 	return 0;
+
+err_fault:
+	ret = -EFAULT;
+err:
+	if (locked)
+		mutex_unlock(&binder_lock);
+	return ret;
 }
 
 void binder_stat_br(struct binder_proc *proc, struct binder_thread *thread,
 		    uint32_t cmd)
 {
 	if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.br)) {
-		binder_stats.br[_IOC_NR(cmd)]++;
-		proc->stats.br[_IOC_NR(cmd)]++;
-		thread->stats.br[_IOC_NR(cmd)]++;
+		atomic_inc(&binder_stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&proc->stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&thread->stats.br[_IOC_NR(cmd)]);
 	}
 }
 
@@ -2189,6 +2904,37 @@ static int binder_has_thread_work(struct binder_thread *thread)
 		(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN);
 }
 
+/*
+ * Node and death work change the object graph and a synchronous
+ * transaction goes onto the reader's transaction stack, so these are read
+ * with binder_lock held. Called with proc->inner_lock held.
+ */
+static bool binder_work_needs_lock(struct binder_work *w)
+{
+	struct binder_transaction *t;
+
+	switch (w->type) {
+	case BINDER_WORK_TRANSACTION:
+		t = container_of(w, struct binder_transaction, work);
+		return t->buffer->target_node && !(t->flags & TF_ONE_WAY);
+	case BINDER_WORK_TRANSACTION_COMPLETE:
+		return false;
+	default:
+		return true;
+	}
+}
+
+/* Put back @w, taken off the head of @list, after a failed copy */
+static void binder_requeue_work(struct binder_proc *proc,
+				struct list_head *list, struct binder_work *w)
+{
+	spin_lock(&proc->inner_lock);
+	list_add(&w->entry, list);
+	spin_unlock(&proc->inner_lock);
+	if (list == &proc->todo)
+		wake_up_interruptible(&proc->wait);
+}
+
 static int binder_thread_read(struct binder_proc *proc,
 			      struct binder_thread *thread,
 			      void  __user *buffer, int size,
@@ -2207,22 +2953,30 @@ static int binder_thread_read(struct binder_proc *proc,
 	}
 
 retry:
+	spin_lock(&proc->inner_lock);
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 				list_empty(&thread->todo);
 
 	if (thread->return_error != BR_OK && ptr < end) {
-		if (thread->return_error2 != BR_OK) {
-			if (put_user(thread->return_error2, (uint32_t __user *)ptr))
+		uint32_t return_error = thread->return_error;
+		uint32_t return_error2 = thread->return_error2;
+
+		/* Both stay set if only return_error2 fits */
+		if (return_error2 == BR_OK || end - ptr > sizeof(uint32_t)) {
+			thread->return_error2 = BR_OK;
+			thread->return_error = BR_OK;
+		}
+		spin_unlock(&proc->inner_lock);
+		if (return_error2 != BR_OK) {
+			if (put_user(return_error2, (uint32_t __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(uint32_t);
 			if (ptr == end)
 				goto done;
-			thread->return_error2 = BR_OK;
 		}
-		if (put_user(thread->return_error, (uint32_t __user *)ptr))
+		if (put_user(return_error, (uint32_t __user *)ptr))
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
-		thread->return_error = BR_OK;
 		goto done;
 	}
 
@@ -2230,7 +2984,7 @@ retry:
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	spin_unlock(&proc->inner_lock);
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2241,7 +2995,7 @@ retry:
 			wait_event_interruptible(binder_user_error_wait,
 						 binder_stop_on_user_error < 2);
 		}
-		binder_set_nice(proc->default_priority);
+		binder_set_priority(proc->default_priority);
 		if (non_block) {
 			if (!binder_has_proc_work(proc, thread))
 				ret = -EAGAIN;
@@ -2254,10 +3008,11 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	spin_lock(&proc->inner_lock);
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
+	spin_unlock(&proc->inner_lock);
 
 	if (ret)
 		return ret;
@@ -2266,29 +3021,63 @@ retry:
 		uint32_t cmd;
 		struct binder_transaction_data tr;
 		struct binder_work *w;
+		struct list_head *list;
 		struct binder_transaction *t = NULL;
+		struct binder_thread *to_thread = NULL;
+		int from_pid = 0, from_tid = 0;
+		bool locked = false;
+		bool sync;
 
+next:
+		spin_lock(&proc->inner_lock);
 		if (!list_empty(&thread->todo))
-			w = list_first_entry(&thread->todo, struct binder_work, entry);
+			list = &thread->todo;
 		else if (!list_empty(&proc->todo) && wait_for_proc_work)
-			w = list_first_entry(&proc->todo, struct binder_work, entry);
+			list = &proc->todo;
 		else {
-			if (ptr - buffer == 4 && !(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN)) 
+			int need_return = thread->looper &
+					  BINDER_LOOPER_STATE_NEED_RETURN;
+
+			spin_unlock(&proc->inner_lock);
+			if (locked)
+				mutex_unlock(&binder_lock);
+			if (ptr - buffer == 4 && !need_return)
 				goto retry;
 			break;
 		}
 
-		if (end - ptr < sizeof(tr) + 4)
+		if (end - ptr < sizeof(tr) + 4) {
+			spin_unlock(&proc->inner_lock);
+			if (locked)
+				mutex_unlock(&binder_lock);
 			break;
+		}
+
+		w = list_first_entry(list, struct binder_work, entry);
+		if (!locked && binder_work_needs_lock(w)) {
+			/* binder_lock ranks above the inner_lock, look again */
+			spin_unlock(&proc->inner_lock);
+			mutex_lock(&binder_lock);
+			locked = true;
+			goto next;
+		}
 
 		switch (w->type) {
 		case BINDER_WORK_TRANSACTION: {
 			t = container_of(w, struct binder_transaction, work);
+			list_del_init(&w->entry);
+			spin_unlock(&proc->inner_lock);
 		} break;
 		case BINDER_WORK_TRANSACTION_COMPLETE: {
+			list_del_init(&w->entry);
+			spin_unlock(&proc->inner_lock);
+			if (locked)
+				mutex_unlock(&binder_lock);
 			cmd = BR_TRANSACTION_COMPLETE;
-			if (put_user(cmd, (uint32_t __user *)ptr))
+			if (put_user(cmd, (uint32_t __user *)ptr)) {
+				binder_requeue_work(proc, list, w);
 				return -EFAULT;
+			}
 			ptr += sizeof(uint32_t);
 
 			binder_stat_br(proc, thread, cmd);
@@ -2296,7 +3085,6 @@ retry:
 				     "binder: %d:%d BR_TRANSACTION_COMPLETE\n",
 				     proc->pid, thread->pid);
 
-			list_del(&w->entry);
 			kfree(w);
 			binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 		} break;
@@ -2306,6 +3094,9 @@ retry:
 			const char *cmd_name;
 			int strong = node->internal_strong_refs || node->local_strong_refs;
 			int weak = !hlist_empty(&node->refs) || node->local_weak_refs || strong;
+
+			/* binder_lock keeps @w at the head of @list */
+			spin_unlock(&proc->inner_lock);
 			if (weak && !node->has_weak_ref) {
 				cmd = BR_INCREFS;
 				cmd_name = "BR_INCREFS";
@@ -2329,13 +3120,13 @@ retry:
 			}
 			if (cmd != BR_NOOP) {
 				if (put_user(cmd, (uint32_t __user *)ptr))
-					return -EFAULT;
+					goto err_locked_fault;
 				ptr += sizeof(uint32_t);
 				if (put_user(node->ptr, (void * __user *)ptr))
-					return -EFAULT;
+					goto err_locked_fault;
 				ptr += sizeof(void *);
 				if (put_user(node->cookie, (void * __user *)ptr))
-					return -EFAULT;
+					goto err_locked_fault;
 				ptr += sizeof(void *);
 
 				binder_stat_br(proc, thread, cmd);
@@ -2343,13 +3134,16 @@ retry:
 					     "binder: %d:%d %s %d u%p c%p\n",
 					     proc->pid, thread->pid, cmd_name, node->debug_id, node->ptr, node->cookie);
 			} else {
+				spin_lock(&proc->inner_lock);
 				list_del_init(&w->entry);
+				spin_unlock(&proc->inner_lock);
 				if (!weak && !strong) {
 					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 						     "binder: %d:%d node %d u%p c%p deleted\n",
 						     proc->pid, thread->pid, node->debug_id,
 						     node->ptr, node->cookie);
 					rb_erase(&node->rb_node, &proc->nodes);
+					kfree(node->lat);
 					kfree(node);
 					binder_stats_deleted(BINDER_STAT_NODE);
 				} else {
@@ -2359,6 +3153,7 @@ retry:
 						     node->cookie);
 				}
 			}
+			mutex_unlock(&binder_lock);
 		} break;
 		case BINDER_WORK_DEAD_BINDER:
 		case BINDER_WORK_DEAD_BINDER_AND_CLEAR:
@@ -2366,16 +3161,17 @@ retry:
 			struct binder_ref_death *death;
 			uint32_t cmd;
 
+			spin_unlock(&proc->inner_lock);
 			death = container_of(w, struct binder_ref_death, work);
 			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION)
 				cmd = BR_CLEAR_DEATH_NOTIFICATION_DONE;
 			else
 				cmd = BR_DEAD_BINDER;
 			if (put_user(cmd, (uint32_t __user *)ptr))
-				return -EFAULT;
+				goto err_locked_fault;
 			ptr += sizeof(uint32_t);
 			if (put_user(death->cookie, (void * __user *)ptr))
-				return -EFAULT;
+				goto err_locked_fault;
 			ptr += sizeof(void *);
 			binder_debug(BINDER_DEBUG_DEATH_NOTIFICATION,
 				     "binder: %d:%d %s %p\n",
@@ -2385,12 +3181,17 @@ retry:
 				      "BR_CLEAR_DEATH_NOTIFICATION_DONE",
 				      death->cookie);
 
+			spin_lock(&proc->inner_lock);
 			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION) {
 				list_del(&w->entry);
+				spin_unlock(&proc->inner_lock);
 				kfree(death);
 				binder_stats_deleted(BINDER_STAT_DEATH);
-			} else
+			} else {
 				list_move(&w->entry, &proc->delivered_death);
+				spin_unlock(&proc->inner_lock);
+			}
+			mutex_unlock(&binder_lock);
 			if (cmd == BR_DEAD_BINDER)
 				goto done; 
 		} break;
@@ -2402,15 +3203,23 @@ retry:
 		BUG_ON(t->buffer == NULL);
 		if (t->buffer->target_node) {
 			struct binder_node *target_node = t->buffer->target_node;
+			struct binder_priority node_prio;
+
+			node_prio = binder_node_priority(target_node);
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
-			t->saved_priority = task_nice(current);
-			if (t->priority < target_node->min_priority &&
+			t->saved_priority = binder_current_priority();
+			/*
+			 * Sync calls run with the caller's policy and
+			 * priority, rt included, or the node's minimum if
+			 * that is higher. Async calls only get the minimum.
+			 */
+			if (t->priority.prio < node_prio.prio &&
 			    !(t->flags & TF_ONE_WAY))
-				binder_set_nice(t->priority);
+				binder_set_priority(t->priority);
 			else if (!(t->flags & TF_ONE_WAY) ||
-				 t->saved_priority > target_node->min_priority)
-				binder_set_nice(target_node->min_priority);
+				 t->saved_priority.prio > node_prio.prio)
+				binder_set_priority(node_prio);
 			cmd = BR_TRANSACTION;
 		} else {
 			tr.target.ptr = NULL;
@@ -2421,10 +3230,13 @@ retry:
 		tr.flags = t->flags;
 		tr.sender_euid = t->sender_euid;
 
+		/* Only set on synchronous transactions, read under binder_lock */
 		if (t->from) {
 			struct task_struct *sender = t->from->proc->tsk;
 			tr.sender_pid = task_tgid_nr_ns(sender,
 							current->nsproxy->pid_ns);
+			from_pid = t->from->proc->pid;
+			from_tid = t->from->pid;
 		} else {
 			tr.sender_pid = 0;
 		}
@@ -2437,12 +3249,34 @@ retry:
 					ALIGN(t->buffer->data_size,
 					    sizeof(void *));
 
-		if (put_user(cmd, (uint32_t __user *)ptr))
-			return -EFAULT;
-		ptr += sizeof(uint32_t);
-		if (copy_to_user(ptr, &tr, sizeof(tr)))
+		sync = cmd == BR_TRANSACTION && !(t->flags & TF_ONE_WAY);
+		if (sync) {
+			/* Pushed while binder_lock is held, undone on a fault */
+			to_thread = t->to_thread;
+			spin_lock(&proc->inner_lock);
+			t->to_parent = thread->transaction_stack;
+			t->to_thread = thread;
+			thread->transaction_stack = t;
+			spin_unlock(&proc->inner_lock);
+		}
+		if (locked)
+			mutex_unlock(&binder_lock);
+
+		if (put_user(cmd, (uint32_t __user *)ptr) ||
+		    copy_to_user(ptr + sizeof(uint32_t), &tr, sizeof(tr))) {
+			if (sync) {
+				mutex_lock(&binder_lock);
+				spin_lock(&proc->inner_lock);
+				thread->transaction_stack = t->to_parent;
+				t->to_parent = NULL;
+				t->to_thread = to_thread;
+				spin_unlock(&proc->inner_lock);
+				mutex_unlock(&binder_lock);
+			}
+			binder_requeue_work(proc, list, &t->work);
 			return -EFAULT;
-		ptr += sizeof(tr);
+		}
+		ptr += sizeof(uint32_t) + sizeof(tr);
 
 		binder_stat_br(proc, thread, cmd);
 		binder_debug(BINDER_DEBUG_TRANSACTION,
@@ -2451,19 +3285,19 @@ retry:
 			     proc->pid, thread->pid,
 			     (cmd == BR_TRANSACTION) ? "BR_TRANSACTION" :
 			     "BR_REPLY",
-			     t->debug_id, t->from ? t->from->proc->pid : 0,
-			     t->from ? t->from->pid : 0, cmd,
+			     t->debug_id, from_pid, from_tid, cmd,
 			     t->buffer->data_size, t->buffer->offsets_size,
 			     tr.data.ptr.buffer, tr.data.ptr.offsets);
 
-		list_del(&t->work.entry);
+		binder_lat_delivered(proc, t, cmd);
+
+		/* BC_FREE_BUFFER may release the buffer once this is set */
+		mutex_lock(&proc->alloc_lock);
 		t->buffer->allow_user_free = 1;
-		if (cmd == BR_TRANSACTION && !(t->flags & TF_ONE_WAY)) {
-			t->to_parent = thread->transaction_stack;
-			t->to_thread = thread;
-			thread->transaction_stack = t;
-		} else {
+		if (!sync)
 			t->buffer->transaction = NULL;
+		mutex_unlock(&proc->alloc_lock);
+		if (!sync) {
 			kfree(t);
 			binder_stats_deleted(BINDER_STAT_TRANSACTION);
 		}
@@ -2473,27 +3307,41 @@ retry:
 done:
 
 	*consumed = ptr - buffer;
+	spin_lock(&proc->inner_lock);
 	if (proc->requested_threads + proc->ready_threads == 0 &&
 	    proc->requested_threads_started < proc->max_threads &&
 	    (thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 	     BINDER_LOOPER_STATE_ENTERED)) 
 	     ) {
 		proc->requested_threads++;
+		spin_unlock(&proc->inner_lock);
 		binder_debug(BINDER_DEBUG_THREADS,
 			     "binder: %d:%d BR_SPAWN_LOOPER\n",
 			     proc->pid, thread->pid);
 		if (put_user(BR_SPAWN_LOOPER, (uint32_t __user *)buffer))
 			return -EFAULT;
-	}
+	} else
+		spin_unlock(&proc->inner_lock);
 	return 0;
+
+err_locked_fault:
+	mutex_unlock(&binder_lock);
+	return -EFAULT;
 }
 
-static void binder_release_work(struct list_head *list)
+static void binder_release_work(struct binder_proc *proc,
+				struct list_head *list)
 {
 	struct binder_work *w;
-	while (!list_empty(list)) {
+	while (1) {
+		spin_lock(&proc->inner_lock);
+		if (list_empty(list)) {
+			spin_unlock(&proc->inner_lock);
+			break;
+		}
 		w = list_first_entry(list, struct binder_work, entry);
 		list_del_init(&w->entry);
+		spin_unlock(&proc->inner_lock);
 		switch (w->type) {
 		case BINDER_WORK_TRANSACTION: {
 			struct binder_transaction *t;
@@ -2516,9 +3364,14 @@ static void binder_release_work(struct list_head *list)
 static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 {
 	struct binder_thread *thread = NULL;
-	struct rb_node *parent = NULL;
-	struct rb_node **p = &proc->threads.rb_node;
+	struct binder_thread *new_thread = NULL;
+	struct rb_node *parent;
+	struct rb_node **p;
 
+retry:
+	parent = NULL;
+	p = &proc->threads.rb_node;
+	spin_lock(&proc->inner_lock);
 	while (*p) {
 		parent = *p;
 		thread = rb_entry(parent, struct binder_thread, rb_node);
@@ -2531,9 +3384,15 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 			break;
 	}
 	if (*p == NULL) {
-		thread = kzalloc(sizeof(*thread), GFP_KERNEL);
-		if (thread == NULL)
-			return NULL;
+		if (new_thread == NULL) {
+			spin_unlock(&proc->inner_lock);
+			new_thread = kzalloc(sizeof(*thread), GFP_KERNEL);
+			if (new_thread == NULL)
+				return NULL;
+			goto retry;
+		}
+		thread = new_thread;
+		new_thread = NULL;
 		binder_stats_created(BINDER_STAT_THREAD);
 		thread->proc = proc;
 		thread->pid = current->pid;
@@ -2545,6 +3404,8 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 		thread->return_error = BR_OK;
 		thread->return_error2 = BR_OK;
 	}
+	spin_unlock(&proc->inner_lock);
+	kfree(new_thread);
 	return thread;
 }
 
@@ -2555,7 +3416,9 @@ static int binder_free_thread(struct binder_proc *proc,
 	struct binder_transaction *send_reply = NULL;
 	int active_transactions = 0;
 
+	spin_lock(&proc->inner_lock);
 	rb_erase(&thread->rb_node, &proc->threads);
+	spin_unlock(&proc->inner_lock);
 	t = thread->transaction_stack;
 	if (t && t->to_thread == thread)
 		send_reply = t;
@@ -2583,9 +3446,12 @@ static int binder_free_thread(struct binder_proc *proc,
 	}
 	if (send_reply)
 		binder_send_failed_reply(send_reply, BR_DEAD_REPLY);
-	binder_release_work(&thread->todo);
-	kfree(thread);
-	binder_stats_deleted(BINDER_STAT_THREAD);
+	binder_release_work(proc, &thread->todo);
+	thread->is_dead = true;
+	if (!thread->tmp_ref) {
+		kfree(thread);
+		binder_stats_deleted(BINDER_STAT_THREAD);
+	}
 	return active_transactions;
 }
 
@@ -2596,12 +3462,14 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
 	thread = binder_get_thread(proc);
+	if (thread == NULL)
+		return POLLERR;
 
+	spin_lock(&proc->inner_lock);
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	spin_unlock(&proc->inner_lock);
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2619,6 +3487,32 @@ static unsigned int binder_poll(struct file *filp,
 	return 0;
 }
 
+static int binder_ioctl_set_ctx_mgr(struct binder_proc *proc)
+{
+	if (binder_context_mgr_node != NULL) {
+		printk(KERN_INFO "binder: BINDER_SET_CONTEXT_MGR already set\n");
+		return -EBUSY;
+	}
+	if (binder_context_mgr_uid != -1) {
+		if (binder_context_mgr_uid != current->cred->euid) {
+			printk(KERN_INFO "binder: BINDER_SET_"
+				     "CONTEXT_MGR bad uid %d != %d\n",
+				     current->cred->euid,
+				     binder_context_mgr_uid);
+			return -EPERM;
+		}
+	} else
+		binder_context_mgr_uid = current->cred->euid;
+	binder_context_mgr_node = binder_new_node(proc, NULL, NULL);
+	if (binder_context_mgr_node == NULL)
+		return -ENOMEM;
+	binder_context_mgr_node->local_weak_refs++;
+	binder_context_mgr_node->local_strong_refs++;
+	binder_context_mgr_node->has_strong_ref = 1;
+	binder_context_mgr_node->has_weak_ref = 1;
+	return 0;
+}
+
 static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
 	int ret;
@@ -2633,7 +3527,6 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2685,43 +3578,31 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		}
 		break;
 	}
-	case BINDER_SET_MAX_THREADS:
-		if (copy_from_user(&proc->max_threads, ubuf, sizeof(proc->max_threads))) {
+	case BINDER_SET_MAX_THREADS: {
+		int max_threads;
+
+		if (copy_from_user(&max_threads, ubuf, sizeof(max_threads))) {
 			ret = -EINVAL;
 			goto err;
 		}
+		spin_lock(&proc->inner_lock);
+		proc->max_threads = max_threads;
+		spin_unlock(&proc->inner_lock);
 		break;
+	}
 	case BINDER_SET_CONTEXT_MGR:
-		if (binder_context_mgr_node != NULL) {
-			printk(KERN_INFO "binder: BINDER_SET_CONTEXT_MGR already set\n");
-			ret = -EBUSY;
-			goto err;
-		}
-		if (binder_context_mgr_uid != -1) {
-			if (binder_context_mgr_uid != current->cred->euid) {
-				printk(KERN_INFO "binder: BINDER_SET_"
-					     "CONTEXT_MGR bad uid %d != %d\n",
-					     current->cred->euid,
-					     binder_context_mgr_uid);
-				ret = -EPERM;
-				goto err;
-			}
-		} else
-			binder_context_mgr_uid = current->cred->euid;
-		binder_context_mgr_node = binder_new_node(proc, NULL, NULL);
-		if (binder_context_mgr_node == NULL) {
-			ret = -ENOMEM;
+		mutex_lock(&binder_lock);
+		ret = binder_ioctl_set_ctx_mgr(proc);
+		mutex_unlock(&binder_lock);
+		if (ret)
 			goto err;
-		}
-		binder_context_mgr_node->local_weak_refs++;
-		binder_context_mgr_node->local_strong_refs++;
-		binder_context_mgr_node->has_strong_ref = 1;
-		binder_context_mgr_node->has_weak_ref = 1;
 		break;
 	case BINDER_THREAD_EXIT:
 		binder_debug(BINDER_DEBUG_THREADS, "binder: %d:%d exit\n",
 			     proc->pid, thread->pid);
+		mutex_lock(&binder_lock);
 		binder_free_thread(proc, thread);
+		mutex_unlock(&binder_lock);
 		thread = NULL;
 		break;
 	case BINDER_VERSION:
@@ -2740,9 +3621,11 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	}
 	ret = 0;
 err:
-	if (thread)
+	if (thread) {
+		spin_lock(&proc->inner_lock);
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+		spin_unlock(&proc->inner_lock);
+	}
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n",
@@ -2780,7 +3663,7 @@ static struct vm_operations_struct binder_vm_ops = {
 
 static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 {
-	int ret;
+	int ret, i;
 	struct vm_struct *area;
 	struct binder_proc *proc = filp->private_data;
 	const char *failure_string;
@@ -2834,6 +3717,12 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 		goto err_alloc_pages_failed;
 	}
 	proc->buffer_size = vma->vm_end - vma->vm_start;
+	for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
+		INIT_LIST_HEAD(&proc->pages[i].lru);
+		proc->pages[i].proc = proc;
+	}
+	for (i = 0; i < BINDER_FREE_LISTS; i++)
+		INIT_LIST_HEAD(&proc->free_lists[i]);
 
 	vma->vm_ops = &binder_vm_ops;
 	vma->vm_private_data = proc;
@@ -2885,9 +3774,11 @@ static int binder_open(struct inode *nodp, struct file *filp)
 		return -ENOMEM;
 	get_task_struct(current);
 	proc->tsk = current;
+	spin_lock_init(&proc->inner_lock);
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
-	proc->default_priority = task_nice(current);
+	mutex_init(&proc->alloc_lock);
+	proc->default_priority = binder_current_priority();
 	mutex_lock(&binder_lock);
 	binder_stats_created(BINDER_STAT_PROC);
 	hlist_add_head(&proc->proc_node, &binder_procs);
@@ -2919,6 +3810,7 @@ static void binder_deferred_flush(struct binder_proc *proc)
 {
 	struct rb_node *n;
 	int wake_count = 0;
+	spin_lock(&proc->inner_lock);
 	for (n = rb_first(&proc->threads); n != NULL; n = rb_next(n)) {
 		struct binder_thread *thread = rb_entry(n, struct binder_thread, rb_node);
 		thread->looper |= BINDER_LOOPER_STATE_NEED_RETURN;
@@ -2927,6 +3819,7 @@ static void binder_deferred_flush(struct binder_proc *proc)
 			wake_count++;
 		}
 	}
+	spin_unlock(&proc->inner_lock);
 	wake_up_interruptible_all(&proc->wait);
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
@@ -2946,9 +3839,8 @@ static int binder_release(struct inode *nodp, struct file *filp)
 static void binder_deferred_release(struct binder_proc *proc)
 {
 	struct hlist_node *pos;
-	struct binder_transaction *t;
 	struct rb_node *n;
-	int threads, nodes, incoming_refs, outgoing_refs, buffers, active_transactions, page_count;
+	int threads, nodes, incoming_refs, outgoing_refs, active_transactions;
 
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
@@ -2975,8 +3867,11 @@ static void binder_deferred_release(struct binder_proc *proc)
 
 		nodes++;
 		rb_erase(&node->rb_node, &proc->nodes);
+		spin_lock(&proc->inner_lock);
 		list_del_init(&node->work.entry);
+		spin_unlock(&proc->inner_lock);
 		if (hlist_empty(&node->refs)) {
+			kfree(node->lat);
 			kfree(node);
 			binder_stats_deleted(BINDER_STAT_NODE);
 		} else {
@@ -2992,12 +3887,14 @@ static void binder_deferred_release(struct binder_proc *proc)
 				incoming_refs++;
 				if (ref->death) {
 					death++;
+					spin_lock(&ref->proc->inner_lock);
 					if (list_empty(&ref->death->work.entry)) {
 						ref->death->work.type = BINDER_WORK_DEAD_BINDER;
 						list_add_tail(&ref->death->work.entry, &ref->proc->todo);
 						wake_up_interruptible(&ref->proc->wait);
 					} else
 						BUG();
+					spin_unlock(&ref->proc->inner_lock);
 				}
 			}
 			binder_debug(BINDER_DEBUG_DEAD_BINDER,
@@ -3013,9 +3910,26 @@ static void binder_deferred_release(struct binder_proc *proc)
 		outgoing_refs++;
 		binder_delete_ref(ref);
 	}
-	binder_release_work(&proc->todo);
-	buffers = 0;
+	binder_release_work(proc, &proc->todo);
+
+	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
+		     "binder_release: %d threads %d, nodes %d (ref %d), "
+		     "refs %d, active transactions %d\n",
+		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
+		     active_transactions);
+
+	proc->is_dead = true;
+	if (!proc->tmp_ref)
+		binder_free_proc(proc);
+}
 
+static void binder_free_proc(struct binder_proc *proc)
+{
+	struct binder_transaction *t;
+	struct rb_node *n;
+	int buffers, page_count;
+
+	buffers = 0;
 	while ((n = rb_first(&proc->allocated_buffers))) {
 		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
 							rb_node);
@@ -3037,20 +3951,25 @@ static void binder_deferred_release(struct binder_proc *proc)
 	page_count = 0;
 	if (proc->pages) {
 		int i;
+		mutex_lock(&proc->alloc_lock);
 		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
-			if (proc->pages[i]) {
+			if (proc->pages[i].page) {
 				void *page_addr = proc->buffer + i * PAGE_SIZE;
-				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
-					     "binder_release: %d: "
-					     "page %d at %p not freed\n",
-					     proc->pid, i,
-					     page_addr);
+				if (!list_empty(&proc->pages[i].lru))
+					binder_lru_del(&proc->pages[i]);
+				else
+					binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+						     "binder_release: %d: "
+						     "page %d at %p not freed\n",
+						     proc->pid, i,
+						     page_addr);
 				unmap_kernel_range((unsigned long)page_addr,
 					PAGE_SIZE);
-				__free_page(proc->pages[i]);
+				__free_page(proc->pages[i].page);
 				page_count++;
 			}
 		}
+		mutex_unlock(&proc->alloc_lock);
 		kfree(proc->pages);
 		vfree(proc->buffer);
 	}
@@ -3058,11 +3977,8 @@ static void binder_deferred_release(struct binder_proc *proc)
 	put_task_struct(proc->tsk);
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
-		     "binder_release: %d threads %d, nodes %d (ref %d), "
-		     "refs %d, active transactions %d, buffers %d, "
-		     "pages %d\n",
-		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
-		     active_transactions, buffers, page_count);
+		     "binder_release: %d buffers %d, pages %d\n",
+		     proc->pid, buffers, page_count);
 
 	kfree(proc);
 }
@@ -3125,13 +4041,14 @@ static void print_binder_transaction(struct seq_file *m, const char *prefix,
 				     struct binder_transaction *t)
 {
 	seq_printf(m,
-		   "%s %d: %p from %d:%d to %d:%d code %x flags %x pri %ld r%d",
+		   "%s %d: %p from %d:%d to %d:%d code %x flags %x pri %d:%d r%d",
 		   prefix, t->debug_id, t,
 		   t->from ? t->from->proc->pid : 0,
 		   t->from ? t->from->pid : 0,
 		   t->to_proc ? t->to_proc->pid : 0,
 		   t->to_thread ? t->to_thread->pid : 0,
-		   t->code, t->flags, t->priority, t->need_reply);
+		   t->code, t->flags, t->priority.sched_policy,
+		   t->priority.prio, t->need_reply);
 	if (t->buffer == NULL) {
 		seq_puts(m, " buffer free\n");
 		return;
@@ -3243,9 +4160,11 @@ static void print_binder_node(struct seq_file *m, struct binder_node *node)
 			seq_printf(m, " %d", ref->proc->pid);
 	}
 	seq_puts(m, "\n");
+	spin_lock(&node->lock);
 	list_for_each_entry(w, &node->async_todo, entry)
 		print_binder_work(m, "    ",
 				  "    pending async transaction", w);
+	spin_unlock(&node->lock);
 }
 
 static void print_binder_ref(struct seq_file *m, struct binder_ref *ref)
@@ -3266,9 +4185,11 @@ static void print_binder_proc(struct seq_file *m,
 	seq_printf(m, "proc %d\n", proc->pid);
 	header_pos = m->count;
 
+	spin_lock(&proc->inner_lock);
 	for (n = rb_first(&proc->threads); n != NULL; n = rb_next(n))
 		print_binder_thread(m, rb_entry(n, struct binder_thread,
 						rb_node), print_all);
+	spin_unlock(&proc->inner_lock);
 	for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
 		struct binder_node *node = rb_entry(n, struct binder_node,
 						    rb_node);
@@ -3282,11 +4203,15 @@ static void print_binder_proc(struct seq_file *m,
 			print_binder_ref(m, rb_entry(n, struct binder_ref,
 						     rb_node_desc));
 	}
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		print_binder_buffer(m, "  buffer",
 				    rb_entry(n, struct binder_buffer, rb_node));
+	mutex_unlock(&proc->alloc_lock);
+	spin_lock(&proc->inner_lock);
 	list_for_each_entry(w, &proc->todo, entry)
 		print_binder_work(m, "  ", "  pending transaction", w);
+	spin_unlock(&proc->inner_lock);
 	list_for_each_entry(w, &proc->delivered_death, entry) {
 		seq_puts(m, "  has delivered dead binder\n");
 		break;
@@ -3333,7 +4258,9 @@ static const char *binder_command_strings[] = {
 	"BC_EXIT_LOOPER",
 	"BC_REQUEST_DEATH_NOTIFICATION",
 	"BC_CLEAR_DEATH_NOTIFICATION",
-	"BC_DEAD_BINDER_DONE"
+	"BC_DEAD_BINDER_DONE",
+	"BC_TRANSACTION_SG",
+	"BC_REPLY_SG"
 };
 
 static const char *binder_objstat_strings[] = {
@@ -3354,17 +4281,21 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->bc) !=
 		     ARRAY_SIZE(binder_command_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->bc); i++) {
-		if (stats->bc[i])
+		int temp = atomic_read(&stats->bc[i]);
+
+		if (temp)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_command_strings[i], stats->bc[i]);
+				   binder_command_strings[i], temp);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->br) !=
 		     ARRAY_SIZE(binder_return_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->br); i++) {
-		if (stats->br[i])
+		int temp = atomic_read(&stats->br[i]);
+
+		if (temp)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_return_strings[i], stats->br[i]);
+				   binder_return_strings[i], temp);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
@@ -3372,14 +4303,45 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
 		     ARRAY_SIZE(stats->obj_deleted));
 	for (i = 0; i < ARRAY_SIZE(stats->obj_created); i++) {
-		if (stats->obj_created[i] || stats->obj_deleted[i])
+		int created = atomic_read(&stats->obj_created[i]);
+		int deleted = atomic_read(&stats->obj_deleted[i]);
+
+		if (created || deleted)
 			seq_printf(m, "%s%s: active %d total %d\n", prefix,
 				binder_objstat_strings[i],
-				stats->obj_created[i] - stats->obj_deleted[i],
-				stats->obj_created[i]);
+				created - deleted, created);
 	}
 }
 
+/*
+ * Fragmentation is the share of free space outside the largest free
+ * buffer, i.e. how much of it a single large transaction cannot use.
+ */
+static void print_binder_proc_free_space(struct seq_file *m,
+					 struct binder_proc *proc)
+{
+	struct binder_buffer *buffer;
+	size_t buffer_size, free_size = 0, largest = 0;
+	int i, count = 0;
+
+	if (!proc->pages)
+		return;
+	for (i = 0; i < BINDER_FREE_LISTS; i++) {
+		list_for_each_entry(buffer, &proc->free_lists[i], free_entry) {
+			buffer_size = binder_buffer_size(proc, buffer);
+			free_size += buffer_size;
+			if (buffer_size > largest)
+				largest = buffer_size;
+			count++;
+		}
+	}
+	seq_printf(m, "  free buffers: %d size %zd largest %zd "
+		   "fragmentation %zd%%\n", count, free_size, largest,
+		   free_size ? 100 - largest * 100 / free_size : 0);
+	seq_printf(m, "  pages: %d mapped %d cached\n",
+		   proc->pages_mapped, proc->pages_cached);
+}
+
 static void print_binder_proc_stats(struct seq_file *m,
 				    struct binder_proc *proc)
 {
@@ -3389,6 +4351,7 @@ static void print_binder_proc_stats(struct seq_file *m,
 
 	seq_printf(m, "proc %d\n", proc->pid);
 	count = 0;
+	spin_lock(&proc->inner_lock);
 	for (n = rb_first(&proc->threads); n != NULL; n = rb_next(n))
 		count++;
 	seq_printf(m, "  threads: %d\n", count);
@@ -3397,6 +4360,7 @@ static void print_binder_proc_stats(struct seq_file *m,
 			"  free async space %zd\n", proc->requested_threads,
 			proc->requested_threads_started, proc->max_threads,
 			proc->ready_threads, proc->free_async_space);
+	spin_unlock(&proc->inner_lock);
 	count = 0;
 	for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n))
 		count++;
@@ -3414,11 +4378,15 @@ static void print_binder_proc_stats(struct seq_file *m,
 	seq_printf(m, "  refs: %d s %d w %d\n", count, strong, weak);
 
 	count = 0;
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
 	seq_printf(m, "  buffers: %d\n", count);
+	print_binder_proc_free_space(m, proc);
+	mutex_unlock(&proc->alloc_lock);
 
 	count = 0;
+	spin_lock(&proc->inner_lock);
 	list_for_each_entry(w, &proc->todo, entry) {
 		switch (w->type) {
 		case BINDER_WORK_TRANSACTION:
@@ -3428,6 +4396,7 @@ static void print_binder_proc_stats(struct seq_file *m,
 			break;
 		}
 	}
+	spin_unlock(&proc->inner_lock);
 	seq_printf(m, "  pending transactions: %d\n", count);
 
 	print_binder_stats(m, "  ", &proc->stats);
@@ -3470,6 +4439,10 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	seq_puts(m, "binder stats:\n");
 
 	print_binder_stats(m, "", &binder_stats);
+	spin_lock(&binder_lru_lock);
+	seq_printf(m, "cached pages: %d reclaimed %lu\n", binder_lru_count,
+		   binder_lru_reclaimed);
+	spin_unlock(&binder_lru_lock);
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
@@ -3495,6 +4468,63 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 	return 0;
 }
 
+static void print_binder_lat_hist(struct seq_file *m, const char *name,
+				  struct binder_lat_hist *hist)
+{
+	int i;
+
+	if (!hist->count)
+		return;
+	seq_printf(m, "  %s: count %u avg %llu max %u us\n   ", name,
+		   hist->count, div_u64(hist->total_us, hist->count),
+		   hist->max_us);
+	for (i = 0; i < BINDER_LAT_BUCKETS; i++)
+		seq_printf(m, " %u", hist->bucket[i]);
+	seq_puts(m, "\n");
+}
+
+static void print_binder_lat_stats(struct seq_file *m,
+				   struct binder_lat_stats *lat)
+{
+	print_binder_lat_hist(m, "queue", &lat->queue);
+	print_binder_lat_hist(m, "handle", &lat->handle);
+	print_binder_lat_hist(m, "reply", &lat->reply);
+}
+
+static int binder_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct binder_node *node;
+	struct hlist_node *pos;
+	struct rb_node *n;
+	int do_lock = !binder_debug_no_lock;
+
+	if (do_lock)
+		mutex_lock(&binder_lock);
+
+	seq_printf(m, "binder latency (us, bucket n < 2^n, last %d+):\n",
+		   1 << (BINDER_LAT_BUCKETS - 2));
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		seq_printf(m, "proc %d\n", proc->pid);
+		spin_lock(&proc->inner_lock);
+		print_binder_lat_stats(m, &proc->lat);
+		spin_unlock(&proc->inner_lock);
+		for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
+			node = rb_entry(n, struct binder_node, rb_node);
+			if (!node->lat)
+				continue;
+			seq_printf(m, " node %d u%p\n", node->debug_id,
+				   node->ptr);
+			spin_lock(&node->lock);
+			print_binder_lat_stats(m, node->lat);
+			spin_unlock(&node->lock);
+		}
+	}
+	if (do_lock)
+		mutex_unlock(&binder_lock);
+	return 0;
+}
+
 static int binder_proc_show(struct seq_file *m, void *unused)
 {
 	struct binder_proc *proc = m->private;
@@ -3554,6 +4584,7 @@ BINDER_DEBUG_ENTRY(state);
 BINDER_DEBUG_ENTRY(stats);
 BINDER_DEBUG_ENTRY(transactions);
 BINDER_DEBUG_ENTRY(transaction_log);
+BINDER_DEBUG_ENTRY(latency);
 
 static int __init binder_init(void)
 {
@@ -3563,6 +4594,8 @@ static int __init binder_init(void)
 	if (!binder_deferred_workqueue)
 		return -ENOMEM;
 
+	register_shrinker(&binder_shrinker);
+
 	binder_debugfs_dir_entry_root = debugfs_create_dir("binder", NULL);
 	if (binder_debugfs_dir_entry_root)
 		binder_debugfs_dir_entry_proc = debugfs_create_dir("proc",
@@ -3594,6 +4627,11 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    &binder_transaction_log_failed,
 				    &binder_transaction_log_fops);
+		debugfs_create_file("latency",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_latency_fops);
 	}
 	return ret;
 }
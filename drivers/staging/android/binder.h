@@ -32,11 +32,20 @@ enum {
 	BINDER_TYPE_HANDLE	= B_PACK_CHARS('s', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_WEAK_HANDLE	= B_PACK_CHARS('w', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_FD		= B_PACK_CHARS('f', 'd', '*', B_TYPE_LARGE),
+	BINDER_TYPE_PTR		= B_PACK_CHARS('p', 't', '*', B_TYPE_LARGE),
 };
 
 enum {
+	/*
+	 * Minimum priority of threads handling transactions on the node:
+	 * a nice value for SCHED_NORMAL and SCHED_BATCH, an rt priority for
+	 * SCHED_FIFO and SCHED_RR.
+	 */
 	FLAT_BINDER_FLAG_PRIORITY_MASK = 0xff,
 	FLAT_BINDER_FLAG_ACCEPTS_FDS = 0x100,
+	/* Scheduling policy that goes with the minimum priority */
+	FLAT_BINDER_FLAG_SCHED_POLICY_SHIFT = 9,
+	FLAT_BINDER_FLAG_SCHED_POLICY_MASK = 0x3 << 9,
 };
 
 struct flat_binder_object {
@@ -54,6 +63,20 @@ struct flat_binder_object {
 	void			*cookie;
 };
 
+/*
+ * A BINDER_TYPE_PTR object, sent with BC_TRANSACTION_SG or BC_REPLY_SG,
+ * refers to a buffer in the sender's memory. The driver copies it straight
+ * into the target's binder mapping and points @buffer at the copy, so large
+ * payloads need not be flattened into the transaction data first. It has
+ * the size of a flat_binder_object.
+ */
+struct binder_buffer_object {
+	unsigned long		type;
+	unsigned long		flags;
+	void			*buffer;
+	size_t			length;
+};
+
 
 struct binder_write_read {
 	signed long	write_size;	
@@ -113,6 +136,12 @@ struct binder_transaction_data {
 	} data;
 };
 
+struct binder_transaction_data_sg {
+	struct binder_transaction_data transaction_data;
+	/* total size of the BINDER_TYPE_PTR buffers, pointer aligned */
+	size_t		buffers_size;
+};
+
 struct binder_ptr_cookie {
 	void *ptr;
 	void *cookie;
@@ -191,6 +220,9 @@ enum BinderDriverCommandProtocol {
 	BC_CLEAR_DEATH_NOTIFICATION = _IOW('c', 15, struct binder_ptr_cookie),
 
 	BC_DEAD_BINDER_DONE = _IOW('c', 16, void *),
+
+	BC_TRANSACTION_SG = _IOW('c', 17, struct binder_transaction_data_sg),
+	BC_REPLY_SG = _IOW('c', 18, struct binder_transaction_data_sg),
 };
 
 #endif 
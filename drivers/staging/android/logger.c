@@ -25,6 +25,8 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -34,7 +36,7 @@ struct logger_log {
 	struct miscdevice	misc;	
 	wait_queue_head_t	wq;	
 	struct list_head	readers; 
-	struct mutex		mutex;	
+	spinlock_t		lock;
 	size_t			w_off;	
 	size_t			head;	
 	size_t			size;	
@@ -46,8 +48,23 @@ struct logger_reader {
 	size_t			r_off;	
 	bool			r_all;	
 	int			r_ver;	
+	struct mutex		mutex;
+	struct logger_entry	*entry;
 };
 
+#define LOGGER_ENTRY_MAX_LEN \
+	(sizeof(struct logger_entry) + LOGGER_ENTRY_MAX_PAYLOAD)
+
+/*
+ * Writers gather their payload here before taking log->lock, so that the
+ * ring is only locked for a memcpy and never across a page fault.
+ */
+struct logger_stage {
+	unsigned char buf[LOGGER_ENTRY_MAX_PAYLOAD];
+};
+
+static struct logger_stage __percpu *logger_stage;
+
 size_t logger_offset(struct logger_log *log, size_t n)
 {
 	return n & (log->size-1);
@@ -118,37 +135,40 @@ static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
 	return copy_to_user(buf, hdr, hdr_len);
 }
 
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+/*
+ * Copy the entry at reader->r_off out of the ring and return the offset of
+ * the next one. Called with log->lock held; the copy to userspace happens
+ * after it is dropped, and r_off only steps past the entry once it is done.
+ */
+static size_t do_read_log(struct logger_log *log, struct logger_reader *reader)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
+	size_t count;
 	size_t len;
-	size_t msg_start;
 
-	entry = get_entry_header(log, reader->r_off, &scratch);
-	if (copy_header_to_user(reader->r_ver, entry, buf))
-		return -EFAULT;
+	count = sizeof(struct logger_entry) +
+		get_entry_msg_len(log, reader->r_off);
+	len = min(count, log->size - reader->r_off);
+	memcpy(reader->entry, log->buffer + reader->r_off, len);
 
-	count -= get_user_hdr_len(reader->r_ver);
-	buf += get_user_hdr_len(reader->r_ver);
-	msg_start = logger_offset(log,
-		reader->r_off + sizeof(struct logger_entry));
+	if (count != len)
+		memcpy((void *) reader->entry + len, log->buffer, count - len);
 
-	len = min(count, log->size - msg_start);
-	if (copy_to_user(buf, log->buffer + msg_start, len))
-		return -EFAULT;
+	return logger_offset(log, reader->r_off + count);
+}
 
-	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
+static ssize_t copy_entry_to_user(struct logger_reader *reader,
+				  char __user *buf)
+{
+	struct logger_entry *entry = reader->entry;
+	size_t hdr_len = get_user_hdr_len(reader->r_ver);
+
+	if (copy_header_to_user(reader->r_ver, entry, buf))
+		return -EFAULT;
 
-	reader->r_off = logger_offset(log, reader->r_off +
-		sizeof(struct logger_entry) + count);
+	if (copy_to_user(buf + hdr_len, entry->msg, entry->len))
+		return -EFAULT;
 
-	return count + get_user_hdr_len(reader->r_ver);
+	return hdr_len + entry->len;
 }
 
 static size_t get_next_entry_by_uid(struct logger_log *log,
@@ -188,17 +208,17 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	size_t off, next;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
 start:
 	while (1) {
-		mutex_lock(&log->mutex);
-
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
+		spin_lock(&log->lock);
 		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 		if (!ret)
 			break;
 
@@ -219,7 +239,8 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	mutex_lock(&reader->mutex);
+	spin_lock(&log->lock);
 
 	if (!reader->r_all)
 		reader->r_off = get_next_entry_by_uid(log,
@@ -227,7 +248,8 @@ start:
 
 	
 	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
+		mutex_unlock(&reader->mutex);
 		goto start;
 	}
 
@@ -235,15 +257,27 @@ start:
 	ret = get_user_hdr_len(reader->r_ver) +
 		get_entry_msg_len(log, reader->r_off);
 	if (count < ret) {
+		spin_unlock(&log->lock);
 		ret = -EINVAL;
 		goto out;
 	}
 
-	
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	off = reader->r_off;
+	next = do_read_log(log, reader);
+	spin_unlock(&log->lock);
+
+	ret = copy_entry_to_user(reader, buf);
+	if (ret < 0)
+		goto out;
+
+	/* Unless a writer overran the entry meanwhile and moved us already */
+	spin_lock(&log->lock);
+	if (reader->r_off == off)
+		reader->r_off = next;
+	spin_unlock(&log->lock);
 
 out:
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
@@ -305,32 +339,56 @@ static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 
 }
 
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+/*
+ * Gather up to count bytes of the iovec into dst. With atomic set this may
+ * be called with preemption disabled and fails rather than fault pages in.
+ */
+static int logger_copy_iov(void *dst, const struct iovec *iov,
+			   unsigned long nr_segs, size_t count, bool atomic)
 {
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
-
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
+	while (count && nr_segs-- > 0) {
+		size_t len = min_t(size_t, iov->iov_len, count);
+		unsigned long left;
+
+		if (atomic) {
+			pagefault_disable();
+			left = __copy_from_user_inatomic(dst, iov->iov_base,
+							 len);
+			pagefault_enable();
+		} else
+			left = copy_from_user(dst, iov->iov_base, len);
+
+		if (unlikely(left))
 			return -EFAULT;
 
-	log->w_off = logger_offset(log, log->w_off + count);
+		dst += len;
+		count -= len;
+		iov++;
+	}
 
-	return count;
+	return 0;
+}
+
+/* Append a complete entry to the ring; this is the only write-side lock */
+static void logger_commit(struct logger_log *log, struct logger_entry *header,
+			  const void *payload)
+{
+	spin_lock(&log->lock);
+	fix_up_readers(log, sizeof(struct logger_entry) + header->len);
+	do_write_log(log, header, sizeof(struct logger_entry));
+	do_write_log(log, payload, header->len);
+	spin_unlock(&log->lock);
 }
 
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	struct logger_stage *stage;
 	struct logger_entry header;
 	struct timespec now;
-	ssize_t ret = 0;
+	void *payload;
+	int ret;
 
 	now = current_kernel_time();
 
@@ -346,37 +404,36 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
-
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
-
-		
-		len = min_t(size_t, iov->iov_len, header.len - ret);
-
-		
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
-		}
-
-		iov++;
-		ret += nr;
+	/*
+	 * Fast path: the caller just wrote the message, so its pages are
+	 * almost always resident and it can be staged on this CPU without
+	 * faulting.
+	 */
+	stage = get_cpu_ptr(logger_stage);
+	ret = logger_copy_iov(stage->buf, iov, nr_segs, header.len, true);
+	if (likely(!ret)) {
+		logger_commit(log, &header, stage->buf);
+		put_cpu_ptr(logger_stage);
+		goto out;
 	}
+	put_cpu_ptr(logger_stage);
 
-	mutex_unlock(&log->mutex);
+	payload = kmalloc(header.len, GFP_KERNEL);
+	if (!payload)
+		return -ENOMEM;
 
+	ret = logger_copy_iov(payload, iov, nr_segs, header.len, false);
+	if (!ret)
+		logger_commit(log, &header, payload);
+	kfree(payload);
+	if (ret)
+		return ret;
+
+out:
 	
 	wake_up_interruptible(&log->wq);
 
-	return ret;
+	return header.len;
 }
 
 static struct logger_log *get_log_from_minor(int);
@@ -401,17 +458,24 @@ static int logger_open(struct inode *inode, struct file *file)
 		if (!reader)
 			return -ENOMEM;
 
+		reader->entry = kmalloc(LOGGER_ENTRY_MAX_LEN, GFP_KERNEL);
+		if (!reader->entry) {
+			kfree(reader);
+			return -ENOMEM;
+		}
+
 		reader->log = log;
 		reader->r_ver = 1;
 		reader->r_all = in_egroup_p(inode->i_gid) ||
 			capable(CAP_SYSLOG);
 
+		mutex_init(&reader->mutex);
 		INIT_LIST_HEAD(&reader->list);
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		reader->r_off = log->head;
 		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
 		file->private_data = reader;
 	} else
@@ -426,10 +490,11 @@ static int logger_release(struct inode *ignored, struct file *file)
 		struct logger_reader *reader = file->private_data;
 		struct logger_log *log = reader->log;
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		list_del(&reader->list);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
+		kfree(reader->entry);
 		kfree(reader);
 	}
 
@@ -450,14 +515,14 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
+	spin_lock(&log->lock);
 	if (!reader->r_all)
 		reader->r_off = get_next_entry_by_uid(log,
 			reader->r_off, current_euid());
 
 	if (log->w_off != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -471,7 +536,9 @@ static long logger_set_version(struct logger_reader *reader, void __user *arg)
 	if ((version < 1) || (version > 2))
 		return -EINVAL;
 
+	mutex_lock(&reader->mutex);
 	reader->r_ver = version;
+	mutex_unlock(&reader->mutex);
 	return 0;
 }
 
@@ -482,7 +549,14 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	long ret = -EINVAL;
 	void __user *argp = (void __user *) arg;
 
-	mutex_lock(&log->mutex);
+	/* Only touches this reader, and may fault on argp */
+	if (cmd == LOGGER_SET_VERSION) {
+		if (!(file->f_mode & FMODE_READ))
+			return -EBADF;
+		return logger_set_version(file->private_data, argp);
+	}
+
+	spin_lock(&log->lock);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -534,17 +608,9 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		reader = file->private_data;
 		ret = reader->r_ver;
 		break;
-	case LOGGER_SET_VERSION:
-		if (!(file->f_mode & FMODE_READ)) {
-			ret = -EBADF;
-			break;
-		}
-		reader = file->private_data;
-		ret = logger_set_version(reader, argp);
-		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -572,7 +638,7 @@ static struct logger_log VAR = { \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
@@ -617,23 +683,36 @@ static int __init logger_init(void)
 {
 	int ret;
 
+	logger_stage = alloc_percpu(struct logger_stage);
+	if (!logger_stage)
+		return -ENOMEM;
+
 	ret = init_log(&log_main);
 	if (unlikely(ret))
-		goto out;
+		goto out_free;
 
 	ret = init_log(&log_events);
 	if (unlikely(ret))
-		goto out;
+		goto out_main;
 
 	ret = init_log(&log_radio);
 	if (unlikely(ret))
-		goto out;
+		goto out_events;
 
 	ret = init_log(&log_system);
 	if (unlikely(ret))
-		goto out;
+		goto out_radio;
 
-out:
+	return 0;
+
+out_radio:
+	misc_deregister(&log_radio.misc);
+out_events:
+	misc_deregister(&log_events.misc);
+out_main:
+	misc_deregister(&log_main.misc);
+out_free:
+	free_percpu(logger_stage);
 	return ret;
 }
 device_initcall(logger_init);
@@ -17,6 +17,12 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Candidates are kept in an index bucketed by oom_score_adj, updated on
+ * fork, exit and adj changes, so a kill only looks at the buckets at or
+ * above the threshold instead of walking every process. After a kill no
+ * other task is chosen until the victim has released its memory or
+ * /sys/module/lowmemorykiller/parameters/victim_wait_ms has passed.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -36,7 +42,14 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/rcupdate.h>
+#include <linux/rculist_nulls.h>
 #include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+
+#define CREATE_TRACE_POINTS
+#include "trace/lowmemorykiller.h"
 
 extern void show_meminfo(void);
 static uint32_t lowmem_debug_level = 2;
@@ -56,6 +69,72 @@ static int lowmem_minfree[6] = {
 static int lowmem_minfree_size = 4;
 
 static unsigned long lowmem_deathpending_timeout;
+static struct task_struct *lowmem_deathpending;
+static uint32_t lowmem_victim_wait_ms = 1000;
+static DEFINE_MUTEX(lowmem_scan_mutex);
+
+/*
+ * Thread group leaders hashed by oom_score_adj. Readers walk the buckets
+ * under RCU; a task can move to another bucket while being looked at, so
+ * each bucket ends in a nulls marker holding its own index and a walk that
+ * ends anywhere else is restarted.
+ */
+#define LOWMEM_BUCKET_SHIFT	4
+#define LOWMEM_NR_BUCKETS \
+	(((OOM_SCORE_ADJ_MAX - OOM_SCORE_ADJ_MIN) >> LOWMEM_BUCKET_SHIFT) + 1)
+
+static struct hlist_nulls_head lowmem_index[LOWMEM_NR_BUCKETS];
+static DEFINE_SPINLOCK(lowmem_index_lock);
+static bool lowmem_index_ready;
+
+static int lowmem_bucket(int oom_score_adj)
+{
+	return (oom_score_adj - OOM_SCORE_ADJ_MIN) >> LOWMEM_BUCKET_SHIFT;
+}
+
+static void __lowmem_index_add(struct task_struct *p)
+{
+	int b = lowmem_bucket(p->signal->oom_score_adj);
+
+	hlist_nulls_add_head_rcu(&p->lowmem_node, &lowmem_index[b]);
+}
+
+/* Called from copy_process() and de_thread() with tasklist_lock held */
+void lowmem_task_add(struct task_struct *p)
+{
+	p->lowmem_node.pprev = NULL;
+	if (!thread_group_leader(p))
+		return;
+
+	spin_lock(&lowmem_index_lock);
+	if (lowmem_index_ready)
+		__lowmem_index_add(p);
+	spin_unlock(&lowmem_index_lock);
+}
+
+/* Called from __unhash_process() for every exiting task */
+void lowmem_task_remove(struct task_struct *p)
+{
+	spin_lock(&lowmem_index_lock);
+	if (p == lowmem_deathpending)
+		lowmem_deathpending = NULL;
+	if (!hlist_nulls_unhashed(&p->lowmem_node))
+		hlist_nulls_del_init_rcu(&p->lowmem_node);
+	spin_unlock(&lowmem_index_lock);
+}
+
+/* Called with the siglock held after p->signal->oom_score_adj changed */
+void lowmem_task_update(struct task_struct *p)
+{
+	p = p->group_leader;
+
+	spin_lock(&lowmem_index_lock);
+	if (!hlist_nulls_unhashed(&p->lowmem_node)) {
+		hlist_nulls_del_init_rcu(&p->lowmem_node);
+		__lowmem_index_add(p);
+	}
+	spin_unlock(&lowmem_index_lock);
+}
 
 #define lowmem_print(level, x...)			\
 	do {						\
@@ -87,6 +166,10 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
 	struct task_struct *tsk;
 	struct task_struct *selected = NULL;
+	struct task_struct *victim;
+	ktime_t start;
+	int buckets = 0;
+	int b;
 	int rem = 0;
 	int tasksize;
 	int i;
@@ -125,54 +208,97 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	}
 	selected_oom_score_adj = min_score_adj;
 
-	rcu_read_lock();
-	for_each_process(tsk) {
-		struct task_struct *p;
-		int oom_score_adj;
-
-		if (tsk->flags & PF_KTHREAD)
-			continue;
+	/*
+	 * Reclaim runs on several CPUs at once under a burst of allocations;
+	 * let one of them pick the victim instead of each killing its own.
+	 */
+	if (!mutex_trylock(&lowmem_scan_mutex))
+		return 0;
+	start = ktime_get();
 
-		p = find_lock_task_mm(tsk);
-		if (!p)
-			continue;
+	/*
+	 * Until the previous victim has released its memory the numbers
+	 * above do not reflect the kill yet, so wait for it rather than
+	 * choosing another task.
+	 */
+	rcu_read_lock();
+	victim = ACCESS_ONCE(lowmem_deathpending);
+	if (victim && time_before_eq(jiffies, lowmem_deathpending_timeout)) {
+		struct task_struct *p = find_lock_task_mm(victim);
 
-		if (test_tsk_thread_flag(p, TIF_MEMDIE) &&
-		    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
+		if (p) {
 			lowmem_print(2, "%d (%s), oom_adj %d score_adj %d, is exiting, return\n"
 					, p->pid, p->comm, p->signal->oom_adj, p->signal->oom_score_adj);
 			task_unlock(p);
 			rcu_read_unlock();
+			mutex_unlock(&lowmem_scan_mutex);
 			return 0;
 		}
-		oom_score_adj = p->signal->oom_score_adj;
-		if (oom_score_adj < min_score_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(p->mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_score_adj < selected_oom_score_adj)
+	}
+
+	for (b = lowmem_bucket(OOM_SCORE_ADJ_MAX);
+	     b >= lowmem_bucket(max(min_score_adj, OOM_SCORE_ADJ_MIN)) &&
+	     !selected; b--) {
+		struct hlist_nulls_node *node;
+
+		buckets++;
+restart:
+		hlist_nulls_for_each_entry_rcu(tsk, node, &lowmem_index[b],
+					       lowmem_node) {
+			struct task_struct *p;
+			int oom_score_adj;
+
+			if (tsk->flags & PF_KTHREAD)
+				continue;
+
+			p = find_lock_task_mm(tsk);
+			if (!p)
+				continue;
+
+			if (test_tsk_thread_flag(p, TIF_MEMDIE) &&
+			    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
+				lowmem_print(2, "%d (%s), oom_adj %d score_adj %d, is exiting, return\n"
+						, p->pid, p->comm, p->signal->oom_adj, p->signal->oom_score_adj);
+				task_unlock(p);
+				rcu_read_unlock();
+				mutex_unlock(&lowmem_scan_mutex);
+				return 0;
+			}
+			oom_score_adj = p->signal->oom_score_adj;
+			if (oom_score_adj < min_score_adj) {
+				task_unlock(p);
 				continue;
-			if (oom_score_adj == selected_oom_score_adj &&
-			    tasksize <= selected_tasksize)
+			}
+			tasksize = get_mm_rss(p->mm);
+			task_unlock(p);
+			if (tasksize <= 0)
 				continue;
+			if (selected) {
+				if (oom_score_adj < selected_oom_score_adj)
+					continue;
+				if (oom_score_adj == selected_oom_score_adj &&
+				    tasksize <= selected_tasksize)
+					continue;
+			}
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_score_adj = oom_score_adj;
+			selected_oom_adj = p->signal->oom_adj;
+			lowmem_print(2, "select %d (%s), oom_adj %d score_adj %d, size %d, to kill\n",
+				     p->pid, p->comm, selected_oom_adj, oom_score_adj, tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_score_adj = oom_score_adj;
-		selected_oom_adj = p->signal->oom_adj;
-		lowmem_print(2, "select %d (%s), oom_adj %d score_adj %d, size %d, to kill\n",
-			     p->pid, p->comm, selected_oom_adj, oom_score_adj, tasksize);
+		/* Followed a task into another bucket, walk this one again */
+		if (get_nulls_value(node) != b)
+			goto restart;
 	}
+	trace_lowmem_select(selected, min_score_adj, selected_tasksize,
+			    buckets, ktime_to_ns(ktime_sub(ktime_get(), start)));
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), oom_adj %d, score_adj %d, size %d\n",
 			     selected->pid, selected->comm, selected_oom_adj,
 			     selected_oom_score_adj, selected_tasksize);
-		lowmem_deathpending_timeout = jiffies + HZ;
+		lowmem_deathpending_timeout = jiffies +
+			msecs_to_jiffies(lowmem_victim_wait_ms);
 		if (selected_oom_adj < 7)
 		{
 			show_meminfo();
@@ -180,11 +306,17 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		}
 		send_sig(SIGKILL, selected, 0);
 		set_tsk_thread_flag(selected, TIF_MEMDIE);
+		/* Only remember it if lowmem_task_remove() will still see it */
+		spin_lock(&lowmem_index_lock);
+		if (pid_alive(selected))
+			lowmem_deathpending = selected;
+		spin_unlock(&lowmem_index_lock);
 		rem -= selected_tasksize;
 	}
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
 	rcu_read_unlock();
+	mutex_unlock(&lowmem_scan_mutex);
 	return rem;
 }
 
@@ -193,8 +325,26 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+/* Index the tasks that were forked before the driver came up */
+static void __init lowmem_index_init(void)
+{
+	struct task_struct *p;
+	int b;
+
+	read_lock(&tasklist_lock);
+	spin_lock(&lowmem_index_lock);
+	for (b = 0; b < LOWMEM_NR_BUCKETS; b++)
+		INIT_HLIST_NULLS_HEAD(&lowmem_index[b], b);
+	for_each_process(p)
+		__lowmem_index_add(p);
+	lowmem_index_ready = true;
+	spin_unlock(&lowmem_index_lock);
+	read_unlock(&tasklist_lock);
+}
+
 static int __init lowmem_init(void)
 {
+	lowmem_index_init();
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
@@ -210,6 +360,8 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(victim_wait_ms, lowmem_victim_wait_ms, uint,
+		   S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -19,7 +19,9 @@
 #include <linux/init.h>
 #include <linux/io.h>
 #include <linux/list.h>
+#include <linux/lzo.h>
 #include <linux/memblock.h>
+#include <linux/mutex.h>
 #include <linux/persistent_ram.h>
 #include <linux/rslib.h>
 #include <linux/slab.h>
@@ -35,6 +37,7 @@ struct persistent_ram_buffer {
 #define PERSISTENT_RAM_SIG (0x43474244) 
 
 static __devinitdata LIST_HEAD(persistent_ram_list);
+static DEFINE_MUTEX(persistent_ram_old_lock);
 
 static inline size_t buffer_size(struct persistent_ram_zone *prz)
 {
@@ -102,30 +105,42 @@ static int persistent_ram_decode_rs8(struct persistent_ram_zone *prz,
 				NULL, 0, NULL, 0, NULL);
 }
 
+/*
+ * Writers reserve their range with a cmpxchg on buffer->start and copy
+ * without any lock, so several of them can be filling the same block.
+ * Instead of re-encoding the blocks touched by every write, each writer
+ * accounts the bytes it committed to a block and the one that completes
+ * it computes the ECC, once. The block holding the write head has no
+ * valid ECC until it is complete; persistent_ram_ecc_old() skips it, but
+ * other readers of the carveout, the bootloader or an older kernel, will
+ * count it as an unrecoverable block.
+ */
 static void notrace persistent_ram_update_ecc(struct persistent_ram_zone *prz,
 	unsigned int start, unsigned int count)
 {
 	struct persistent_ram_buffer *buffer = prz->buffer;
-	uint8_t *buffer_end = buffer->data + prz->buffer_size;
-	uint8_t *block;
-	uint8_t *par;
-	int ecc_block_size = prz->ecc_block_size;
-	int ecc_size = prz->ecc_size;
-	int size = prz->ecc_block_size;
+	unsigned int ecc_block_size = prz->ecc_block_size;
+	unsigned int end = start + count;
 
 	if (!prz->ecc)
 		return;
 
-	block = buffer->data + (start & ~(ecc_block_size - 1));
-	par = prz->par_buffer + (start / ecc_block_size) * prz->ecc_size;
-
-	do {
-		if (block + ecc_block_size > buffer_end)
-			size = buffer_end - block;
-		persistent_ram_encode_rs8(prz, block, size, par);
-		block += ecc_block_size;
-		par += ecc_size;
-	} while (block < buffer->data + start + count);
+	while (start < end) {
+		unsigned int block = start / ecc_block_size;
+		unsigned int block_start = block * ecc_block_size;
+		unsigned int size = min_t(unsigned int, ecc_block_size,
+					  prz->buffer_size - block_start);
+		unsigned int n = min(end, block_start + size) - start;
+		int fill = atomic_add_return(n, &prz->ecc_fill[block]);
+
+		if (fill >= size && fill - n < size) {
+			atomic_sub(size, &prz->ecc_fill[block]);
+			persistent_ram_encode_rs8(prz,
+				buffer->data + block_start, size,
+				prz->par_buffer + block * prz->ecc_size);
+		}
+		start += n;
+	}
 }
 
 static void persistent_ram_update_header_ecc(struct persistent_ram_zone *prz)
@@ -144,15 +159,26 @@ static void persistent_ram_ecc_old(struct persistent_ram_zone *prz)
 	struct persistent_ram_buffer *buffer = prz->buffer;
 	uint8_t *block;
 	uint8_t *par;
+	uint8_t *head = NULL;
 
 	if (!prz->ecc)
 		return;
 
+	/* The block being filled when we went down was never encoded */
+	if (buffer_start(prz) % prz->ecc_block_size)
+		head = buffer->data + buffer_start(prz) -
+			buffer_start(prz) % prz->ecc_block_size;
+
 	block = buffer->data;
 	par = prz->par_buffer;
 	while (block < buffer->data + buffer_size(prz)) {
 		int numerr;
 		int size = prz->ecc_block_size;
+		if (block == head) {
+			block += prz->ecc_block_size;
+			par += prz->ecc_size;
+			continue;
+		}
 		if (block + size > buffer->data + prz->buffer_size)
 			size = buffer->data + prz->buffer_size - block;
 		numerr = persistent_ram_decode_rs8(prz, block, size, par);
@@ -198,6 +224,12 @@ static int persistent_ram_init_ecc(struct persistent_ram_zone *prz,
 	prz->par_buffer = buffer->data + prz->buffer_size;
 	prz->par_header = prz->par_buffer + ecc_blocks * prz->ecc_size;
 
+	prz->ecc_fill = kcalloc(DIV_ROUND_UP(prz->buffer_size,
+					     prz->ecc_block_size),
+				sizeof(*prz->ecc_fill), GFP_KERNEL);
+	if (!prz->ecc_fill)
+		return -ENOMEM;
+
 	prz->rs_decoder = init_rs(prz->ecc_symsize, prz->ecc_poly, 0, 1,
 				  prz->ecc_size);
 	if (prz->rs_decoder == NULL) {
@@ -244,6 +276,79 @@ static void notrace persistent_ram_update(struct persistent_ram_zone *prz,
 	persistent_ram_update_ecc(prz, start, count);
 }
 
+#ifdef CONFIG_ANDROID_PERSISTENT_RAM_COMPRESS
+/*
+ * The old log stays allocated for the whole uptime but is usually read
+ * once, if at all: keep it LZO compressed until the first reader.
+ */
+static void __devinit
+persistent_ram_compress_old(struct persistent_ram_zone *prz)
+{
+	size_t lzo_size = lzo1x_worst_compress(prz->old_log_size);
+	void *wrkmem;
+	char *lzo;
+	char *dest;
+	int ret;
+
+	wrkmem = kmalloc(LZO1X_1_MEM_COMPRESS, GFP_KERNEL);
+	lzo = vmalloc(lzo_size);
+	if (!wrkmem || !lzo)
+		goto out;
+
+	ret = lzo1x_1_compress(prz->old_log, prz->old_log_size, lzo,
+			       &lzo_size, wrkmem);
+	if (ret != LZO_E_OK || lzo_size >= prz->old_log_size)
+		goto out;
+
+	dest = kmalloc(lzo_size, GFP_KERNEL);
+	if (!dest)
+		goto out;
+	memcpy(dest, lzo, lzo_size);
+	kfree(prz->old_log);
+	prz->old_log = dest;
+	prz->old_log_lzo_size = lzo_size;
+	pr_info("persistent_ram: old log compressed from %zu to %zu bytes\n",
+		prz->old_log_size, lzo_size);
+out:
+	vfree(lzo);
+	kfree(wrkmem);
+}
+
+static int persistent_ram_decompress_old(struct persistent_ram_zone *prz)
+{
+	size_t size = prz->old_log_size;
+	char *dest;
+	int ret;
+
+	dest = kmalloc(size, GFP_KERNEL);
+	if (!dest)
+		return -ENOMEM;
+
+	ret = lzo1x_decompress_safe(prz->old_log, prz->old_log_lzo_size,
+				    dest, &size);
+	if (ret != LZO_E_OK || size != prz->old_log_size) {
+		pr_err("persistent_ram: failed to decompress old log, %d\n",
+		       ret);
+		kfree(dest);
+		return -EINVAL;
+	}
+
+	kfree(prz->old_log);
+	prz->old_log = dest;
+	prz->old_log_lzo_size = 0;
+	return 0;
+}
+#else
+static inline void persistent_ram_compress_old(struct persistent_ram_zone *prz)
+{
+}
+
+static inline int persistent_ram_decompress_old(struct persistent_ram_zone *prz)
+{
+	return 0;
+}
+#endif
+
 static void __devinit
 persistent_ram_save_old(struct persistent_ram_zone *prz)
 {
@@ -264,6 +369,8 @@ persistent_ram_save_old(struct persistent_ram_zone *prz)
 	prz->old_log_size = size;
 	memcpy(prz->old_log, &buffer->data[start], size - start);
 	memcpy(prz->old_log + size - start, &buffer->data[0], start);
+
+	persistent_ram_compress_old(prz);
 }
 
 int notrace persistent_ram_write(struct persistent_ram_zone *prz,
@@ -303,14 +410,24 @@ size_t persistent_ram_old_size(struct persistent_ram_zone *prz)
 
 void *persistent_ram_old(struct persistent_ram_zone *prz)
 {
-	return prz->old_log;
+	void *old_log = NULL;
+
+	mutex_lock(&persistent_ram_old_lock);
+	if (!prz->old_log_lzo_size || !persistent_ram_decompress_old(prz))
+		old_log = prz->old_log;
+	mutex_unlock(&persistent_ram_old_lock);
+
+	return old_log;
 }
 
 void persistent_ram_free_old(struct persistent_ram_zone *prz)
 {
+	mutex_lock(&persistent_ram_old_lock);
 	kfree(prz->old_log);
 	prz->old_log = NULL;
 	prz->old_log_size = 0;
+	prz->old_log_lzo_size = 0;
+	mutex_unlock(&persistent_ram_old_lock);
 }
 
 static int persistent_ram_buffer_map(phys_addr_t start, phys_addr_t size,
@@ -424,6 +541,8 @@ struct persistent_ram_zone *__persistent_ram_init(struct device *dev, bool ecc)
 
 	return prz;
 err:
+	if (!IS_ERR_OR_NULL(prz))
+		kfree(prz->ecc_fill);
 	kfree(prz);
 	return ERR_PTR(ret);
 }
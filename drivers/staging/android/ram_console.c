@@ -105,6 +105,8 @@ static ssize_t ram_console_read_old(struct file *file, char __user *buf,
 
 	/* Main last_kmsg log */
 	if (pos < old_log_size) {
+		if (!old_log)
+			return -ENOMEM;
 		count = min(len, (size_t)(old_log_size - pos));
 		if (copy_to_user(buf, old_log + pos, count))
 			return -EFAULT;
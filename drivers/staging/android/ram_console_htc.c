@@ -79,27 +79,33 @@ static int ram_console_decode_rs8(void *data, size_t len, uint8_t *ecc)
 }
 #endif
 
+/*
+ * Console writes are serialized by the console lock. Only the blocks a
+ * write completes are encoded, instead of every block it touches: a block
+ * filled by many short lines used to be encoded once per line. The block
+ * holding the write head has no valid ECC until it fills up, so a reader
+ * of the carveout, the bootloader or an older kernel, reports it as
+ * unrecoverable; ram_console_save_old() skips it.
+ */
 static void ram_console_update(const char *s, unsigned int count)
 {
 	struct ram_console_buffer *buffer = ram_console_buffer;
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
-	uint8_t *buffer_end = buffer->data + ram_console_buffer_size;
-	uint8_t *block;
-	uint8_t *par;
-	int size = ECC_BLOCK_SIZE;
+	size_t end = buffer->start + count;
+	size_t off = buffer->start & ~(ECC_BLOCK_SIZE - 1);
+	size_t size;
 #endif
 	memcpy(buffer->data + buffer->start, s, count);
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
-	block = buffer->data + (buffer->start & ~(ECC_BLOCK_SIZE - 1));
-	par = ram_console_par_buffer +
-	      (buffer->start / ECC_BLOCK_SIZE) * ECC_SIZE;
-	do {
-		if (block + ECC_BLOCK_SIZE > buffer_end)
-			size = buffer_end - block;
-		ram_console_encode_rs8(block, size, par);
-		block += ECC_BLOCK_SIZE;
-		par += ECC_SIZE;
-	} while (block < buffer->data + buffer->start + count);
+	for (; off < end; off += ECC_BLOCK_SIZE) {
+		size = min_t(size_t, ECC_BLOCK_SIZE,
+			     ram_console_buffer_size - off);
+		if (off + size > end)
+			break;
+		ram_console_encode_rs8(buffer->data + off, size,
+				       (uint8_t *)ram_console_par_buffer +
+				       (off / ECC_BLOCK_SIZE) * ECC_SIZE);
+	}
 #endif
 }
 
@@ -211,14 +217,24 @@ ram_console_save_old(struct ram_console_buffer *buffer, const char *bootinfo,
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
 	uint8_t *block;
 	uint8_t *par;
+	uint8_t *head = NULL;
 	char strbuf[80];
 	int strbuf_len = 0;
 
+	/* The block being filled when we went down was never encoded */
+	if (buffer->start % ECC_BLOCK_SIZE)
+		head = buffer->data + (buffer->start & ~(ECC_BLOCK_SIZE - 1));
+
 	block = buffer->data;
 	par = ram_console_par_buffer;
 	while (block < buffer->data + buffer->size) {
 		int numerr;
 		int size = ECC_BLOCK_SIZE;
+		if (block == head) {
+			block += ECC_BLOCK_SIZE;
+			par += ECC_SIZE;
+			continue;
+		}
 		if (block + size > buffer->data + ram_console_buffer_size)
 			size = buffer->data + ram_console_buffer_size - block;
 		numerr = ram_console_decode_rs8(block, size, par);
@@ -0,0 +1,118 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM binder
+
+#if !defined(_TRACE_BINDER_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_BINDER_H
+
+#include <linux/tracepoint.h>
+
+struct binder_buffer;
+struct binder_node;
+struct binder_proc;
+struct binder_thread;
+struct binder_transaction;
+
+TRACE_EVENT(binder_transaction,
+
+	TP_PROTO(bool reply, struct binder_transaction *t,
+		 struct binder_node *target_node),
+
+	TP_ARGS(reply, t, target_node),
+
+	TP_STRUCT__entry(
+		__field(	int,		debug_id	)
+		__field(	int,		target_node	)
+		__field(	int,		to_proc		)
+		__field(	int,		to_thread	)
+		__field(	int,		reply		)
+		__field(	unsigned int,	code		)
+		__field(	unsigned int,	flags		)
+	),
+
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->target_node = target_node ? target_node->debug_id : 0;
+		__entry->to_proc = t->to_proc->pid;
+		__entry->to_thread = t->to_thread ? t->to_thread->pid : 0;
+		__entry->reply = reply;
+		__entry->code = t->code;
+		__entry->flags = t->flags;
+	),
+
+	TP_printk("transaction=%d dest_node=%d dest_proc=%d dest_thread=%d reply=%d flags=0x%x code=0x%x",
+		  __entry->debug_id, __entry->target_node, __entry->to_proc,
+		  __entry->to_thread, __entry->reply, __entry->flags,
+		  __entry->code)
+);
+
+TRACE_EVENT(binder_transaction_received,
+
+	TP_PROTO(struct binder_transaction *t, u32 queue_us),
+
+	TP_ARGS(t, queue_us),
+
+	TP_STRUCT__entry(
+		__field(	int,	debug_id	)
+		__field(	u32,	queue_us	)
+	),
+
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->queue_us = queue_us;
+	),
+
+	TP_printk("transaction=%d queue_us=%u",
+		  __entry->debug_id, __entry->queue_us)
+);
+
+TRACE_EVENT(binder_reply_handled,
+
+	TP_PROTO(struct binder_transaction *in_reply_to, u32 handle_us),
+
+	TP_ARGS(in_reply_to, handle_us),
+
+	TP_STRUCT__entry(
+		__field(	int,	debug_id	)
+		__field(	u32,	handle_us	)
+	),
+
+	TP_fast_assign(
+		__entry->debug_id = in_reply_to->debug_id;
+		__entry->handle_us = handle_us;
+	),
+
+	TP_printk("transaction=%d handle_us=%u",
+		  __entry->debug_id, __entry->handle_us)
+);
+
+TRACE_EVENT(binder_transaction_alloc_buf,
+
+	TP_PROTO(struct binder_buffer *buf),
+
+	TP_ARGS(buf),
+
+	TP_STRUCT__entry(
+		__field(	int,	debug_id	)
+		__field(	size_t,	data_size	)
+		__field(	size_t,	offsets_size	)
+	),
+
+	TP_fast_assign(
+		__entry->debug_id = buf->debug_id;
+		__entry->data_size = buf->data_size;
+		__entry->offsets_size = buf->offsets_size;
+	),
+
+	TP_printk("transaction=%d data_size=%zd offsets_size=%zd",
+		  __entry->debug_id, __entry->data_size,
+		  __entry->offsets_size)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH ../../drivers/staging/android/trace
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE binder
+
+#include <trace/define_trace.h>
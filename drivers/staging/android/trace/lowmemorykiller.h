@@ -0,0 +1,53 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lowmemorykiller
+
+#if !defined(_TRACE_LOWMEMORYKILLER_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_LOWMEMORYKILLER_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(lowmem_select,
+
+	TP_PROTO(struct task_struct *selected, int min_score_adj,
+		 int tasksize, int buckets, s64 elapsed_ns),
+
+	TP_ARGS(selected, min_score_adj, tasksize, buckets, elapsed_ns),
+
+	TP_STRUCT__entry(
+		__field(	pid_t,	pid			)
+		__array(	char,	comm,	TASK_COMM_LEN	)
+		__field(	int,	oom_score_adj		)
+		__field(	int,	min_score_adj		)
+		__field(	int,	tasksize		)
+		__field(	int,	buckets			)
+		__field(	s64,	elapsed_ns		)
+	),
+
+	TP_fast_assign(
+		__entry->pid = selected ? selected->pid : 0;
+		if (selected)
+			memcpy(__entry->comm, selected->comm, TASK_COMM_LEN);
+		else
+			__entry->comm[0] = '\0';
+		__entry->oom_score_adj = selected ?
+			selected->signal->oom_score_adj : 0;
+		__entry->min_score_adj = min_score_adj;
+		__entry->tasksize = tasksize;
+		__entry->buckets = buckets;
+		__entry->elapsed_ns = elapsed_ns;
+	),
+
+	TP_printk("pid=%d comm=%s oom_score_adj=%d min_score_adj=%d size=%d buckets=%d elapsed_ns=%lld",
+		  __entry->pid, __entry->comm, __entry->oom_score_adj,
+		  __entry->min_score_adj, __entry->tasksize, __entry->buckets,
+		  __entry->elapsed_ns)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH ../../drivers/staging/android/trace
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE lowmemorykiller
+
+#include <trace/define_trace.h>
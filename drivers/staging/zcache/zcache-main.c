@@ -972,6 +972,9 @@ static void zcache_put_pool(struct tmem_pool *pool)
 int zcache_new_client(uint16_t cli_id)
 {
 	struct zcache_client *cli = NULL;
+#ifdef CONFIG_FRONTSWAP
+	char name[16];
+#endif
 	int ret = -1;
 
 	if (cli_id == LOCAL_CLIENT)
@@ -984,7 +987,12 @@ int zcache_new_client(uint16_t cli_id)
 		goto out;
 	cli->allocated = 1;
 #ifdef CONFIG_FRONTSWAP
-	cli->zspool = zs_create_pool("zcache", ZCACHE_GFP_MASK);
+	/* Each client's pool needs a name of its own in debugfs */
+	if (cli_id == LOCAL_CLIENT)
+		strlcpy(name, "zcache", sizeof(name));
+	else
+		snprintf(name, sizeof(name), "zcache-%u", cli_id);
+	cli->zspool = zs_create_pool(name, ZCACHE_GFP_MASK);
 	if (cli->zspool == NULL)
 		goto out;
 #endif
@@ -0,0 +1,250 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#include <linux/kernel.h>
+#include <linux/crypto.h>
+#include <linux/gfp.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zcomp.h"
+
+/*
+ * Crypto API compressors zram knows how to drive, default first. Their
+ * decompressors must be reentrant on a single transform, see zcomp->dtfm.
+ */
+static const char * const backends[] = {
+	"lzo",
+	"lz4",
+	NULL
+};
+
+static void zcomp_strm_free(struct zcomp_strm *zstrm)
+{
+	if (!IS_ERR_OR_NULL(zstrm->tfm))
+		crypto_free_comp(zstrm->tfm);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	kfree(zstrm);
+}
+
+/*
+ * Crypto transforms are allocated with GFP_KERNEL, so streams must never
+ * be allocated on the I/O path: they are set up by zcomp_create() and
+ * zcomp_set_max_streams() only.
+ */
+static struct zcomp_strm *zcomp_strm_alloc(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	zstrm = kzalloc(sizeof(*zstrm), GFP_KERNEL);
+	if (!zstrm)
+		return NULL;
+
+	zstrm->tfm = crypto_alloc_comp(comp->name, 0, 0);
+	zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (IS_ERR(zstrm->tfm) || !zstrm->buffer) {
+		zcomp_strm_free(zstrm);
+		return NULL;
+	}
+
+	return zstrm;
+}
+
+/*
+ * Get an idle compression stream, sleeping until another user releases
+ * one if all of them are busy. Callers must not hold locks that a stream
+ * owner may wait for.
+ */
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	spin_lock(&comp->strm_lock);
+	while (list_empty(&comp->idle_strm)) {
+		comp->strm_waits++;
+		spin_unlock(&comp->strm_lock);
+		wait_event(comp->strm_wait, !list_empty(&comp->idle_strm));
+		spin_lock(&comp->strm_lock);
+	}
+	zstrm = list_first_entry(&comp->idle_strm, struct zcomp_strm, list);
+	list_del(&zstrm->list);
+	spin_unlock(&comp->strm_lock);
+
+	return zstrm;
+}
+
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm)
+{
+	spin_lock(&comp->strm_lock);
+	if (comp->avail_strm <= comp->max_strm) {
+		list_add(&zstrm->list, &comp->idle_strm);
+		spin_unlock(&comp->strm_lock);
+		wake_up(&comp->strm_wait);
+		return;
+	}
+
+	/* The limit was lowered while this stream was busy */
+	comp->avail_strm--;
+	spin_unlock(&comp->strm_lock);
+	zcomp_strm_free(zstrm);
+}
+
+int zcomp_set_max_streams(struct zcomp *comp, int num_strm)
+{
+	struct zcomp_strm *zstrm;
+	int ret = 0;
+
+	if (num_strm < 1)
+		return -EINVAL;
+
+	spin_lock(&comp->strm_lock);
+	comp->max_strm = num_strm;
+	while (comp->avail_strm > num_strm &&
+			!list_empty(&comp->idle_strm)) {
+		zstrm = list_first_entry(&comp->idle_strm,
+				struct zcomp_strm, list);
+		list_del(&zstrm->list);
+		comp->avail_strm--;
+		spin_unlock(&comp->strm_lock);
+		zcomp_strm_free(zstrm);
+		spin_lock(&comp->strm_lock);
+	}
+
+	while (comp->avail_strm < num_strm) {
+		spin_unlock(&comp->strm_lock);
+		zstrm = zcomp_strm_alloc(comp);
+		spin_lock(&comp->strm_lock);
+		if (!zstrm) {
+			ret = -ENOMEM;
+			break;
+		}
+		list_add(&zstrm->list, &comp->idle_strm);
+		comp->avail_strm++;
+	}
+	spin_unlock(&comp->strm_lock);
+	wake_up_all(&comp->strm_wait);
+
+	return ret;
+}
+
+u64 zcomp_strm_waits(struct zcomp *comp)
+{
+	u64 val;
+
+	spin_lock(&comp->strm_lock);
+	val = comp->strm_waits;
+	spin_unlock(&comp->strm_lock);
+
+	return val;
+}
+
+int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
+		const unsigned char *src, size_t *dst_len)
+{
+	/* The output buffer is two pages, see struct zcomp_strm */
+	unsigned int dlen = 2 * PAGE_SIZE;
+	int ret;
+
+	ret = crypto_comp_compress(zstrm->tfm, src, PAGE_SIZE,
+			zstrm->buffer, &dlen);
+	*dst_len = dlen;
+
+	return ret;
+}
+
+int zcomp_decompress(struct zcomp *comp, const unsigned char *src,
+		size_t src_len, unsigned char *dst)
+{
+	unsigned int dlen = PAGE_SIZE;
+
+	return crypto_comp_decompress(comp->dtfm, src, src_len, dst, &dlen);
+}
+
+bool zcomp_available_algorithm(const char *comp)
+{
+	int i;
+
+	for (i = 0; backends[i]; i++) {
+		if (!strcmp(comp, backends[i]))
+			return crypto_has_comp(comp, 0, 0);
+	}
+
+	return false;
+}
+
+/* List the usable backends, with the current one in brackets */
+ssize_t zcomp_available_show(const char *comp, char *buf)
+{
+	ssize_t sz = 0;
+	int i;
+
+	for (i = 0; backends[i]; i++) {
+		if (!crypto_has_comp(backends[i], 0, 0))
+			continue;
+
+		if (!strcmp(comp, backends[i]))
+			sz += sprintf(buf + sz, "[%s] ", backends[i]);
+		else
+			sz += sprintf(buf + sz, "%s ", backends[i]);
+	}
+	sz += sprintf(buf + sz, "\n");
+
+	return sz;
+}
+
+const char *zcomp_default_algorithm(void)
+{
+	return backends[0];
+}
+
+struct zcomp *zcomp_create(const char *compress, int max_strm)
+{
+	struct zcomp *comp;
+
+	if (!zcomp_available_algorithm(compress))
+		return NULL;
+
+	comp = kzalloc(sizeof(*comp), GFP_KERNEL);
+	if (!comp)
+		return NULL;
+
+	spin_lock_init(&comp->strm_lock);
+	INIT_LIST_HEAD(&comp->idle_strm);
+	init_waitqueue_head(&comp->strm_wait);
+	strlcpy(comp->name, compress, sizeof(comp->name));
+
+	comp->dtfm = crypto_alloc_comp(comp->name, 0, 0);
+	if (IS_ERR(comp->dtfm) || zcomp_set_max_streams(comp, max_strm)) {
+		zcomp_destroy(comp);
+		return NULL;
+	}
+
+	return comp;
+}
+
+void zcomp_destroy(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	while (!list_empty(&comp->idle_strm)) {
+		zstrm = list_first_entry(&comp->idle_strm,
+				struct zcomp_strm, list);
+		list_del(&zstrm->list);
+		zcomp_strm_free(zstrm);
+	}
+	if (!IS_ERR_OR_NULL(comp->dtfm))
+		crypto_free_comp(comp->dtfm);
+	kfree(comp);
+}
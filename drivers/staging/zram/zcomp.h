@@ -0,0 +1,67 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#ifndef _ZCOMP_H_
+#define _ZCOMP_H_
+
+#include <linux/crypto.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+/*
+ * Compression stream: the crypto transform and output buffer needed by
+ * one compression in flight. Writes take an idle stream, so up to
+ * max_strm pages can be compressed concurrently.
+ */
+struct zcomp_strm {
+	struct crypto_comp *tfm;
+	/* compressed output; two pages since it can exceed PAGE_SIZE */
+	void *buffer;
+	struct list_head list;
+};
+
+struct zcomp {
+	/*
+	 * Shared by all readers: the backends keep no state in the
+	 * transform when decompressing, so no stream is needed for it.
+	 */
+	struct crypto_comp *dtfm;
+	spinlock_t strm_lock;	/* protects idle_strm and the counters */
+	struct list_head idle_strm;
+	wait_queue_head_t strm_wait;
+	int max_strm;		/* streams allowed */
+	int avail_strm;		/* streams currently allocated */
+	u64 strm_waits;		/* writes that had to wait for a stream */
+	char name[CRYPTO_MAX_ALG_NAME];	/* crypto API compressor */
+};
+
+bool zcomp_available_algorithm(const char *comp);
+ssize_t zcomp_available_show(const char *comp, char *buf);
+const char *zcomp_default_algorithm(void);
+
+struct zcomp *zcomp_create(const char *compress, int max_strm);
+void zcomp_destroy(struct zcomp *comp);
+
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp);
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm);
+int zcomp_set_max_streams(struct zcomp *comp, int num_strm);
+u64 zcomp_strm_waits(struct zcomp *comp);
+
+int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
+		const unsigned char *src, size_t *dst_len);
+int zcomp_decompress(struct zcomp *comp, const unsigned char *src,
+		size_t src_len, unsigned char *dst);
+
+#endif /* _ZCOMP_H_ */
@@ -25,13 +25,16 @@
 #include <linux/bitops.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
+#include <linux/completion.h>
 #include <linux/device.h>
+#include <linux/fs.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
+#include <linux/time.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
 
@@ -89,21 +92,38 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
+static void zram_fill_page(void *ptr, unsigned int len, unsigned long value)
+{
+	unsigned int pos;
+	unsigned long *page;
+
+	if (likely(!value)) {
+		memset(ptr, 0, len);
+		return;
+	}
+
+	page = (unsigned long *)ptr;
+
+	for (pos = 0; pos != len / sizeof(*page); pos++)
+		page[pos] = value;
+}
+
 static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 {
 	if (!zram->disksize) {
@@ -133,22 +153,188 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+static u32 zram_now(void)
+{
+	struct timespec ts;
+
+	get_monotonic_boottime(&ts);
+	return ts.tv_sec;
+}
+
+static void zram_accessed(struct zram *zram, u32 index)
+{
+	zram->table[index].ac_time = zram_now();
+}
+
+/* Block 0 is never handed out, so that it can mean "none" */
+static unsigned long alloc_block_bdev(struct zram *zram)
+{
+	unsigned long blk_idx = 1;
+retry:
+	blk_idx = find_next_zero_bit(zram->bitmap, zram->nr_pages, blk_idx);
+	if (blk_idx == zram->nr_pages)
+		return 0;
+
+	if (test_and_set_bit(blk_idx, zram->bitmap))
+		goto retry;
+
+	return blk_idx;
+}
+
+static void free_block_bdev(struct zram *zram, unsigned long blk_idx)
+{
+	WARN_ON_ONCE(!test_and_clear_bit(blk_idx, zram->bitmap));
+}
+
+static void zram_bdev_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+static int zram_bdev_rw_sync(struct zram *zram, struct page *page,
+			     unsigned long blk_idx, int rw)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct bio *bio;
+	int ret = 0;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_sector = (sector_t)blk_idx << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_bdev = zram->bdev;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+	bio->bi_end_io = zram_bdev_end_io;
+	bio->bi_private = &done;
+
+	submit_bio(rw | REQ_SYNC, bio);
+	wait_for_completion(&done);
+
+	if (!test_bit(BIO_UPTODATE, &bio->bi_flags))
+		ret = -EIO;
+	bio_put(bio);
+
+	return ret;
+}
+
+struct zram_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk_idx;
+	int ret;
+};
+
+static void zram_sync_read(struct work_struct *work)
+{
+	struct zram_work *zw = container_of(work, struct zram_work, work);
+
+	zw->ret = zram_bdev_rw_sync(zw->zram, zw->page, zw->blk_idx, READ);
+}
+
+/*
+ * Bios submitted from within zram's make_request function are only
+ * dispatched once it returns, so waiting for one here would deadlock.
+ * Do the read from a worker instead.
+ *
+ * Called with zram->lock held for read. It is dropped while the read is
+ * in flight so that writers and writeback are not held up by the backing
+ * device. Returns -EAGAIN if the slot no longer points at the block read
+ * when the lock is back; the caller has to look at the slot again. A
+ * slot that points at the same block again can only have been rewritten
+ * by a write overlapping this read, which may return either content.
+ */
+static int read_from_bdev(struct zram *zram, struct page *page, u32 index)
+{
+	struct zram_work work;
+
+	work.zram = zram;
+	work.page = page;
+	work.blk_idx = zram->table[index].element;
+
+	up_read(&zram->lock);
+	INIT_WORK_ONSTACK(&work.work, zram_sync_read);
+	queue_work(system_unbound_wq, &work.work);
+	flush_work(&work.work);
+	destroy_work_on_stack(&work.work);
+	down_read(&zram->lock);
+
+	if (!zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram->table[index].element != work.blk_idx)
+		return -EAGAIN;
+
+	if (!work.ret)
+		zram_stat64_inc(zram, &zram->stats.bd_reads);
+
+	return work.ret;
+}
+
+/* Read a written back page into a PAGE_SIZE buffer */
+static int read_from_bdev_to_buf(struct zram *zram, unsigned char *mem,
+				 u32 index)
+{
+	struct page *page;
+	unsigned char *src;
+	int ret;
+
+	page = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+	if (!page)
+		return -ENOMEM;
+
+	ret = read_from_bdev(zram, page, index);
+	if (!ret) {
+		src = kmap_atomic(page);
+		memcpy(mem, src, PAGE_SIZE);
+		kunmap_atomic(src);
+	}
+	__free_page(page);
+
+	return ret;
+}
+#else
+static inline void zram_accessed(struct zram *zram, u32 index)
+{
+}
+#endif
+
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	void *handle = zram->table[index].handle;
 
-	if (unlikely(!handle)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			zram_clear_flag(zram, index, ZRAM_ZERO);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* Tell a writeback in progress that the page changed under it */
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		free_block_bdev(zram, zram->table[index].element);
+		zram_stat_dec(&zram->stats.bd_count);
+		zram->table[index].element = 0;
+		return;
+	}
+#endif
+
+	/*
+	 * No memory is allocated for same filled pages.
+	 * Simply clear the flag and the fill word.
+	 */
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		if (!zram->table[index].element)
 			zram_stat_dec(&zram->stats.pages_zero);
-		}
+		zram_stat_dec(&zram->stats.pages_same);
+		zram->table[index].element = 0;
 		return;
 	}
 
+	if (unlikely(!handle))
+		return;
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		__free_page(handle);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
@@ -170,13 +356,14 @@ out:
 	zram->table[index].size = 0;
 }
 
-static void handle_zero_page(struct bio_vec *bvec)
+static void handle_same_page(struct bio_vec *bvec, unsigned long element)
 {
 	struct page *page = bvec->bv_page;
 	void *user_mem;
 
 	user_mem = kmap_atomic(page);
-	memset(user_mem + bvec->bv_offset, 0, bvec->bv_len);
+	/* bvecs are sector aligned, so the word pattern stays in phase */
+	zram_fill_page(user_mem + bvec->bv_offset, bvec->bv_len, element);
 	kunmap_atomic(user_mem);
 
 	flush_dcache_page(page);
@@ -203,27 +390,84 @@ static inline int is_partial_io(struct bio_vec *bvec)
 	return bvec->bv_len != PAGE_SIZE;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+static int zram_bvec_read_bdev(struct zram *zram, struct bio_vec *bvec,
+			       u32 index, int offset)
+{
+	struct page *page;
+	unsigned char *user_mem, *src;
+	int ret;
+
+	if (!is_partial_io(bvec)) {
+		ret = read_from_bdev(zram, bvec->bv_page, index);
+		goto out;
+	}
+
+	page = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+	if (!page)
+		return -ENOMEM;
+
+	ret = read_from_bdev(zram, page, index);
+	if (!ret) {
+		user_mem = kmap_atomic(bvec->bv_page);
+		src = kmap_atomic(page);
+		memcpy(user_mem + bvec->bv_offset, src + offset,
+		       bvec->bv_len);
+		kunmap_atomic(src);
+		kunmap_atomic(user_mem);
+	}
+	__free_page(page);
+
+out:
+	if (ret == -EAGAIN)
+		return ret;
+	if (unlikely(ret)) {
+		pr_err("Backing device read failed! err=%d, page=%u\n",
+		       ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return ret;
+	}
+
+	flush_dcache_page(bvec->bv_page);
+	return 0;
+}
+#endif
+
+/* Called with zram->lock held for read; a backing device read drops it */
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 			  u32 index, int offset, struct bio *bio)
 {
 	int ret;
-	size_t clen;
 	struct page *page;
 	struct zobj_header *zheader;
 	unsigned char *user_mem, *cmem, *uncmem = NULL;
 
 	page = bvec->bv_page;
 
-	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-		handle_zero_page(bvec);
+#ifdef CONFIG_ZRAM_WRITEBACK
+retry:
+#endif
+	zram_accessed(zram, index);
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		handle_same_page(bvec, zram->table[index].element);
 		return 0;
 	}
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		ret = zram_bvec_read_bdev(zram, bvec, index, offset);
+		if (ret == -EAGAIN)
+			goto retry;
+		return ret;
+	}
+#endif
+
 	/* Requested page is not present in compressed area */
 	if (unlikely(!zram->table[index].handle)) {
 		pr_debug("Read before write: sector=%lu, size=%u",
 			 (ulong)(bio->bi_sector), bio->bi_size);
-		handle_zero_page(bvec);
+		handle_same_page(bvec, 0);
 		return 0;
 	}
 
@@ -245,13 +489,11 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	user_mem = kmap_atomic(page);
 	if (!is_partial_io(bvec))
 		uncmem = user_mem;
-	clen = PAGE_SIZE;
 
 	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    zram->table[index].size,
-				    uncmem, &clen);
+	ret = zcomp_decompress(zram->comp, cmem + sizeof(*zheader),
+			       zram->table[index].size, uncmem);
 
 	if (is_partial_io(bvec)) {
 		memcpy(user_mem + bvec->bv_offset, uncmem + offset,
@@ -263,7 +505,7 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	kunmap_atomic(user_mem);
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		zram_stat64_inc(zram, &zram->stats.failed_reads);
 		return ret;
@@ -274,35 +516,51 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	return 0;
 }
 
-static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
+/* Called with zram->lock held for read; a backing device read drops it */
+static int zram_read_before_write(struct zram *zram, unsigned char *mem,
+				  u32 index)
 {
 	int ret;
-	size_t clen = PAGE_SIZE;
 	struct zobj_header *zheader;
 	unsigned char *cmem;
 
-	if (zram_test_flag(zram, index, ZRAM_ZERO) ||
-	    !zram->table[index].handle) {
-		memset(mem, 0, PAGE_SIZE);
+#ifdef CONFIG_ZRAM_WRITEBACK
+retry:
+#endif
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_fill_page(mem, PAGE_SIZE, zram->table[index].element);
 		return 0;
 	}
 
-	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		ret = read_from_bdev_to_buf(zram, mem, index);
+		if (ret == -EAGAIN)
+			goto retry;
+		return ret;
+	}
+#endif
+
+	if (!zram->table[index].handle) {
+		memset(mem, 0, PAGE_SIZE);
+		return 0;
+	}
 
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		cmem = kmap_atomic(zram->table[index].handle);
 		memcpy(mem, cmem, PAGE_SIZE);
 		kunmap_atomic(cmem);
 		return 0;
 	}
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    zram->table[index].size,
-				    mem, &clen);
+	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
+	ret = zcomp_decompress(zram->comp, cmem + sizeof(*zheader),
+			       zram->table[index].size, mem);
 	zs_unmap_object(zram->mem_pool, zram->table[index].handle);
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		zram_stat64_inc(zram, &zram->stats.failed_reads);
 		return ret;
@@ -314,16 +572,17 @@ static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
 static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			   int offset)
 {
-	int ret;
-	u32 store_offset;
+	int ret = 0;
 	size_t clen;
 	void *handle;
 	struct zobj_header *zheader;
 	struct page *page, *page_store;
+	struct zcomp_strm *zstrm;
 	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
+	unsigned long element;
+	int uncompressed = 0, same;
 
 	page = bvec->bv_page;
-	src = zram->compress_buffer;
 
 	if (is_partial_io(bvec)) {
 		/*
@@ -336,47 +595,59 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			ret = -ENOMEM;
 			goto out;
 		}
+		down_read(&zram->lock);
 		ret = zram_read_before_write(zram, uncmem, index);
-		if (ret) {
-			kfree(uncmem);
+		up_read(&zram->lock);
+		if (ret)
 			goto out;
-		}
 	}
 
-	/*
-	 * System overwrites unused sectors. Free memory associated
-	 * with this sector now.
-	 */
-	if (zram->table[index].handle ||
-	    zram_test_flag(zram, index, ZRAM_ZERO))
-		zram_free_page(zram, index);
-
 	user_mem = kmap_atomic(page);
-
-	if (is_partial_io(bvec))
+	if (is_partial_io(bvec)) {
 		memcpy(uncmem + offset, user_mem + bvec->bv_offset,
 		       bvec->bv_len);
-	else
-		uncmem = user_mem;
+		same = page_same_filled(uncmem, &element);
+	} else {
+		same = page_same_filled(user_mem, &element);
+	}
+	kunmap_atomic(user_mem);
 
-	if (page_zero_filled(uncmem)) {
-		kunmap_atomic(user_mem);
-		if (is_partial_io(bvec))
-			kfree(uncmem);
-		zram_stat_inc(&zram->stats.pages_zero);
-		zram_set_flag(zram, index, ZRAM_ZERO);
-		ret = 0;
+	/* Same filled pages need neither a stream nor pool memory */
+	if (same) {
+		down_write(&zram->lock);
+		zram_free_page(zram, index);
+		zram->table[index].element = element;
+		zram_set_flag(zram, index, ZRAM_SAME);
+		zram_stat_inc(&zram->stats.pages_same);
+		if (!element)
+			zram_stat_inc(&zram->stats.pages_zero);
+		zram_accessed(zram, index);
+		up_write(&zram->lock);
 		goto out;
 	}
 
-	ret = lzo1x_1_compress(uncmem, PAGE_SIZE, src, &clen,
-			       zram->compress_workmem);
+	/*
+	 * Compression runs without zram->lock held, on a stream of its
+	 * own, so that concurrent writers compress in parallel. The lock
+	 * is only taken to publish the result in the table.
+	 */
+	zstrm = zcomp_strm_find(zram->comp);
+	if (is_partial_io(bvec)) {
+		user_mem = NULL;
+	} else {
+		user_mem = kmap_atomic(page);
+		uncmem = user_mem;
+	}
+
+	ret = zcomp_compress(zram->comp, zstrm, uncmem, &clen);
 
-	kunmap_atomic(user_mem);
-	if (is_partial_io(bvec))
-			kfree(uncmem);
+	if (user_mem) {
+		kunmap_atomic(user_mem);
+		uncmem = NULL;
+	}
 
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
+		zcomp_strm_release(zram->comp, zstrm);
 		pr_err("Compression failed! err=%d\n", ret);
 		goto out;
 	}
@@ -387,6 +658,7 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	 * errors which has side effect of hanging the system.
 	 */
 	if (unlikely(clen > max_zpage_size)) {
+		zcomp_strm_release(zram->comp, zstrm);
 		clen = PAGE_SIZE;
 		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 		if (unlikely(!page_store)) {
@@ -396,17 +668,20 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			goto out;
 		}
 
-		store_offset = 0;
-		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_inc(&zram->stats.pages_expand);
+		uncompressed = 1;
 		handle = page_store;
-		src = kmap_atomic(page);
+		src = uncmem ? uncmem : kmap_atomic(page);
 		cmem = kmap_atomic(page_store);
-		goto memstore;
+		memcpy(cmem, src, clen);
+		kunmap_atomic(cmem);
+		if (!uncmem)
+			kunmap_atomic(src);
+		goto update;
 	}
 
 	handle = zs_malloc(zram->mem_pool, clen + sizeof(*zheader));
 	if (!handle) {
+		zcomp_strm_release(zram->comp, zstrm);
 		pr_info("Error allocating memory for compressed "
 			"page: %u, size=%zu\n", index, clen);
 		ret = -ENOMEM;
@@ -414,42 +689,220 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	}
 	cmem = zs_map_object(zram->mem_pool, handle);
 
-memstore:
 #if 0
 	/* Back-reference needed for memory defragmentation */
-	if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
-	}
+	zheader = (struct zobj_header *)cmem;
+	zheader->table_idx = index;
+	cmem += sizeof(*zheader);
 #endif
 
-	memcpy(cmem, src, clen);
+	memcpy(cmem, zstrm->buffer, clen);
+	zs_unmap_object(zram->mem_pool, handle);
+	zcomp_strm_release(zram->comp, zstrm);
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		kunmap_atomic(cmem);
-		kunmap_atomic(src);
-	} else {
-		zs_unmap_object(zram->mem_pool, handle);
-	}
+update:
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	down_write(&zram->lock);
+	zram_free_page(zram, index);
 
 	zram->table[index].handle = handle;
 	zram->table[index].size = clen;
+	if (uncompressed) {
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(&zram->stats.pages_expand);
+	}
 
 	/* Update stats */
 	zram_stat64_add(zram, &zram->stats.compr_size, clen);
 	zram_stat_inc(&zram->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_inc(&zram->stats.good_compress);
-
-	return 0;
+	zram_accessed(zram, index);
+	up_write(&zram->lock);
 
 out:
+	if (is_partial_io(bvec))
+		kfree(uncmem);
 	if (ret)
 		zram_stat64_inc(zram, &zram->stats.failed_writes);
 	return ret;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+static bool zram_wb_candidate(struct zram *zram, u32 index,
+			      enum zram_wb_mode mode, u32 now)
+{
+	if (!zram->table[index].handle ||
+	    zram_test_flag(zram, index, ZRAM_SAME) ||
+	    zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		return false;
+
+	if (mode == ZRAM_WB_HUGE)
+		return zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+
+	return now - zram->table[index].ac_time >= zram->wb_idle_age;
+}
+
+/*
+ * Move pages matching @mode to the backing device, one at a time, and
+ * release their memory. Called with init_lock held for read on an
+ * initialized device.
+ */
+int zram_writeback(struct zram *zram, enum zram_wb_mode mode)
+{
+	unsigned long nr_pages = zram->disksize >> PAGE_SHIFT;
+	unsigned long blk_idx = 0;
+	struct page *page;
+	u32 index, now;
+	void *mem;
+	int ret = 0, err;
+
+	if (!zram->backing_dev)
+		return -ENODEV;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	now = zram_now();
+	for (index = 0; index < nr_pages; index++) {
+		if (!blk_idx) {
+			blk_idx = alloc_block_bdev(zram);
+			if (!blk_idx) {
+				ret = -ENOSPC;
+				break;
+			}
+		}
+
+		down_write(&zram->lock);
+		if (!zram_wb_candidate(zram, index, mode, now)) {
+			up_write(&zram->lock);
+			continue;
+		}
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		up_write(&zram->lock);
+
+		/* kmap() may sleep, so map the page before taking the lock */
+		mem = kmap(page);
+		down_read(&zram->lock);
+		err = zram_read_before_write(zram, mem, index);
+		up_read(&zram->lock);
+		kunmap(page);
+
+		if (!err)
+			err = zram_bdev_rw_sync(zram, page, blk_idx, WRITE);
+
+		down_write(&zram->lock);
+		/* zram_free_page() drops the flag if the page was rewritten */
+		if (!zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			up_write(&zram->lock);
+			continue;
+		}
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		if (err) {
+			up_write(&zram->lock);
+			ret = err;
+			break;
+		}
+
+		zram_free_page(zram, index);
+		zram->table[index].element = blk_idx;
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram_stat_inc(&zram->stats.bd_count);
+		zram_stat64_inc(zram, &zram->stats.bd_writes);
+		up_write(&zram->lock);
+
+		blk_idx = 0;
+		cond_resched();
+	}
+
+	if (blk_idx)
+		free_block_bdev(zram, blk_idx);
+	__free_page(page);
+
+	return ret;
+}
+
+static void zram_reset_bdev(struct zram *zram)
+{
+	if (!zram->backing_dev)
+		return;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	filp_close(zram->backing_dev, NULL);
+	vfree(zram->bitmap);
+
+	zram->backing_dev = NULL;
+	zram->bdev = NULL;
+	zram->bitmap = NULL;
+	zram->nr_pages = 0;
+}
+
+/* Called with init_lock held for write on an uninitialized device */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	struct file *backing_dev;
+	struct block_device *bdev;
+	struct inode *inode;
+	unsigned long *bitmap;
+	unsigned long nr_pages;
+	int ret;
+
+	backing_dev = filp_open(path, O_RDWR | O_LARGEFILE, 0);
+	if (IS_ERR(backing_dev))
+		return PTR_ERR(backing_dev);
+
+	inode = backing_dev->f_mapping->host;
+	if (!S_ISBLK(inode->i_mode)) {
+		ret = -ENOTBLK;
+		goto out_close;
+	}
+
+	/* Block 0 is reserved, see alloc_block_bdev() */
+	nr_pages = i_size_read(inode) >> PAGE_SHIFT;
+	if (nr_pages < 2) {
+		ret = -EINVAL;
+		goto out_close;
+	}
+
+	bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	if (!bitmap) {
+		ret = -ENOMEM;
+		goto out_close;
+	}
+
+	bdev = bdgrab(I_BDEV(inode));
+	ret = blkdev_get(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL, zram);
+	if (ret < 0)
+		goto out_free;
+
+	ret = set_blocksize(bdev, PAGE_SIZE);
+	if (ret < 0) {
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+		goto out_free;
+	}
+
+	zram_reset_bdev(zram);
+	zram->backing_dev = backing_dev;
+	zram->bdev = bdev;
+	zram->bitmap = bitmap;
+	zram->nr_pages = nr_pages;
+
+	pr_info("setup backing device %s\n", path);
+	return 0;
+
+out_free:
+	vfree(bitmap);
+out_close:
+	filp_close(backing_dev, NULL);
+	return ret;
+}
+#endif
+
 static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 			int offset, struct bio *bio, int rw)
 {
@@ -460,9 +913,7 @@ static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 		ret = zram_bvec_read(zram, bvec, index, offset, bio);
 		up_read(&zram->lock);
 	} else {
-		down_write(&zram->lock);
 		ret = zram_bvec_write(zram, bvec, index, offset);
-		up_write(&zram->lock);
 	}
 
 	return ret;
@@ -584,17 +1035,19 @@ void __zram_reset_device(struct zram *zram)
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	if (zram->comp)
+		zcomp_destroy(zram->comp);
+	zram->comp = NULL;
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
 		void *handle = zram->table[index].handle;
-		if (!handle)
+		if (!handle || zram_test_flag(zram, index, ZRAM_SAME))
 			continue;
+#ifdef CONFIG_ZRAM_WRITEBACK
+		if (zram_test_flag(zram, index, ZRAM_WB))
+			continue;
+#endif
 
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
 			__free_page(handle);
@@ -608,6 +1061,10 @@ void __zram_reset_device(struct zram *zram)
 	zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram_reset_bdev(zram);
+#endif
+
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
 
@@ -635,17 +1092,9 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail_no_table;
-	}
-
-	zram->compress_buffer =
-		(void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
+	zram->comp = zcomp_create(zram->compressor, zram->max_comp_streams);
+	if (!zram->comp) {
+		pr_err("Error initializing %s compressor\n", zram->compressor);
 		ret = -ENOMEM;
 		goto fail_no_table;
 	}
@@ -663,7 +1112,9 @@ int zram_init_device(struct zram *zram)
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = zs_create_pool("zram", GFP_NOIO | __GFP_HIGHMEM);
+	/* Named after the disk, for the per-pool zsmalloc debugfs stats */
+	zram->mem_pool = zs_create_pool(zram->disk->disk_name,
+					GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -708,6 +1159,12 @@ static int create_device(struct zram *zram, int device_id)
 	init_rwsem(&zram->lock);
 	init_rwsem(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	zram->max_comp_streams = num_online_cpus();
+	strlcpy(zram->compressor, zcomp_default_algorithm(),
+		sizeof(zram->compressor));
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram->wb_idle_age = ZRAM_DEFAULT_WB_IDLE_AGE;
+#endif
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -844,6 +1301,10 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+#ifdef CONFIG_ZRAM_WRITEBACK
+		/* A backing device may be set on a never initialized disk */
+		zram_reset_bdev(zram);
+#endif
 	}
 
 	unregister_blkdev(zram_major, "zram");
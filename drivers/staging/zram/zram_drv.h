@@ -19,6 +19,7 @@
 #include <linux/mutex.h>
 
 #include "../zsmalloc/zsmalloc.h"
+#include "zcomp.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -43,6 +44,9 @@ struct zobj_header {
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
+/* Default age in seconds after which a page is idle for writeback */
+#define ZRAM_DEFAULT_WB_IDLE_AGE	3600
+
 /*
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
@@ -71,8 +75,17 @@ enum zram_pageflags {
 	/* Page is stored uncompressed */
 	ZRAM_UNCOMPRESSED,
 
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO,
+	/*
+	 * Page is filled with one repeated word, kept in table.element
+	 * instead of the pool. Zero filled pages are the common case.
+	 */
+	ZRAM_SAME,
+
+	/* Page was written back, table.element is its backing dev block */
+	ZRAM_WB,
+
+	/* Page is being written back to the backing device */
+	ZRAM_UNDER_WB,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
@@ -81,10 +94,16 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct table {
-	void *handle;
+	union {
+		void *handle;
+		unsigned long element;	/* fill word of ZRAM_SAME pages */
+	};
 	u16 size;	/* object size (excluding header) */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	u32 ac_time;	/* last access, seconds since boot */
+#endif
 } __attribute__((aligned(4)));
 
 struct zram_stats {
@@ -96,19 +115,24 @@ struct zram_stats {
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
 	u32 pages_zero;		/* no. of zero filled pages */
+	u32 pages_same;		/* no. of same element filled pages */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	u64 bd_reads;		/* pages read back from the backing device */
+	u64 bd_writes;		/* pages written back */
+	u32 bd_count;		/* pages currently on the backing device */
+#endif
 };
 
 struct zram {
 	struct zs_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zcomp *comp;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct rw_semaphore lock; /* protect compression buffers and table
-				   * against concurrent read and writes */
+	struct rw_semaphore lock; /* protect table against concurrent
+				   * read and writes */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -119,6 +143,18 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	/* Number of pages that can be compressed in parallel */
+	int max_comp_streams;
+	/* Crypto API compressor, can only be changed before init */
+	char compressor[CRYPTO_MAX_ALG_NAME];
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* Block device cold pages are written back to, set before init */
+	struct file *backing_dev;
+	struct block_device *bdev;
+	unsigned long *bitmap;		/* backing dev blocks in use */
+	unsigned long nr_pages;		/* backing dev size in pages */
+	u32 wb_idle_age;		/* seconds before a page is idle */
+#endif
 
 	struct zram_stats stats;
 };
@@ -132,4 +168,15 @@ extern struct attribute_group zram_disk_attr_group;
 extern int zram_init_device(struct zram *zram);
 extern void __zram_reset_device(struct zram *zram);
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* Modes of zram_writeback() */
+enum zram_wb_mode {
+	ZRAM_WB_IDLE,	/* pages not accessed for wb_idle_age seconds */
+	ZRAM_WB_HUGE,	/* pages stored uncompressed */
+};
+
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern int zram_writeback(struct zram *zram, enum zram_wb_mode mode);
+#endif
+
 #endif
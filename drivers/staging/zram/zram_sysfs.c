@@ -15,6 +15,8 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/string.h>
 
 #include "zram_drv.h"
 
@@ -76,6 +78,76 @@ static ssize_t disksize_store(struct device *dev,
 	return len;
 }
 
+static ssize_t max_comp_streams_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	int val;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	val = zram->max_comp_streams;
+	up_read(&zram->init_lock);
+
+	return sprintf(buf, "%d\n", val);
+}
+
+static ssize_t max_comp_streams_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret, num;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = kstrtoint(buf, 10, &num);
+	if (ret)
+		return ret;
+	if (num < 1)
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (zram->init_done)
+		zcomp_set_max_streams(zram->comp, num);
+	zram->max_comp_streams = num;
+	up_write(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t comp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	ssize_t sz;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	sz = zcomp_available_show(zram->compressor, buf);
+	up_read(&zram->init_lock);
+
+	return sz;
+}
+
+static ssize_t comp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	char compressor[CRYPTO_MAX_ALG_NAME], *name;
+	struct zram *zram = dev_to_zram(dev);
+
+	strlcpy(compressor, buf, sizeof(compressor));
+	name = strim(compressor);
+	if (!zcomp_available_algorithm(name))
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (zram->init_done) {
+		up_write(&zram->init_lock);
+		pr_info("Cannot change algorithm for initialized device\n");
+		return -EBUSY;
+	}
+	strlcpy(zram->compressor, name, sizeof(zram->compressor));
+	up_write(&zram->init_lock);
+
+	return len;
+}
+
 static ssize_t initstate_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
@@ -162,6 +234,14 @@ static ssize_t zero_pages_show(struct device *dev,
 	return sprintf(buf, "%u\n", zram->stats.pages_zero);
 }
 
+static ssize_t same_pages_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->stats.pages_same);
+}
+
 static ssize_t orig_data_size_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
@@ -180,6 +260,179 @@ static ssize_t compr_data_size_show(struct device *dev,
 		zram_stat64_read(zram, &zram->stats.compr_size));
 }
 
+static ssize_t comp_stream_waits_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	u64 val = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	if (zram->init_done)
+		val = zcomp_strm_waits(zram->comp);
+	up_read(&zram->init_lock);
+
+	return sprintf(buf, "%llu\n", val);
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+static ssize_t backing_dev_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	char *p;
+	ssize_t ret;
+
+	down_read(&zram->init_lock);
+	if (!zram->backing_dev) {
+		up_read(&zram->init_lock);
+		return sprintf(buf, "none\n");
+	}
+
+	p = d_path(&zram->backing_dev->f_path, buf, PAGE_SIZE - 1);
+	if (IS_ERR(p)) {
+		ret = PTR_ERR(p);
+	} else {
+		ret = strlen(p);
+		memmove(buf, p, ret);
+		buf[ret++] = '\n';
+	}
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+
+static ssize_t backing_dev_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	char *path;
+	int ret;
+
+	path = kstrndup(buf, PATH_MAX, GFP_KERNEL);
+	if (!path)
+		return -ENOMEM;
+
+	down_write(&zram->init_lock);
+	if (zram->init_done) {
+		pr_info("Cannot change backing device for initialized device\n");
+		ret = -EBUSY;
+		goto out;
+	}
+
+	ret = zram_set_backing_dev(zram, strim(path));
+out:
+	up_write(&zram->init_lock);
+	kfree(path);
+
+	return ret ? ret : len;
+}
+
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	enum zram_wb_mode mode;
+	int ret;
+
+	if (sysfs_streq(buf, "idle"))
+		mode = ZRAM_WB_IDLE;
+	else if (sysfs_streq(buf, "huge"))
+		mode = ZRAM_WB_HUGE;
+	else
+		return -EINVAL;
+
+	down_read(&zram->init_lock);
+	if (!zram->init_done) {
+		up_read(&zram->init_lock);
+		return -EINVAL;
+	}
+	ret = zram_writeback(zram, mode);
+	up_read(&zram->init_lock);
+
+	return ret ? ret : len;
+}
+
+static ssize_t writeback_idle_age_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->wb_idle_age);
+}
+
+static ssize_t writeback_idle_age_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	unsigned int age;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &age);
+	if (ret)
+		return ret;
+
+	zram->wb_idle_age = age;
+
+	return len;
+}
+
+static ssize_t bd_count_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->stats.bd_count);
+}
+
+static ssize_t bd_reads_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.bd_reads));
+}
+
+static ssize_t bd_writes_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.bd_writes));
+}
+#endif
+
+static ssize_t compact_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	if (!zram->init_done) {
+		up_read(&zram->init_lock);
+		return -EINVAL;
+	}
+	zs_compact(zram->mem_pool);
+	up_read(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t pages_compacted_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	unsigned long val = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	if (zram->init_done)
+		val = zs_get_pages_compacted(zram->mem_pool);
+	up_read(&zram->init_lock);
+
+	return sprintf(buf, "%lu\n", val);
+}
+
 static ssize_t mem_used_total_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
@@ -196,6 +449,10 @@ static ssize_t mem_used_total_show(struct device *dev,
 
 static DEVICE_ATTR(disksize, S_IRUGO | S_IWUSR,
 		disksize_show, disksize_store);
+static DEVICE_ATTR(max_comp_streams, S_IRUGO | S_IWUSR,
+		max_comp_streams_show, max_comp_streams_store);
+static DEVICE_ATTR(comp_algorithm, S_IRUGO | S_IWUSR,
+		comp_algorithm_show, comp_algorithm_store);
 static DEVICE_ATTR(initstate, S_IRUGO, initstate_show, NULL);
 static DEVICE_ATTR(reset, S_IWUSR, NULL, reset_store);
 static DEVICE_ATTR(num_reads, S_IRUGO, num_reads_show, NULL);
@@ -203,12 +460,28 @@ static DEVICE_ATTR(num_writes, S_IRUGO, num_writes_show, NULL);
 static DEVICE_ATTR(invalid_io, S_IRUGO, invalid_io_show, NULL);
 static DEVICE_ATTR(notify_free, S_IRUGO, notify_free_show, NULL);
 static DEVICE_ATTR(zero_pages, S_IRUGO, zero_pages_show, NULL);
+static DEVICE_ATTR(same_pages, S_IRUGO, same_pages_show, NULL);
 static DEVICE_ATTR(orig_data_size, S_IRUGO, orig_data_size_show, NULL);
 static DEVICE_ATTR(compr_data_size, S_IRUGO, compr_data_size_show, NULL);
 static DEVICE_ATTR(mem_used_total, S_IRUGO, mem_used_total_show, NULL);
+static DEVICE_ATTR(compact, S_IWUSR, NULL, compact_store);
+static DEVICE_ATTR(pages_compacted, S_IRUGO, pages_compacted_show, NULL);
+static DEVICE_ATTR(comp_stream_waits, S_IRUGO, comp_stream_waits_show, NULL);
+#ifdef CONFIG_ZRAM_WRITEBACK
+static DEVICE_ATTR(backing_dev, S_IRUGO | S_IWUSR,
+		backing_dev_show, backing_dev_store);
+static DEVICE_ATTR(writeback, S_IWUSR, NULL, writeback_store);
+static DEVICE_ATTR(writeback_idle_age, S_IRUGO | S_IWUSR,
+		writeback_idle_age_show, writeback_idle_age_store);
+static DEVICE_ATTR(bd_count, S_IRUGO, bd_count_show, NULL);
+static DEVICE_ATTR(bd_reads, S_IRUGO, bd_reads_show, NULL);
+static DEVICE_ATTR(bd_writes, S_IRUGO, bd_writes_show, NULL);
+#endif
 
 static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_disksize.attr,
+	&dev_attr_max_comp_streams.attr,
+	&dev_attr_comp_algorithm.attr,
 	&dev_attr_initstate.attr,
 	&dev_attr_reset.attr,
 	&dev_attr_num_reads.attr,
@@ -216,9 +489,21 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_invalid_io.attr,
 	&dev_attr_notify_free.attr,
 	&dev_attr_zero_pages.attr,
+	&dev_attr_same_pages.attr,
 	&dev_attr_orig_data_size.attr,
 	&dev_attr_compr_data_size.attr,
 	&dev_attr_mem_used_total.attr,
+	&dev_attr_compact.attr,
+	&dev_attr_pages_compacted.attr,
+	&dev_attr_comp_stream_waits.attr,
+#ifdef CONFIG_ZRAM_WRITEBACK
+	&dev_attr_backing_dev.attr,
+	&dev_attr_writeback.attr,
+	&dev_attr_writeback_idle_age.attr,
+	&dev_attr_bd_count.attr,
+	&dev_attr_bd_reads.attr,
+	&dev_attr_bd_writes.attr,
+#endif
 	NULL,
 };
 
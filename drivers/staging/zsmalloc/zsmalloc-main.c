@@ -17,6 +17,8 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
+#include <linux/debugfs.h>
 #include <linux/errno.h>
 #include <linux/highmem.h>
 #include <linux/init.h>
@@ -26,6 +28,8 @@
 #include <asm/pgtable.h>
 #include <linux/cpumask.h>
 #include <linux/cpu.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
 #include <linux/vmalloc.h>
 
 #include "zsmalloc.h"
@@ -43,6 +47,13 @@
 /* per-cpu VM mapping areas for zspage accesses that cross page boundaries */
 static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
 
+/* Handles: words holding the current location of each object */
+static struct kmem_cache *zs_handle_cache;
+
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *zs_stat_root;
+#endif
+
 static int is_first_page(struct page *page)
 {
 	return test_bit(PG_private, &page->flags);
@@ -230,30 +241,66 @@ static struct page *get_next_page(struct page *page)
 	return next;
 }
 
-/* Encode <page, obj_idx> as a single handle value */
-static void *obj_location_to_handle(struct page *page, unsigned long obj_idx)
+/* Encode <page, obj_idx> as a single object location value */
+static void *location_to_obj(struct page *page, unsigned long obj_idx)
 {
-	unsigned long handle;
+	unsigned long obj;
 
 	if (!page) {
 		BUG_ON(obj_idx);
 		return NULL;
 	}
 
-	handle = page_to_pfn(page) << OBJ_INDEX_BITS;
-	handle |= (obj_idx & OBJ_INDEX_MASK);
+	obj = page_to_pfn(page) << OBJ_INDEX_BITS;
+	obj |= (obj_idx & OBJ_INDEX_MASK);
+	obj <<= OBJ_TAG_BITS;
 
-	return (void *)handle;
+	return (void *)obj;
 }
 
-/* Decode <page, obj_idx> pair from the given object handle */
-static void obj_handle_to_location(void *handle, struct page **page,
+/* Decode <page, obj_idx> pair from the given object location */
+static void obj_to_location(void *obj, struct page **page,
 				unsigned long *obj_idx)
 {
-	unsigned long hval = (unsigned long)handle;
+	unsigned long oval = (unsigned long)obj >> OBJ_TAG_BITS;
+
+	*page = pfn_to_page(oval >> OBJ_INDEX_BITS);
+	*obj_idx = oval & OBJ_INDEX_MASK;
+}
+
+static void *handle_to_obj(void *handle)
+{
+	return (void *)(*(unsigned long *)handle & ~BIT(HANDLE_PIN_BIT));
+}
+
+/* Point the handle at a new location, keeping the pin bit as it is */
+static void record_obj(void *handle, void *obj, int pinned)
+{
+	unsigned long val = (unsigned long)obj;
+
+	if (pinned)
+		val |= BIT(HANDLE_PIN_BIT);
+	*(volatile unsigned long *)handle = val;
+}
 
-	*page = pfn_to_page(hval >> OBJ_INDEX_BITS);
-	*obj_idx = hval & OBJ_INDEX_MASK;
+/*
+ * A pinned object is neither moved by compaction nor freed, so its
+ * location stays valid: zs_map_object() keeps it pinned until
+ * zs_unmap_object().
+ */
+static void pin_tag(void *handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_tag(void *handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void unpin_tag(void *handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
 }
 
 static unsigned long obj_idx_to_offset(struct page *page,
@@ -330,7 +377,7 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 		for (i = 1; i <= objs_on_page; i++) {
 			off += class->size;
 			if (off < PAGE_SIZE) {
-				link->next = obj_location_to_handle(page, i);
+				link->next = location_to_obj(page, i);
 				link += class->size / sizeof(*link);
 			}
 		}
@@ -341,7 +388,7 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 		 * page (if present)
 		 */
 		next_page = get_next_page(page);
-		link->next = obj_location_to_handle(next_page, 0);
+		link->next = location_to_obj(next_page, 0);
 		kunmap_atomic(link);
 		page = next_page;
 		off = (off + class->size) % PAGE_SIZE;
@@ -396,7 +443,7 @@ static struct page *alloc_zspage(struct size_class *class, gfp_t flags)
 
 	init_zspage(first_page, class);
 
-	first_page->freelist = obj_location_to_handle(first_page, 0);
+	first_page->freelist = location_to_obj(first_page, 0);
 	/* Maximum number of objects we can store in this zspage */
 	first_page->objects = class->zspage_order * PAGE_SIZE / class->size;
 
@@ -425,6 +472,426 @@ static struct page *find_get_zspage(struct size_class *class)
 	return page;
 }
 
+/* Take a free object off the zspage's freelist and give it to @handle */
+static void *obj_malloc(struct size_class *class, struct page *first_page,
+			void *handle)
+{
+	void *obj;
+	struct link_free *link;
+	struct page *m_page;
+	unsigned long m_objidx, m_offset;
+
+	obj = first_page->freelist;
+	obj_to_location(obj, &m_page, &m_objidx);
+	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
+
+	link = (struct link_free *)kmap_atomic(m_page) +
+					m_offset / sizeof(*link);
+	first_page->freelist = link->next;
+	link->handle = (unsigned long)handle | OBJ_ALLOCATED_TAG;
+	kunmap_atomic(link);
+
+	first_page->inuse++;
+
+	return obj;
+}
+
+/* Put the object back on its zspage's freelist */
+static void obj_free(struct size_class *class, void *obj)
+{
+	struct link_free *link;
+	struct page *first_page, *f_page;
+	unsigned long f_objidx, f_offset;
+
+	obj_to_location(obj, &f_page, &f_objidx);
+	first_page = get_first_page(f_page);
+	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
+
+	link = (struct link_free *)((unsigned char *)kmap_atomic(f_page)
+							+ f_offset);
+	link->next = first_page->freelist;
+	kunmap_atomic(link);
+	first_page->freelist = obj;
+
+	first_page->inuse--;
+}
+
+/* Copy a whole object, either end of which may span two pages */
+static void zs_object_copy(struct size_class *class, void *dst_obj,
+			   void *src_obj)
+{
+	struct page *s_page, *d_page;
+	unsigned long s_objidx, d_objidx, s_off, d_off;
+	int s_size, d_size, size, written = 0;
+	void *s_addr, *d_addr;
+
+	obj_to_location(src_obj, &s_page, &s_objidx);
+	obj_to_location(dst_obj, &d_page, &d_objidx);
+	s_off = obj_idx_to_offset(s_page, s_objidx, class->size);
+	d_off = obj_idx_to_offset(d_page, d_objidx, class->size);
+
+	s_size = min_t(int, class->size, PAGE_SIZE - s_off);
+	d_size = min_t(int, class->size, PAGE_SIZE - d_off);
+
+	s_addr = kmap_atomic(s_page);
+	d_addr = kmap_atomic(d_page);
+
+	while (1) {
+		size = min(s_size, d_size);
+		memcpy(d_addr + d_off, s_addr + s_off, size);
+		written += size;
+		if (written == class->size)
+			break;
+
+		s_off += size;
+		s_size -= size;
+		d_off += size;
+		d_size -= size;
+
+		/* kmap_atomic() mappings must be released in reverse order */
+		if (!s_size) {
+			kunmap_atomic(d_addr);
+			kunmap_atomic(s_addr);
+			s_page = get_next_page(s_page);
+			s_addr = kmap_atomic(s_page);
+			d_addr = kmap_atomic(d_page);
+			s_size = class->size - written;
+			s_off = 0;
+		}
+
+		if (!d_size) {
+			kunmap_atomic(d_addr);
+			d_page = get_next_page(d_page);
+			d_addr = kmap_atomic(d_page);
+			d_size = class->size - written;
+			d_off = 0;
+		}
+	}
+
+	kunmap_atomic(d_addr);
+	kunmap_atomic(s_addr);
+}
+
+/*
+ * Find the first allocated object starting in @page at or after index
+ * @obj_idx, and return its location and handle.
+ */
+static void *find_alloced_obj(struct size_class *class, struct page *page,
+			      unsigned long *obj_idx, void **handle)
+{
+	unsigned long off, head;
+	void *addr, *obj = NULL;
+
+	off = obj_idx_to_offset(page, *obj_idx, class->size);
+	addr = kmap_atomic(page);
+	while (off < PAGE_SIZE) {
+		head = *(unsigned long *)(addr + off);
+		if (head & OBJ_ALLOCATED_TAG) {
+			*handle = (void *)(head & ~OBJ_ALLOCATED_TAG);
+			obj = location_to_obj(page, *obj_idx);
+			break;
+		}
+		off += class->size;
+		(*obj_idx)++;
+	}
+	kunmap_atomic(addr);
+
+	return obj;
+}
+
+/*
+ * Move objects from zspage @src to zspage @dst. Returns 0 once @src is
+ * empty, -ENOSPC if @dst filled up first and -EBUSY if an object in
+ * @src is pinned by a mapping or a free in progress.
+ */
+static int migrate_zspage(struct size_class *class, struct page *src,
+			  struct page *dst)
+{
+	struct page *s_page = src;
+	unsigned long obj_idx = 0;
+	void *handle, *used_obj, *free_obj;
+
+	while (s_page) {
+		used_obj = find_alloced_obj(class, s_page, &obj_idx, &handle);
+		if (!used_obj) {
+			s_page = get_next_page(s_page);
+			obj_idx = 0;
+			continue;
+		}
+
+		if (dst->inuse == dst->objects)
+			return -ENOSPC;
+
+		if (!trypin_tag(handle))
+			return -EBUSY;
+
+		free_obj = obj_malloc(class, dst, handle);
+		zs_object_copy(class, free_obj, used_obj);
+		record_obj(handle, free_obj, 1);
+		unpin_tag(handle);
+		obj_free(class, used_obj);
+		obj_idx++;
+	}
+
+	return 0;
+}
+
+/* The sparsest zspages are at the tail, away from where zs_malloc works */
+static struct page *isolate_source_page(struct size_class *class)
+{
+	struct page *page = class->fullness_list[ZS_ALMOST_EMPTY];
+
+	if (!page)
+		return NULL;
+
+	page = list_entry(page->lru.prev, struct page, lru);
+	remove_zspage(page, class, ZS_ALMOST_EMPTY);
+
+	return page;
+}
+
+static struct page *isolate_target_page(struct size_class *class)
+{
+	int i;
+	struct page *page;
+
+	for (i = 0; i < _ZS_NR_FULLNESS_GROUPS; i++) {
+		page = class->fullness_list[i];
+		if (page) {
+			remove_zspage(page, class, i);
+			return page;
+		}
+	}
+
+	return NULL;
+}
+
+static enum fullness_group putback_zspage(struct size_class *class,
+					  struct page *first_page)
+{
+	enum fullness_group fullness;
+
+	fullness = get_fullness_group(first_page);
+	insert_zspage(first_page, class, fullness);
+	set_zspage_mapping(first_page, class->index, fullness);
+
+	return fullness;
+}
+
+/* Number of pages compaction could free in this class */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	unsigned long obj_wasted, objs_per_zspage;
+
+	if (class->obj_allocated <= class->obj_used)
+		return 0;
+
+	objs_per_zspage = class->zspage_order * PAGE_SIZE / class->size;
+	obj_wasted = (class->obj_allocated - class->obj_used) /
+			objs_per_zspage;
+
+	return obj_wasted * class->zspage_order;
+}
+
+static unsigned long __zs_compact(struct size_class *class)
+{
+	struct page *src, *dst;
+	unsigned long freed = 0;
+	int ret;
+
+	spin_lock(&class->lock);
+	while (zs_can_compact(class)) {
+		src = isolate_source_page(class);
+		if (!src)
+			break;
+
+		ret = -ENOSPC;
+		while ((dst = isolate_target_page(class))) {
+			ret = migrate_zspage(class, src, dst);
+			putback_zspage(class, dst);
+			if (ret != -ENOSPC)
+				break;
+		}
+
+		if (putback_zspage(class, src) == ZS_EMPTY) {
+			class->pages_allocated -= class->zspage_order;
+			class->obj_allocated -= src->objects;
+			class->pages_compacted += class->zspage_order;
+			freed += class->zspage_order;
+
+			spin_unlock(&class->lock);
+			free_zspage(src);
+			cond_resched();
+			spin_lock(&class->lock);
+		}
+
+		/* An object is pinned, or there is nowhere left to move to */
+		if (ret)
+			break;
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - free zspages by packing objects into fewer of them
+ * @pool: pool to compact
+ *
+ * Objects are migrated out of the sparsest zspages of each size class
+ * into fuller ones, and the emptied zspages are freed. Handles stay
+ * valid; objects mapped at the time are skipped. May sleep.
+ *
+ * Returns the number of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--)
+		freed += __zs_compact(&pool->size_class[i]);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+unsigned long zs_get_pages_compacted(struct zs_pool *pool)
+{
+	int i;
+	unsigned long pages = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++)
+		pages += pool->size_class[i].pages_compacted;
+
+	return pages;
+}
+EXPORT_SYMBOL_GPL(zs_get_pages_compacted);
+
+static int zs_shrinker_shrink(struct shrinker *shrinker,
+			      struct shrink_control *sc)
+{
+	int i;
+	unsigned long freeable = 0;
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+					    shrinker);
+
+	if (sc->nr_to_scan)
+		zs_compact(pool);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++)
+		freeable += zs_can_compact(&pool->size_class[i]);
+
+	return min_t(unsigned long, freeable, INT_MAX);
+}
+
+#ifdef CONFIG_DEBUG_FS
+static int zs_count_zspages(struct page *head)
+{
+	struct list_head *pos;
+	int count;
+
+	if (!head)
+		return 0;
+
+	count = 1;
+	list_for_each(pos, &head->lru)
+		count++;
+
+	return count;
+}
+
+static int zs_stats_classes_show(struct seq_file *s, void *v)
+{
+	int i;
+	struct zs_pool *pool = s->private;
+	unsigned long obj_allocated, obj_used, pages_used, freeable;
+	unsigned long total_objs = 0, total_used_objs = 0, total_pages = 0;
+	unsigned long total_freeable = 0;
+	int almost_full, almost_empty;
+
+	seq_printf(s, " %5s %5s %11s %12s %13s %10s %10s %16s %8s\n",
+			"class", "size", "almost_full", "almost_empty",
+			"obj_allocated", "obj_used", "pages_used",
+			"pages_per_zspage", "freeable");
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		almost_full = zs_count_zspages(
+				class->fullness_list[ZS_ALMOST_FULL]);
+		almost_empty = zs_count_zspages(
+				class->fullness_list[ZS_ALMOST_EMPTY]);
+		obj_allocated = class->obj_allocated;
+		obj_used = class->obj_used;
+		pages_used = class->pages_allocated;
+		freeable = zs_can_compact(class);
+		spin_unlock(&class->lock);
+
+		if (!obj_allocated)
+			continue;
+
+		seq_printf(s, " %5d %5d %11d %12d %13lu %10lu %10lu %16d %8lu\n",
+			i, class->size, almost_full, almost_empty,
+			obj_allocated, obj_used, pages_used,
+			class->zspage_order, freeable);
+
+		total_objs += obj_allocated;
+		total_used_objs += obj_used;
+		total_pages += pages_used;
+		total_freeable += freeable;
+	}
+
+	seq_puts(s, "\n");
+	seq_printf(s, " %5s %5s %11s %12s %13lu %10lu %10lu %16s %8lu\n",
+			"Total", "", "", "", total_objs, total_used_objs,
+			total_pages, "", total_freeable);
+
+	return 0;
+}
+
+static int zs_stats_classes_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zs_stats_classes_show, inode->i_private);
+}
+
+static const struct file_operations zs_stats_classes_fops = {
+	.open		= zs_stats_classes_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void zs_pool_stat_create(struct zs_pool *pool)
+{
+	if (!zs_stat_root)
+		return;
+
+	pool->stat_dentry = debugfs_create_dir(pool->name, zs_stat_root);
+	if (!pool->stat_dentry) {
+		pr_warning("zsmalloc: debugfs dir for pool %s not created\n",
+			pool->name);
+		return;
+	}
+
+	debugfs_create_file("classes", S_IRUGO, pool->stat_dentry, pool,
+			&zs_stats_classes_fops);
+}
+
+static void zs_pool_stat_destroy(struct zs_pool *pool)
+{
+	debugfs_remove_recursive(pool->stat_dentry);
+}
+#else
+static void zs_pool_stat_create(struct zs_pool *pool)
+{
+}
+
+static void zs_pool_stat_destroy(struct zs_pool *pool)
+{
+}
+#endif
 
 static int zs_cpu_notifier(struct notifier_block *nb, unsigned long action,
 				void *pcpu)
@@ -464,12 +931,31 @@ static void zs_exit(void)
 	for_each_online_cpu(cpu)
 		zs_cpu_notifier(NULL, CPU_DEAD, (void *)(long)cpu);
 	unregister_cpu_notifier(&zs_cpu_nb);
+
+#ifdef CONFIG_DEBUG_FS
+	debugfs_remove_recursive(zs_stat_root);
+	zs_stat_root = NULL;
+#endif
+	if (zs_handle_cache)
+		kmem_cache_destroy(zs_handle_cache);
+	zs_handle_cache = NULL;
 }
 
 static int zs_init(void)
 {
 	int cpu, ret;
 
+	zs_handle_cache = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+					   0, 0, NULL);
+	if (!zs_handle_cache)
+		return -ENOMEM;
+
+#ifdef CONFIG_DEBUG_FS
+	zs_stat_root = debugfs_create_dir("zsmalloc", NULL);
+	if (IS_ERR(zs_stat_root))
+		zs_stat_root = NULL;
+#endif
+
 	register_cpu_notifier(&zs_cpu_nb);
 	for_each_online_cpu(cpu) {
 		ret = zs_cpu_notifier(NULL, CPU_UP_PREPARE, (void *)(long)cpu);
@@ -495,6 +981,13 @@ struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
 	if (!pool)
 		return NULL;
 
+	/* Also names the pool's debugfs directory, so it must be unique */
+	pool->name = kstrdup(name, GFP_KERNEL);
+	if (!pool->name) {
+		kfree(pool);
+		return NULL;
+	}
+
 	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
 		int size;
 		struct size_class *class;
@@ -512,7 +1005,12 @@ struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
 	}
 
 	pool->flags = flags;
-	pool->name = name;
+
+	pool->shrinker.shrink = zs_shrinker_shrink;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+
+	zs_pool_stat_create(pool);
 
 	return pool;
 }
@@ -522,6 +1020,9 @@ void zs_destroy_pool(struct zs_pool *pool)
 {
 	int i;
 
+	unregister_shrinker(&pool->shrinker);
+	zs_pool_stat_destroy(pool);
+
 	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
 		int fg;
 		struct size_class *class = &pool->size_class[i];
@@ -534,6 +1035,7 @@ void zs_destroy_pool(struct zs_pool *pool)
 			}
 		}
 	}
+	kfree(pool->name);
 	kfree(pool);
 }
 EXPORT_SYMBOL_GPL(zs_destroy_pool);
@@ -542,28 +1044,31 @@ EXPORT_SYMBOL_GPL(zs_destroy_pool);
  * zs_malloc - Allocate block of given size from pool.
  * @pool: pool to allocate from
  * @size: size of block to allocate
- * @page: page no. that holds the object
- * @offset: location of object within page
  *
- * On success, <page, offset> identifies block allocated
- * and 0 is returned. On failure, <page, offset> is set to
- * 0 and -ENOMEM is returned.
+ * On success, a handle to the allocated block is returned; it must be
+ * mapped with zs_map_object() to access the block. On failure, NULL is
+ * returned.
  *
- * Allocation requests with size > ZS_MAX_ALLOC_SIZE will fail.
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE
+ * will fail.
  */
 void *zs_malloc(struct zs_pool *pool, size_t size)
 {
-	void *obj;
-	struct link_free *link;
+	void *obj, *handle;
 	int class_idx;
 	struct size_class *class;
+	struct page *first_page;
 
-	struct page *first_page, *m_page;
-	unsigned long m_objidx, m_offset;
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE))
+		return NULL;
 
-	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+	handle = kmem_cache_alloc(zs_handle_cache,
+			pool->flags & ~(__GFP_HIGHMEM | __GFP_MOVABLE));
+	if (!handle)
 		return NULL;
 
+	/* Room for the back-reference compaction needs */
+	size += ZS_HANDLE_SIZE;
 	class_idx = get_size_class_index(size);
 	class = &pool->size_class[class_idx];
 	BUG_ON(class_idx != class->index);
@@ -574,72 +1079,67 @@ void *zs_malloc(struct zs_pool *pool, size_t size)
 	if (!first_page) {
 		spin_unlock(&class->lock);
 		first_page = alloc_zspage(class, pool->flags);
-		if (unlikely(!first_page))
+		if (unlikely(!first_page)) {
+			kmem_cache_free(zs_handle_cache, handle);
 			return NULL;
+		}
 
 		set_zspage_mapping(first_page, class->index, ZS_EMPTY);
 		spin_lock(&class->lock);
 		class->pages_allocated += class->zspage_order;
+		class->obj_allocated += first_page->objects;
 	}
 
-	obj = first_page->freelist;
-	obj_handle_to_location(obj, &m_page, &m_objidx);
-	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
-
-	link = (struct link_free *)kmap_atomic(m_page) +
-					m_offset / sizeof(*link);
-	first_page->freelist = link->next;
-	memset(link, POISON_INUSE, sizeof(*link));
-	kunmap_atomic(link);
-
-	first_page->inuse++;
+	obj = obj_malloc(class, first_page, handle);
+	record_obj(handle, obj, 0);
+	class->obj_used++;
 	/* Now move the zspage to another fullness group, if required */
 	fix_fullness_group(pool, first_page);
 	spin_unlock(&class->lock);
 
-	return obj;
+	return handle;
 }
 EXPORT_SYMBOL_GPL(zs_malloc);
 
-void zs_free(struct zs_pool *pool, void *obj)
+void zs_free(struct zs_pool *pool, void *handle)
 {
-	struct link_free *link;
+	void *obj;
 	struct page *first_page, *f_page;
-	unsigned long f_objidx, f_offset;
+	unsigned long f_objidx;
 
 	int class_idx;
 	struct size_class *class;
 	enum fullness_group fullness;
 
-	if (unlikely(!obj))
+	if (unlikely(!handle))
 		return;
 
-	obj_handle_to_location(obj, &f_page, &f_objidx);
+	/* Keep compaction from moving the object while it is freed */
+	pin_tag(handle);
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &f_page, &f_objidx);
 	first_page = get_first_page(f_page);
 
 	get_zspage_mapping(first_page, &class_idx, &fullness);
 	class = &pool->size_class[class_idx];
-	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
 
 	spin_lock(&class->lock);
-
-	/* Insert this object in containing zspage's freelist */
-	link = (struct link_free *)((unsigned char *)kmap_atomic(f_page)
-							+ f_offset);
-	link->next = first_page->freelist;
-	kunmap_atomic(link);
-	first_page->freelist = obj;
-
-	first_page->inuse--;
+	obj_free(class, obj);
+	class->obj_used--;
 	fullness = fix_fullness_group(pool, first_page);
 
-	if (fullness == ZS_EMPTY)
+	if (fullness == ZS_EMPTY) {
 		class->pages_allocated -= class->zspage_order;
+		class->obj_allocated -= first_page->objects;
+	}
 
 	spin_unlock(&class->lock);
+	unpin_tag(handle);
 
 	if (fullness == ZS_EMPTY)
 		free_zspage(first_page);
+
+	kmem_cache_free(zs_handle_cache, handle);
 }
 EXPORT_SYMBOL_GPL(zs_free);
 
@@ -655,7 +1155,9 @@ void *zs_map_object(struct zs_pool *pool, void *handle)
 
 	BUG_ON(!handle);
 
-	obj_handle_to_location(handle, &page, &obj_idx);
+	/* The object stays put until zs_unmap_object() */
+	pin_tag(handle);
+	obj_to_location(handle_to_obj(handle), &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
@@ -679,7 +1181,7 @@ void *zs_map_object(struct zs_pool *pool, void *handle)
 		area->vm_addr = area->vm->addr;
 	}
 
-	return area->vm_addr + off;
+	return area->vm_addr + off + ZS_HANDLE_SIZE;
 }
 EXPORT_SYMBOL_GPL(zs_map_object);
 
@@ -695,7 +1197,7 @@ void zs_unmap_object(struct zs_pool *pool, void *handle)
 
 	BUG_ON(!handle);
 
-	obj_handle_to_location(handle, &page, &obj_idx);
+	obj_to_location(handle_to_obj(handle), &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
@@ -710,6 +1212,7 @@ void zs_unmap_object(struct zs_pool *pool, void *handle)
 		__flush_tlb_one((unsigned long)area->vm_addr + PAGE_SIZE);
 	}
 	put_cpu_var(zs_map_area);
+	unpin_tag(handle);
 }
 EXPORT_SYMBOL_GPL(zs_unmap_object);
 
@@ -21,11 +21,14 @@ struct zs_pool *zs_create_pool(const char *name, gfp_t flags);
 void zs_destroy_pool(struct zs_pool *pool);
 
 void *zs_malloc(struct zs_pool *pool, size_t size);
-void zs_free(struct zs_pool *pool, void *obj);
+void zs_free(struct zs_pool *pool, void *handle);
 
 void *zs_map_object(struct zs_pool *pool, void *handle);
 void zs_unmap_object(struct zs_pool *pool, void *handle);
 
 u64 zs_get_total_size_bytes(struct zs_pool *pool);
 
+unsigned long zs_compact(struct zs_pool *pool);
+unsigned long zs_get_pages_compacted(struct zs_pool *pool);
+
 #endif
@@ -14,6 +14,7 @@
 #define _ZS_MALLOC_INT_H_
 
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
 
@@ -33,14 +34,18 @@
 #define ZS_MAX_PAGES_PER_ZSPAGE (_AC(1, UL) << ZS_MAX_ZSPAGE_ORDER)
 
 /*
- * Object location (<PFN>, <obj_idx>) is encoded as
- * as single (void *) handle value.
+ * Object location (<PFN>, <obj_idx>) is encoded as a single value,
+ * shifted left by OBJ_TAG_BITS to keep the low bit free.
  *
  * Note that object index <obj_idx> is relative to system
  * page <PFN> it is stored in, so for each sub-page belonging
  * to a zspage, obj_idx starts with 0.
  *
  * This is made more complicated by various memory models and PAE.
+ *
+ * Users do not get the location itself but a handle: a pointer to a
+ * word holding it, so that compaction can move objects around. The
+ * low bit of that word is a lock pinning the object in place.
  */
 
 #ifndef MAX_PHYSMEM_BITS
@@ -55,7 +60,8 @@
 #endif
 #endif
 #define _PFN_BITS		(MAX_PHYSMEM_BITS - PAGE_SHIFT)
-#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS)
+#define OBJ_TAG_BITS	1
+#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS - OBJ_TAG_BITS)
 #define OBJ_INDEX_MASK	((_AC(1, UL) << OBJ_INDEX_BITS) - 1)
 
 #define MAX(a, b) ((a) >= (b) ? (a) : (b))
@@ -64,6 +70,15 @@
 	MAX(32, (ZS_MAX_PAGES_PER_ZSPAGE << PAGE_SHIFT >> OBJ_INDEX_BITS))
 #define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
 
+/*
+ * The first word of an allocated object holds its handle, tagged with
+ * OBJ_ALLOCATED_TAG, so that compaction can find the handle to update
+ * when it moves the object.
+ */
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+#define OBJ_ALLOCATED_TAG	1
+#define HANDLE_PIN_BIT		0
+
 /*
  * On systems with 4K page size, this gives 254 size classes! There is a
  * trader-off here:
@@ -130,6 +145,9 @@ struct size_class {
 
 	/* stats */
 	u64 pages_allocated;
+	unsigned long obj_allocated;	/* objects the zspages can hold */
+	unsigned long obj_used;		/* objects in use */
+	unsigned long pages_compacted;	/* freed by compaction */
 
 	struct page *fullness_list[_ZS_NR_FULLNESS_GROUPS];
 };
@@ -137,12 +155,17 @@ struct size_class {
 /*
  * Placed within free objects to form a singly linked list.
  * For every zspage, first_page->freelist gives head of this list.
+ * Allocated objects keep their tagged handle here instead.
  *
  * This must be power of 2 and less than or equal to ZS_ALIGN
  */
 struct link_free {
-	/* Handle of next free chunk (encodes <PFN, obj_idx>) */
-	void *next;
+	union {
+		/* Location of next free chunk (encodes <PFN, obj_idx>) */
+		void *next;
+		/* Handle of this chunk, | OBJ_ALLOCATED_TAG */
+		unsigned long handle;
+	};
 };
 
 struct zs_pool {
@@ -150,6 +173,13 @@ struct zs_pool {
 
 	gfp_t flags;	/* allocation flags used when growing pool */
 	const char *name;
+
+	/* Compacts the pool under memory pressure */
+	struct shrinker shrinker;
+
+#ifdef CONFIG_DEBUG_FS
+	struct dentry *stat_dentry;
+#endif
 };
 
 #endif
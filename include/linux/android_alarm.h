@@ -51,6 +51,7 @@ struct alarm {
 void alarm_init(struct alarm *alarm,
 	enum android_alarm_type type, void (*function)(struct alarm *));
 void alarm_start_range(struct alarm *alarm, ktime_t start, ktime_t end);
+void alarm_start_coalesced(struct alarm *alarm, ktime_t expires);
 int alarm_try_to_cancel(struct alarm *alarm);
 int alarm_cancel(struct alarm *alarm);
 ktime_t alarm_get_elapsed_realtime(void);
@@ -80,6 +81,9 @@ enum android_alarm_return_flags {
 #define ANDROID_ALARM_SET_AND_WAIT(type)    ALARM_IOW(3, type, struct timespec)
 #define ANDROID_ALARM_GET_TIME(type)        ALARM_IOW(4, type, struct timespec)
 #define ANDROID_ALARM_SET_RTC               _IOW('a', 5, struct timespec)
+#define ANDROID_ALARM_SET_EXACT(type)       ALARM_IOW(6, type, struct timespec)
+#define ANDROID_ALARM_SET_EXACT_AND_WAIT(type) \
+					    ALARM_IOW(7, type, struct timespec)
 #define ANDROID_ALARM_BASE_CMD(cmd)         (cmd & ~(_IOC(0, 0, 0xf0, 0)))
 #define ANDROID_ALARM_IOCTL_TO_TYPE(cmd)    (_IOC_NR(cmd) >> 4)
 
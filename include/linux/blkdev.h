@@ -235,6 +235,7 @@ struct request_queue {
 	struct request_list	rq;
 
 	request_fn_proc		*request_fn;
+	request_fn_proc		*urgent_request_fn;
 	make_request_fn		*make_request_fn;
 	prep_rq_fn		*prep_rq_fn;
 	unprep_rq_fn		*unprep_rq_fn;
@@ -255,6 +256,9 @@ struct request_queue {
 
 	unsigned long		queue_flags;
 
+	/* urgent_request_fn was called and the driver has not caught up */
+	bool			notified_urgent;
+
 	int			id;
 
 	gfp_t			bounce_gfp;
@@ -278,6 +282,7 @@ struct request_queue {
 	struct list_head	tag_busy_list;
 
 	unsigned int		nr_sorted;
+	unsigned int		nr_queued_reads;	/* sorted, not started */
 	unsigned int		in_flight[2];
 
 	unsigned int		rq_timeout;
@@ -567,6 +572,8 @@ extern struct request *blk_get_request(struct request_queue *, int, gfp_t);
 extern struct request *blk_make_request(struct request_queue *, struct bio *,
 					gfp_t);
 extern void blk_requeue_request(struct request_queue *, struct request *);
+extern int blk_reinsert_request(struct request_queue *, struct request *);
+extern bool blk_reinsert_req_sup(struct request_queue *);
 extern void blk_add_request_payload(struct request *rq, struct page *page,
 		unsigned int len);
 extern int blk_rq_check_limits(struct request_queue *q, struct request *rq);
@@ -715,6 +722,7 @@ extern void blk_queue_lld_busy(struct request_queue *q, lld_busy_fn *fn);
 extern void blk_queue_segment_boundary(struct request_queue *, unsigned long);
 extern void blk_queue_prep_rq(struct request_queue *, prep_rq_fn *pfn);
 extern void blk_queue_unprep_rq(struct request_queue *, unprep_rq_fn *ufn);
+extern void blk_queue_urgent_request(struct request_queue *, request_fn_proc *);
 extern void blk_queue_merge_bvec(struct request_queue *, merge_bvec_fn *);
 extern void blk_queue_dma_alignment(struct request_queue *, int);
 extern void blk_queue_update_dma_alignment(struct request_queue *, int);
@@ -25,12 +25,22 @@ enum {
 	EARLY_SUSPEND_LEVEL_STOP_DRAWING = 100,
 	EARLY_SUSPEND_LEVEL_DISABLE_FB = 150,
 };
+/*
+ * Handlers run in level order on suspend and in reverse on resume. A
+ * handler with async set does not depend on the others of its level and
+ * may run concurrently with the other async handlers of that level.
+ */
 struct early_suspend {
 #ifdef CONFIG_HAS_EARLYSUSPEND
 	struct list_head link;
 	int level;
 	void (*suspend)(struct early_suspend *h);
 	void (*resume)(struct early_suspend *h);
+	bool async;
+	unsigned int suspend_us;
+	unsigned int suspend_max_us;
+	unsigned int resume_us;
+	unsigned int resume_max_us;
 #endif
 };
 
@@ -0,0 +1,41 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Public Kernel Interface
+ *  Compressor and decompressor for the LZ4 block format
+ *
+ *  LZ4 is a byte-oriented LZ77 format with no entropy coding. It trades
+ *  some compression ratio against LZO for much faster decompression.
+ *  The format is described at http://code.google.com/p/lz4/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/types.h>
+
+#define LZ4_MEM_COMPRESS	(4096 * sizeof(u32))
+
+/* Size of the output buffer lz4_compress() needs in the worst case */
+#define lz4_compressbound(isize)	((isize) + ((isize) / 255) + 16)
+
+/*
+ * dst must hold at least lz4_compressbound(src_len) bytes.
+ * On return *dst_len is the size of the compressed data.
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * *dst_len is the size of dst on entry and the number of bytes
+ * decompressed on return. Returns 0 on success, LZ4_E_ERROR on
+ * malformed input or if the output does not fit.
+ */
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len);
+
+#define LZ4_E_OK			0
+#define LZ4_E_ERROR			(-1)
+
+#endif
@@ -11,6 +11,7 @@
 #define LINUX_MMC_CARD_H
 
 #include <linux/device.h>
+#include <linux/ktime.h>
 #include <linux/mmc/core.h>
 #include <linux/mod_devicetable.h>
 
@@ -224,17 +225,49 @@ enum mmc_packed_stop_reasons {
 	EMPTY_QUEUE,
 	REL_WRITE,
 	THRESHOLD,
+	READ_WAITING,
 	MAX_REASONS,
 };
 
+/* log2 buckets of the packed write size in KB, the last one open ended */
+#define MMC_PACK_SIZE_BUCKETS	12
+
 struct mmc_wr_pack_stats {
 	u32 *packing_events;
 	u32 pack_stop_reason[MAX_REASONS];
+	u32 pack_size_hist[MMC_PACK_SIZE_BUCKETS];
 	spinlock_t lock;
 	bool enabled;
 	bool print_in_read;
 };
 
+/* Preemption of writes for urgent requests, see mmc_urgent_request() */
+struct mmc_urgent_stats {
+	u32 notified;		/* urgent requests reported by the scheduler */
+	u32 preempted;		/* writes stopped and requeued */
+	u32 not_stopped;	/* no write in flight, or the host refused */
+	u64 saved_us;		/* estimated time the writes had left */
+};
+
+#define MMC_BKOPS_IDLE_MS	3000
+
+/* Background operations, see mmc_start_idle_bkops() */
+struct mmc_bkops_stats {
+	u32 idle_started;	/* started once the queue was idle long enough */
+	u32 urgent_started;	/* started right away for an urgent level */
+	u32 hpi;		/* stopped with HPI for a new request */
+	u32 completed;		/* done, or waited for, when a request came */
+	u64 total_us;		/* from start to stop or to the next request */
+	u64 max_us;
+};
+
+struct mmc_bkops_info {
+	unsigned int		idle_ms;	/* queue idle time before starting */
+	unsigned long		need_since;	/* jiffies, urgent level seen */
+	ktime_t			start_time;
+	struct mmc_bkops_stats	stats;
+};
+
 struct mmc_card {
 	struct mmc_host		*host;		
 	struct device		dev;		
@@ -321,6 +354,8 @@ struct mmc_card {
 	unsigned int		wr_perf; 
 
 	struct mmc_wr_pack_stats wr_pack_stats; 
+	struct mmc_urgent_stats	urgent_stats;
+	struct mmc_bkops_info	bkops_info;
 };
 
 static inline void mmc_part_add(struct mmc_card *card, unsigned int size,
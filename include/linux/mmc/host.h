@@ -105,6 +105,13 @@ struct mmc_host_ops {
 	void	(*enable_preset_value)(struct mmc_host *host, bool enable);
 	int	(*select_drive_strength)(unsigned int max_dtr, int host_drv, int card_drv);
 	void	(*hw_reset)(struct mmc_host *host);
+
+	/*
+	 * Abort the data transfer of mrq if it is the write in flight, which
+	 * then completes with data->error == -EINTR. May be called in atomic
+	 * context; returns non-zero if nothing could be stopped.
+	 */
+	int	(*stop_request)(struct mmc_host *host, struct mmc_request *mrq);
 };
 
 struct mmc_card;
@@ -373,6 +373,7 @@ struct _mmc_csd {
 #define MMC_PW_OFF_NOTIFY_LONG		2
 
 #define EXT_CSD_BKOPS_LEVEL_2		0x2
+#define EXT_CSD_BKOPS_LEVEL_3		0x3
 #define ENCRYPT_MAGIC_NUMBER 73939133
 #define ENCRYPT_MAGIC_NUMBER2 67629137
 
@@ -53,6 +53,24 @@ static inline void oom_killer_enable(void)
 
 extern struct task_struct *find_lock_task_mm(struct task_struct *p);
 
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+extern void lowmem_task_add(struct task_struct *p);
+extern void lowmem_task_remove(struct task_struct *p);
+extern void lowmem_task_update(struct task_struct *p);
+#else
+static inline void lowmem_task_add(struct task_struct *p)
+{
+}
+
+static inline void lowmem_task_remove(struct task_struct *p)
+{
+}
+
+static inline void lowmem_task_update(struct task_struct *p)
+{
+}
+#endif
+
 extern int sysctl_oom_dump_tasks;
 extern int sysctl_oom_kill_allocating_task;
 extern int sysctl_panic_on_oom;
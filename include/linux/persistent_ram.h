@@ -53,6 +53,7 @@ struct persistent_ram_zone {
 	char *par_buffer;
 	char *par_header;
 	struct rs_control *rs_decoder;
+	atomic_t *ecc_fill;
 	int corrected_bytes;
 	int bad_blocks;
 	int ecc_block_size;
@@ -63,6 +64,7 @@ struct persistent_ram_zone {
 	char *old_log;
 	size_t old_log_size;
 	size_t old_log_footer_size;
+	size_t old_log_lzo_size;
 	bool early;
 };
 
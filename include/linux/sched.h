@@ -69,6 +69,7 @@ struct sched_param {
 #include <linux/seccomp.h>
 #include <linux/rcupdate.h>
 #include <linux/rculist.h>
+#include <linux/list_nulls.h>
 #include <linux/rtmutex.h>
 
 #include <linux/time.h>
@@ -1048,6 +1049,9 @@ struct task_struct {
 #endif
 
 	struct list_head tasks;
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	struct hlist_nulls_node lowmem_node;	/* lowmemorykiller adj index */
+#endif
 #ifdef CONFIG_SMP
 	struct plist_node pushable_tasks;
 #endif
@@ -1858,6 +1862,7 @@ static inline void mmdrop(struct mm_struct * mm)
 }
 
 extern void mmput(struct mm_struct *);
+extern void mmput_async(struct mm_struct *);
 extern struct mm_struct *get_task_mm(struct task_struct *task);
 extern struct mm_struct *mm_access(struct task_struct *task, unsigned int mode);
 extern void mm_release(struct task_struct *, struct mm_struct *);
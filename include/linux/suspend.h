@@ -94,6 +94,37 @@ static inline void dpm_save_failed_step(enum suspend_stat_step step)
 	suspend_stats.last_failed_step %= REC_FAILED_NUM;
 }
 
+enum suspend_timing_step {
+	SUSPEND_TIMING_SYNC,
+	SUSPEND_TIMING_FREEZE,
+	SUSPEND_TIMING_SUSPEND,
+	SUSPEND_TIMING_SUSPEND_END,
+	SUSPEND_TIMING_SYSCORE_SUSPEND,
+	SUSPEND_TIMING_ENTER,
+	SUSPEND_TIMING_SYSCORE_RESUME,
+	SUSPEND_TIMING_RESUME_START,
+	SUSPEND_TIMING_RESUME,
+	SUSPEND_TIMING_THAW,
+	SUSPEND_TIMING_NR_STEPS
+};
+
+struct device;
+
+#ifdef CONFIG_PM_SUSPEND_TIMING
+extern void suspend_timing_begin(void);
+extern void suspend_timing_end(int error);
+extern void suspend_timing_add(enum suspend_timing_step step, u64 ns);
+extern void suspend_timing_device(struct device *dev, pm_message_t state,
+				  u64 ns);
+#else
+static inline void suspend_timing_begin(void) {}
+static inline void suspend_timing_end(int error) {}
+static inline void suspend_timing_add(enum suspend_timing_step step,
+				      u64 ns) {}
+static inline void suspend_timing_device(struct device *dev,
+					 pm_message_t state, u64 ns) {}
+#endif
+
 struct platform_suspend_ops {
 	int (*valid)(suspend_state_t state);
 	int (*begin)(suspend_state_t state);
@@ -64,6 +64,26 @@ TRACE_EVENT(machine_suspend,
 	TP_printk("state=%lu", (unsigned long)__entry->state)
 );
 
+TRACE_EVENT(suspend_timing,
+
+	TP_PROTO(const char *step, u64 ns),
+
+	TP_ARGS(step, ns),
+
+	TP_STRUCT__entry(
+		__string(	step,		step		)
+		__field(	u64,		ns		)
+	),
+
+	TP_fast_assign(
+		__assign_str(step, step);
+		__entry->ns = ns;
+	),
+
+	TP_printk("step=%s ns=%llu", __get_str(step),
+		  (unsigned long long)__entry->ns)
+);
+
 #ifdef CONFIG_EVENT_POWER_TRACING_DEPRECATED
 
 DECLARE_EVENT_CLASS(power,
@@ -74,6 +74,7 @@ static void __unhash_process(struct task_struct *p, bool group_dead)
 		__this_cpu_dec(process_counts);
 	}
 	list_del_rcu(&p->thread_group);
+	lowmem_task_remove(p);
 }
 
 static void __exit_signal(struct task_struct *tsk)
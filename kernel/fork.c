@@ -528,28 +528,50 @@ void __mmdrop(struct mm_struct *mm)
 }
 EXPORT_SYMBOL_GPL(__mmdrop);
 
+static void __mmput(struct mm_struct *mm)
+{
+	exit_aio(mm);
+	ksm_exit(mm);
+	khugepaged_exit(mm); 
+	exit_mmap(mm);
+	set_mm_exe_file(mm, NULL);
+	if (!list_empty(&mm->mmlist)) {
+		spin_lock(&mmlist_lock);
+		list_del(&mm->mmlist);
+		spin_unlock(&mmlist_lock);
+	}
+	put_swap_token(mm);
+	if (mm->binfmt)
+		module_put(mm->binfmt->module);
+	mmdrop(mm);
+}
+
 void mmput(struct mm_struct *mm)
 {
 	might_sleep();
 
+	if (atomic_dec_and_test(&mm->mm_users))
+		__mmput(mm);
+}
+EXPORT_SYMBOL_GPL(mmput);
+
+static void mmput_async_fn(struct work_struct *work)
+{
+	__mmput(container_of(work, struct mm_struct, async_put_work));
+}
+
+/*
+ * For callers in reclaim: if this is the last reference, tearing down the
+ * address space is left to a worker instead of running exit_mmap() here.
+ */
+void mmput_async(struct mm_struct *mm)
+{
 	if (atomic_dec_and_test(&mm->mm_users)) {
-		exit_aio(mm);
-		ksm_exit(mm);
-		khugepaged_exit(mm); 
-		exit_mmap(mm);
-		set_mm_exe_file(mm, NULL);
-		if (!list_empty(&mm->mmlist)) {
-			spin_lock(&mmlist_lock);
-			list_del(&mm->mmlist);
-			spin_unlock(&mmlist_lock);
-		}
-		put_swap_token(mm);
-		if (mm->binfmt)
-			module_put(mm->binfmt->module);
-		mmdrop(mm);
+		INIT_WORK(&mm->async_put_work, mmput_async_fn);
+		schedule_work(&mm->async_put_work);
 	}
 }
-EXPORT_SYMBOL_GPL(mmput);
+EXPORT_SYMBOL_GPL(mmput_async);
 
 void added_exe_file_vma(struct mm_struct *mm)
 {
@@ -1286,6 +1308,7 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 			__this_cpu_inc(process_counts);
 		}
 		attach_pid(p, PIDTYPE_PID, pid);
+		lowmem_task_add(p);
 		nr_threads++;
 	}
 
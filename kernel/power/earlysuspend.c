@@ -21,6 +21,10 @@
 #include <linux/workqueue.h>
 #include <linux/cpu.h>
 #include <linux/cpufreq.h>
+#include <linux/async.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
 
 #include "power.h"
 #ifdef CONFIG_TRACING_IRQ_PWR
@@ -56,6 +60,9 @@ enum {
 	SUSPEND_REQUESTED_AND_SUSPENDED = SUSPEND_REQUESTED | SUSPENDED,
 };
 static int state;
+static LIST_HEAD(early_suspend_domain);
+static unsigned int early_suspend_us;
+static unsigned int late_resume_us;
 #ifdef CONFIG_HTC_ONMODE_CHARGING
 static LIST_HEAD(onchg_suspend_handlers);
 static void onchg_suspend(struct work_struct *work);
@@ -111,6 +118,80 @@ static void __ref boost_cpu_speed(int boost)
 static void boost_cpu_speed(int boost) { return; }
 #endif
 
+static void early_suspend_call(struct early_suspend *h, bool resume)
+{
+	ktime_t start = ktime_get();
+	unsigned int us;
+
+	if (debug_mask & DEBUG_VERBOSE)
+		pr_info("%s: calling %pf\n", resume ? "late_resume" :
+			"early_suspend", resume ? h->resume : h->suspend);
+	if (resume)
+		h->resume(h);
+	else
+		h->suspend(h);
+
+	us = ktime_to_us(ktime_sub(ktime_get(), start));
+	if (resume) {
+		h->resume_us = us;
+		h->resume_max_us = max(h->resume_max_us, us);
+	} else {
+		h->suspend_us = us;
+		h->suspend_max_us = max(h->suspend_max_us, us);
+	}
+}
+
+static void early_suspend_async_suspend(void *data, async_cookie_t cookie)
+{
+	early_suspend_call(data, false);
+}
+
+static void early_suspend_async_resume(void *data, async_cookie_t cookie)
+{
+	early_suspend_call(data, true);
+}
+
+static void early_suspend_schedule(struct early_suspend *h, bool resume,
+				   int *level)
+{
+	if (h->level != *level) {
+		async_synchronize_full_domain(&early_suspend_domain);
+		*level = h->level;
+	}
+	if (!(resume ? h->resume : h->suspend))
+		return;
+	if (h->async)
+		async_schedule_domain(resume ? early_suspend_async_resume :
+				      early_suspend_async_suspend, h,
+				      &early_suspend_domain);
+	else
+		early_suspend_call(h, resume);
+}
+
+/*
+ * Levels run one after the other. Within a level, handlers are taken in
+ * list order: async ones are handed to the async domain and sync ones run
+ * inline, so the latter overlap with the async handlers started before
+ * them. Called with early_suspend_lock held.
+ */
+static unsigned int early_suspend_run_handlers(bool resume)
+{
+	struct early_suspend *pos;
+	ktime_t start = ktime_get();
+	int level = INT_MIN;
+
+	if (resume) {
+		list_for_each_entry_reverse(pos, &early_suspend_handlers, link)
+			early_suspend_schedule(pos, true, &level);
+	} else {
+		list_for_each_entry(pos, &early_suspend_handlers, link)
+			early_suspend_schedule(pos, false, &level);
+	}
+	async_synchronize_full_domain(&early_suspend_domain);
+
+	return ktime_to_us(ktime_sub(ktime_get(), start));
+}
+
 void register_early_suspend(struct early_suspend *handler)
 {
 	struct list_head *pos;
@@ -139,7 +220,6 @@ EXPORT_SYMBOL(unregister_early_suspend);
 
 static void early_suspend(struct work_struct *work)
 {
-	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
 
@@ -167,13 +247,7 @@ static void early_suspend(struct work_struct *work)
 
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("early_suspend: call handlers\n");
-	list_for_each_entry(pos, &early_suspend_handlers, link) {
-		if (pos->suspend != NULL) {
-			if (debug_mask & DEBUG_VERBOSE)
-				pr_info("early_suspend: calling %pf\n", pos->suspend);
-			pos->suspend(pos);
-		}
-	}
+	early_suspend_us = early_suspend_run_handlers(false);
 	boost_cpu_speed(0);
 	mutex_unlock(&early_suspend_lock);
 
@@ -197,7 +271,6 @@ abort:
 
 static void late_resume(struct work_struct *work)
 {
-	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
 
@@ -224,14 +297,7 @@ static void late_resume(struct work_struct *work)
 
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: call handlers\n");
-	list_for_each_entry_reverse(pos, &early_suspend_handlers, link) {
-		if (pos->resume != NULL) {
-			if (debug_mask & DEBUG_VERBOSE)
-				pr_info("late_resume: calling %pf\n", pos->resume);
-
-			pos->resume(pos);
-		}
-	}
+	late_resume_us = early_suspend_run_handlers(true);
 
 	boost_cpu_speed(0);
 
@@ -415,3 +481,40 @@ suspend_state_t get_suspend_state(void)
 {
 	return requested_suspend_state;
 }
+
+static int early_suspend_stats_show(struct seq_file *m, void *unused)
+{
+	struct early_suspend *pos;
+
+	mutex_lock(&early_suspend_lock);
+	seq_printf(m, "early_suspend %u us, late_resume %u us\n",
+		   early_suspend_us, late_resume_us);
+	seq_puts(m, "level async suspend_us max_us resume_us max_us handler\n");
+	list_for_each_entry(pos, &early_suspend_handlers, link)
+		seq_printf(m, "%5d %5d %10u %6u %9u %6u %pf\n", pos->level,
+			   pos->async, pos->suspend_us, pos->suspend_max_us,
+			   pos->resume_us, pos->resume_max_us,
+			   pos->suspend ? pos->suspend : pos->resume);
+	mutex_unlock(&early_suspend_lock);
+	return 0;
+}
+
+static int early_suspend_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, early_suspend_stats_show, NULL);
+}
+
+static const struct file_operations early_suspend_stats_fops = {
+	.open = early_suspend_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init early_suspend_debugfs_init(void)
+{
+	debugfs_create_file("early_suspend", S_IRUGO, NULL, NULL,
+			    &early_suspend_stats_fops);
+	return 0;
+}
+late_initcall(early_suspend_debugfs_init);
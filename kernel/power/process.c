@@ -115,6 +115,7 @@ static int try_to_freeze_tasks(bool user_only)
 
 int freeze_processes(void)
 {
+	u64 start;
 	int error;
 
 	error = __usermodehelper_disable(UMH_FREEZING);
@@ -126,7 +127,9 @@ int freeze_processes(void)
 
 	printk("Freezing user space processes ... ");
 	pm_freezing = true;
+	start = local_clock();
 	error = try_to_freeze_tasks(true);
+	suspend_timing_add(SUSPEND_TIMING_FREEZE, local_clock() - start);
 	if (!error) {
 		printk("done.");
 		__usermodehelper_set_disable_depth(UMH_DISABLED);
@@ -142,15 +145,20 @@ int freeze_processes(void)
 
 int freeze_kernel_threads(void)
 {
+	u64 start;
 	int error;
 
+	start = local_clock();
 	error = suspend_sys_sync_wait();
+	suspend_timing_add(SUSPEND_TIMING_SYNC, local_clock() - start);
 	if (error)
 		return error;
 
 	printk("Freezing remaining freezable tasks ... ");
 	pm_nosig_freezing = true;
+	start = local_clock();
 	error = try_to_freeze_tasks(false);
+	suspend_timing_add(SUSPEND_TIMING_FREEZE, local_clock() - start);
 	if (!error)
 		printk("done.");
 
@@ -26,6 +26,8 @@
 #include <linux/syscore_ops.h>
 #include <linux/ftrace.h>
 #include <linux/rtc.h>
+#include <linux/sched.h>
+#include <linux/hrtimer.h>
 #include <trace/events/power.h>
 
 #include "power.h"
@@ -108,6 +110,9 @@ void __attribute__ ((weak)) arch_suspend_enable_irqs(void)
 
 static int suspend_enter(suspend_state_t state, bool *wakeup)
 {
+	ktime_t sleep_start;
+	u64 syscore_ns;
+	u64 start;
 	int error;
 
 	if (suspend_ops->prepare) {
@@ -116,7 +121,9 @@ static int suspend_enter(suspend_state_t state, bool *wakeup)
 			goto Platform_finish;
 	}
 
+	start = local_clock();
 	error = dpm_suspend_end(PMSG_SUSPEND);
+	suspend_timing_add(SUSPEND_TIMING_SUSPEND_END, local_clock() - start);
 	if (error) {
 		printk(KERN_ERR "PM: Some devices failed to power down\n");
 		goto Platform_finish;
@@ -138,14 +145,32 @@ static int suspend_enter(suspend_state_t state, bool *wakeup)
 	arch_suspend_disable_irqs();
 	BUG_ON(!irqs_disabled());
 
+	/*
+	 * Timekeeping is suspended by the syscore ops, so the time spent in
+	 * ->enter() is what boot time advanced by across the whole block,
+	 * less the syscore ops themselves.
+	 */
+	sleep_start = ktime_get_boottime();
+	start = local_clock();
 	error = syscore_suspend();
+	syscore_ns = local_clock() - start;
+	suspend_timing_add(SUSPEND_TIMING_SYSCORE_SUSPEND, syscore_ns);
 	if (!error) {
 		*wakeup = pm_wakeup_pending();
 		if (!(suspend_test(TEST_CORE) || *wakeup)) {
 			error = suspend_ops->enter(state);
 			events_check_enabled = false;
 		}
+		start = local_clock();
 		syscore_resume();
+		start = local_clock() - start;
+		suspend_timing_add(SUSPEND_TIMING_SYSCORE_RESUME, start);
+		syscore_ns += start;
+		start = ktime_to_ns(ktime_sub(ktime_get_boottime(),
+					      sleep_start));
+		if (start > syscore_ns)
+			suspend_timing_add(SUSPEND_TIMING_ENTER,
+					   start - syscore_ns);
 	}
 
 	arch_suspend_enable_irqs();
@@ -158,7 +183,9 @@ static int suspend_enter(suspend_state_t state, bool *wakeup)
 	if (suspend_ops->wake)
 		suspend_ops->wake();
 
+	start = local_clock();
 	dpm_resume_start(PMSG_RESUME);
+	suspend_timing_add(SUSPEND_TIMING_RESUME_START, local_clock() - start);
 
  Platform_finish:
 	if (suspend_ops->finish)
@@ -171,6 +198,7 @@ int suspend_devices_and_enter(suspend_state_t state)
 {
 	int error;
 	bool wakeup = false;
+	u64 start;
 
 	if (!suspend_ops)
 		return -ENOSYS;
@@ -185,7 +213,9 @@ int suspend_devices_and_enter(suspend_state_t state)
 		suspend_console();
 	ftrace_stop();
 	suspend_test_start();
+	start = local_clock();
 	error = dpm_suspend_start(PMSG_SUSPEND);
+	suspend_timing_add(SUSPEND_TIMING_SUSPEND, local_clock() - start);
 	if (error) {
 		printk(KERN_ERR "PM: Some devices failed to suspend\n");
 		goto Recover_platform;
@@ -201,7 +231,9 @@ int suspend_devices_and_enter(suspend_state_t state)
 
  Resume_devices:
 	suspend_test_start();
+	start = local_clock();
 	dpm_resume_end(PMSG_RESUME);
+	suspend_timing_add(SUSPEND_TIMING_RESUME, local_clock() - start);
 	suspend_test_finish("resume devices");
 	ftrace_start();
 	if (!suspend_console_deferred)
@@ -220,7 +252,10 @@ int suspend_devices_and_enter(suspend_state_t state)
 
 static void suspend_finish(void)
 {
+	u64 start = local_clock();
+
 	suspend_thaw_processes();
+	suspend_timing_add(SUSPEND_TIMING_THAW, local_clock() - start);
 	pm_notifier_call_chain(PM_POST_SUSPEND);
 	pm_restore_console();
 }
@@ -277,7 +312,9 @@ int pm_suspend(suspend_state_t state)
 		return -EINVAL;
 
 	pm_suspend_marker("entry");
+	suspend_timing_begin();
 	error = enter_state(state);
+	suspend_timing_end(error);
 	if (error) {
 		suspend_stats.fail++;
 		dpm_save_failed_errno(error);
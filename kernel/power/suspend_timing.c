@@ -0,0 +1,216 @@
+/*
+ * kernel/power/suspend_timing.c - latency breakdown of suspend/resume cycles
+ *
+ * Each call to pm_suspend() opens a record in a ring of the last
+ * SUSPEND_TIMING_CYCLES cycles. The suspend path adds the time spent in
+ * each of its steps and the device core reports every PM callback, of
+ * which the slowest few are kept for each direction. The ring is shown in
+ * /sys/kernel/debug/suspend_timing, newest cycle first.
+ *
+ * This file is released under the GPLv2.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/device.h>
+#include <linux/suspend.h>
+#include <linux/spinlock.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/hrtimer.h>
+#include <linux/time.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <trace/events/power.h>
+
+#define SUSPEND_TIMING_CYCLES	16
+#define SUSPEND_TIMING_DEVICES	4
+
+struct suspend_timing_dev {
+	char name[24];
+	u64 ns;
+};
+
+struct suspend_timing_cycle {
+	unsigned int seq;
+	struct timespec start;		/* wall clock */
+	ktime_t boot_start;		/* boot time, to include the sleep */
+	u64 total_ns;
+	int error;
+	u64 step_ns[SUSPEND_TIMING_NR_STEPS];
+	struct suspend_timing_dev slow_suspend[SUSPEND_TIMING_DEVICES];
+	struct suspend_timing_dev slow_resume[SUSPEND_TIMING_DEVICES];
+};
+
+static const char * const suspend_timing_steps[SUSPEND_TIMING_NR_STEPS] = {
+	[SUSPEND_TIMING_SYNC]		 = "sync",
+	[SUSPEND_TIMING_FREEZE]		 = "freeze",
+	[SUSPEND_TIMING_SUSPEND]	 = "dpm_suspend",
+	[SUSPEND_TIMING_SUSPEND_END]	 = "dpm_suspend_end",
+	[SUSPEND_TIMING_SYSCORE_SUSPEND] = "syscore_suspend",
+	[SUSPEND_TIMING_ENTER]		 = "enter",
+	[SUSPEND_TIMING_SYSCORE_RESUME]	 = "syscore_resume",
+	[SUSPEND_TIMING_RESUME_START]	 = "dpm_resume_start",
+	[SUSPEND_TIMING_RESUME]		 = "dpm_resume",
+	[SUSPEND_TIMING_THAW]		 = "thaw",
+};
+
+static struct suspend_timing_cycle suspend_timing_ring[SUSPEND_TIMING_CYCLES];
+static unsigned int suspend_timing_seq;
+static bool suspend_timing_active;
+static DEFINE_SPINLOCK(suspend_timing_lock);
+
+static struct suspend_timing_cycle *suspend_timing_cur(void)
+{
+	return &suspend_timing_ring[suspend_timing_seq % SUSPEND_TIMING_CYCLES];
+}
+
+void suspend_timing_begin(void)
+{
+	struct suspend_timing_cycle *c;
+	unsigned long flags;
+
+	spin_lock_irqsave(&suspend_timing_lock, flags);
+	suspend_timing_seq++;
+	c = suspend_timing_cur();
+	memset(c, 0, sizeof(*c));
+	c->seq = suspend_timing_seq;
+	getnstimeofday(&c->start);
+	c->boot_start = ktime_get_boottime();
+	suspend_timing_active = true;
+	spin_unlock_irqrestore(&suspend_timing_lock, flags);
+}
+
+void suspend_timing_end(int error)
+{
+	struct suspend_timing_cycle *c;
+	unsigned long flags;
+
+	spin_lock_irqsave(&suspend_timing_lock, flags);
+	c = suspend_timing_cur();
+	c->error = error;
+	c->total_ns = ktime_to_ns(ktime_sub(ktime_get_boottime(),
+					    c->boot_start));
+	suspend_timing_active = false;
+	spin_unlock_irqrestore(&suspend_timing_lock, flags);
+}
+
+/*
+ * Steps are accumulated, as some of them run more than once per cycle
+ * (freezing is done in two passes, ->suspend_again() repeats the enter).
+ */
+void suspend_timing_add(enum suspend_timing_step step, u64 ns)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&suspend_timing_lock, flags);
+	if (!suspend_timing_active) {
+		spin_unlock_irqrestore(&suspend_timing_lock, flags);
+		return;
+	}
+	suspend_timing_cur()->step_ns[step] += ns;
+	spin_unlock_irqrestore(&suspend_timing_lock, flags);
+
+	trace_suspend_timing(suspend_timing_steps[step], ns);
+}
+
+/* Called for every PM callback of a device, possibly from async threads */
+void suspend_timing_device(struct device *dev, pm_message_t state, u64 ns)
+{
+	struct suspend_timing_dev *slow;
+	unsigned long flags;
+	int i;
+
+	if (state.event != PM_EVENT_SUSPEND && state.event != PM_EVENT_RESUME)
+		return;
+
+	spin_lock_irqsave(&suspend_timing_lock, flags);
+	if (!suspend_timing_active)
+		goto out;
+	if (state.event == PM_EVENT_SUSPEND)
+		slow = suspend_timing_cur()->slow_suspend;
+	else
+		slow = suspend_timing_cur()->slow_resume;
+	if (ns <= slow[SUSPEND_TIMING_DEVICES - 1].ns)
+		goto out;
+
+	for (i = SUSPEND_TIMING_DEVICES - 1; i > 0 && ns > slow[i - 1].ns; i--)
+		slow[i] = slow[i - 1];
+	strlcpy(slow[i].name, dev_name(dev), sizeof(slow[i].name));
+	slow[i].ns = ns;
+out:
+	spin_unlock_irqrestore(&suspend_timing_lock, flags);
+}
+
+static void suspend_timing_show_devs(struct seq_file *m, const char *dir,
+				     struct suspend_timing_dev *slow)
+{
+	int i;
+
+	seq_printf(m, "  slowest %s:", dir);
+	for (i = 0; i < SUSPEND_TIMING_DEVICES && slow[i].ns; i++)
+		seq_printf(m, " %s %llu", slow[i].name,
+			   (unsigned long long)div_u64(slow[i].ns,
+						       NSEC_PER_USEC));
+	seq_putc(m, '\n');
+}
+
+static int suspend_timing_show(struct seq_file *m, void *unused)
+{
+	struct suspend_timing_cycle *c;
+	unsigned int seq;
+	int i, n;
+
+	/* Copied out cycle by cycle so as not to print under the lock */
+	c = kmalloc(sizeof(*c), GFP_KERNEL);
+	if (!c)
+		return -ENOMEM;
+
+	seq_puts(m, "times in us\n");
+	spin_lock_irq(&suspend_timing_lock);
+	seq = suspend_timing_seq;
+	spin_unlock_irq(&suspend_timing_lock);
+
+	for (n = 0; n < SUSPEND_TIMING_CYCLES && n < seq; n++) {
+		spin_lock_irq(&suspend_timing_lock);
+		*c = suspend_timing_ring[(seq - n) % SUSPEND_TIMING_CYCLES];
+		spin_unlock_irq(&suspend_timing_lock);
+		/* Overwritten by a new cycle while we were printing */
+		if (c->seq != seq - n)
+			break;
+
+		seq_printf(m, "cycle %u at %ld.%09ld error %d total %llu\n",
+			   c->seq, c->start.tv_sec, c->start.tv_nsec, c->error,
+			   (unsigned long long)div_u64(c->total_ns,
+						       NSEC_PER_USEC));
+		for (i = 0; i < SUSPEND_TIMING_NR_STEPS; i++)
+			seq_printf(m, "  %-16s %llu\n", suspend_timing_steps[i],
+				   (unsigned long long)div_u64(c->step_ns[i],
+							       NSEC_PER_USEC));
+		suspend_timing_show_devs(m, "suspend", c->slow_suspend);
+		suspend_timing_show_devs(m, "resume", c->slow_resume);
+	}
+
+	kfree(c);
+	return 0;
+}
+
+static int suspend_timing_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, suspend_timing_show, NULL);
+}
+
+static const struct file_operations suspend_timing_fops = {
+	.open = suspend_timing_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init suspend_timing_init(void)
+{
+	debugfs_create_file("suspend_timing", S_IRUGO, NULL, NULL,
+			    &suspend_timing_fops);
+	return 0;
+}
+late_initcall(suspend_timing_init);
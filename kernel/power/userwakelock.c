@@ -17,6 +17,8 @@
 #include <linux/module.h>
 #include <linux/wakelock.h>
 #include <linux/slab.h>
+#include <linux/dcache.h>
+#include <linux/hash.h>
 
 #include "power.h"
 
@@ -30,22 +32,24 @@ enum {
 static int debug_mask = DEBUG_FAILURE;
 module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 
-static DEFINE_MUTEX(tree_lock);
+static DEFINE_MUTEX(table_lock);
+
+#define USER_WAKE_LOCK_HASH_BITS	8
 
 struct user_wake_lock {
-	struct rb_node		node;
+	struct hlist_node	node;
 	struct wake_lock	wake_lock;
 	char			name[0];
 };
-struct rb_root user_wake_locks;
+static struct hlist_head user_wake_locks[1 << USER_WAKE_LOCK_HASH_BITS];
 
 static struct user_wake_lock *lookup_wake_lock_name(
 	const char *buf, int allocate, long *timeoutptr)
 {
-	struct rb_node **p = &user_wake_locks.rb_node;
-	struct rb_node *parent = NULL;
+	struct hlist_head *head;
+	struct hlist_node *n;
 	struct user_wake_lock *l;
-	int diff;
+	unsigned int hash;
 	u64 timeout;
 	int name_len;
 	const char *arg;
@@ -79,21 +83,13 @@ static struct user_wake_lock *lookup_wake_lock_name(
 		*timeoutptr = 0;
 
 	
-	while (*p) {
-		parent = *p;
-		l = rb_entry(parent, struct user_wake_lock, node);
-		diff = strncmp(buf, l->name, name_len);
-		if (!diff && l->name[name_len])
-			diff = -1;
+	hash = full_name_hash((const unsigned char *)buf, name_len);
+	head = &user_wake_locks[hash_32(hash, USER_WAKE_LOCK_HASH_BITS)];
+	hlist_for_each_entry(l, n, head, node) {
 		if (debug_mask & DEBUG_ERROR)
-			pr_info("lookup_wake_lock_name: compare %.*s %s %d\n",
-				name_len, buf, l->name, diff);
-
-		if (diff < 0)
-			p = &(*p)->rb_left;
-		else if (diff > 0)
-			p = &(*p)->rb_right;
-		else
+			pr_info("lookup_wake_lock_name: compare %.*s %s\n",
+				name_len, buf, l->name);
+		if (!strncmp(buf, l->name, name_len) && !l->name[name_len])
 			return l;
 	}
 
@@ -115,8 +111,7 @@ static struct user_wake_lock *lookup_wake_lock_name(
 	if (debug_mask & DEBUG_NEW)
 		pr_info("lookup_wake_lock_name: new wake lock %s\n", l->name);
 	wake_lock_init(&l->wake_lock, WAKE_LOCK_SUSPEND, l->name);
-	rb_link_node(&l->node, parent, p);
-	rb_insert_color(&l->node, &user_wake_locks);
+	hlist_add_head(&l->node, head);
 	return l;
 
 bad_arg:
@@ -131,19 +126,21 @@ ssize_t wake_lock_show(
 {
 	char *s = buf;
 	char *end = buf + PAGE_SIZE;
-	struct rb_node *n;
+	struct hlist_node *n;
 	struct user_wake_lock *l;
+	int i;
 
-	mutex_lock(&tree_lock);
+	mutex_lock(&table_lock);
 
-	for (n = rb_first(&user_wake_locks); n != NULL; n = rb_next(n)) {
-		l = rb_entry(n, struct user_wake_lock, node);
-		if (wake_lock_active(&l->wake_lock))
-			s += scnprintf(s, end - s, "%s ", l->name);
+	for (i = 0; i < ARRAY_SIZE(user_wake_locks); i++) {
+		hlist_for_each_entry(l, n, &user_wake_locks[i], node) {
+			if (wake_lock_active(&l->wake_lock))
+				s += scnprintf(s, end - s, "%s ", l->name);
+		}
 	}
 	s += scnprintf(s, end - s, "\n");
 
-	mutex_unlock(&tree_lock);
+	mutex_unlock(&table_lock);
 	return (s - buf);
 }
 
@@ -154,7 +151,7 @@ ssize_t wake_lock_store(
 	long timeout;
 	struct user_wake_lock *l;
 
-	mutex_lock(&tree_lock);
+	mutex_lock(&table_lock);
 	l = lookup_wake_lock_name(buf, 1, &timeout);
 	if (IS_ERR(l)) {
 		n = PTR_ERR(l);
@@ -169,7 +166,7 @@ ssize_t wake_lock_store(
 	else
 		wake_lock(&l->wake_lock);
 bad_name:
-	mutex_unlock(&tree_lock);
+	mutex_unlock(&table_lock);
 	return n;
 }
 
@@ -179,19 +176,21 @@ ssize_t wake_unlock_show(
 {
 	char *s = buf;
 	char *end = buf + PAGE_SIZE;
-	struct rb_node *n;
+	struct hlist_node *n;
 	struct user_wake_lock *l;
+	int i;
 
-	mutex_lock(&tree_lock);
+	mutex_lock(&table_lock);
 
-	for (n = rb_first(&user_wake_locks); n != NULL; n = rb_next(n)) {
-		l = rb_entry(n, struct user_wake_lock, node);
-		if (!wake_lock_active(&l->wake_lock))
-			s += scnprintf(s, end - s, "%s ", l->name);
+	for (i = 0; i < ARRAY_SIZE(user_wake_locks); i++) {
+		hlist_for_each_entry(l, n, &user_wake_locks[i], node) {
+			if (!wake_lock_active(&l->wake_lock))
+				s += scnprintf(s, end - s, "%s ", l->name);
+		}
 	}
 	s += scnprintf(s, end - s, "\n");
 
-	mutex_unlock(&tree_lock);
+	mutex_unlock(&table_lock);
 	return (s - buf);
 }
 
@@ -201,7 +200,7 @@ ssize_t wake_unlock_store(
 {
 	struct user_wake_lock *l;
 
-	mutex_lock(&tree_lock);
+	mutex_lock(&table_lock);
 	l = lookup_wake_lock_name(buf, 0, NULL);
 	if (IS_ERR(l)) {
 		n = PTR_ERR(l);
@@ -213,7 +212,7 @@ ssize_t wake_unlock_store(
 
 	wake_unlock(&l->wake_lock);
 not_found:
-	mutex_unlock(&tree_lock);
+	mutex_unlock(&table_lock);
 	return n;
 }
 
@@ -44,7 +44,13 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 
 static DEFINE_SPINLOCK(list_lock);
 static LIST_HEAD(inactive_locks);
+/*
+ * Active locks of each type: those without timeout first, then those with
+ * one, sorted by expiry. active_untimed counts the former, so whether a
+ * lock of a type is held is known without walking the list.
+ */
 static struct list_head active_wake_locks[WAKE_LOCK_TYPE_COUNT];
+static int active_untimed[WAKE_LOCK_TYPE_COUNT];
 static int current_event_num;
 static int suspend_sys_sync_count;
 static DEFINE_SPINLOCK(suspend_sys_sync_lock);
@@ -202,13 +208,24 @@ static void update_sleep_wait_stats_locked(int done)
 #endif
 
 
+/* Take @lock off its list, keeping active_untimed in sync */
+static void wake_lock_unlink_locked(struct wake_lock *lock)
+{
+	int type = lock->flags & WAKE_LOCK_TYPE_MASK;
+
+	if ((lock->flags & (WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE)) ==
+	    WAKE_LOCK_ACTIVE)
+		active_untimed[type]--;
+	list_del(&lock->link);
+}
+
 static void expire_wake_lock(struct wake_lock *lock)
 {
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_unlock_stat_locked(lock, 1);
 #endif
+	wake_lock_unlink_locked(lock);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
-	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
 	if (debug_mask & (DEBUG_WAKE_LOCK | DEBUG_EXPIRE))
 		pr_info("expired wake lock %s\n", lock->name);
@@ -263,23 +280,29 @@ void htc_print_active_wake_locks(int type)
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
 
+/*
+ * Returns -1 if a lock without timeout is held, else the time until the
+ * last timed lock expires, 0 if none is left. Only the locks that expired
+ * since the last call are visited.
+ */
 static long has_wake_lock_locked(int type)
 {
-	struct wake_lock *lock, *n;
-	long max_timeout = 0;
+	struct list_head *head = &active_wake_locks[type];
+	struct wake_lock *lock;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry_safe(lock, n, &active_wake_locks[type], link) {
-		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
-			long timeout = lock->expires - jiffies;
-			if (timeout <= 0)
-				expire_wake_lock(lock);
-			else if (timeout > max_timeout)
-				max_timeout = timeout;
-		} else
-			return -1;
+	if (active_untimed[type])
+		return -1;
+	while (!list_empty(head)) {
+		lock = list_first_entry(head, struct wake_lock, link);
+		if ((long)(lock->expires - jiffies) > 0)
+			break;
+		expire_wake_lock(lock);
 	}
-	return max_timeout;
+	if (list_empty(head))
+		return 0;
+	lock = list_entry(head->prev, struct wake_lock, link);
+	return lock->expires - jiffies;
 }
 
 long has_wake_lock(int type)
@@ -479,7 +502,6 @@ void wake_lock_destroy(struct wake_lock *lock)
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_lock_destroy name=%s\n", lock->name);
 	spin_lock_irqsave(&list_lock, irqflags);
-	lock->flags &= ~WAKE_LOCK_INITIALIZED;
 #ifdef CONFIG_WAKELOCK_STAT
 	if (lock->stat.count) {
 		deleted_wake_locks.stat.count += lock->stat.count;
@@ -495,7 +517,8 @@ void wake_lock_destroy(struct wake_lock *lock)
 				  lock->stat.max_time);
 	}
 #endif
-	list_del(&lock->link);
+	wake_lock_unlink_locked(lock);
+	lock->flags &= ~WAKE_LOCK_INITIALIZED;
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
 EXPORT_SYMBOL(wake_lock_destroy);
@@ -506,6 +529,7 @@ static void wake_lock_internal(
 	int type;
 	unsigned long irqflags;
 	long expire_in;
+	struct wake_lock *pos;
 
 	spin_lock_irqsave(&list_lock, irqflags);
 	type = lock->flags & WAKE_LOCK_TYPE_MASK;
@@ -524,13 +548,13 @@ static void wake_lock_internal(
 		lock->stat.last_time = ktime_get();
 	}
 #endif
+	wake_lock_unlink_locked(lock);
 	if (!(lock->flags & WAKE_LOCK_ACTIVE)) {
 		lock->flags |= WAKE_LOCK_ACTIVE;
 #ifdef CONFIG_WAKELOCK_STAT
 		lock->stat.last_time = ktime_get();
 #endif
 	}
-	list_del(&lock->link);
 	if (has_timeout) {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d, timeout %ld.%03lu\n",
@@ -538,12 +562,20 @@ static void wake_lock_internal(
 				(timeout % HZ) * MSEC_PER_SEC / HZ);
 		lock->expires = jiffies + timeout;
 		lock->flags |= WAKE_LOCK_AUTO_EXPIRE;
-		list_add_tail(&lock->link, &active_wake_locks[type]);
+		/* Keep the timed locks sorted, new ones usually go last */
+		list_for_each_entry_reverse(pos, &active_wake_locks[type],
+					    link) {
+			if (!(pos->flags & WAKE_LOCK_AUTO_EXPIRE) ||
+			    !time_after(pos->expires, lock->expires))
+				break;
+		}
+		list_add(&lock->link, &pos->link);
 	} else {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d\n", lock->name, type);
 		lock->expires = LONG_MAX;
 		lock->flags &= ~WAKE_LOCK_AUTO_EXPIRE;
+		active_untimed[type]++;
 		list_add(&lock->link, &active_wake_locks[type]);
 	}
 	if (type == WAKE_LOCK_SUSPEND) {
@@ -598,8 +630,8 @@ void wake_unlock(struct wake_lock *lock)
 #endif
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_unlock: %s\n", lock->name);
+	wake_lock_unlink_locked(lock);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
-	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
 	if (type == WAKE_LOCK_SUSPEND) {
 		long has_lock = has_wake_lock_locked(type);
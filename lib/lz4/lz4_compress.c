@@ -0,0 +1,142 @@
+/*
+ *  LZ4 Compressor
+ *
+ *  A greedy, single hash table implementation of the LZ4 block format
+ *  (see lz4defs.h), tuned for compressing one page at a time.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/export.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_hash(const unsigned char *p)
+{
+	return (get_unaligned((const u32 *)p) * 2654435761U) >>
+		(32 - HASH_LOG);
+}
+
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	const unsigned char * const iend = src + src_len;
+	const unsigned char * const mflimit = iend - MFLIMIT;
+	const unsigned char * const matchlimit = iend - LASTLITERALS;
+	const unsigned char *ip = src, *anchor = src, *ref;
+	unsigned char *op = dst, *token;
+	u32 *table = wrkmem;
+	size_t len;
+	u32 h;
+
+	if (src_len < MFLIMIT + 1)
+		goto last_literals;
+
+	memset(table, 0, LZ4_MEM_COMPRESS);
+	table[lz4_hash(ip)] = 0;
+	ip++;
+
+	for (;;) {
+		const unsigned char *forward = ip;
+		unsigned int attempts = 1U << SKIP_TRIGGER;
+
+		/* Find a match, stepping faster over incompressible data */
+		do {
+			ip = forward;
+			forward = ip + (attempts++ >> SKIP_TRIGGER);
+			if (unlikely(forward > mflimit))
+				goto last_literals;
+
+			h = lz4_hash(ip);
+			ref = src + table[h];
+			table[h] = ip - src;
+		} while (ip - ref > MAX_DISTANCE ||
+			 get_unaligned((const u32 *)ref) !=
+			 get_unaligned((const u32 *)ip));
+
+		/* Extend the match backwards over pending literals */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		len = ip - anchor;
+		token = op++;
+		if (len >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_put_length(op, len - RUN_MASK);
+		} else {
+			*token = len << ML_BITS;
+		}
+		memcpy(op, anchor, len);
+		op += len;
+
+next_match:
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		ip += MINMATCH;
+		ref += MINMATCH;
+		anchor = ip;
+		while (ip < matchlimit && *ip == *ref) {
+			ip++;
+			ref++;
+		}
+
+		len = ip - anchor;
+		if (len >= ML_MASK) {
+			*token += ML_MASK;
+			op = lz4_put_length(op, len - ML_MASK);
+		} else {
+			*token += len;
+		}
+		anchor = ip;
+
+		if (ip > mflimit)
+			break;
+
+		table[lz4_hash(ip - 2)] = ip - 2 - src;
+
+		/* Try to chain another match without any literals */
+		h = lz4_hash(ip);
+		ref = src + table[h];
+		table[h] = ip - src;
+		if (ip - ref <= MAX_DISTANCE &&
+		    get_unaligned((const u32 *)ref) ==
+		    get_unaligned((const u32 *)ip)) {
+			token = op++;
+			*token = 0;
+			goto next_match;
+		}
+		ip++;
+	}
+
+last_literals:
+	len = iend - anchor;
+	token = op++;
+	if (len >= RUN_MASK) {
+		*token = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, len - RUN_MASK);
+	} else {
+		*token = len << ML_BITS;
+	}
+	memcpy(op, anchor, len);
+	op += len;
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
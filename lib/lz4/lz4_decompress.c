@@ -0,0 +1,96 @@
+/*
+ *  LZ4 Decompressor
+ *
+ *  Every length and offset is checked against the input and output
+ *  buffers, so corrupted or hostile data cannot overrun either of them.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/export.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline int lz4_get_length(const unsigned char **ipp,
+		const unsigned char *iend, size_t *len)
+{
+	const unsigned char *ip = *ipp;
+	unsigned char s;
+
+	do {
+		if (unlikely(ip >= iend))
+			return -1;
+		s = *ip++;
+		*len += s;
+	} while (s == 255);
+
+	*ipp = ip;
+	return 0;
+}
+
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len)
+{
+	const unsigned char *ip = src;
+	const unsigned char * const iend = src + src_len;
+	unsigned char *op = dst;
+	unsigned char * const oend = dst + *dst_len;
+	const unsigned char *ref;
+	unsigned char token;
+	size_t len, offset;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		len = token >> ML_BITS;
+		if (len == RUN_MASK && lz4_get_length(&ip, iend, &len))
+			goto error;
+		if (unlikely(len > (size_t)(iend - ip) ||
+			     len > (size_t)(oend - op)))
+			goto error;
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+
+		/* The last sequence has no match part */
+		if (ip == iend)
+			break;
+
+		if (unlikely(iend - ip < 2))
+			goto error;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (unlikely(offset == 0 || offset > (size_t)(op - dst)))
+			goto error;
+		ref = op - offset;
+
+		len = token & ML_MASK;
+		if (len == ML_MASK && lz4_get_length(&ip, iend, &len))
+			goto error;
+		len += MINMATCH;
+		if (unlikely(len > (size_t)(oend - op)))
+			goto error;
+
+		/* Overlapping matches replicate the last offset bytes */
+		if (offset >= len) {
+			memcpy(op, ref, len);
+			op += len;
+		} else {
+			while (len--)
+				*op++ = *ref++;
+		}
+	}
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+
+error:
+	*dst_len = op - dst;
+	return LZ4_E_ERROR;
+}
+EXPORT_SYMBOL_GPL(lz4_decompress_unknownoutputsize);
@@ -0,0 +1,320 @@
+/*
+ * Memory pressure notifications
+ *
+ * Reclaim reports how many pages it scanned and how many of them it managed
+ * to reclaim. The ratio between the two is a cheap estimate of how hard the
+ * system is working to satisfy allocations: when most scanned pages are
+ * reclaimed there is plenty of easy memory left, when few are the page
+ * cache is exhausted and the system is about to start thrashing or killing.
+ *
+ * The estimate is taken over windows of vmpressure_win scanned pages and
+ * mapped to one of three levels, which userspace can wait for with an
+ * eventfd registered through /sys/kernel/mm/vmpressure/event_control:
+ *
+ *	echo "<eventfd> <low|medium|critical>" > event_control
+ *
+ * The eventfd is signalled each time a window ends at or above the
+ * requested level, and is unregistered when it is closed.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/file.h>
+#include <linux/poll.h>
+#include <linux/eventfd.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/vmpressure.h>
+
+/*
+ * Number of scanned pages over which the reclaim ratio is computed: large
+ * enough to smooth out single reclaim passes, small enough to react before
+ * the LRU is emptied.
+ */
+static const unsigned long vmpressure_win = SWAP_CLUSTER_MAX * 16;
+
+/* Percentage of scanned pages that could not be reclaimed */
+static const unsigned int vmpressure_level_med = 60;
+static const unsigned int vmpressure_level_critical = 95;
+
+/*
+ * Reclaim dropping to this priority means it already scanned a tenth of
+ * the LRU without making progress, which is critical whatever the ratio.
+ */
+static const int vmpressure_level_critical_prio = ilog2(100 / 10);
+
+static const char * const vmpressure_str_levels[] = {
+	[VMPRESSURE_LOW] = "low",
+	[VMPRESSURE_MEDIUM] = "medium",
+	[VMPRESSURE_CRITICAL] = "critical",
+};
+
+struct vmpressure_event {
+	struct eventfd_ctx *efd;
+	enum vmpressure_levels level;
+	struct list_head node;
+
+	/* Unregistration when the eventfd is closed */
+	poll_table pt;
+	wait_queue_head_t *wqh;
+	wait_queue_t wait;
+	struct work_struct remove;
+};
+
+struct vmpressure {
+	spinlock_t sr_lock;	/* protects scanned and reclaimed */
+	unsigned long scanned;
+	unsigned long reclaimed;
+
+	struct mutex events_lock;
+	struct list_head events;
+	enum vmpressure_levels level;	/* level of the last window */
+
+	struct work_struct work;
+};
+
+static void vmpressure_work_fn(struct work_struct *work);
+
+/* Statically initialised: reclaim can run before initcalls */
+static struct vmpressure vmpr = {
+	.sr_lock = __SPIN_LOCK_UNLOCKED(vmpr.sr_lock),
+	.events_lock = __MUTEX_INITIALIZER(vmpr.events_lock),
+	.events = LIST_HEAD_INIT(vmpr.events),
+	.work = __WORK_INITIALIZER(vmpr.work, vmpressure_work_fn),
+};
+
+static enum vmpressure_levels vmpressure_calc_level(unsigned long scanned,
+						    unsigned long reclaimed)
+{
+	unsigned long pressure = 0;
+
+	if (reclaimed < scanned)
+		pressure = 100 - reclaimed * 100 / scanned;
+
+	if (pressure >= vmpressure_level_critical)
+		return VMPRESSURE_CRITICAL;
+	if (pressure >= vmpressure_level_med)
+		return VMPRESSURE_MEDIUM;
+	return VMPRESSURE_LOW;
+}
+
+static void vmpressure_work_fn(struct work_struct *work)
+{
+	struct vmpressure_event *ev;
+	enum vmpressure_levels level;
+	unsigned long scanned;
+	unsigned long reclaimed;
+
+	spin_lock(&vmpr.sr_lock);
+	scanned = vmpr.scanned;
+	reclaimed = vmpr.reclaimed;
+	vmpr.scanned = 0;
+	vmpr.reclaimed = 0;
+	spin_unlock(&vmpr.sr_lock);
+
+	/* Another run of the work already consumed this window */
+	if (!scanned)
+		return;
+
+	level = vmpressure_calc_level(scanned, reclaimed);
+
+	mutex_lock(&vmpr.events_lock);
+	vmpr.level = level;
+	list_for_each_entry(ev, &vmpr.events, node) {
+		if (level >= ev->level)
+			eventfd_signal(ev->efd, 1);
+	}
+	mutex_unlock(&vmpr.events_lock);
+}
+
+/**
+ * vmpressure() - account reclaim efficiency
+ * @gfp:	allocation flags the reclaim was done for
+ * @scanned:	pages scanned
+ * @reclaimed:	pages reclaimed
+ *
+ * Called from shrink_zone() for global reclaim. Only accumulates; the
+ * level is computed and reported from a work item once a full window has
+ * been scanned.
+ */
+void vmpressure(gfp_t gfp, unsigned long scanned, unsigned long reclaimed)
+{
+	/*
+	 * Reclaim that could not use highmem, movable, IO or FS pages says
+	 * nothing about the pressure on memory as a whole.
+	 */
+	if (!(gfp & (__GFP_HIGHMEM | __GFP_MOVABLE | __GFP_IO | __GFP_FS)))
+		return;
+
+	if (!scanned)
+		return;
+
+	spin_lock(&vmpr.sr_lock);
+	vmpr.scanned += scanned;
+	vmpr.reclaimed += reclaimed;
+	scanned = vmpr.scanned;
+	spin_unlock(&vmpr.sr_lock);
+
+	if (scanned < vmpressure_win)
+		return;
+	schedule_work(&vmpr.work);
+}
+
+/**
+ * vmpressure_prio() - account reclaim priority
+ * @gfp:	allocation flags the reclaim is done for
+ * @prio:	reclaim priority about to be used
+ *
+ * Reports a window of unsuccessful reclaim once the priority becomes low
+ * enough that reclaim is close to giving up.
+ */
+void vmpressure_prio(gfp_t gfp, int prio)
+{
+	if (prio > vmpressure_level_critical_prio)
+		return;
+
+	vmpressure(gfp, vmpressure_win, 0);
+}
+
+static void vmpressure_event_remove(struct work_struct *work)
+{
+	struct vmpressure_event *ev = container_of(work,
+			struct vmpressure_event, remove);
+
+	mutex_lock(&vmpr.events_lock);
+	list_del(&ev->node);
+	mutex_unlock(&vmpr.events_lock);
+
+	eventfd_ctx_put(ev->efd);
+	kfree(ev);
+}
+
+static int vmpressure_event_wake(wait_queue_t *wait, unsigned mode,
+				 int sync, void *key)
+{
+	struct vmpressure_event *ev = container_of(wait,
+			struct vmpressure_event, wait);
+	unsigned long flags = (unsigned long)key;
+
+	/* Called with wqh->lock held; the list is dropped from process context */
+	if (flags & POLLHUP) {
+		__remove_wait_queue(ev->wqh, &ev->wait);
+		schedule_work(&ev->remove);
+	}
+
+	return 0;
+}
+
+static void vmpressure_ptable_queue_proc(struct file *file,
+		wait_queue_head_t *wqh, poll_table *pt)
+{
+	struct vmpressure_event *ev = container_of(pt,
+			struct vmpressure_event, pt);
+
+	ev->wqh = wqh;
+	add_wait_queue(wqh, &ev->wait);
+}
+
+static ssize_t level_show(struct kobject *kobj, struct kobj_attribute *attr,
+			  char *buf)
+{
+	return sprintf(buf, "%s\n", vmpressure_str_levels[vmpr.level]);
+}
+
+static ssize_t event_control_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct vmpressure_event *ev;
+	struct file *efile;
+	unsigned int efd;
+	char *endp;
+	int level;
+	int ret;
+
+	efd = simple_strtoul(buf, &endp, 10);
+	if (*endp != ' ')
+		return -EINVAL;
+
+	for (level = 0; level < VMPRESSURE_NUM_LEVELS; level++) {
+		if (sysfs_streq(endp + 1, vmpressure_str_levels[level]))
+			break;
+	}
+	if (level == VMPRESSURE_NUM_LEVELS)
+		return -EINVAL;
+
+	ev = kzalloc(sizeof(*ev), GFP_KERNEL);
+	if (!ev)
+		return -ENOMEM;
+	ev->level = level;
+	INIT_LIST_HEAD(&ev->node);
+	init_poll_funcptr(&ev->pt, vmpressure_ptable_queue_proc);
+	init_waitqueue_func_entry(&ev->wait, vmpressure_event_wake);
+	INIT_WORK(&ev->remove, vmpressure_event_remove);
+
+	efile = eventfd_fget(efd);
+	if (IS_ERR(efile)) {
+		ret = PTR_ERR(efile);
+		goto err_free;
+	}
+
+	ev->efd = eventfd_ctx_fileget(efile);
+	if (IS_ERR(ev->efd)) {
+		ret = PTR_ERR(ev->efd);
+		goto err_fput;
+	}
+
+	mutex_lock(&vmpr.events_lock);
+	list_add(&ev->node, &vmpr.events);
+	mutex_unlock(&vmpr.events_lock);
+
+	/* Hook the eventfd wait queue to notice when it is released */
+	efile->f_op->poll(efile, &ev->pt);
+
+	fput(efile);
+	return count;
+
+err_fput:
+	fput(efile);
+err_free:
+	kfree(ev);
+	return ret;
+}
+
+static struct kobj_attribute level_attr = __ATTR_RO(level);
+static struct kobj_attribute event_control_attr =
+	__ATTR(event_control, 0200, NULL, event_control_store);
+
+static struct attribute *vmpressure_attrs[] = {
+	&level_attr.attr,
+	&event_control_attr.attr,
+	NULL,
+};
+
+static struct attribute_group vmpressure_attr_group = {
+	.attrs = vmpressure_attrs,
+	.name = "vmpressure",
+};
+
+static int __init vmpressure_init(void)
+{
+	int err;
+
+	err = sysfs_create_group(mm_kobj, &vmpressure_attr_group);
+	if (err)
+		printk(KERN_ERR "vmpressure: register sysfs failed\n");
+
+	return err;
+}
+module_init(vmpressure_init);
@@ -38,6 +38,7 @@
 #include <linux/freezer.h>
 #include <linux/memcontrol.h>
 #include <linux/delayacct.h>
+#include <linux/vmpressure.h>
 #include <linux/sysctl.h>
 #include <linux/oom.h>
 #include <linux/prefetch.h>
@@ -1555,6 +1556,8 @@ static void shrink_zone(int priority, struct zone *zone,
 		.priority = priority,
 	};
 	struct mem_cgroup *memcg;
+	unsigned long nr_scanned = sc->nr_scanned;
+	unsigned long nr_reclaimed = sc->nr_reclaimed;
 
 	memcg = mem_cgroup_iter(root, NULL, &reclaim);
 	do {
@@ -1570,6 +1573,10 @@ static void shrink_zone(int priority, struct zone *zone,
 		}
 		memcg = mem_cgroup_iter(root, memcg, &reclaim);
 	} while (memcg);
+
+	if (global_reclaim(sc))
+		vmpressure(sc->gfp_mask, sc->nr_scanned - nr_scanned,
+			   sc->nr_reclaimed - nr_reclaimed);
 }
 
 static inline bool compaction_ready(struct zone *zone, struct scan_control *sc)
@@ -1698,6 +1705,8 @@ static unsigned long do_try_to_free_pages(struct zonelist *zonelist,
 
 	for (priority = DEF_PRIORITY; priority >= 0; priority--) {
 		sc->nr_scanned = 0;
+		if (global_reclaim(sc))
+			vmpressure_prio(sc->gfp_mask, priority);
 		if (!priority)
 			disable_swap_token(sc->target_mem_cgroup);
 		aborted_reclaim = shrink_zones(priority, zonelist, sc);
@@ -0,0 +1,288 @@
+/*
+ * Binder async-flood benchmark: N clients (4 by default) send one-way
+ * transactions of random size, 64 bytes to 16 KB, to one server as fast
+ * as they can for a few seconds. The server frees each buffer as soon as
+ * it is delivered. Queued one-way buffers fill the server's async space,
+ * so sends are refused with BR_FAILED_REPLY whenever it is full.
+ *
+ * Reported are the accepted sends/sec, refused sends, the send latency
+ * percentiles, and the server's free space and page statistics from
+ * debugfs (/sys/kernel/debug/binder/stats) at the end of the flood.
+ *
+ * usage: binder_async_flood [clients [seconds]]
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "../../../../drivers/staging/android/binder.h"
+
+#define MAP_SIZE	(1024 * 1024)
+#define MAX_CLIENTS	64
+#define MIN_PAYLOAD	64
+#define MAX_PAYLOAD	(16 * 1024)
+#define MAX_SAMPLES	(1 << 20)
+#define DEFAULT_CLIENTS	4
+#define DEFAULT_SECONDS	5
+
+struct result {
+	unsigned int id;
+	unsigned long sent;
+	unsigned long refused;
+	uint64_t p50_ns, p99_ns, max_ns;
+};
+
+static int binder_open(void)
+{
+	int fd;
+
+	fd = open("/dev/binder", O_RDWR);
+	if (fd < 0) {
+		perror("open /dev/binder");
+		exit(1);
+	}
+	if (mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, fd, 0) == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	return fd;
+}
+
+static void binder_write_read(int fd, void *wbuf, size_t wsize,
+			      void *rbuf, size_t rsize, size_t *consumed)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_buffer = (unsigned long)wbuf;
+	bwr.write_size = wsize;
+	bwr.read_buffer = (unsigned long)rbuf;
+	bwr.read_size = rsize;
+	if (ioctl(fd, BINDER_WRITE_READ, &bwr) < 0) {
+		perror("BINDER_WRITE_READ");
+		exit(1);
+	}
+	if (consumed)
+		*consumed = bwr.read_consumed;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Context manager: free every delivered buffer right away */
+static void run_server(int ready)
+{
+	static uint8_t rbuf[4096];
+	struct binder_transaction_data tr;
+	struct {
+		uint32_t cmd;
+		const void *ptr;
+	} __attribute__((packed)) frees[sizeof(rbuf) / sizeof(tr)];
+	uint32_t cmd = BC_ENTER_LOOPER;
+	size_t len, pos;
+	int fd, n;
+
+	fd = binder_open();
+	if (ioctl(fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("BINDER_SET_CONTEXT_MGR");
+		exit(1);
+	}
+	binder_write_read(fd, &cmd, sizeof(cmd), NULL, 0, NULL);
+	if (write(ready, "", 1) != 1)
+		exit(1);
+
+	for (;;) {
+		binder_write_read(fd, NULL, 0, rbuf, sizeof(rbuf), &len);
+		for (pos = 0, n = 0; pos < len; ) {
+			memcpy(&cmd, rbuf + pos, sizeof(cmd));
+			pos += sizeof(cmd);
+			if (cmd == BR_TRANSACTION) {
+				memcpy(&tr, rbuf + pos, sizeof(tr));
+				frees[n].cmd = BC_FREE_BUFFER;
+				frees[n].ptr = tr.data.ptr.buffer;
+				n++;
+			}
+			pos += _IOC_SIZE(cmd);
+		}
+		if (n)
+			binder_write_read(fd, frees, n * sizeof(frees[0]),
+					  NULL, 0, NULL);
+	}
+}
+
+/* Send one-way transactions for @seconds and report to @result */
+static void run_client(unsigned int id, int seconds, int result)
+{
+	static uint8_t payload[MAX_PAYLOAD];
+	static uint64_t lat_ns[MAX_SAMPLES];
+	struct {
+		uint32_t cmd;
+		struct binder_transaction_data tr;
+	} __attribute__((packed)) out;
+	unsigned int seed = id + 1;
+	struct result res;
+	uint8_t rbuf[64];
+	uint64_t start, end;
+	size_t len, pos;
+	uint32_t cmd;
+	int fd, done;
+
+	fd = binder_open();
+	memset(&res, 0, sizeof(res));
+	res.id = id;
+	memset(&out, 0, sizeof(out));
+	out.cmd = BC_TRANSACTION;
+	out.tr.target.handle = 0;
+	out.tr.flags = TF_ONE_WAY;
+	out.tr.data.ptr.buffer = payload;
+
+	end = now_ns() + seconds * 1000000000ULL;
+	while (now_ns() < end) {
+		out.tr.data_size = MIN_PAYLOAD + rand_r(&seed) %
+				   (MAX_PAYLOAD - MIN_PAYLOAD + 1);
+		out.tr.data_size &= ~7;
+		start = now_ns();
+		binder_write_read(fd, &out, sizeof(out), NULL, 0, NULL);
+		for (done = 0; !done; ) {
+			binder_write_read(fd, NULL, 0, rbuf, sizeof(rbuf), &len);
+			for (pos = 0; pos < len && !done; ) {
+				memcpy(&cmd, rbuf + pos, sizeof(cmd));
+				pos += sizeof(cmd) + _IOC_SIZE(cmd);
+				if (cmd == BR_TRANSACTION_COMPLETE) {
+					if (res.sent < MAX_SAMPLES)
+						lat_ns[res.sent] =
+							now_ns() - start;
+					res.sent++;
+					done = 1;
+				} else if (cmd == BR_FAILED_REPLY) {
+					/* Async space is full, let it drain */
+					res.refused++;
+					sched_yield();
+					done = 1;
+				} else if (cmd == BR_DEAD_REPLY) {
+					fprintf(stderr, "client %u: server died\n",
+						id);
+					exit(1);
+				}
+			}
+		}
+	}
+
+	if (res.sent) {
+		len = res.sent < MAX_SAMPLES ? res.sent : MAX_SAMPLES;
+		qsort(lat_ns, len, sizeof(*lat_ns), cmp_u64);
+		res.p50_ns = lat_ns[len / 2];
+		res.p99_ns = lat_ns[len * 99 / 100];
+		res.max_ns = lat_ns[len - 1];
+	}
+	if (write(result, &res, sizeof(res)) != sizeof(res))
+		exit(1);
+	exit(0);
+}
+
+/* Print the server's allocator lines from the binder stats file */
+static void print_server_stats(pid_t server)
+{
+	char line[256], header[32];
+	int in_proc = 0;
+	FILE *f;
+
+	f = fopen("/sys/kernel/debug/binder/stats", "r");
+	if (!f) {
+		printf("server stats: debugfs not available\n");
+		return;
+	}
+	snprintf(header, sizeof(header), "proc %d\n", server);
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, "proc ", 5))
+			in_proc = !strcmp(line, header);
+		else if (in_proc && (strstr(line, "free async space") ||
+				     strstr(line, "free buffers") ||
+				     strstr(line, "pages:")))
+			printf("server%s", line);
+	}
+	fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+	int nr_clients = DEFAULT_CLIENTS, seconds = DEFAULT_SECONDS;
+	unsigned long sent = 0, refused = 0;
+	int ready[2], result[2], i;
+	struct result res;
+	pid_t server;
+	char c;
+
+	if (argc > 1)
+		nr_clients = atoi(argv[1]);
+	if (argc > 2)
+		seconds = atoi(argv[2]);
+	if (nr_clients < 1 || nr_clients > MAX_CLIENTS || seconds < 1) {
+		fprintf(stderr, "usage: %s [clients, 1..%d [seconds]]\n",
+			argv[0], MAX_CLIENTS);
+		return 1;
+	}
+	if (pipe(ready) < 0 || pipe(result) < 0) {
+		perror("pipe");
+		return 1;
+	}
+
+	server = fork();
+	if (!server)
+		run_server(ready[1]);
+	close(ready[1]);
+	if (server < 0 || read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "server failed to start\n");
+		return 1;
+	}
+	for (i = 0; i < nr_clients; i++)
+		if (!fork())
+			run_client(i, seconds, result[1]);
+	close(result[1]);
+
+	printf("client     sent/s  refused   p50_us   p99_us   max_us\n");
+	for (i = 0; i < nr_clients; i++) {
+		if (read(result[0], &res, sizeof(res)) != sizeof(res)) {
+			fprintf(stderr, "client failed\n");
+			kill(server, SIGKILL);
+			return 1;
+		}
+		printf("%6u %10.0f %8lu %8.1f %8.1f %8.1f\n", res.id,
+		       (double)res.sent / seconds, res.refused,
+		       res.p50_ns / 1e3, res.p99_ns / 1e3, res.max_ns / 1e3);
+		sent += res.sent;
+		refused += res.refused;
+	}
+	printf(" total %10.0f %8lu\n", (double)sent / seconds, refused);
+	print_server_stats(server);
+
+	kill(server, SIGKILL);
+	while (wait(NULL) > 0)
+		;
+	return 0;
+}
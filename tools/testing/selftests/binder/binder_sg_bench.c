@@ -0,0 +1,230 @@
+/*
+ * Binder scatter-gather benchmark: time synchronous transactions carrying
+ * a payload of 4 KB to 1 MB, once flattened into the transaction data as
+ * a parcel would be, and once referenced by a BINDER_TYPE_PTR object sent
+ * with BC_TRANSACTION_SG.
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "../../../../drivers/staging/android/binder.h"
+
+#define MAP_SIZE	(4 * 1024 * 1024)
+#define MIN_PAYLOAD	(4 * 1024)
+#define MAX_PAYLOAD	(1024 * 1024)
+#define RUN_SECONDS	1
+
+static int binder_open(void)
+{
+	int fd;
+
+	fd = open("/dev/binder", O_RDWR);
+	if (fd < 0) {
+		perror("open /dev/binder");
+		exit(1);
+	}
+	if (mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, fd, 0) == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	return fd;
+}
+
+static void binder_write_read(int fd, void *wbuf, size_t wsize,
+			      void *rbuf, size_t rsize, size_t *consumed)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_buffer = (unsigned long)wbuf;
+	bwr.write_size = wsize;
+	bwr.read_buffer = (unsigned long)rbuf;
+	bwr.read_size = rsize;
+	if (ioctl(fd, BINDER_WRITE_READ, &bwr) < 0) {
+		perror("BINDER_WRITE_READ");
+		exit(1);
+	}
+	if (consumed)
+		*consumed = bwr.read_consumed;
+}
+
+/* Read until a transaction or reply arrives, return its cmd */
+static uint32_t binder_wait(int fd, struct binder_transaction_data *tr)
+{
+	uint8_t rbuf[128];
+	uint8_t *p = rbuf;
+	size_t len = 0;
+	uint32_t cmd;
+
+	for (;;) {
+		if (p >= rbuf + len) {
+			p = rbuf;
+			binder_write_read(fd, NULL, 0, rbuf, sizeof(rbuf), &len);
+		}
+		memcpy(&cmd, p, sizeof(cmd));
+		p += sizeof(cmd);
+		if (cmd == BR_TRANSACTION || cmd == BR_REPLY) {
+			memcpy(tr, p, sizeof(*tr));
+			return cmd;
+		}
+		if (cmd == BR_FAILED_REPLY || cmd == BR_DEAD_REPLY)
+			return cmd;
+		p += _IOC_SIZE(cmd);
+	}
+}
+
+/* Context manager: free every buffer and reply with nothing */
+static void run_server(int ready)
+{
+	struct binder_transaction_data tr;
+	struct {
+		uint32_t free_cmd;
+		const void *free_ptr;
+		uint32_t reply_cmd;
+		struct binder_transaction_data reply;
+	} __attribute__((packed)) out;
+	uint32_t cmd = BC_ENTER_LOOPER;
+	int fd = binder_open();
+
+	if (ioctl(fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("BINDER_SET_CONTEXT_MGR");
+		exit(1);
+	}
+	binder_write_read(fd, &cmd, sizeof(cmd), NULL, 0, NULL);
+	if (write(ready, "", 1) != 1)
+		exit(1);
+
+	memset(&out, 0, sizeof(out));
+	out.free_cmd = BC_FREE_BUFFER;
+	out.reply_cmd = BC_REPLY;
+	for (;;) {
+		if (binder_wait(fd, &tr) != BR_TRANSACTION)
+			continue;
+		out.free_ptr = tr.data.ptr.buffer;
+		binder_write_read(fd, &out, sizeof(out), NULL, 0, NULL);
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Average microseconds per transaction of @size bytes */
+static double run(int fd, size_t size, int sg)
+{
+	static uint8_t payload[MAX_PAYLOAD], parcel[MAX_PAYLOAD];
+	struct binder_buffer_object obj;
+	struct binder_transaction_data tr;
+	struct {
+		uint32_t free_cmd;
+		const void *free_ptr;
+		uint32_t cmd;
+		struct binder_transaction_data_sg tr;
+	} __attribute__((packed)) out;
+	const void *free_buf = NULL;
+	size_t offset = 0, wsize;
+	unsigned long count = 0;
+	double start, us;
+
+	memset(&out, 0, sizeof(out));
+	out.free_cmd = BC_FREE_BUFFER;
+	out.cmd = sg ? BC_TRANSACTION_SG : BC_TRANSACTION;
+	if (sg) {
+		memset(&obj, 0, sizeof(obj));
+		obj.type = BINDER_TYPE_PTR;
+		obj.buffer = payload;
+		obj.length = size;
+		out.tr.transaction_data.data_size = sizeof(obj);
+		out.tr.transaction_data.data.ptr.buffer = &obj;
+		out.tr.transaction_data.offsets_size = sizeof(offset);
+		out.tr.transaction_data.data.ptr.offsets = &offset;
+		out.tr.buffers_size = size;
+	} else {
+		out.tr.transaction_data.data_size = size;
+		out.tr.transaction_data.data.ptr.buffer = parcel;
+	}
+
+	/* BC_TRANSACTION takes the transaction data without buffers_size */
+	wsize = sizeof(out) - (sg ? 0 : sizeof(out.tr.buffers_size));
+
+	start = now();
+	do {
+		/* A flat parcel has to be built before every send */
+		if (!sg)
+			memcpy(parcel, payload, size);
+		/* The reply to the previous transaction is freed on the way */
+		out.free_ptr = free_buf;
+		if (free_buf)
+			binder_write_read(fd, &out, wsize, NULL, 0, NULL);
+		else
+			binder_write_read(fd, &out.cmd,
+					  wsize - offsetof(typeof(out), cmd),
+					  NULL, 0, NULL);
+		if (binder_wait(fd, &tr) != BR_REPLY) {
+			fprintf(stderr, "%s transaction of %zu bytes failed\n",
+				sg ? "sg" : "flat", size);
+			exit(1);
+		}
+		free_buf = tr.data.ptr.buffer;
+		count++;
+	} while (now() - start < RUN_SECONDS);
+	us = (now() - start) * 1e6 / count;
+
+	binder_write_read(fd, &out, offsetof(typeof(out), cmd), NULL, 0, NULL);
+	return us;
+}
+
+int main(void)
+{
+	int ready[2];
+	size_t size;
+	pid_t pid;
+	char c;
+	int fd;
+
+	if (pipe(ready) < 0) {
+		perror("pipe");
+		return 1;
+	}
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (!pid)
+		run_server(ready[1]);
+	close(ready[1]);
+	if (read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "server failed to start\n");
+		return 1;
+	}
+
+	fd = binder_open();
+	printf("bytes flat_us sg_us\n");
+	for (size = MIN_PAYLOAD; size <= MAX_PAYLOAD; size *= 2) {
+		printf("%7zu %7.1f", size, run(fd, size, 0));
+		printf(" %7.1f\n", run(fd, size, 1));
+	}
+
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	return 0;
+}
@@ -0,0 +1,244 @@
+/*
+ * Selftest for binder scatter-gather transactions: a child becomes the
+ * context manager, the parent sends it a BINDER_TYPE_PTR object with
+ * BC_TRANSACTION_SG and the child checks it finds the buffer contents
+ * in its own mapping. The same object over plain BC_TRANSACTION must be
+ * refused.
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "../../../../drivers/staging/android/binder.h"
+
+#define MAP_SIZE	(128 * 1024)
+#define PAYLOAD_SIZE	(16 * 1024)
+
+static int binder_open(void)
+{
+	int fd;
+	void *map;
+
+	fd = open("/dev/binder", O_RDWR);
+	if (fd < 0) {
+		perror("open /dev/binder");
+		exit(1);
+	}
+	map = mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	return fd;
+}
+
+static int binder_write_read(int fd, void *wbuf, size_t wsize,
+			     void *rbuf, size_t rsize, size_t *consumed)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_buffer = (unsigned long)wbuf;
+	bwr.write_size = wsize;
+	bwr.read_buffer = (unsigned long)rbuf;
+	bwr.read_size = rsize;
+	if (ioctl(fd, BINDER_WRITE_READ, &bwr) < 0) {
+		perror("BINDER_WRITE_READ");
+		return -1;
+	}
+	if (consumed)
+		*consumed = bwr.read_consumed;
+	return 0;
+}
+
+static void fill_payload(uint8_t *p)
+{
+	int i;
+
+	for (i = 0; i < PAYLOAD_SIZE; i++)
+		p[i] = i * 7 + 3;
+}
+
+/* Context manager: check each PTR object it gets and reply with the result */
+static void run_server(int fd, int ready)
+{
+	uint8_t expect[PAYLOAD_SIZE];
+	uint32_t rbuf[64];
+	size_t len;
+	uint32_t cmd;
+
+	fill_payload(expect);
+	if (ioctl(fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("BINDER_SET_CONTEXT_MGR");
+		exit(1);
+	}
+	cmd = BC_ENTER_LOOPER;
+	if (binder_write_read(fd, &cmd, sizeof(cmd), NULL, 0, NULL))
+		exit(1);
+	if (write(ready, "", 1) != 1)
+		exit(1);
+
+	for (;;) {
+		uint8_t *p = (uint8_t *)rbuf;
+
+		if (binder_write_read(fd, NULL, 0, rbuf, sizeof(rbuf), &len))
+			exit(1);
+		while (p < (uint8_t *)rbuf + len) {
+			struct binder_transaction_data *tr;
+			struct binder_buffer_object *bp;
+			struct {
+				uint32_t free_cmd;
+				void *free_ptr;
+				uint32_t reply_cmd;
+				struct binder_transaction_data reply;
+			} __attribute__((packed)) out;
+			int32_t status = 0;
+
+			memcpy(&cmd, p, sizeof(cmd));
+			p += sizeof(cmd);
+			if (cmd == BR_NOOP)
+				continue;
+			if (cmd != BR_TRANSACTION) {
+				fprintf(stderr, "server: unexpected cmd %x\n",
+					cmd);
+				exit(1);
+			}
+			tr = (struct binder_transaction_data *)p;
+			p += sizeof(*tr);
+
+			bp = (struct binder_buffer_object *)
+				((uint8_t *)tr->data.ptr.buffer +
+				 *(size_t *)tr->data.ptr.offsets);
+			if (tr->offsets_size != sizeof(size_t) ||
+			    bp->type != BINDER_TYPE_PTR ||
+			    bp->length != PAYLOAD_SIZE ||
+			    memcmp(bp->buffer, expect, PAYLOAD_SIZE))
+				status = -1;
+
+			memset(&out, 0, sizeof(out));
+			out.free_cmd = BC_FREE_BUFFER;
+			out.free_ptr = (void *)tr->data.ptr.buffer;
+			out.reply_cmd = BC_REPLY;
+			out.reply.flags = TF_STATUS_CODE;
+			out.reply.data_size = sizeof(status);
+			out.reply.data.ptr.buffer = &status;
+			if (binder_write_read(fd, &out, sizeof(out),
+					      NULL, 0, NULL))
+				exit(1);
+		}
+	}
+}
+
+/* Send the PTR object to handle 0, return the reply cmd and status */
+static uint32_t send_ptr(int fd, int sg, int32_t *status)
+{
+	static uint8_t payload[PAYLOAD_SIZE];
+	struct binder_buffer_object obj;
+	size_t offset = 0;
+	struct {
+		uint32_t cmd;
+		struct binder_transaction_data_sg tr;
+	} __attribute__((packed)) out;
+	uint32_t rbuf[64];
+	size_t len;
+	uint32_t cmd;
+
+	fill_payload(payload);
+	memset(&obj, 0, sizeof(obj));
+	obj.type = BINDER_TYPE_PTR;
+	obj.buffer = payload;
+	obj.length = PAYLOAD_SIZE;
+
+	memset(&out, 0, sizeof(out));
+	out.cmd = sg ? BC_TRANSACTION_SG : BC_TRANSACTION;
+	out.tr.transaction_data.target.handle = 0;
+	out.tr.transaction_data.data_size = sizeof(obj);
+	out.tr.transaction_data.offsets_size = sizeof(offset);
+	out.tr.transaction_data.data.ptr.buffer = &obj;
+	out.tr.transaction_data.data.ptr.offsets = &offset;
+	out.tr.buffers_size = PAYLOAD_SIZE;
+	if (binder_write_read(fd, &out, sg ? sizeof(out) :
+			      sizeof(out.cmd) + sizeof(out.tr.transaction_data),
+			      NULL, 0, NULL))
+		return BR_ERROR;
+
+	for (;;) {
+		uint8_t *p = (uint8_t *)rbuf;
+
+		if (binder_write_read(fd, NULL, 0, rbuf, sizeof(rbuf), &len))
+			return BR_ERROR;
+		while (p < (uint8_t *)rbuf + len) {
+			struct binder_transaction_data *tr;
+
+			memcpy(&cmd, p, sizeof(cmd));
+			p += sizeof(cmd);
+			switch (cmd) {
+			case BR_NOOP:
+			case BR_TRANSACTION_COMPLETE:
+				break;
+			case BR_REPLY:
+				tr = (struct binder_transaction_data *)p;
+				*status = *(int32_t *)tr->data.ptr.buffer;
+				return cmd;
+			default:
+				return cmd;
+			}
+		}
+	}
+}
+
+int main(void)
+{
+	int ready[2];
+	int32_t status = 0;
+	uint32_t cmd;
+	pid_t pid;
+	char c;
+	int ret = 0;
+
+	if (pipe(ready) < 0) {
+		perror("pipe");
+		return 1;
+	}
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (!pid)
+		run_server(binder_open(), ready[1]);
+	if (read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "server failed to start\n");
+		return 1;
+	}
+
+	cmd = send_ptr(binder_open(), 1, &status);
+	if (cmd != BR_REPLY || status) {
+		fprintf(stderr, "BC_TRANSACTION_SG: cmd %x status %d\n",
+			cmd, status);
+		ret = 1;
+	}
+
+	cmd = send_ptr(binder_open(), 0, &status);
+	if (cmd != BR_FAILED_REPLY) {
+		fprintf(stderr, "BC_TRANSACTION with ptr not refused: cmd %x\n",
+			cmd);
+		ret = 1;
+	}
+
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	printf("binder_sg_test: %s\n", ret ? "[FAIL]" : "[OK]");
+	return ret;
+}
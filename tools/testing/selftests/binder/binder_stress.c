@@ -0,0 +1,392 @@
+/*
+ * Binder stress benchmark: N client/server pairs each run synchronous
+ * transactions for a few seconds and the summed transactions/sec are
+ * reported for N = 1 up to the number of online cpus (or argv[1]).
+ *
+ * A minimal context manager hands each client a handle to its server:
+ * servers register a binder object under their index, clients look it up.
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "../../../../drivers/staging/android/binder.h"
+
+#define MAP_SIZE	(128 * 1024)
+#define MAX_PAIRS	64
+#define RUN_SECONDS	2
+
+enum {
+	CODE_ADD = 1,
+	CODE_GET,
+	CODE_PING,
+};
+
+struct wbuf {
+	uint8_t data[256];
+	size_t len;
+};
+
+static void put(struct wbuf *w, const void *p, size_t size)
+{
+	memcpy(w->data + w->len, p, size);
+	w->len += size;
+}
+
+static void put32(struct wbuf *w, uint32_t v)
+{
+	put(w, &v, sizeof(v));
+}
+
+static void putptr(struct wbuf *w, const void *v)
+{
+	put(w, &v, sizeof(v));
+}
+
+static int binder_open(void)
+{
+	int fd;
+
+	fd = open("/dev/binder", O_RDWR);
+	if (fd < 0) {
+		perror("open /dev/binder");
+		exit(1);
+	}
+	if (mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, fd, 0) == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	return fd;
+}
+
+static void binder_write_read(int fd, struct wbuf *w, void *rbuf,
+			      size_t rsize, size_t *consumed)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	if (w) {
+		bwr.write_buffer = (unsigned long)w->data;
+		bwr.write_size = w->len;
+		w->len = 0;
+	}
+	bwr.read_buffer = (unsigned long)rbuf;
+	bwr.read_size = rsize;
+	if (ioctl(fd, BINDER_WRITE_READ, &bwr) < 0) {
+		perror("BINDER_WRITE_READ");
+		exit(1);
+	}
+	if (consumed)
+		*consumed = bwr.read_consumed;
+}
+
+/*
+ * Read commands until a transaction or reply arrives and copy it to @tr.
+ * Reference count requests on our own nodes are acknowledged on the way.
+ */
+static uint32_t binder_wait(int fd, struct binder_transaction_data *tr)
+{
+	static uint8_t rbuf[256];
+	static size_t len, pos;
+	struct wbuf w = { .len = 0 };
+	uint32_t cmd;
+
+	for (;;) {
+		if (pos >= len) {
+			pos = 0;
+			binder_write_read(fd, NULL, rbuf, sizeof(rbuf), &len);
+		}
+		memcpy(&cmd, rbuf + pos, sizeof(cmd));
+		pos += sizeof(cmd);
+		switch (cmd) {
+		case BR_TRANSACTION:
+		case BR_REPLY:
+			memcpy(tr, rbuf + pos, sizeof(*tr));
+			pos += sizeof(*tr);
+			return cmd;
+		case BR_INCREFS:
+		case BR_ACQUIRE:
+			put32(&w, cmd == BR_INCREFS ? BC_INCREFS_DONE :
+						      BC_ACQUIRE_DONE);
+			put(&w, rbuf + pos, sizeof(struct binder_ptr_cookie));
+			binder_write_read(fd, &w, NULL, 0, NULL);
+			break;
+		case BR_DEAD_REPLY:
+		case BR_FAILED_REPLY:
+		case BR_ERROR:
+			pos += _IOC_SIZE(cmd);
+			return cmd;
+		}
+		if (cmd != BR_TRANSACTION && cmd != BR_REPLY)
+			pos += _IOC_SIZE(cmd);
+	}
+}
+
+static void binder_send(int fd, uint32_t cmd, uint32_t handle, uint32_t code,
+			const void *data, size_t data_size,
+			const size_t *offsets, size_t offsets_size,
+			const void *free_buf)
+{
+	struct binder_transaction_data tr;
+	struct wbuf w = { .len = 0 };
+
+	if (free_buf) {
+		put32(&w, BC_FREE_BUFFER);
+		putptr(&w, free_buf);
+	}
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = handle;
+	tr.code = code;
+	tr.data_size = data_size;
+	tr.offsets_size = offsets_size;
+	tr.data.ptr.buffer = data;
+	tr.data.ptr.offsets = offsets;
+	put32(&w, cmd);
+	put(&w, &tr, sizeof(tr));
+	binder_write_read(fd, &w, NULL, 0, NULL);
+}
+
+static void binder_enter_looper(int fd)
+{
+	struct wbuf w = { .len = 0 };
+
+	put32(&w, BC_ENTER_LOOPER);
+	binder_write_read(fd, &w, NULL, 0, NULL);
+}
+
+static void binder_free(int fd, const void *buf)
+{
+	struct wbuf w = { .len = 0 };
+
+	put32(&w, BC_FREE_BUFFER);
+	putptr(&w, buf);
+	binder_write_read(fd, &w, NULL, 0, NULL);
+}
+
+static void run_manager(int ready)
+{
+	uint32_t handles[MAX_PAIRS];
+	struct binder_transaction_data tr;
+	struct flat_binder_object obj;
+	size_t offset = 0;
+	int32_t status;
+	uint32_t idx;
+	int fd;
+
+	memset(handles, 0, sizeof(handles));
+	fd = binder_open();
+	if (ioctl(fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("BINDER_SET_CONTEXT_MGR");
+		exit(1);
+	}
+	binder_enter_looper(fd);
+	if (write(ready, "", 1) != 1)
+		exit(1);
+
+	for (;;) {
+		if (binder_wait(fd, &tr) != BR_TRANSACTION)
+			continue;
+		status = -1;
+		if (tr.code == CODE_ADD &&
+		    tr.data_size == sizeof(obj) + sizeof(idx)) {
+			memcpy(&obj, tr.data.ptr.buffer, sizeof(obj));
+			memcpy(&idx, (uint8_t *)tr.data.ptr.buffer +
+				     sizeof(obj), sizeof(idx));
+			if (idx < MAX_PAIRS &&
+			    obj.type == BINDER_TYPE_HANDLE) {
+				handles[idx] = obj.handle;
+				status = 0;
+			}
+		} else if (tr.code == CODE_GET &&
+			   tr.data_size == sizeof(idx)) {
+			memcpy(&idx, tr.data.ptr.buffer, sizeof(idx));
+			if (idx < MAX_PAIRS && handles[idx]) {
+				memset(&obj, 0, sizeof(obj));
+				obj.type = BINDER_TYPE_HANDLE;
+				obj.handle = handles[idx];
+				binder_send(fd, BC_REPLY, 0, 0, &obj,
+					    sizeof(obj), &offset,
+					    sizeof(offset),
+					    tr.data.ptr.buffer);
+				continue;
+			}
+		}
+		binder_send(fd, BC_REPLY, 0, 0, &status, sizeof(status),
+			    NULL, 0, tr.data.ptr.buffer);
+	}
+}
+
+static void run_server(uint32_t idx)
+{
+	static int node;
+	struct {
+		struct flat_binder_object obj;
+		uint32_t idx;
+	} __attribute__((packed)) msg;
+	struct binder_transaction_data tr;
+	size_t offset = 0;
+	uint32_t reply = 0;
+	int fd;
+
+	fd = binder_open();
+	binder_enter_looper(fd);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.obj.type = BINDER_TYPE_BINDER;
+	msg.obj.binder = &node;
+	msg.obj.cookie = &node;
+	msg.idx = idx;
+	binder_send(fd, BC_TRANSACTION, 0, CODE_ADD, &msg, sizeof(msg),
+		    &offset, sizeof(offset), NULL);
+	if (binder_wait(fd, &tr) != BR_REPLY ||
+	    *(const int32_t *)tr.data.ptr.buffer) {
+		fprintf(stderr, "server %u: register failed\n", idx);
+		exit(1);
+	}
+	binder_free(fd, tr.data.ptr.buffer);
+
+	for (;;) {
+		if (binder_wait(fd, &tr) != BR_TRANSACTION)
+			continue;
+		binder_send(fd, BC_REPLY, 0, 0, &reply, sizeof(reply),
+			    NULL, 0, tr.data.ptr.buffer);
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Look up server @idx, then ping it for RUN_SECONDS and report the rate */
+static void run_client(uint32_t idx, int result)
+{
+	struct binder_transaction_data tr;
+	const void *free_buf = NULL;
+	const struct flat_binder_object *obj;
+	uint32_t handle, ping = 0;
+	double start, rate;
+	unsigned long count = 0;
+	int fd;
+
+	fd = binder_open();
+	for (;;) {
+		binder_send(fd, BC_TRANSACTION, 0, CODE_GET, &idx, sizeof(idx),
+			    NULL, 0, free_buf);
+		if (binder_wait(fd, &tr) != BR_REPLY) {
+			fprintf(stderr, "client %u: lookup failed\n", idx);
+			exit(1);
+		}
+		free_buf = tr.data.ptr.buffer;
+		if (tr.offsets_size)
+			break;
+		usleep(1000);
+	}
+	obj = tr.data.ptr.buffer;
+	handle = obj->handle;
+
+	start = now();
+	do {
+		binder_send(fd, BC_TRANSACTION, handle, CODE_PING, &ping,
+			    sizeof(ping), NULL, 0, free_buf);
+		if (binder_wait(fd, &tr) != BR_REPLY) {
+			fprintf(stderr, "client %u: transaction failed\n",
+				idx);
+			exit(1);
+		}
+		free_buf = tr.data.ptr.buffer;
+		count++;
+	} while (now() - start < RUN_SECONDS);
+
+	rate = count / (now() - start);
+	if (write(result, &rate, sizeof(rate)) != sizeof(rate))
+		exit(1);
+	exit(0);
+}
+
+int main(int argc, char **argv)
+{
+	pid_t manager, servers[MAX_PAIRS];
+	int ready[2], result[2];
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int max_pairs, n, i, ret = 0;
+	char c;
+
+	max_pairs = argc > 1 ? atoi(argv[1]) : ncpus;
+	if (max_pairs < 1 || max_pairs > MAX_PAIRS) {
+		fprintf(stderr, "usage: %s [pairs, 1..%d]\n", argv[0],
+			MAX_PAIRS);
+		return 1;
+	}
+	if (pipe(ready) < 0) {
+		perror("pipe");
+		return 1;
+	}
+
+	manager = fork();
+	if (!manager)
+		run_manager(ready[1]);
+	close(ready[1]);
+	if (manager < 0 || read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "context manager failed to start\n");
+		return 1;
+	}
+	for (i = 0; i < max_pairs; i++) {
+		servers[i] = fork();
+		if (!servers[i])
+			run_server(i);
+	}
+
+	printf("cpus %ld\npairs transactions/sec\n", ncpus);
+	for (n = 1; n <= max_pairs; n++) {
+		double rate, total = 0;
+
+		/* A fresh pipe per round, so a dead client reads as EOF */
+		if (pipe(result) < 0) {
+			perror("pipe");
+			ret = 1;
+			break;
+		}
+		for (i = 0; i < n; i++)
+			if (!fork())
+				run_client(i, result[1]);
+		close(result[1]);
+		for (i = 0; i < n; i++) {
+			if (read(result[0], &rate, sizeof(rate)) !=
+			    sizeof(rate))
+				break;
+			total += rate;
+		}
+		close(result[0]);
+		if (i < n) {
+			fprintf(stderr, "client failed\n");
+			ret = 1;
+			break;
+		}
+		while (waitpid(-1, NULL, WNOHANG) > 0)
+			;
+		printf("%5d %.0f\n", n, total);
+	}
+
+	for (i = 0; i < max_pairs; i++)
+		kill(servers[i], SIGKILL);
+	kill(manager, SIGKILL);
+	while (wait(NULL) > 0)
+		;
+	return ret;
+}
@@ -0,0 +1,132 @@
+/*
+ * ION allocation latency: time ION_IOC_ALLOC and ION_IOC_FREE on
+ * /dev/ion for buffer sizes from 4 KB to 8 MB, the range camera and video
+ * buffers fall in. The first allocation of each size is reported on its
+ * own since it may have to go to the page allocator; the following ones
+ * are what a recycling heap serves from its pools. By default the system
+ * heap is used.
+ *
+ * usage: ion_alloc_bench [iterations [heap id]]
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "../../../../include/linux/ion.h"
+
+#define DEFAULT_ITERATIONS	1000
+#define MIN_SIZE		(4 * 1024)
+#define MAX_SIZE		(8 * 1024 * 1024)
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t ion_alloc(int fd, size_t len, unsigned int heap_id,
+			  struct ion_handle **handle)
+{
+	struct ion_allocation_data data;
+	uint64_t start;
+
+	memset(&data, 0, sizeof(data));
+	data.len = len;
+	data.align = 4096;
+	data.flags = ION_HEAP(heap_id) | ION_SET_CACHE(CACHED);
+	start = now_ns();
+	if (ioctl(fd, ION_IOC_ALLOC, &data) < 0) {
+		perror("ION_IOC_ALLOC");
+		exit(1);
+	}
+	*handle = data.handle;
+	return now_ns() - start;
+}
+
+static uint64_t ion_free(int fd, struct ion_handle *handle)
+{
+	struct ion_handle_data data;
+	uint64_t start;
+
+	data.handle = handle;
+	start = now_ns();
+	if (ioctl(fd, ION_IOC_FREE, &data) < 0) {
+		perror("ION_IOC_FREE");
+		exit(1);
+	}
+	return now_ns() - start;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int iterations = DEFAULT_ITERATIONS;
+	unsigned int heap_id = ION_SYSTEM_HEAP_ID;
+	struct ion_handle *handle;
+	uint64_t *alloc_ns, *free_ns, first;
+	unsigned int i;
+	size_t size;
+	int fd;
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+	if (argc > 2)
+		heap_id = atoi(argv[2]);
+	if (!iterations || heap_id >= ION_HEAP_ID_RESERVED) {
+		fprintf(stderr, "usage: %s [iterations [heap id]]\n", argv[0]);
+		return 1;
+	}
+
+	alloc_ns = malloc(iterations * sizeof(*alloc_ns));
+	free_ns = malloc(iterations * sizeof(*free_ns));
+	if (!alloc_ns || !free_ns) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	fd = open("/dev/ion", O_RDONLY);
+	if (fd < 0) {
+		perror("open /dev/ion");
+		return 1;
+	}
+
+	printf("heap %u, %u iterations\n", heap_id, iterations);
+	printf("%8s %9s %9s %9s %9s %9s\n", "bytes", "first_us",
+	       "alloc_p50", "alloc_p99", "alloc_max", "free_p50");
+	for (size = MIN_SIZE; size <= MAX_SIZE; size *= 2) {
+		first = ion_alloc(fd, size, heap_id, &handle);
+		ion_free(fd, handle);
+		for (i = 0; i < iterations; i++) {
+			alloc_ns[i] = ion_alloc(fd, size, heap_id, &handle);
+			free_ns[i] = ion_free(fd, handle);
+		}
+		qsort(alloc_ns, iterations, sizeof(*alloc_ns), cmp_u64);
+		qsort(free_ns, iterations, sizeof(*free_ns), cmp_u64);
+		printf("%8zu %9.1f %9.1f %9.1f %9.1f %9.1f\n", size,
+		       first / 1e3, alloc_ns[iterations / 2] / 1e3,
+		       alloc_ns[iterations * 99 / 100] / 1e3,
+		       alloc_ns[iterations - 1] / 1e3,
+		       free_ns[iterations / 2] / 1e3);
+	}
+
+	close(fd);
+	free(alloc_ns);
+	free(free_ns);
+	return 0;
+}
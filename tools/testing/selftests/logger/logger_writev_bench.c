@@ -0,0 +1,152 @@
+/*
+ * Logger writev() latency under concurrent writers: each of N threads
+ * (8 by default) writes entries the way liblog does, as a priority, tag
+ * and message iovec, and times every call. The latency percentiles over
+ * all calls and the total entries/sec are printed.
+ *
+ * usage: logger_writev_bench [writers [entries per writer [log device]]]
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#define DEFAULT_WRITERS	8
+#define DEFAULT_ENTRIES	20000
+#define LOG_PRIO_INFO	4
+
+static const char *log_path = "/dev/log/main";
+static unsigned int nr_entries = DEFAULT_ENTRIES;
+
+struct writer {
+	pthread_t thread;
+	unsigned int id;
+	uint64_t *lat_ns;
+	int err;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *writer_fn(void *arg)
+{
+	struct writer *w = arg;
+	unsigned char prio = LOG_PRIO_INFO;
+	char tag[] = "logger_bench";
+	char msg[128];
+	struct iovec iov[3];
+	unsigned int i;
+	uint64_t start;
+	int fd;
+
+	fd = open(log_path, O_WRONLY);
+	if (fd < 0) {
+		perror(log_path);
+		w->err = 1;
+		return NULL;
+	}
+
+	iov[0].iov_base = &prio;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = tag;
+	iov[1].iov_len = sizeof(tag);
+	iov[2].iov_base = msg;
+
+	for (i = 0; i < nr_entries; i++) {
+		iov[2].iov_len = snprintf(msg, sizeof(msg),
+				"writer %u entry %u of a typical log line",
+				w->id, i) + 1;
+		start = now_ns();
+		if (writev(fd, iov, 3) < 0) {
+			perror("writev");
+			w->err = 1;
+			break;
+		}
+		w->lat_ns[i] = now_ns() - start;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nr_writers = DEFAULT_WRITERS;
+	struct writer *writers;
+	uint64_t *lat, start, elapsed, total = 0;
+	size_t n, i;
+
+	if (argc > 1)
+		nr_writers = atoi(argv[1]);
+	if (argc > 2)
+		nr_entries = atoi(argv[2]);
+	if (argc > 3)
+		log_path = argv[3];
+	if (!nr_writers || !nr_entries) {
+		fprintf(stderr, "usage: %s [writers [entries [device]]]\n",
+			argv[0]);
+		return 1;
+	}
+
+	n = (size_t)nr_writers * nr_entries;
+	writers = calloc(nr_writers, sizeof(*writers));
+	lat = calloc(n, sizeof(*lat));
+	if (!writers || !lat) {
+		perror("calloc");
+		return 1;
+	}
+
+	start = now_ns();
+	for (i = 0; i < nr_writers; i++) {
+		writers[i].id = i;
+		writers[i].lat_ns = lat + i * nr_entries;
+		if (pthread_create(&writers[i].thread, NULL, writer_fn,
+				   &writers[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	for (i = 0; i < nr_writers; i++)
+		pthread_join(writers[i].thread, NULL);
+	elapsed = now_ns() - start;
+
+	for (i = 0; i < nr_writers; i++)
+		if (writers[i].err)
+			return 1;
+
+	for (i = 0; i < n; i++)
+		total += lat[i];
+	qsort(lat, n, sizeof(*lat), cmp_u64);
+
+	printf("writers %u entries %zu elapsed %llu ms, %llu entries/s\n",
+	       nr_writers, n, (unsigned long long)(elapsed / 1000000),
+	       (unsigned long long)(n * 1000000000ULL / elapsed));
+	printf("writev latency us: avg %.2f p50 %.2f p99 %.2f p99.9 %.2f "
+	       "max %.2f\n", total / 1000.0 / n, lat[n / 2] / 1000.0,
+	       lat[n * 99 / 100] / 1000.0, lat[n * 999 / 1000] / 1000.0,
+	       lat[n - 1] / 1000.0);
+
+	free(lat);
+	free(writers);
+	return 0;
+}
@@ -0,0 +1,221 @@
+/*
+ * Mixed read/write benchmark for the ROW I/O scheduler: a writer process
+ * streams buffered 1 MB writes into a scratch file while the reader times
+ * 4 KB O_DIRECT random reads from another file on the same device, the
+ * app-launch-behind-bulk-writes case ROW is meant for. The run is repeated
+ * for every scheduler named on the command line (cfq and row by default)
+ * and the read latency percentiles and write throughput are printed.
+ *
+ * usage: row_mixed_bench <dir> <disk> [scheduler...]
+ *   <dir>  a writable directory on the disk under test
+ *   <disk> its name in /sys/block, e.g. mmcblk0
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define READ_FILE_SIZE	(64 << 20)
+#define WRITE_FILE_SIZE	(256 << 20)
+#define READ_SIZE	4096
+#define WRITE_SIZE	(1 << 20)
+#define RUN_SECONDS	10
+#define MAX_READS	(1 << 20)
+
+static char read_path[4096], write_path[4096];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int set_scheduler(const char *disk, const char *sched)
+{
+	char path[256];
+	int fd, ret = 0;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/queue/scheduler", disk);
+	fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	if (write(fd, sched, strlen(sched)) < 0) {
+		fprintf(stderr, "%s: cannot select %s\n", path, sched);
+		ret = -1;
+	}
+	close(fd);
+	return ret;
+}
+
+static int fill_file(const char *path, size_t size)
+{
+	static char buf[WRITE_SIZE];
+	size_t done;
+	int fd;
+
+	memset(buf, 0x5a, sizeof(buf));
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	for (done = 0; done < size; done += sizeof(buf))
+		if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			perror(path);
+			close(fd);
+			return -1;
+		}
+	fsync(fd);
+	close(fd);
+	return 0;
+}
+
+/* Stream async writes until killed, counting the bytes in @written */
+static void run_writer(volatile uint64_t *written)
+{
+	static char buf[WRITE_SIZE];
+	off_t off = 0;
+	int fd;
+
+	memset(buf, 0xa5, sizeof(buf));
+	fd = open(write_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		perror(write_path);
+		exit(1);
+	}
+	for (;;) {
+		if (pwrite(fd, buf, sizeof(buf), off) != sizeof(buf)) {
+			perror(write_path);
+			exit(1);
+		}
+		*written += sizeof(buf);
+		off += sizeof(buf);
+		if (off >= WRITE_FILE_SIZE)
+			off = 0;
+	}
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int run(const char *sched, uint64_t *lat_ns)
+{
+	volatile uint64_t *written;
+	uint64_t start, t, end;
+	unsigned long n = 0;
+	void *buf;
+	pid_t pid;
+	int fd;
+
+	written = mmap(NULL, sizeof(*written), PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (written == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	if (posix_memalign(&buf, READ_SIZE, READ_SIZE)) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+	fd = open(read_path, O_RDONLY | O_DIRECT);
+	if (fd < 0) {
+		perror(read_path);
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return -1;
+	}
+	if (!pid)
+		run_writer(written);
+
+	/* Give the writer time to fill the page cache and start writeback */
+	sleep(2);
+	*written = 0;
+	start = now_ns();
+	end = start + RUN_SECONDS * 1000000000ULL;
+	do {
+		off_t off = (off_t)(rand() % (READ_FILE_SIZE / READ_SIZE)) *
+			    READ_SIZE;
+
+		t = now_ns();
+		if (pread(fd, buf, READ_SIZE, off) != READ_SIZE) {
+			perror(read_path);
+			break;
+		}
+		lat_ns[n++] = now_ns() - t;
+	} while (n < MAX_READS && now_ns() < end);
+	t = now_ns() - start;
+
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	close(fd);
+	free(buf);
+	if (!n)
+		return -1;
+
+	qsort(lat_ns, n, sizeof(*lat_ns), cmp_u64);
+	printf("%-9s %8lu %8.1f %8.1f %8.1f %9.1f\n", sched, n,
+	       lat_ns[n / 2] / 1e3, lat_ns[n * 99 / 100] / 1e3,
+	       lat_ns[n - 1] / 1e3, *written / (t / 1e9) / (1 << 20));
+	munmap((void *)written, sizeof(*written));
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *def_scheds[] = { "cfq", "row" };
+	const char **scheds = def_scheds;
+	int nr_scheds = 2, i, ret = 0;
+	uint64_t *lat_ns;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s <dir> <disk> [scheduler...]\n",
+			argv[0]);
+		return 1;
+	}
+	if (argc > 3) {
+		scheds = (const char **)argv + 3;
+		nr_scheds = argc - 3;
+	}
+	snprintf(read_path, sizeof(read_path), "%s/row_bench.read", argv[1]);
+	snprintf(write_path, sizeof(write_path), "%s/row_bench.write", argv[1]);
+
+	lat_ns = malloc(MAX_READS * sizeof(*lat_ns));
+	if (!lat_ns || fill_file(read_path, READ_FILE_SIZE))
+		return 1;
+
+	printf("%-9s %8s %8s %8s %8s %9s\n", "sched", "reads",
+	       "p50_us", "p99_us", "max_us", "write_MBs");
+	for (i = 0; i < nr_scheds && !ret; i++) {
+		ret = set_scheduler(argv[2], scheds[i]);
+		if (!ret)
+			ret = run(scheds[i], lat_ns);
+	}
+
+	unlink(read_path);
+	unlink(write_path);
+	free(lat_ns);
+	return ret ? 1 : 0;
+}
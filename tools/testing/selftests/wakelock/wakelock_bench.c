@@ -0,0 +1,118 @@
+/*
+ * Userspace wake lock benchmark: 10k lock/unlock pairs through
+ * /sys/power/wake_lock and /sys/power/wake_unlock, the way libpower
+ * drives them, cycling over 1, 64 and 1024 lock names. Each round is run
+ * with plain locks and with locks taking a one second timeout, which go
+ * through the timed path of has_wake_lock. The average and percentile
+ * latency of a lock/unlock pair are printed.
+ *
+ * usage: wakelock_bench [pairs]
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#define DEFAULT_PAIRS	10000
+#define TIMEOUT_NS	"1000000000"
+
+static const unsigned int nr_names[] = { 1, 64, 1024 };
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int open_attr(const char *path)
+{
+	int fd = open(path, O_WRONLY);
+
+	if (fd < 0) {
+		perror(path);
+		exit(1);
+	}
+	return fd;
+}
+
+static void write_attr(int fd, const char *buf, size_t len)
+{
+	if (write(fd, buf, len) != (ssize_t)len) {
+		perror("wake lock write");
+		exit(1);
+	}
+}
+
+static void run(int lock_fd, int unlock_fd, unsigned int names, int timed,
+		uint64_t *lat_ns, unsigned int pairs)
+{
+	char lock[64], name[32];
+	uint64_t start, total = 0;
+	unsigned int i;
+	int len;
+
+	for (i = 0; i < pairs; i++) {
+		snprintf(name, sizeof(name), "wakelock_bench_%u", i % names);
+		len = snprintf(lock, sizeof(lock), "%s%s", name,
+			       timed ? " " TIMEOUT_NS : "");
+		start = now_ns();
+		write_attr(lock_fd, lock, len);
+		write_attr(unlock_fd, name, strlen(name));
+		lat_ns[i] = now_ns() - start;
+		total += lat_ns[i];
+	}
+	qsort(lat_ns, pairs, sizeof(*lat_ns), cmp_u64);
+	printf("%5u %-7s %8.2f %8.2f %8.2f %8.2f\n", names,
+	       timed ? "timeout" : "plain", total / 1e3 / pairs,
+	       lat_ns[pairs / 2] / 1e3, lat_ns[pairs * 99 / 100] / 1e3,
+	       lat_ns[pairs - 1] / 1e3);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int pairs = DEFAULT_PAIRS, i;
+	int lock_fd, unlock_fd, timed;
+	uint64_t *lat_ns;
+
+	if (argc > 1)
+		pairs = atoi(argv[1]);
+	if (!pairs) {
+		fprintf(stderr, "usage: %s [pairs]\n", argv[0]);
+		return 1;
+	}
+	lat_ns = malloc(pairs * sizeof(*lat_ns));
+	if (!lat_ns) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	lock_fd = open_attr("/sys/power/wake_lock");
+	unlock_fd = open_attr("/sys/power/wake_unlock");
+
+	printf("%u lock/unlock pairs\n", pairs);
+	printf("%5s %-7s %8s %8s %8s %8s\n", "names", "type", "avg_us",
+	       "p50_us", "p99_us", "max_us");
+	for (timed = 0; timed < 2; timed++)
+		for (i = 0; i < sizeof(nr_names) / sizeof(nr_names[0]); i++)
+			run(lock_fd, unlock_fd, nr_names[i], timed, lat_ns,
+			    pairs);
+
+	close(lock_fd);
+	close(unlock_fd);
+	free(lat_ns);
+	return 0;
+}
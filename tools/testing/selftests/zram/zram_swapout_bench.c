@@ -0,0 +1,195 @@
+/*
+ * zram swap-out throughput with 1 to N concurrent writers (4 by default).
+ * Each writer thread stores pages into its own part of the device the way
+ * swap-out does, as page-sized, page-aligned O_DIRECT writes, for a few
+ * seconds. The pages are about half compressible and never same-filled,
+ * so every write goes through a compression stream. The total MB/s and
+ * the comp_stream_waits delta are printed per writer count.
+ *
+ * The device must be initialized, e.g.
+ *   echo $((256 << 20)) > /sys/block/zram0/disksize
+ * and must not be in use as swap while this runs.
+ *
+ * usage: zram_swapout_bench [writers [zram device]]
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <time.h>
+
+#define DEFAULT_WRITERS	4
+#define MAX_WRITERS	64
+#define PAGE_SZ		4096
+#define BUF_PAGES	256
+#define RUN_SECONDS	3
+
+static const char *dev_path = "/dev/zram0";
+static off_t dev_size;
+
+struct writer {
+	pthread_t thread;
+	off_t start, len;
+	unsigned long pages;
+	int err;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Random first half, repeating pattern second half */
+static void fill_page(uint8_t *p, unsigned int seed)
+{
+	unsigned int i;
+
+	for (i = 0; i < PAGE_SZ / 2; i++)
+		p[i] = rand_r(&seed);
+	for (; i < PAGE_SZ; i++)
+		p[i] = "zram swap-out"[i % 13];
+}
+
+static void *writer_fn(void *arg)
+{
+	struct writer *w = arg;
+	uint8_t *buf;
+	off_t off = 0;
+	double end;
+	int fd, i;
+
+	if (posix_memalign((void **)&buf, PAGE_SZ,
+			   BUF_PAGES * PAGE_SZ)) {
+		w->err = 1;
+		return NULL;
+	}
+	for (i = 0; i < BUF_PAGES; i++)
+		fill_page(buf + i * PAGE_SZ, (uintptr_t)w + i);
+
+	fd = open(dev_path, O_WRONLY | O_DIRECT);
+	if (fd < 0) {
+		perror(dev_path);
+		w->err = 1;
+		free(buf);
+		return NULL;
+	}
+	end = now() + RUN_SECONDS;
+	do {
+		i = w->pages % BUF_PAGES;
+		if (pwrite(fd, buf + i * PAGE_SZ, PAGE_SZ,
+			   w->start + off) != PAGE_SZ) {
+			perror("pwrite");
+			w->err = 1;
+			break;
+		}
+		w->pages++;
+		off += PAGE_SZ;
+		if (off >= w->len)
+			off = 0;
+	} while ((w->pages & 63) || now() < end);
+
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static long read_stat(const char *name)
+{
+	char path[256], *dev = strdup(dev_path);
+	long val = -1;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/%s", basename(dev), name);
+	free(dev);
+	f = fopen(path, "r");
+	if (f) {
+		if (fscanf(f, "%ld", &val) != 1)
+			val = -1;
+		fclose(f);
+	}
+	return val;
+}
+
+static int run(int nr_writers)
+{
+	struct writer writers[MAX_WRITERS];
+	unsigned long pages = 0;
+	long waits;
+	double start, secs;
+	off_t len;
+	int i, err = 0;
+
+	len = dev_size / nr_writers / PAGE_SZ * PAGE_SZ;
+	waits = read_stat("comp_stream_waits");
+	memset(writers, 0, sizeof(writers));
+	start = now();
+	for (i = 0; i < nr_writers; i++) {
+		writers[i].start = i * len;
+		writers[i].len = len;
+		if (pthread_create(&writers[i].thread, NULL, writer_fn,
+				   &writers[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	for (i = 0; i < nr_writers; i++) {
+		pthread_join(writers[i].thread, NULL);
+		pages += writers[i].pages;
+		err |= writers[i].err;
+	}
+	secs = now() - start;
+	if (err)
+		return 1;
+
+	printf("%7d %9.1f", nr_writers, pages * (double)PAGE_SZ /
+	       (1 << 20) / secs);
+	if (waits >= 0)
+		printf(" %10ld", read_stat("comp_stream_waits") - waits);
+	printf("\n");
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int max_writers = DEFAULT_WRITERS, n, fd;
+
+	if (argc > 1)
+		max_writers = atoi(argv[1]);
+	if (argc > 2)
+		dev_path = argv[2];
+	if (max_writers < 1 || max_writers > MAX_WRITERS) {
+		fprintf(stderr, "usage: %s [writers, 1..%d [zram device]]\n",
+			argv[0], MAX_WRITERS);
+		return 1;
+	}
+
+	fd = open(dev_path, O_RDONLY);
+	if (fd < 0) {
+		perror(dev_path);
+		return 1;
+	}
+	dev_size = lseek(fd, 0, SEEK_END);
+	close(fd);
+	if (dev_size < (off_t)max_writers * PAGE_SZ) {
+		fprintf(stderr, "%s: disksize is not set\n", dev_path);
+		return 1;
+	}
+
+	printf("max_comp_streams %ld\nwriters      MB/s strm_waits\n",
+	       read_stat("max_comp_streams"));
+	for (n = 1; n <= max_writers; n++)
+		if (run(n))
+			return 1;
+	return 0;
+}